@@ -0,0 +1,540 @@
+//
+//  ConvolutionConformance.cpp
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  Checks GFSConvolutionEngine against a reference convolution: a naive
+//  one written straight from the documentation of vImageConvolve_ARGB8888
+//  (and _Planar8) with kvImageBackgroundColorFill. That is all it checks,
+//  the goldens below come from the reference too, not from vImage. Two
+//  ways:
+//
+//   - random cases (image and kernel sizes, weights, divisors, background
+//     colors, regions of interest, padded rowBytes) against the reference,
+//     through every entry point: whole kernels, split kernels, Planar8, and
+//     accumulate then pack. Each runs with GFSConvolutionScalar and with
+//     the SIMD path the tool was compiled for, on one thread and on all of
+//     them. The padding past each dest row must come back untouched.
+//   - the app's kernels on phillip.jpg (decoded with GFSImageDecoder, so
+//     the pixels are the same everywhere), against goldens: an FNV-1a hash
+//     of each result, kept in kGoldens below.
+//
+//  Prints CSV and fails when anything differs.
+//
+//  The SIMD path is picked when the engine is compiled, so build once per
+//  instruction set (no -m flag for plain C, -msse4.1, -mavx2; NEON on ARM):
+//
+//    c++ -O2 -std=c++11 -msse4.1 -I../Convolver -I../../ImageDecompress/ImageDecompress
+//        -o ConvolutionConformance ../Convolver/GFSConvolutionEngine.cpp
+//        ../Convolver/GFSMemoryAccounting.cpp ../../ImageDecompress/ImageDecompress/GFSImageDecoder.cpp
+//        ConvolutionConformance.cpp -lz -lpthread
+//    ./ConvolutionConformance [-n cases] [-s seed] ../Convolver/phillip.jpg
+//
+//  -record prints kGoldens taken from the reference. On OS X, with
+//  -framework Accelerate, it takes them from vImage itself instead; putting
+//  those in kGoldens would make this a check against vImage.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#if defined(__APPLE__)
+  #include <Accelerate/Accelerate.h>
+#endif
+
+#include "GFSConvolutionEngine.h"
+#include "GFSImageDecoder.h"
+
+namespace {
+
+#if defined(__AVX2__)
+const char *kSIMD = "avx2";
+#elif defined(__SSE4_1__)
+const char *kSIMD = "sse4.1";
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+const char *kSIMD = "neon";
+#else
+const char *kSIMD = "none";
+#endif
+
+// what the padding past each dest row is filled with, and must still be
+const uint8_t kPadding = 0xA5;
+
+#pragma mark - Reference
+
+struct Image {
+  size_t width;
+  size_t height;
+  size_t rowBytes;
+  std::vector<uint8_t> pixels;
+
+  GFSConvolutionBuffer Buffer() {
+    GFSConvolutionBuffer buffer = { pixels.data(), height, width, rowBytes };
+    return buffer;
+  }
+};
+
+Image MakeImage(size_t width, size_t height, size_t rowBytes) {
+  Image image = { width, height, rowBytes, std::vector<uint8_t>(std::max((size_t)1, rowBytes * height), kPadding) };
+  return image;
+}
+
+// vImage's convolution, one pixel at a time: the kernel centered and not
+// rotated, the background past the edges of src, 32 bit sums, truncating
+// division and then clamping
+void Convolve(const Image &src, Image &dest, size_t offsetX, size_t offsetY, size_t channels,
+              const std::vector<int16_t> &kernel, uint32_t kernelWidth, uint32_t kernelHeight,
+              int32_t divisor, const uint8_t background[4]) {
+  for(size_t y = 0;y < dest.height;y++) {
+    for(size_t x = 0;x < dest.width;x++) {
+      for(size_t c = 0;c < channels;c++) {
+        int32_t sum = 0;
+        for(uint32_t ky = 0;ky < kernelHeight;ky++) {
+          for(uint32_t kx = 0;kx < kernelWidth;kx++) {
+            ptrdiff_t sx = (ptrdiff_t)(x + offsetX + kx) - kernelWidth / 2;
+            ptrdiff_t sy = (ptrdiff_t)(y + offsetY + ky) - kernelHeight / 2;
+            int32_t value = background[c];
+            if(sx >= 0 && sy >= 0 && sx < (ptrdiff_t)src.width && sy < (ptrdiff_t)src.height) {
+              value = src.pixels[sy * src.rowBytes + sx * channels + c];
+            }
+            sum += kernel[ky * kernelWidth + kx] * value;
+          }
+        }
+        sum /= divisor;
+        dest.pixels[y * dest.rowBytes + x * channels + c] = (uint8_t)(sum < 0 ? 0 : sum > 255 ? 255 : sum);
+      }
+    }
+  }
+}
+
+// the rows' pixels match, and the padding past them is untouched
+bool Same(const Image &a, const Image &b, size_t channels) {
+  for(size_t y = 0;y < a.height;y++) {
+    const uint8_t *rowA = a.pixels.data() + y * a.rowBytes;
+    const uint8_t *rowB = b.pixels.data() + y * b.rowBytes;
+    if(0 != memcmp(rowA, rowB, a.width * channels)) {
+      return false;
+    }
+    for(size_t i = a.width * channels;i < b.rowBytes;i++) {
+      if(kPadding != rowB[i]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+#pragma mark - Random cases
+
+struct Case {
+  size_t channels;
+  Image src;
+  size_t offsetX;
+  size_t offsetY;
+  size_t destWidth;
+  size_t destHeight;
+  size_t destPadding;
+  uint32_t kernelWidth;
+  uint32_t kernelHeight;
+  std::vector<int16_t> kernel;
+  int32_t divisor;
+  uint8_t background[4];
+};
+
+// Small enough that the sums can't overflow 32 bits, vImage's can and
+// then nobody agrees.
+Case MakeCase(std::mt19937 &random) {
+  auto uniform = [&](int low, int high) { return std::uniform_int_distribution<int>(low, high)(random); };
+  Case c;
+  c.channels = uniform(0, 3) ? 4 : 1;
+  // rowBytes that aren't a multiple of the pixel size, or of anything
+  size_t width = uniform(1, 80);
+  size_t height = uniform(1, 72);
+  c.src = MakeImage(width, height, width * c.channels + (uniform(0, 1) ? uniform(1, 13) : 0));
+  for(uint8_t &value : c.src.pixels) {
+    value = (uint8_t)uniform(0, 255);
+  }
+  // the whole image half of the time, otherwise a region somewhere in it
+  if(uniform(0, 1)) {
+    c.offsetX = 0;
+    c.offsetY = 0;
+    c.destWidth = width;
+    c.destHeight = height;
+  } else {
+    c.offsetX = uniform(0, (int)width - 1);
+    c.offsetY = uniform(0, (int)height - 1);
+    c.destWidth = uniform(1, (int)(width - c.offsetX));
+    c.destHeight = uniform(1, (int)(height - c.offsetY));
+  }
+  c.destPadding = uniform(0, 1) ? uniform(1, 11) : 0;
+
+  c.kernelWidth = 2 * uniform(0, 7) + 1;
+  c.kernelHeight = 2 * uniform(0, 7) + 1;
+  c.kernel.resize(c.kernelWidth * c.kernelHeight);
+  switch(uniform(0, 2)) {
+    case 0:
+      // anything, with some zero weights for the taps to skip
+      for(int16_t &weight : c.kernel) {
+        weight = uniform(0, 3) ? (int16_t)uniform(-128, 128) : 0;
+      }
+      break;
+    case 1:
+      // a box
+      std::fill(c.kernel.begin(), c.kernel.end(), (int16_t)uniform(-8, 8));
+      if(0 == c.kernel[0]) {
+        c.kernel.assign(c.kernel.size(), 1);
+      }
+      break;
+    default: {
+      // an outer product, a blur or a Sobel say
+      std::vector<int16_t> rowKernel(c.kernelWidth), columnKernel(c.kernelHeight);
+      for(int16_t &weight : rowKernel) {
+        weight = (int16_t)uniform(-11, 11);
+      }
+      for(int16_t &weight : columnKernel) {
+        weight = (int16_t)uniform(-11, 11);
+      }
+      for(uint32_t ky = 0;ky < c.kernelHeight;ky++) {
+        for(uint32_t kx = 0;kx < c.kernelWidth;kx++) {
+          c.kernel[ky * c.kernelWidth + kx] = columnKernel[ky] * rowKernel[kx];
+        }
+      }
+      break;
+    }
+  }
+
+  // the kernel's sum (a normalized blur), 1, or anything, either sign
+  int32_t sum = 0;
+  for(int16_t weight : c.kernel) {
+    sum += weight;
+  }
+  switch(uniform(0, 3)) {
+    case 0: c.divisor = 0 != sum ? sum : 1; break;
+    case 1: c.divisor = 1; break;
+    case 2: c.divisor = uniform(2, 5000); break;
+    default: c.divisor = -uniform(1, 300); break;
+  }
+  for(uint8_t &value : c.background) {
+    value = uniform(0, 1) ? (uint8_t)uniform(0, 255) : 0;
+  }
+  return c;
+}
+
+enum Entry {
+  EntryFull,
+  EntrySeparable,
+  EntryAccumulatePack,
+  EntryCount
+};
+
+const char *kEntryNames[EntryCount] = { "full", "separable", "accumulate+pack" };
+
+// Runs case c through entry, false when it doesn't apply to the case.
+bool Run(Case &c, Entry entry, uint32_t flags, Image &dest, GFSConvolutionError &err) {
+  GFSConvolutionBuffer src = c.src.Buffer();
+  GFSConvolutionBuffer out = dest.Buffer();
+  switch(entry) {
+    case EntryFull:
+      err = 4 == c.channels
+        ? GFSConvolveARGB8888(&src, &out, c.offsetX, c.offsetY, c.kernel.data(), c.kernelWidth, c.kernelHeight,
+                              c.divisor, c.background, flags)
+        : GFSConvolvePlanar8(&src, &out, c.offsetX, c.offsetY, c.kernel.data(), c.kernelWidth, c.kernelHeight,
+                             c.divisor, c.background[0], flags);
+      return true;
+    case EntrySeparable: {
+      // the split the engine finds, which needn't be the one the case was
+      // made from
+      std::vector<int16_t> rowKernel(c.kernelWidth), columnKernel(c.kernelHeight);
+      if(!GFSConvolutionSeparateKernel(c.kernel.data(), c.kernelWidth, c.kernelHeight,
+                                       rowKernel.data(), columnKernel.data())) {
+        return false;
+      }
+      err = 4 == c.channels
+        ? GFSConvolveSeparableARGB8888(&src, &out, c.offsetX, c.offsetY, rowKernel.data(), c.kernelWidth,
+                                       columnKernel.data(), c.kernelHeight, c.divisor, c.background, flags)
+        : GFSConvolveSeparablePlanar8(&src, &out, c.offsetX, c.offsetY, rowKernel.data(), c.kernelWidth,
+                                      columnKernel.data(), c.kernelHeight, c.divisor, c.background[0], flags);
+      return true;
+    }
+    default: {
+      if(4 != c.channels) {
+        return false;
+      }
+      std::vector<int32_t> sums(std::max((size_t)1, dest.width * dest.height * 4));
+      GFSConvolutionBuffer accumulators = { sums.data(), dest.height, dest.width, dest.width * 4 * sizeof(int32_t) };
+      err = GFSConvolveAccumulateARGB8888(&src, &accumulators, c.offsetX, c.offsetY, c.kernel.data(),
+                                          c.kernelWidth, c.kernelHeight, flags);
+      if(GFSConvolutionNoError == err) {
+        err = GFSConvolutionPackARGB8888(&accumulators, &src, &out, c.offsetX, c.offsetY, c.kernel.data(),
+                                         c.kernelWidth, c.kernelHeight, c.divisor, c.background, flags);
+      }
+      return true;
+    }
+  }
+}
+
+// Every case through every entry and path. Prints a row per entry and path,
+// and the first few cases that differ on stderr.
+bool CheckRandomCases(unsigned caseCount, unsigned seed) {
+  static const uint32_t paths[] = {
+    GFSConvolutionScalar | GFSConvolutionSingleThread,
+    GFSConvolutionScalar,
+    GFSConvolutionSingleThread,
+    GFSConvolutionNoFlags
+  };
+  static const char *pathNames[] = { "scalar", "scalar-threads", kSIMD, "threads" };
+  const size_t pathCount = sizeof(paths) / sizeof(paths[0]);
+  unsigned runs[EntryCount][pathCount] = {};
+  unsigned failures[EntryCount][pathCount] = {};
+  unsigned reported = 0;
+
+  std::mt19937 random(seed);
+  for(unsigned n = 0;n < caseCount;n++) {
+    Case c = MakeCase(random);
+    Image expected = MakeImage(c.destWidth, c.destHeight, c.destWidth * c.channels + c.destPadding);
+    Convolve(c.src, expected, c.offsetX, c.offsetY, c.channels, c.kernel, c.kernelWidth, c.kernelHeight,
+             c.divisor, c.background);
+    for(int entry = 0;entry < EntryCount;entry++) {
+      for(size_t p = 0;p < pathCount;p++) {
+        Image dest = MakeImage(c.destWidth, c.destHeight, c.destWidth * c.channels + c.destPadding);
+        GFSConvolutionError err = GFSConvolutionNoError;
+        if(!Run(c, (Entry)entry, paths[p], dest, err)) {
+          continue;
+        }
+        runs[entry][p]++;
+        if(GFSConvolutionNoError != err || !Same(expected, dest, c.channels)) {
+          failures[entry][p]++;
+          if(reported++ < 10) {
+            fprintf(stderr, "case %u %s %s: %s%zux%zu+%zu src, %zux%zu at %zu,%zu, %ux%u kernel, divisor %d, "
+                    "error %d\n", n, kEntryNames[entry], pathNames[p], 4 == c.channels ? "ARGB8888 " : "Planar8 ",
+                    c.src.width, c.src.height, c.src.rowBytes - c.src.width * c.channels, c.destWidth,
+                    c.destHeight, c.offsetX, c.offsetY, c.kernelWidth, c.kernelHeight, c.divisor, (int)err);
+          }
+        }
+      }
+    }
+  }
+
+  bool passed = true;
+  printf("entry,path,simd,cases,failures\n");
+  for(int entry = 0;entry < EntryCount;entry++) {
+    for(size_t p = 0;p < pathCount;p++) {
+      printf("%s,%s,%s,%u,%u\n", kEntryNames[entry], pathNames[p], kSIMD, runs[entry][p], failures[entry][p]);
+      passed = passed && 0 == failures[entry][p];
+    }
+  }
+  return passed;
+}
+
+#pragma mark - Goldens
+
+struct GoldenCase {
+  const char *name;
+  uint32_t kernelWidth;
+  uint32_t kernelHeight;
+  int16_t kernel[25];
+  int32_t divisor;
+  uint8_t background[4];
+  // the region of interest, the whole image when width is 0
+  size_t offsetX;
+  size_t offsetY;
+  size_t width;
+  size_t height;
+};
+
+// GFSConvolvedViewController's and GFSImageConvolver's kernels, a 5x5
+// Gaussian, GFSNoiseGenerator's 25x1 streaks, a colored background and a
+// region that reaches the edges
+const GoldenCase kGoldenCases[] = {
+  { "edge", 3, 3, { -1, -1, -1, -1, 8, -1, -1, -1, -1 }, 1, { 0, 0, 0, 0 }, 0, 0, 0, 0 },
+  { "cross", 3, 3, { 0, 1, 0, 1, 0, 1, 0, 1, 0 }, 4, { 0, 0, 0, 0 }, 0, 0, 0, 0 },
+  { "box", 3, 3, { 1, 1, 1, 1, 1, 1, 1, 1, 1 }, 81, { 0, 0, 0, 0 }, 0, 0, 0, 0 },
+  { "gaussian", 5, 5, { 1, 4, 6, 4, 1, 4, 16, 24, 16, 4, 6, 24, 36, 24, 6, 4, 16, 24, 16, 4, 1, 4, 6, 4, 1 },
+    256, { 255, 0, 0, 0 }, 0, 0, 0, 0 },
+  { "streak", 25, 1, { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+    25, { 255, 40, 80, 160 }, 0, 0, 0, 0 },
+  { "edge-roi", 3, 3, { -1, -1, -1, -1, 8, -1, -1, -1, -1 }, 1, { 255, 255, 255, 255 }, 900, 0, 124, 300 },
+};
+const size_t kGoldenCount = sizeof(kGoldenCases) / sizeof(kGoldenCases[0]);
+
+// FNV-1a of each of kGoldenCases on phillip.jpg, in order, printed by
+// -record on Linux, so from the reference convolution and not vImage.
+const uint64_t kGoldens[kGoldenCount] = {
+  0xde5358391bb46cb2ULL,
+  0x8673be8243ce778bULL,
+  0xeb5aa71d47166143ULL,
+  0xb1a19800b6011c11ULL,
+  0x07ac86b940faa9d6ULL,
+  0x3758ca64f0e29dc1ULL,
+};
+
+uint64_t Hash(const Image &image) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for(size_t y = 0;y < image.height;y++) {
+    const uint8_t *row = image.pixels.data() + y * image.rowBytes;
+    for(size_t i = 0;i < image.width * 4;i++) {
+      hash = (hash ^ row[i]) * 0x100000001b3ULL;
+    }
+  }
+  return hash;
+}
+
+bool ReadFile(const char *path, std::vector<uint8_t> &data) {
+  FILE *file = fopen(path, "rb");
+  if(NULL == file) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  data.resize(length > 0 ? (size_t)length : 0);
+  bool ok = length > 0 && fread(data.data(), 1, data.size(), file) == data.size();
+  fclose(file);
+  return ok;
+}
+
+bool Decode(const char *path, Image &image) {
+  std::vector<uint8_t> data;
+  GFSImageInfo info;
+  if(!ReadFile(path, data) || GFSImageDecoderNoError != GFSImageDecoderReadInfo(data.data(), data.size(), &info)) {
+    return false;
+  }
+  image = MakeImage(info.width, info.height, info.width * 4);
+  return GFSImageDecoderNoError == GFSImageDecodeARGB8888(data.data(), data.size(), 1, NULL,
+                                                          image.pixels.data(), image.rowBytes);
+}
+
+Image GoldenDest(const Image &src, const GoldenCase &golden) {
+  return 0 == golden.width ? MakeImage(src.width, src.height, src.width * 4)
+                           : MakeImage(golden.width, golden.height, golden.width * 4);
+}
+
+// What the goldens are taken from: vImage where there is one, otherwise
+// the naive convolution.
+bool Record(const char *path) {
+  Image src;
+  if(!Decode(path, src)) {
+    fprintf(stderr, "%s: couldn't decode\n", path);
+    return false;
+  }
+#if defined(__APPLE__)
+  fprintf(stderr, "recording from vImage\n");
+#else
+  fprintf(stderr, "no vImage, recording from the naive convolution\n");
+#endif
+  for(size_t g = 0;g < kGoldenCount;g++) {
+    const GoldenCase &golden = kGoldenCases[g];
+    Image dest = GoldenDest(src, golden);
+#if defined(__APPLE__)
+    vImage_Buffer srcBuffer = { src.pixels.data(), src.height, src.width, src.rowBytes };
+    vImage_Buffer destBuffer = { dest.pixels.data(), dest.height, dest.width, dest.rowBytes };
+    vImage_Error err = vImageConvolve_ARGB8888(&srcBuffer, &destBuffer, NULL, golden.offsetX, golden.offsetY,
+                                               golden.kernel, golden.kernelHeight, golden.kernelWidth,
+                                               golden.divisor, golden.background, kvImageBackgroundColorFill);
+    if(kvImageNoError != err) {
+      fprintf(stderr, "%s: vImage error %ld\n", golden.name, (long)err);
+      return false;
+    }
+#else
+    std::vector<int16_t> kernel(golden.kernel, golden.kernel + golden.kernelWidth * golden.kernelHeight);
+    Convolve(src, dest, golden.offsetX, golden.offsetY, 4, kernel, golden.kernelWidth, golden.kernelHeight,
+             golden.divisor, golden.background);
+#endif
+    printf("  0x%016llxULL,\n", (unsigned long long)Hash(dest));
+  }
+  return true;
+}
+
+// The engine against kGoldens, scalar and SIMD, whole and split kernels.
+bool CheckGoldens(const char *path) {
+  Image src;
+  if(!Decode(path, src)) {
+    fprintf(stderr, "%s: couldn't decode\n", path);
+    return false;
+  }
+  bool passed = true;
+  printf("image,case,path,simd,hash,golden,identical\n");
+  for(size_t g = 0;g < kGoldenCount;g++) {
+    const GoldenCase &golden = kGoldenCases[g];
+    GFSConvolutionBuffer srcBuffer = src.Buffer();
+    for(int variant = 0;variant < 4;variant++) {
+      const uint32_t flags = 0 == (variant & 1) ? GFSConvolutionScalar : GFSConvolutionNoFlags;
+      const bool separate = 0 != (variant & 2);
+      Image dest = GoldenDest(src, golden);
+      GFSConvolutionBuffer destBuffer = dest.Buffer();
+      GFSConvolutionError err;
+      if(separate) {
+        int16_t rowKernel[25], columnKernel[25];
+        if(!GFSConvolutionSeparateKernel(golden.kernel, golden.kernelWidth, golden.kernelHeight,
+                                         rowKernel, columnKernel)) {
+          continue;
+        }
+        err = GFSConvolveSeparableARGB8888(&srcBuffer, &destBuffer, golden.offsetX, golden.offsetY,
+                                           rowKernel, golden.kernelWidth, columnKernel, golden.kernelHeight,
+                                           golden.divisor, golden.background, flags);
+      } else {
+        err = GFSConvolveARGB8888(&srcBuffer, &destBuffer, golden.offsetX, golden.offsetY, golden.kernel,
+                                  golden.kernelWidth, golden.kernelHeight, golden.divisor, golden.background,
+                                  flags);
+      }
+      const uint64_t hash = GFSConvolutionNoError == err ? Hash(dest) : 0;
+      const bool identical = GFSConvolutionNoError == err && hash == kGoldens[g];
+      passed = passed && identical;
+      printf("%s,%s,%s%s,%s,%016llx,%016llx,%s\n", path, golden.name, separate ? "separable-" : "",
+             GFSConvolutionScalar == flags ? "scalar" : kSIMD, kSIMD, (unsigned long long)hash,
+             (unsigned long long)kGoldens[g], identical ? "yes" : "no");
+    }
+  }
+  return passed;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  unsigned caseCount = 1000;
+  unsigned seed = 1;
+  bool record = false;
+  int first = 1;
+  while(first < argc && '-' == argv[first][0]) {
+    if(0 == strcmp(argv[first], "-record")) {
+      record = true;
+      first++;
+    } else if(first + 1 < argc && 0 == strcmp(argv[first], "-n")) {
+      caseCount = (unsigned)atoi(argv[first + 1]);
+      first += 2;
+    } else if(first + 1 < argc && 0 == strcmp(argv[first], "-s")) {
+      seed = (unsigned)atoi(argv[first + 1]);
+      first += 2;
+    } else {
+      break;
+    }
+  }
+  if(first + 1 != argc) {
+    fprintf(stderr, "usage: %s [-record] [-n cases] [-s seed] phillip.jpg\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  if(record) {
+    return Record(argv[first]) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  bool passed = CheckRandomCases(caseCount, seed);
+  passed = CheckGoldens(argv[first]) && passed;
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
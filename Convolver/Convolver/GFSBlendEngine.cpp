@@ -0,0 +1,620 @@
+//
+//  GFSBlendEngine.cpp
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "GFSBlendEngine.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define GFS_BLEND_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define GFS_BLEND_NEON 1
+#endif
+
+namespace {
+
+// don't bother starting a thread for less work than this
+const size_t kMinRowsPerThread = 16;
+const float kByteToFloat = 1.f / 255.f;
+
+// The blend math is written once, as templates over the type of a channel:
+// float for one pixel, Vec for the same channel of four pixels. Both have
+// the same arithmetic operators plus Min, Max, Sqrt and Select (a blend on
+// a comparison), and do exactly the same operations in the same order, so
+// the SIMD results are the plain C ones.
+
+#pragma mark - Scalar
+
+inline float Min(float a, float b) {
+  return a < b ? a : b;
+}
+
+inline float Max(float a, float b) {
+  return a > b ? a : b;
+}
+
+inline float Select(bool mask, float a, float b) {
+  return mask ? a : b;
+}
+
+inline float Sqrt(float a) {
+  return sqrtf(a);
+}
+
+#pragma mark - SSE2
+
+#if GFS_BLEND_SSE2
+
+struct Vec {
+  __m128 v;
+  Vec() {}
+  Vec(float f) : v(_mm_set1_ps(f)) {}
+  explicit Vec(__m128 v) : v(v) {}
+};
+
+struct Mask {
+  __m128 m;
+  explicit Mask(__m128 m) : m(m) {}
+};
+
+inline Vec operator+(Vec a, Vec b) { return Vec(_mm_add_ps(a.v, b.v)); }
+inline Vec operator-(Vec a, Vec b) { return Vec(_mm_sub_ps(a.v, b.v)); }
+inline Vec operator*(Vec a, Vec b) { return Vec(_mm_mul_ps(a.v, b.v)); }
+inline Vec operator/(Vec a, Vec b) { return Vec(_mm_div_ps(a.v, b.v)); }
+inline Mask operator<(Vec a, Vec b) { return Mask(_mm_cmplt_ps(a.v, b.v)); }
+inline Mask operator<=(Vec a, Vec b) { return Mask(_mm_cmple_ps(a.v, b.v)); }
+inline Mask operator>(Vec a, Vec b) { return Mask(_mm_cmpgt_ps(a.v, b.v)); }
+inline Mask operator>=(Vec a, Vec b) { return Mask(_mm_cmpge_ps(a.v, b.v)); }
+inline Mask operator==(Vec a, Vec b) { return Mask(_mm_cmpeq_ps(a.v, b.v)); }
+inline Mask operator&(Mask a, Mask b) { return Mask(_mm_and_ps(a.m, b.m)); }
+inline Mask operator|(Mask a, Mask b) { return Mask(_mm_or_ps(a.m, b.m)); }
+inline Vec Min(Vec a, Vec b) { return Vec(_mm_min_ps(a.v, b.v)); }
+inline Vec Max(Vec a, Vec b) { return Vec(_mm_max_ps(a.v, b.v)); }
+inline Vec Sqrt(Vec a) { return Vec(_mm_sqrt_ps(a.v)); }
+
+inline Vec Select(Mask mask, Vec a, Vec b) {
+  return Vec(_mm_or_ps(_mm_and_ps(mask.m, a.v), _mm_andnot_ps(mask.m, b.v)));
+}
+
+#endif
+
+#pragma mark - NEON
+
+#if GFS_BLEND_NEON
+
+struct Vec {
+  float32x4_t v;
+  Vec() {}
+  Vec(float f) : v(vdupq_n_f32(f)) {}
+  explicit Vec(float32x4_t v) : v(v) {}
+};
+
+struct Mask {
+  uint32x4_t m;
+  explicit Mask(uint32x4_t m) : m(m) {}
+};
+
+inline Vec operator+(Vec a, Vec b) { return Vec(vaddq_f32(a.v, b.v)); }
+inline Vec operator-(Vec a, Vec b) { return Vec(vsubq_f32(a.v, b.v)); }
+inline Vec operator*(Vec a, Vec b) { return Vec(vmulq_f32(a.v, b.v)); }
+inline Mask operator<(Vec a, Vec b) { return Mask(vcltq_f32(a.v, b.v)); }
+inline Mask operator<=(Vec a, Vec b) { return Mask(vcleq_f32(a.v, b.v)); }
+inline Mask operator>(Vec a, Vec b) { return Mask(vcgtq_f32(a.v, b.v)); }
+inline Mask operator>=(Vec a, Vec b) { return Mask(vcgeq_f32(a.v, b.v)); }
+inline Mask operator==(Vec a, Vec b) { return Mask(vceqq_f32(a.v, b.v)); }
+inline Mask operator&(Mask a, Mask b) { return Mask(vandq_u32(a.m, b.m)); }
+inline Mask operator|(Mask a, Mask b) { return Mask(vorrq_u32(a.m, b.m)); }
+
+inline Vec Select(Mask mask, Vec a, Vec b) {
+  return Vec(vbslq_f32(mask.m, a.v, b.v));
+}
+
+// NaN in either gives b, like the scalar versions and SSE
+inline Vec Min(Vec a, Vec b) {
+  return Select(a < b, a, b);
+}
+
+inline Vec Max(Vec a, Vec b) {
+  return Select(a > b, a, b);
+}
+
+#if defined(__aarch64__)
+
+inline Vec operator/(Vec a, Vec b) { return Vec(vdivq_f32(a.v, b.v)); }
+inline Vec Sqrt(Vec a) { return Vec(vsqrtq_f32(a.v)); }
+
+#else
+
+// ARMv7 only has estimates, which wouldn't match the scalar results
+inline Vec operator/(Vec a, Vec b) {
+  float x[4], y[4];
+  vst1q_f32(x, a.v);
+  vst1q_f32(y, b.v);
+  for(int i = 0; i < 4; i++) {
+    x[i] /= y[i];
+  }
+  return Vec(vld1q_f32(x));
+}
+
+inline Vec Sqrt(Vec a) {
+  float x[4];
+  vst1q_f32(x, a.v);
+  for(int i = 0; i < 4; i++) {
+    x[i] = sqrtf(x[i]);
+  }
+  return Vec(vld1q_f32(x));
+}
+
+#endif
+
+#endif
+
+#pragma mark - Blend modes
+
+template<class T>
+struct Pixel {
+  T a, r, g, b;
+};
+
+template<class T>
+struct Color {
+  T r, g, b;
+};
+
+template<class T>
+inline T Unpremultiply(T c, T a) {
+  return Select(a > T(0.f), c / a, T(0.f));
+}
+
+// Separable blend functions of the backdrop (b) and source (s) colors
+
+struct Normal {
+  template<class T> T operator()(T, T s) const { return s; }
+};
+
+struct Multiply {
+  template<class T> T operator()(T b, T s) const { return b * s; }
+};
+
+struct Screen {
+  template<class T> T operator()(T b, T s) const { return b + s - b * s; }
+};
+
+struct HardLight {
+  template<class T> T operator()(T b, T s) const {
+    const T s2 = s + s;
+    const T screen = s2 - 1.f;
+    return Select(s <= T(.5f), b * s2, b + screen - b * screen);
+  }
+};
+
+struct Overlay {
+  template<class T> T operator()(T b, T s) const { return HardLight()(s, b); }
+};
+
+struct Darken {
+  template<class T> T operator()(T b, T s) const { return Min(b, s); }
+};
+
+struct Lighten {
+  template<class T> T operator()(T b, T s) const { return Max(b, s); }
+};
+
+struct ColorDodge {
+  template<class T> T operator()(T b, T s) const {
+    const T dodge = Select(s >= T(1.f), T(1.f), Min(T(1.f), b / (1.f - s)));
+    return Select(b <= T(0.f), T(0.f), dodge);
+  }
+};
+
+struct ColorBurn {
+  template<class T> T operator()(T b, T s) const {
+    const T burn = Select(s <= T(0.f), T(0.f), 1.f - Min(T(1.f), (1.f - b) / s));
+    return Select(b >= T(1.f), T(1.f), burn);
+  }
+};
+
+struct SoftLight {
+  template<class T> T operator()(T b, T s) const {
+    const T d = Select(b <= T(.25f), ((b * 16.f - 12.f) * b + 4.f) * b, Sqrt(b));
+    const T s2 = s + s;
+    return Select(s <= T(.5f),
+                  b - (1.f - s2) * b * (1.f - b),
+                  b + (s2 - 1.f) * (d - b));
+  }
+};
+
+struct Difference {
+  template<class T> T operator()(T b, T s) const { return Max(b - s, s - b); }
+};
+
+struct Exclusion {
+  template<class T> T operator()(T b, T s) const { return b + s - (b * s + b * s); }
+};
+
+// Non-separable, on all three colors at once
+
+template<class T>
+inline T Lum(const Color<T> &c) {
+  return c.r * .3f + c.g * .59f + c.b * .11f;
+}
+
+template<class T>
+inline T ClipChannel(T c, T l, T n, T x) {
+  c = Select(n < T(0.f), l + (c - l) * l / (l - n), c);
+  return Select(x > T(1.f), l + (c - l) * (1.f - l) / (x - l), c);
+}
+
+template<class T>
+inline Color<T> SetLum(Color<T> c, T l) {
+  const T d = l - Lum(c);
+  c.r = c.r + d;
+  c.g = c.g + d;
+  c.b = c.b + d;
+  l = Lum(c);
+  const T n = Min(Min(c.r, c.g), c.b);
+  const T x = Max(Max(c.r, c.g), c.b);
+  Color<T> clipped = { ClipChannel(c.r, l, n, x), ClipChannel(c.g, l, n, x), ClipChannel(c.b, l, n, x) };
+  return clipped;
+}
+
+template<class T>
+inline T Sat(const Color<T> &c) {
+  return Max(Max(c.r, c.g), c.b) - Min(Min(c.r, c.g), c.b);
+}
+
+// the largest channel goes to s, the smallest to 0 and the middle one
+// keeps its place between them
+template<class T>
+inline Color<T> SetSat(const Color<T> &c, T s) {
+  const T n = Min(Min(c.r, c.g), c.b);
+  const T x = Max(Max(c.r, c.g), c.b);
+  const T range = x - n;
+  const T scale = Select(range > T(0.f), s / range, T(0.f));
+  Color<T> saturated = { (c.r - n) * scale, (c.g - n) * scale, (c.b - n) * scale };
+  return saturated;
+}
+
+struct Hue {
+  template<class T> Color<T> operator()(const Color<T> &b, const Color<T> &s) const {
+    return SetLum(SetSat(s, Sat(b)), Lum(b));
+  }
+};
+
+struct Saturation {
+  template<class T> Color<T> operator()(const Color<T> &b, const Color<T> &s) const {
+    return SetLum(SetSat(b, Sat(s)), Lum(b));
+  }
+};
+
+struct ColorMode {
+  template<class T> Color<T> operator()(const Color<T> &b, const Color<T> &s) const {
+    return SetLum(s, Lum(b));
+  }
+};
+
+struct Luminosity {
+  template<class T> Color<T> operator()(const Color<T> &b, const Color<T> &s) const {
+    return SetLum(b, Lum(s));
+  }
+};
+
+// source over with the blended color where both are
+template<class T>
+inline T Composite(T cb, T ab, T cs, T as, T blended) {
+  return cs * (1.f - ab) + cb * (1.f - as) + as * ab * blended;
+}
+
+template<class T, class F>
+inline void Separable(Pixel<T> &d, const Pixel<T> &s, F blend) {
+  d.r = Composite(d.r, d.a, s.r, s.a, blend(Unpremultiply(d.r, d.a), Unpremultiply(s.r, s.a)));
+  d.g = Composite(d.g, d.a, s.g, s.a, blend(Unpremultiply(d.g, d.a), Unpremultiply(s.g, s.a)));
+  d.b = Composite(d.b, d.a, s.b, s.a, blend(Unpremultiply(d.b, d.a), Unpremultiply(s.b, s.a)));
+  d.a = s.a + d.a - s.a * d.a;
+}
+
+template<class T, class F>
+inline void NonSeparable(Pixel<T> &d, const Pixel<T> &s, F blend) {
+  const Color<T> cb = { Unpremultiply(d.r, d.a), Unpremultiply(d.g, d.a), Unpremultiply(d.b, d.a) };
+  const Color<T> cs = { Unpremultiply(s.r, s.a), Unpremultiply(s.g, s.a), Unpremultiply(s.b, s.a) };
+  const Color<T> blended = blend(cb, cs);
+  d.r = Composite(d.r, d.a, s.r, s.a, blended.r);
+  d.g = Composite(d.g, d.a, s.g, s.a, blended.g);
+  d.b = Composite(d.b, d.a, s.b, s.a, blended.b);
+  d.a = s.a + d.a - s.a * d.a;
+}
+
+// Porter-Duff, source times fs plus destination times fd
+template<class T>
+inline void PorterDuff(Pixel<T> &d, const Pixel<T> &s, T fs, T fd) {
+  d.a = s.a * fs + d.a * fd;
+  d.r = s.r * fs + d.r * fd;
+  d.g = s.g * fs + d.g * fd;
+  d.b = s.b * fs + d.b * fd;
+}
+
+template<class T>
+inline void PlusLighter(Pixel<T> &d, const Pixel<T> &s) {
+  d.a = Min(T(1.f), s.a + d.a);
+  d.r = Min(T(1.f), s.r + d.r);
+  d.g = Min(T(1.f), s.g + d.g);
+  d.b = Min(T(1.f), s.b + d.b);
+}
+
+// 1 - ((1 - D) + (1 - S)) in premultiplied terms
+template<class T>
+inline void PlusDarker(Pixel<T> &d, const Pixel<T> &s) {
+  const T a = Min(T(1.f), s.a + d.a);
+  d.r = Max(T(0.f), a - ((s.a - s.r) + (d.a - d.r)));
+  d.g = Max(T(0.f), a - ((s.a - s.g) + (d.a - d.g)));
+  d.b = Max(T(0.f), a - ((s.a - s.b) + (d.a - d.b)));
+  d.a = a;
+}
+
+template<class T>
+void BlendPixel(uint32_t mode, Pixel<T> &d, const Pixel<T> &s) {
+  switch(mode) {
+    case GFSBlendNormal: Separable(d, s, Normal()); break;
+    case GFSBlendMultiply: Separable(d, s, Multiply()); break;
+    case GFSBlendScreen: Separable(d, s, Screen()); break;
+    case GFSBlendOverlay: Separable(d, s, Overlay()); break;
+    case GFSBlendDarken: Separable(d, s, Darken()); break;
+    case GFSBlendLighten: Separable(d, s, Lighten()); break;
+    case GFSBlendColorDodge: Separable(d, s, ColorDodge()); break;
+    case GFSBlendColorBurn: Separable(d, s, ColorBurn()); break;
+    case GFSBlendSoftLight: Separable(d, s, SoftLight()); break;
+    case GFSBlendHardLight: Separable(d, s, HardLight()); break;
+    case GFSBlendDifference: Separable(d, s, Difference()); break;
+    case GFSBlendExclusion: Separable(d, s, Exclusion()); break;
+    case GFSBlendHue: NonSeparable(d, s, Hue()); break;
+    case GFSBlendSaturation: NonSeparable(d, s, Saturation()); break;
+    case GFSBlendColor: NonSeparable(d, s, ColorMode()); break;
+    case GFSBlendLuminosity: NonSeparable(d, s, Luminosity()); break;
+    case GFSBlendClear: PorterDuff(d, s, T(0.f), T(0.f)); break;
+    case GFSBlendCopy: PorterDuff(d, s, T(1.f), T(0.f)); break;
+    case GFSBlendSourceIn: PorterDuff(d, s, d.a, T(0.f)); break;
+    case GFSBlendSourceOut: PorterDuff(d, s, 1.f - d.a, T(0.f)); break;
+    case GFSBlendSourceAtop: PorterDuff(d, s, d.a, 1.f - s.a); break;
+    case GFSBlendDestinationOver: PorterDuff(d, s, 1.f - d.a, T(1.f)); break;
+    case GFSBlendDestinationIn: PorterDuff(d, s, T(0.f), s.a); break;
+    case GFSBlendDestinationOut: PorterDuff(d, s, T(0.f), 1.f - s.a); break;
+    case GFSBlendDestinationAtop: PorterDuff(d, s, 1.f - d.a, s.a); break;
+    case GFSBlendXOR: PorterDuff(d, s, 1.f - d.a, 1.f - s.a); break;
+    case GFSBlendPlusDarker: PlusDarker(d, s); break;
+    case GFSBlendPlusLighter: PlusLighter(d, s); break;
+    default: break;
+  }
+}
+
+template<class T>
+inline void Fade(Pixel<T> &p, float opacity) {
+  p.a = p.a * opacity;
+  p.r = p.r * opacity;
+  p.g = p.g * opacity;
+  p.b = p.b * opacity;
+}
+
+#pragma mark - Loading and storing
+
+inline Pixel<float> LoadPixel(const uint8_t *p) {
+  Pixel<float> pixel = { p[0] * kByteToFloat, p[1] * kByteToFloat, p[2] * kByteToFloat, p[3] * kByteToFloat };
+  return pixel;
+}
+
+inline uint8_t ToByte(float v) {
+  return (uint8_t)(Min(Max(v, 0.f), 1.f) * 255.f + .5f);
+}
+
+inline void StorePixel(const Pixel<float> &pixel, uint8_t *p) {
+  p[0] = ToByte(pixel.a);
+  p[1] = ToByte(pixel.r);
+  p[2] = ToByte(pixel.g);
+  p[3] = ToByte(pixel.b);
+}
+
+#if GFS_BLEND_SSE2
+
+// 4 pixels, transposed so each Vec is one channel
+inline Pixel<Vec> LoadPixels(const uint8_t *p) {
+  const __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+  const __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+  __m128 p0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+  __m128 p1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+  __m128 p2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+  __m128 p3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+  _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+  const Vec scale(kByteToFloat);
+  Pixel<Vec> pixels = { Vec(p0) * scale, Vec(p1) * scale, Vec(p2) * scale, Vec(p3) * scale };
+  return pixels;
+}
+
+inline __m128 ToBytes(Vec v) {
+  return (Min(Max(v, Vec(0.f)), Vec(1.f)) * Vec(255.f) + Vec(.5f)).v;
+}
+
+inline void StorePixels(const Pixel<Vec> &pixels, uint8_t *p) {
+  __m128 p0 = ToBytes(pixels.a);
+  __m128 p1 = ToBytes(pixels.r);
+  __m128 p2 = ToBytes(pixels.g);
+  __m128 p3 = ToBytes(pixels.b);
+  _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+  const __m128i lo = _mm_packs_epi32(_mm_cvttps_epi32(p0), _mm_cvttps_epi32(p1));
+  const __m128i hi = _mm_packs_epi32(_mm_cvttps_epi32(p2), _mm_cvttps_epi32(p3));
+  _mm_storeu_si128((__m128i *)p, _mm_packus_epi16(lo, hi));
+}
+
+#elif GFS_BLEND_NEON
+
+inline void Transpose(float32x4_t &p0, float32x4_t &p1, float32x4_t &p2, float32x4_t &p3) {
+  const float32x4x2_t t01 = vtrnq_f32(p0, p1);
+  const float32x4x2_t t23 = vtrnq_f32(p2, p3);
+  p0 = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+  p1 = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+  p2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+  p3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+}
+
+inline Pixel<Vec> LoadPixels(const uint8_t *p) {
+  const uint8x16_t bytes = vld1q_u8(p);
+  const uint16x8_t lo = vmovl_u8(vget_low_u8(bytes));
+  const uint16x8_t hi = vmovl_u8(vget_high_u8(bytes));
+  float32x4_t p0 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo)));
+  float32x4_t p1 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo)));
+  float32x4_t p2 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi)));
+  float32x4_t p3 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi)));
+  Transpose(p0, p1, p2, p3);
+  const Vec scale(kByteToFloat);
+  Pixel<Vec> pixels = { Vec(p0) * scale, Vec(p1) * scale, Vec(p2) * scale, Vec(p3) * scale };
+  return pixels;
+}
+
+inline float32x4_t ToBytes(Vec v) {
+  return (Min(Max(v, Vec(0.f)), Vec(1.f)) * Vec(255.f) + Vec(.5f)).v;
+}
+
+inline void StorePixels(const Pixel<Vec> &pixels, uint8_t *p) {
+  float32x4_t p0 = ToBytes(pixels.a);
+  float32x4_t p1 = ToBytes(pixels.r);
+  float32x4_t p2 = ToBytes(pixels.g);
+  float32x4_t p3 = ToBytes(pixels.b);
+  Transpose(p0, p1, p2, p3);
+  const uint16x8_t lo = vcombine_u16(vmovn_u32(vcvtq_u32_f32(p0)), vmovn_u32(vcvtq_u32_f32(p1)));
+  const uint16x8_t hi = vcombine_u16(vmovn_u32(vcvtq_u32_f32(p2)), vmovn_u32(vcvtq_u32_f32(p3)));
+  vst1q_u8(p, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+}
+
+#endif
+
+#pragma mark - Rows
+
+struct Blend {
+  const uint8_t *base;
+  size_t baseRowBytes;
+  uint8_t *dest;
+  size_t destRowBytes;
+  size_t width;
+  size_t height;
+  const GFSBlendLayer *layers;
+  uint32_t layerCount;
+  bool scalar;
+};
+
+template<class T>
+inline void BlendLayers(const Blend &blend, Pixel<T> &d, size_t y, size_t x,
+                        Pixel<T> (*load)(const uint8_t *)) {
+  for(uint32_t l = 0; l < blend.layerCount; l++) {
+    const GFSBlendLayer &layer = blend.layers[l];
+    Pixel<T> s = load((const uint8_t *)layer.data + y * layer.rowBytes + x * 4);
+    if(layer.opacity < 1.f) {
+      Fade(s, layer.opacity);
+    }
+    BlendPixel(layer.mode, d, s);
+  }
+}
+
+void BlendRows(const Blend *blend, size_t first, size_t last) {
+  for(size_t y = first; y < last; y++) {
+    const uint8_t *base = blend->base + y * blend->baseRowBytes;
+    uint8_t *dest = blend->dest + y * blend->destRowBytes;
+    size_t x = 0;
+#if GFS_BLEND_SSE2 || GFS_BLEND_NEON
+    if(!blend->scalar) {
+      for(; x + 4 <= blend->width; x += 4) {
+        Pixel<Vec> d = LoadPixels(base + x * 4);
+        BlendLayers(*blend, d, y, x, LoadPixels);
+        StorePixels(d, dest + x * 4);
+      }
+    }
+#endif
+    for(; x < blend->width; x++) {
+      Pixel<float> d = LoadPixel(base + x * 4);
+      BlendLayers(*blend, d, y, x, LoadPixel);
+      StorePixel(d, dest + x * 4);
+    }
+  }
+}
+
+void RunBlend(const Blend &blend, uint32_t flags) {
+  size_t threadCount = 1;
+  if(0 == (flags & GFSBlendSingleThread)) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, std::max((size_t)1, blend.height / kMinRowsPerThread));
+  }
+
+  // the calling thread takes the first band, and any band a thread
+  // couldn't be started for
+  const size_t band = (blend.height + threadCount - 1) / threadCount;
+  std::vector<std::thread> threads;
+  for(size_t t = 1; t < threadCount; t++) {
+    const size_t first = t * band;
+    const size_t last = std::min(blend.height, first + band);
+    if(first < last) {
+      try {
+        threads.push_back(std::thread(BlendRows, &blend, first, last));
+      } catch(const std::system_error &) {
+        BlendRows(&blend, first, last);
+      }
+    }
+  }
+  BlendRows(&blend, 0, std::min(blend.height, band));
+  for(size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+}
+
+} // namespace
+
+#pragma mark - Public
+
+bool GFSBlendARGB8888(const void *base,
+                      size_t baseRowBytes,
+                      void *dest,
+                      size_t destRowBytes,
+                      size_t width,
+                      size_t height,
+                      const GFSBlendLayer *layers,
+                      uint32_t layerCount,
+                      uint32_t flags) {
+  if(NULL == base || NULL == dest || baseRowBytes < width * 4 || destRowBytes < width * 4 ||
+     (0 != layerCount && NULL == layers)) {
+    return false;
+  }
+  for(uint32_t l = 0; l < layerCount; l++) {
+    if(NULL == layers[l].data || layers[l].rowBytes < width * 4 || layers[l].mode >= GFSBlendModeCount) {
+      return false;
+    }
+  }
+  if(0 == width || 0 == height) {
+    return true;
+  }
+  Blend blend = { (const uint8_t *)base, baseRowBytes, (uint8_t *)dest, destRowBytes,
+    width, height, layers, layerCount, 0 != (flags & GFSBlendScalar) };
+  RunBlend(blend, flags);
+  return true;
+}
@@ -0,0 +1,119 @@
+//
+//  GFSBlendEngine.h
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#ifndef GFSBlendEngine_h
+#define GFSBlendEngine_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A portable compositor for the blend modes of CGContextSetBlendMode, so
+ * layers can be blended straight into a buffer instead of drawing them into
+ * a bitmap context one after another.
+ *
+ * Pixels are premultiplied ARGB8888, alpha first in memory
+ * (kCGImageAlphaPremultipliedFirst, big endian). The math is the PDF / W3C
+ * compositing model, in float:
+ *  - the separable modes (Multiply...Exclusion) and the non-separable ones
+ *    (Hue, Saturation, Color, Luminosity) blend the unpremultiplied colors
+ *    and composite source over with the result
+ *  - Clear...XOR are Porter-Duff, PlusDarker and PlusLighter add and clamp
+ *
+ * Any number of layers are blended in one pass, each pixel of the base is
+ * read, blended with every layer and written once. The SIMD paths work on
+ * four pixels at a time (one vector per channel) with the same operations
+ * as the plain C, rows are split across threads.
+ */
+
+// same values as CGBlendMode
+typedef enum {
+  GFSBlendNormal = 0,
+  GFSBlendMultiply,
+  GFSBlendScreen,
+  GFSBlendOverlay,
+  GFSBlendDarken,
+  GFSBlendLighten,
+  GFSBlendColorDodge,
+  GFSBlendColorBurn,
+  GFSBlendSoftLight,
+  GFSBlendHardLight,
+  GFSBlendDifference,
+  GFSBlendExclusion,
+  GFSBlendHue,
+  GFSBlendSaturation,
+  GFSBlendColor,
+  GFSBlendLuminosity,
+  GFSBlendClear,
+  GFSBlendCopy,
+  GFSBlendSourceIn,
+  GFSBlendSourceOut,
+  GFSBlendSourceAtop,
+  GFSBlendDestinationOver,
+  GFSBlendDestinationIn,
+  GFSBlendDestinationOut,
+  GFSBlendDestinationAtop,
+  GFSBlendXOR,
+  GFSBlendPlusDarker,
+  GFSBlendPlusLighter,
+  GFSBlendModeCount
+} GFSBlendMode;
+
+typedef enum {
+  GFSBlendNoFlags = 0,
+  // run on the calling thread only
+  GFSBlendSingleThread = 1 << 0,
+  // skip the SIMD paths, handy for checking them against plain C
+  GFSBlendScalar = 1 << 1
+} GFSBlendFlags;
+
+typedef struct GFSBlendLayer {
+  // premultiplied ARGB8888 the size of dest
+  const void *data;
+  size_t rowBytes;
+  // a GFSBlendMode
+  uint32_t mode;
+  // 0...1, scales the whole layer like CGContextSetAlpha
+  float opacity;
+} GFSBlendLayer;
+
+// dest = base blended with layers[0], then layers[1]... width x height
+// pixels. base may be dest to blend in place. Returns false for bad
+// arguments.
+bool GFSBlendARGB8888(const void *base,
+                      size_t baseRowBytes,
+                      void *dest,
+                      size_t destRowBytes,
+                      size_t width,
+                      size_t height,
+                      const GFSBlendLayer *layers,
+                      uint32_t layerCount,
+                      uint32_t flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
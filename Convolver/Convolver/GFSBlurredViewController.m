@@ -8,12 +8,19 @@
 
 #import "GFSBlurredViewController.h"
 #import "GFSNoiseGenerator.h"
+#import "GFSImageSurfacePool.h"
+#import "GFSBlendEngine.h"
 
 @interface GFSBlurredViewController ()
 
 @property(nonatomic, strong) UIImage *originalImage;
 @property(nonatomic, strong) GFSNoiseGenerator *noiseGenerator;
 @property(nonatomic, assign) NSUInteger tapCount;
+// the original and the noise drawn once at the blended size, premultiplied
+// ARGB, each tap only blends them
+@property(nonatomic, strong) NSMutableData *originalData;
+@property(nonatomic, strong) NSMutableData *noiseData;
+@property(nonatomic, assign) CGSize blendedSize;
 
 @property(nonatomic, weak) IBOutlet UIImageView *noiseImageView;
 @property(nonatomic, weak) IBOutlet UILabel *blendLabel;
@@ -25,6 +32,9 @@
 @synthesize originalImage = _originalImage;
 @synthesize noiseGenerator = _noiseGenerator;
 @synthesize tapCount = _tapCount;
+@synthesize originalData = _originalData;
+@synthesize noiseData = _noiseData;
+@synthesize blendedSize = _blendedSize;
 
 @synthesize noiseImageView = _noiseImageView;
 @synthesize blendLabel = _blendLabel;
@@ -48,20 +58,46 @@
   [self redoBlendedImage];
 }
 
+// image scaled to fill size pixels, premultiplied ARGB
+- (NSMutableData *)pixelsOfImage:(CGImageRef)image size:(CGSize)size {
+  size_t width = size.width;
+  size_t height = size.height;
+  NSMutableData *data = [NSMutableData dataWithLength:width * height * 4];
+  CGContextRef ctx = CGBitmapContextCreate([data mutableBytes], width, height, 8, width * 4,
+                                           [GFSImageSurfacePool deviceRGBColorSpace],
+                                           kCGImageAlphaPremultipliedFirst);
+  if(NULL == ctx) {
+    return nil;
+  }
+  CGContextDrawImage(ctx, CGRectMake(0.0, 0.0, width, height), image);
+  CGContextRelease(ctx);
+  return data;
+}
+
 - (void)redoBlendedImage {
-  UIImage *noiseImage = self.noiseGenerator.noiseImage;
-  CGSize size = CGSizeMake(1024.0, 700.0);
-  UIGraphicsBeginImageContextWithOptions(size, YES, 0.0);
-  CGContextRef ctx = UIGraphicsGetCurrentContext();
-  CGContextTranslateCTM(ctx, 0.0, size.height);
-  CGContextScaleCTM(ctx, 1.0, -1.0);
-  CGContextDrawImage(ctx, CGRectMake(0.0, 0.0, size.width, size.height), self.originalImage.CGImage);
-  CGContextSetBlendMode(ctx, self.tapCount % 28);
-  CGContextDrawImage(ctx, CGRectMake(0.0, 0.0, size.width, size.height), noiseImage.CGImage);
-  CGImageRef blended = CGBitmapContextCreateImage(ctx);
-  UIImage *blendedImage = [UIImage imageWithCGImage:blended];
-  CGImageRelease(blended);
-  UIGraphicsEndImageContext();
+  CGFloat scale = [[UIScreen mainScreen] scale];
+  CGSize size = CGSizeMake(1024.0 * scale, 700.0 * scale);
+  if(nil == self.originalData || !CGSizeEqualToSize(size, self.blendedSize)) {
+    self.originalData = [self pixelsOfImage:self.originalImage.CGImage size:size];
+    self.noiseData = [self pixelsOfImage:self.noiseGenerator.noiseImage.CGImage size:size];
+    self.blendedSize = size;
+  }
+  size_t width = size.width;
+  size_t height = size.height;
+  GFSImageSurfacePool *pool = [GFSImageSurfacePool sharedPool];
+  void *blended = [pool bufferWithLength:width * height * 4];
+  if(NULL == blended || nil == self.originalData || nil == self.noiseData) {
+    [pool recycleBuffer:blended length:width * height * 4];
+    return;
+  }
+  GFSBlendLayer noise = { [self.noiseData bytes], width * 4, self.tapCount % GFSBlendModeCount, 1.0 };
+  GFSBlendARGB8888([self.originalData bytes], width * 4, blended, width * 4, width, height,
+                   &noise, 1, GFSBlendNoFlags);
+  id imageRef = [pool newImageWithBuffer:blended width:width height:height];
+  UIImage *blendedImage = [UIImage imageWithCGImage:(__bridge CGImageRef)imageRef
+                                              scale:scale
+                                        orientation:UIImageOrientationUp];
+  CGImageRelease((__bridge CGImageRef)imageRef);
   
   self.noiseImageView.image = blendedImage;
   
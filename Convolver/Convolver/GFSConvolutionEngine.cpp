@@ -0,0 +1,1376 @@
+//
+//  GFSConvolutionEngine.cpp
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "GFSConvolutionEngine.h"
+#include "GFSMemoryAccounting.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__)
+  #include <immintrin.h>
+  #define GFS_CONVOLUTION_AVX2 1
+#elif defined(__SSE4_1__)
+  #include <smmintrin.h>
+  #define GFS_CONVOLUTION_SSE4 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define GFS_CONVOLUTION_NEON 1
+#endif
+
+namespace {
+
+// output rows convolved per pass over the padded source, small enough that
+// the padded rows for a pass stay in cache
+const size_t kStripRows = 32;
+// don't bother starting a thread for less work than this
+const size_t kMinRowsPerThread = 16;
+
+// One non-zero kernel weight. row indexes the padded source rows for the
+// output row, offset is the byte offset of the tap in that row.
+struct Tap {
+  uint32_t row;
+  uint32_t offset;
+  int32_t weight;
+};
+
+enum Mode {
+  // every non-zero weight of the 2D kernel per pixel
+  ModeFull,
+  // row kernel across, then column kernel down, through 32 bit sums
+  ModeSeparable,
+  // running sums across and down, every weight is the same
+  ModeBox,
+  // no convolving, divide sums kept from an earlier ModeFull, ModeSeparable
+  // or ModeBox job
+  ModePack
+};
+
+struct Job {
+  Mode mode;
+  const uint8_t *src;
+  size_t srcRowBytes;
+  uint8_t *dest;
+  size_t destRowBytes;
+  // the size of dest, which is the region of interest
+  size_t width;
+  size_t height;
+  // the whole source, and where the region of interest starts in it
+  size_t srcWidth;
+  size_t srcHeight;
+  size_t offsetX;
+  size_t offsetY;
+  // bytes per pixel, 4 for ARGB8888 and 1 for Planar8; the inner loops
+  // only ever see a row of channels so they don't care which
+  size_t channels;
+  uint32_t kernelWidth;
+  uint32_t kernelHeight;
+  int32_t divisor;
+  uint32_t background;
+  // ModeFull: the whole kernel, otherwise the row kernel
+  std::vector<Tap> taps;
+  // taps paired up for a 16 bit multiply-add, the high half of each entry
+  // is the weight of the odd tap (zero when the tap count is odd)
+  std::vector<int32_t> pairedWeights;
+  std::vector<int32_t> columnWeights;
+  // ModeBox: the one weight every tap has, otherwise 1
+  int32_t scale;
+  // row sums of a row that is all background
+  int32_t backgroundSums[4];
+  // pipelines fold 1x1 stages into tables applied to the source pixels as
+  // they are read, and to the output as it is written; NULL for none
+  const uint8_t *inputTable;
+  const uint8_t *outputTable;
+  // when set the convolution stops at the 32 bit sums and writes them here
+  // (computed with a zero background) instead of into dest, and ModePack
+  // reads them back
+  int32_t *accumulators;
+  size_t accumulatorRowBytes;
+  // ModePack: summed area table of the kernel, (kernelHeight + 1) rows of
+  // kernelWidth + 1, for the weight that falls outside the source at any
+  // pixel
+  std::vector<uint32_t> kernelSums;
+  bool scalar;
+};
+
+// What pipelines and cached sums add to a plain convolution, see Job.
+struct Hooks {
+  const uint8_t *inputTable;
+  const uint8_t *outputTable;
+  int32_t *accumulators;
+  size_t accumulatorRowBytes;
+};
+
+inline uint8_t Saturate(int32_t value) {
+  return value < 0 ? 0 : (value > 255 ? 255 : (uint8_t)value);
+}
+
+// sums wrap around just like vImage's, do it unsigned to keep it defined
+inline int32_t Scale(int32_t sum, int32_t scale) {
+  return (int32_t)((uint32_t)sum * (uint32_t)scale);
+}
+
+#pragma mark - Scalar
+
+void ConvolveRowScalar(const Job &job, const uint8_t *const *rows,
+                       uint8_t *out, size_t begin, size_t end) {
+  const Tap *taps = job.taps.data();
+  const size_t tapCount = job.taps.size();
+  for(size_t i = begin; i < end; i++) {
+    int32_t sum = 0;
+    for(size_t t = 0; t < tapCount; t++) {
+      sum += (int32_t)rows[taps[t].row][taps[t].offset + i] * taps[t].weight;
+    }
+    out[i] = Saturate(sum / job.divisor);
+  }
+}
+
+void RowSumsScalar(const Job &job, const uint8_t *const *rows,
+                   int32_t *sums, size_t begin, size_t end) {
+  const Tap *taps = job.taps.data();
+  const size_t tapCount = job.taps.size();
+  for(size_t i = begin; i < end; i++) {
+    int32_t sum = 0;
+    for(size_t t = 0; t < tapCount; t++) {
+      sum += (int32_t)rows[taps[t].row][taps[t].offset + i] * taps[t].weight;
+    }
+    sums[i] = sum;
+  }
+}
+
+void ColumnSumsScalar(const Job &job, const int32_t *const *rows,
+                      int32_t *sums, size_t begin, size_t end) {
+  const int32_t *weights = job.columnWeights.data();
+  const size_t count = job.columnWeights.size();
+  for(size_t i = begin; i < end; i++) {
+    uint32_t sum = 0;
+    for(size_t ky = 0; ky < count; ky++) {
+      sum += (uint32_t)rows[ky][i] * (uint32_t)weights[ky];
+    }
+    sums[i] = (int32_t)sum;
+  }
+}
+
+void PackScalar(const Job &job, const int32_t *sums,
+                uint8_t *out, size_t begin, size_t end) {
+  for(size_t i = begin; i < end; i++) {
+    out[i] = Saturate(Scale(sums[i], job.scale) / job.divisor);
+  }
+}
+
+#pragma mark - SSE4.1 / AVX2
+
+#if GFS_CONVOLUTION_SSE4 || GFS_CONVOLUTION_AVX2
+
+// the quotient of two int32s is exact enough in double precision that
+// truncating it always gives the integer quotient
+inline __m128i Divide(__m128i sum, __m128d divisor) {
+  __m128d lo = _mm_cvtepi32_pd(sum);
+  __m128d hi = _mm_cvtepi32_pd(_mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  __m128i qlo = _mm_cvttpd_epi32(_mm_div_pd(lo, divisor));
+  __m128i qhi = _mm_cvttpd_epi32(_mm_div_pd(hi, divisor));
+  return _mm_unpacklo_epi64(qlo, qhi);
+}
+
+// sums for the 8 channels at i
+inline void AccumulateSSE(const Job &job, const uint8_t *const *rows, size_t i,
+                          __m128i &sumLo, __m128i &sumHi) {
+  const Tap *taps = job.taps.data();
+  const int32_t *weights = job.pairedWeights.data();
+  const size_t pairCount = job.pairedWeights.size();
+  const size_t tapCount = job.taps.size();
+  sumLo = _mm_setzero_si128();
+  sumHi = _mm_setzero_si128();
+  for(size_t p = 0; p < pairCount; p++) {
+    const Tap &even = taps[2 * p];
+    __m128i a = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(rows[even.row] + even.offset + i)));
+    __m128i b = _mm_setzero_si128();
+    if(2 * p + 1 < tapCount) {
+      const Tap &odd = taps[2 * p + 1];
+      b = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(rows[odd.row] + odd.offset + i)));
+    }
+    __m128i w = _mm_set1_epi32(weights[p]);
+    sumLo = _mm_add_epi32(sumLo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+    sumHi = _mm_add_epi32(sumHi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+  }
+}
+
+// 8 channels (two pixels) at a time, starting at begin, returns how far
+// it got
+size_t ConvolveRowSSE(const Job &job, const uint8_t *const *rows,
+                      uint8_t *out, size_t begin, size_t count) {
+  const __m128d divisor = _mm_set1_pd((double)job.divisor);
+  size_t i = begin;
+  for(; i + 8 <= count; i += 8) {
+    __m128i sumLo, sumHi;
+    AccumulateSSE(job, rows, i, sumLo, sumHi);
+    if(job.divisor != 1) {
+      sumLo = Divide(sumLo, divisor);
+      sumHi = Divide(sumHi, divisor);
+    }
+    __m128i packed = _mm_packs_epi32(sumLo, sumHi);
+    _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(packed, packed));
+  }
+  return i;
+}
+
+size_t RowSumsSSE(const Job &job, const uint8_t *const *rows, int32_t *sums, size_t count) {
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8) {
+    __m128i sumLo, sumHi;
+    AccumulateSSE(job, rows, i, sumLo, sumHi);
+    _mm_storeu_si128((__m128i *)(sums + i), sumLo);
+    _mm_storeu_si128((__m128i *)(sums + i + 4), sumHi);
+  }
+  return i;
+}
+
+size_t ColumnSumsSSE(const Job &job, const int32_t *const *rows,
+                     int32_t *sums, size_t count) {
+  const int32_t *weights = job.columnWeights.data();
+  const size_t kernelHeight = job.columnWeights.size();
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    __m128i sum = _mm_setzero_si128();
+    for(size_t ky = 0; ky < kernelHeight; ky++) {
+      __m128i value = _mm_loadu_si128((const __m128i *)(rows[ky] + i));
+      sum = _mm_add_epi32(sum, _mm_mullo_epi32(value, _mm_set1_epi32(weights[ky])));
+    }
+    _mm_storeu_si128((__m128i *)(sums + i), sum);
+  }
+  return i;
+}
+
+size_t PackSSE(const Job &job, const int32_t *sums, uint8_t *out, size_t count) {
+  const __m128d divisor = _mm_set1_pd((double)job.divisor);
+  const __m128i scale = _mm_set1_epi32(job.scale);
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8) {
+    __m128i sumLo = _mm_loadu_si128((const __m128i *)(sums + i));
+    __m128i sumHi = _mm_loadu_si128((const __m128i *)(sums + i + 4));
+    if(job.scale != 1) {
+      sumLo = _mm_mullo_epi32(sumLo, scale);
+      sumHi = _mm_mullo_epi32(sumHi, scale);
+    }
+    if(job.divisor != 1) {
+      sumLo = Divide(sumLo, divisor);
+      sumHi = Divide(sumHi, divisor);
+    }
+    __m128i packed = _mm_packs_epi32(sumLo, sumHi);
+    _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(packed, packed));
+  }
+  return i;
+}
+
+#endif
+
+#if GFS_CONVOLUTION_AVX2
+
+inline __m128i Divide256(__m256i sum, __m256d divisor) {
+  __m128i lo = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(sum)), divisor));
+  __m128i hi = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(sum, 1)), divisor));
+  return _mm_packs_epi32(lo, hi);
+}
+
+// 16 channels (four pixels) at a time. The 256 bit unpacks work within
+// 128 bit lanes, so sumLo holds channels 0-3 and 8-11 and sumHi holds 4-7
+// and 12-15, which is what packs_epi32 wants to put them back in order.
+size_t ConvolveRowAVX2(const Job &job, const uint8_t *const *rows,
+                       uint8_t *out, size_t count) {
+  const Tap *taps = job.taps.data();
+  const int32_t *weights = job.pairedWeights.data();
+  const size_t pairCount = job.pairedWeights.size();
+  const size_t tapCount = job.taps.size();
+  const __m256d divisor = _mm256_set1_pd((double)job.divisor);
+  size_t i = 0;
+  for(; i + 16 <= count; i += 16) {
+    __m256i sumLo = _mm256_setzero_si256();
+    __m256i sumHi = _mm256_setzero_si256();
+    for(size_t p = 0; p < pairCount; p++) {
+      const Tap &even = taps[2 * p];
+      __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(rows[even.row] + even.offset + i)));
+      __m256i b = _mm256_setzero_si256();
+      if(2 * p + 1 < tapCount) {
+        const Tap &odd = taps[2 * p + 1];
+        b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(rows[odd.row] + odd.offset + i)));
+      }
+      __m256i w = _mm256_set1_epi32(weights[p]);
+      sumLo = _mm256_add_epi32(sumLo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+      sumHi = _mm256_add_epi32(sumHi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+    }
+    __m128i packed;
+    if(job.divisor != 1) {
+      // divide in channel order, then packs is already in order
+      __m256i ordered0 = _mm256_permute2x128_si256(sumLo, sumHi, 0x20);
+      __m256i ordered1 = _mm256_permute2x128_si256(sumLo, sumHi, 0x31);
+      __m128i q0 = Divide256(ordered0, divisor);
+      __m128i q1 = Divide256(ordered1, divisor);
+      packed = _mm_packus_epi16(q0, q1);
+    } else {
+      __m256i words = _mm256_packs_epi32(sumLo, sumHi);
+      packed = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+    }
+    _mm_storeu_si128((__m128i *)(out + i), packed);
+  }
+  return ConvolveRowSSE(job, rows, out, i, count);
+}
+
+#endif
+
+#pragma mark - NEON
+
+#if GFS_CONVOLUTION_NEON
+
+inline int32x4_t Divide(int32x4_t sum, int32_t divisor) {
+#if defined(__aarch64__)
+  float64x2_t d = vdupq_n_f64((double)divisor);
+  float64x2_t lo = vdivq_f64(vcvtq_f64_s64(vmovl_s32(vget_low_s32(sum))), d);
+  float64x2_t hi = vdivq_f64(vcvtq_f64_s64(vmovl_s32(vget_high_s32(sum))), d);
+  return vcombine_s32(vmovn_s64(vcvtq_s64_f64(lo)), vmovn_s64(vcvtq_s64_f64(hi)));
+#else
+  // no vector divide on armv7
+  int32_t lanes[4];
+  vst1q_s32(lanes, sum);
+  for(int l = 0; l < 4; l++) {
+    lanes[l] /= divisor;
+  }
+  return vld1q_s32(lanes);
+#endif
+}
+
+// sums for the 8 channels at i
+inline void AccumulateNEON(const Job &job, const uint8_t *const *rows, size_t i,
+                           int32x4_t &sumLo, int32x4_t &sumHi) {
+  const Tap *taps = job.taps.data();
+  const size_t tapCount = job.taps.size();
+  sumLo = vdupq_n_s32(0);
+  sumHi = vdupq_n_s32(0);
+  for(size_t t = 0; t < tapCount; t++) {
+    int16x8_t a = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(rows[taps[t].row] + taps[t].offset + i)));
+    int16_t w = (int16_t)taps[t].weight;
+    sumLo = vmlal_n_s16(sumLo, vget_low_s16(a), w);
+    sumHi = vmlal_n_s16(sumHi, vget_high_s16(a), w);
+  }
+}
+
+inline void StoreNEON(const Job &job, int32x4_t sumLo, int32x4_t sumHi, uint8_t *out) {
+  if(job.divisor != 1) {
+    sumLo = Divide(sumLo, job.divisor);
+    sumHi = Divide(sumHi, job.divisor);
+  }
+  int16x8_t words = vcombine_s16(vqmovn_s32(sumLo), vqmovn_s32(sumHi));
+  vst1_u8(out, vqmovun_s16(words));
+}
+
+// 8 channels (two pixels) at a time
+size_t ConvolveRowNEON(const Job &job, const uint8_t *const *rows,
+                       uint8_t *out, size_t count) {
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8) {
+    int32x4_t sumLo, sumHi;
+    AccumulateNEON(job, rows, i, sumLo, sumHi);
+    StoreNEON(job, sumLo, sumHi, out + i);
+  }
+  return i;
+}
+
+size_t RowSumsNEON(const Job &job, const uint8_t *const *rows, int32_t *sums, size_t count) {
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8) {
+    int32x4_t sumLo, sumHi;
+    AccumulateNEON(job, rows, i, sumLo, sumHi);
+    vst1q_s32(sums + i, sumLo);
+    vst1q_s32(sums + i + 4, sumHi);
+  }
+  return i;
+}
+
+size_t ColumnSumsNEON(const Job &job, const int32_t *const *rows,
+                      int32_t *sums, size_t count) {
+  const int32_t *weights = job.columnWeights.data();
+  const size_t kernelHeight = job.columnWeights.size();
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    int32x4_t sum = vdupq_n_s32(0);
+    for(size_t ky = 0; ky < kernelHeight; ky++) {
+      sum = vmlaq_n_s32(sum, vld1q_s32(rows[ky] + i), weights[ky]);
+    }
+    vst1q_s32(sums + i, sum);
+  }
+  return i;
+}
+
+size_t PackNEON(const Job &job, const int32_t *sums, uint8_t *out, size_t count) {
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8) {
+    int32x4_t sumLo = vld1q_s32(sums + i);
+    int32x4_t sumHi = vld1q_s32(sums + i + 4);
+    if(job.scale != 1) {
+      sumLo = vmulq_n_s32(sumLo, job.scale);
+      sumHi = vmulq_n_s32(sumHi, job.scale);
+    }
+    StoreNEON(job, sumLo, sumHi, out + i);
+  }
+  return i;
+}
+
+#endif
+
+#pragma mark - Rows
+
+void ConvolveRow(const Job &job, const uint8_t *const *rows, uint8_t *out) {
+  const size_t count = job.width * job.channels;
+  size_t done = 0;
+  if(!job.scalar) {
+#if GFS_CONVOLUTION_AVX2
+    done = ConvolveRowAVX2(job, rows, out, count);
+#elif GFS_CONVOLUTION_SSE4
+    done = ConvolveRowSSE(job, rows, out, 0, count);
+#elif GFS_CONVOLUTION_NEON
+    done = ConvolveRowNEON(job, rows, out, count);
+#endif
+  }
+  ConvolveRowScalar(job, rows, out, done, count);
+}
+
+// the undivided sums of the taps over rows, one row for a row kernel
+void RowSums(const Job &job, const uint8_t *const *rows, int32_t *sums) {
+  const size_t count = job.width * job.channels;
+  size_t done = 0;
+  if(!job.scalar) {
+#if GFS_CONVOLUTION_SSE4 || GFS_CONVOLUTION_AVX2
+    done = RowSumsSSE(job, rows, sums, count);
+#elif GFS_CONVOLUTION_NEON
+    done = RowSumsNEON(job, rows, sums, count);
+#endif
+  }
+  RowSumsScalar(job, rows, sums, done, count);
+}
+
+void ColumnSums(const Job &job, const int32_t *const *rows, int32_t *sums) {
+  const size_t count = job.width * job.channels;
+  size_t done = 0;
+  if(!job.scalar) {
+#if GFS_CONVOLUTION_SSE4 || GFS_CONVOLUTION_AVX2
+    done = ColumnSumsSSE(job, rows, sums, count);
+#elif GFS_CONVOLUTION_NEON
+    done = ColumnSumsNEON(job, rows, sums, count);
+#endif
+  }
+  ColumnSumsScalar(job, rows, sums, done, count);
+}
+
+void Pack(const Job &job, const int32_t *sums, uint8_t *out) {
+  const size_t count = job.width * job.channels;
+  size_t done = 0;
+  if(!job.scalar) {
+#if GFS_CONVOLUTION_SSE4 || GFS_CONVOLUTION_AVX2
+    done = PackSSE(job, sums, out, count);
+#elif GFS_CONVOLUTION_NEON
+    done = PackNEON(job, sums, out, count);
+#endif
+  }
+  PackScalar(job, sums, out, done, count);
+}
+
+// Box row sums slide along the row, adding the channel coming into the
+// window and dropping the one leaving it.
+void BoxRowSums(const Job &job, const uint8_t *row, int32_t *sums) {
+  const size_t count = job.width * job.channels;
+  const size_t window = job.kernelWidth * job.channels;
+  // channels is 1 or 4, so this picks the channel's running sum
+  const size_t mask = job.channels - 1;
+  int32_t sum[4] = { 0, 0, 0, 0 };
+  for(size_t i = 0; i < window; i++) {
+    sum[i & mask] += row[i];
+  }
+  for(size_t i = 0; i < count; i++) {
+    sums[i] = sum[i & mask];
+    sum[i & mask] += row[i + window] - row[i];
+  }
+}
+
+#pragma mark - Padding
+
+void LookUp(const uint8_t *table, const uint8_t *src, uint8_t *dest, size_t count) {
+  for(size_t i = 0; i < count; i++) {
+    dest[i] = table[src[i]];
+  }
+}
+
+void FillBackground(const Job &job, uint8_t *row, size_t pixels) {
+  if(1 == job.channels) {
+    memset(row, job.background & 0xFF, pixels);
+    return;
+  }
+  for(size_t x = 0; x < pixels; x++) {
+    memcpy(row + 4 * x, &job.background, 4);
+  }
+}
+
+// Copy the part of source row y (which must be inside the source) under
+// the region of interest into row, along with the kernel's halo on either
+// side. The halo comes from the source where there is source there, so a
+// region of interest sees its real neighbors, and is background past the
+// edges of the source.
+// row is paddedWidth + 1 pixels; the extra pixel is only ever read by the
+// last step of a running sum, and the value read there is never used.
+void PadRow(const Job &job, size_t y, uint8_t *row) {
+  const size_t haloLeft = job.kernelWidth / 2;
+  const size_t paddedWidth = job.width + job.kernelWidth;
+  // source columns [first, last) of the padded row, clipped to the source
+  const ptrdiff_t left = (ptrdiff_t)job.offsetX - (ptrdiff_t)haloLeft;
+  const size_t first = (size_t)std::max((ptrdiff_t)0, left);
+  const size_t last = std::min(job.srcWidth, (size_t)(left + (ptrdiff_t)paddedWidth));
+  const size_t before = (size_t)((ptrdiff_t)first - left);
+  const size_t count = last - first;
+  const size_t channels = job.channels;
+  const uint8_t *src = job.src + y * job.srcRowBytes + first * channels;
+  FillBackground(job, row, before);
+  if(NULL == job.inputTable) {
+    memcpy(row + before * channels, src, count * channels);
+  } else {
+    // the background stays as is, only image pixels go through the table
+    LookUp(job.inputTable, src, row + before * channels, count * channels);
+  }
+  FillBackground(job, row + (before + count) * channels,
+                 paddedWidth - before - count);
+}
+
+// Per thread scratch, allocated up front so the workers never allocate.
+struct Scratch {
+  std::vector<uint8_t> padded;
+  std::vector<const uint8_t *> rows;
+  // ModeSeparable and ModeBox: kernelHeight rows of row sums, used as a
+  // ring as the band moves down the image, and one row of column sums
+  std::vector<int32_t> ring;
+  std::vector<const int32_t *> ringRows;
+  std::vector<int32_t> sums;
+};
+
+void AllocateScratch(const Job &job, Scratch &scratch) {
+  const size_t paddedRowBytes = (job.width + job.kernelWidth) * job.channels;
+  const size_t count = job.width * job.channels;
+  if(ModeFull == job.mode) {
+    scratch.padded.resize((kStripRows + job.kernelHeight - 1) * paddedRowBytes);
+    scratch.rows.resize(job.kernelHeight);
+  } else if(ModePack == job.mode) {
+    scratch.sums.resize(count);
+  } else {
+    scratch.padded.resize(paddedRowBytes);
+    scratch.ring.resize(job.kernelHeight * count);
+    scratch.ringRows.resize(job.kernelHeight);
+    scratch.sums.resize(count);
+  }
+}
+
+size_t ScratchBytes(const Scratch &scratch) {
+  return scratch.padded.capacity() + scratch.rows.capacity() * sizeof(const uint8_t *) +
+    scratch.ring.capacity() * sizeof(int32_t) + scratch.ringRows.capacity() * sizeof(const int32_t *) +
+    scratch.sums.capacity() * sizeof(int32_t);
+}
+
+inline int32_t *AccumulatorRow(const Job &job, size_t y) {
+  return (int32_t *)((uint8_t *)job.accumulators + y * job.accumulatorRowBytes);
+}
+
+#pragma mark - Bands
+
+// Convolve output rows [firstRow, lastRow). The source rows each strip
+// needs are copied, with background added around them, into a padded
+// buffer so the inner loops never have to check the image bounds.
+void ConvolveRows(const Job *job, Scratch *scratch, size_t firstRow, size_t lastRow) {
+  const size_t haloTop = job->kernelHeight / 2;
+  const size_t paddedWidth = job->width + job->kernelWidth;
+  const size_t paddedRowBytes = paddedWidth * job->channels;
+  std::vector<uint8_t> &padded = scratch->padded;
+  std::vector<const uint8_t *> &rows = scratch->rows;
+  for(size_t stripRow = firstRow; stripRow < lastRow; stripRow += kStripRows) {
+    const size_t stripEnd = std::min(lastRow, stripRow + kStripRows);
+    const size_t paddedRows = stripEnd - stripRow + job->kernelHeight - 1;
+    for(size_t p = 0; p < paddedRows; p++) {
+      uint8_t *row = &padded[p * paddedRowBytes];
+      // source row for this padded row, may be outside the source
+      const ptrdiff_t y = (ptrdiff_t)(stripRow + p + job->offsetY) - (ptrdiff_t)haloTop;
+      if(y < 0 || y >= (ptrdiff_t)job->srcHeight) {
+        FillBackground(*job, row, paddedWidth);
+      } else {
+        PadRow(*job, y, row);
+      }
+    }
+    for(size_t y = stripRow; y < stripEnd; y++) {
+      for(size_t ky = 0; ky < job->kernelHeight; ky++) {
+        rows[ky] = &padded[(y - stripRow + ky) * paddedRowBytes];
+      }
+      if(NULL != job->accumulators) {
+        RowSums(*job, rows.data(), AccumulatorRow(*job, y));
+        continue;
+      }
+      uint8_t *out = job->dest + y * job->destRowBytes;
+      ConvolveRow(*job, rows.data(), out);
+      if(NULL != job->outputTable) {
+        LookUp(job->outputTable, out, out, job->width * job->channels);
+      }
+    }
+  }
+}
+
+// row sums for the row y rows down from the top of the region of
+// interest, which may be outside of the source
+void HorizontalSums(const Job &job, Scratch &scratch, ptrdiff_t y, int32_t *sums) {
+  const size_t count = job.width * job.channels;
+  y += (ptrdiff_t)job.offsetY;
+  if(y < 0 || y >= (ptrdiff_t)job.srcHeight) {
+    for(size_t i = 0; i < count; i++) {
+      sums[i] = job.backgroundSums[i & (job.channels - 1)];
+    }
+  } else {
+    PadRow(job, y, scratch.padded.data());
+    if(ModeBox == job.mode) {
+      BoxRowSums(job, scratch.padded.data(), sums);
+    } else {
+      const uint8_t *rows[1] = { scratch.padded.data() };
+      RowSums(job, rows, sums);
+    }
+  }
+}
+
+// Separable and box kernels, output rows [firstRow, lastRow). The row sums
+// of the kernelHeight source rows under the current output row are kept in
+// a ring, so each source row is summed across once per band. Box kernels
+// also keep running column sums, so moving down a row is one add and one
+// subtract per channel no matter how tall the kernel is.
+void ConvolveSeparableRows(const Job *job, Scratch *scratch, size_t firstRow, size_t lastRow) {
+  const size_t count = job->width * job->channels;
+  const size_t kernelHeight = job->kernelHeight;
+  const ptrdiff_t top = (ptrdiff_t)firstRow - (ptrdiff_t)(kernelHeight / 2);
+  int32_t *ring = scratch->ring.data();
+  int32_t *sums = scratch->sums.data();
+  const bool box = ModeBox == job->mode;
+
+  for(size_t ky = 0; ky + 1 < kernelHeight; ky++) {
+    HorizontalSums(*job, *scratch, top + ky, ring + ky * count);
+  }
+  if(box) {
+    memset(sums, 0, count * sizeof(int32_t));
+    for(size_t ky = 0; ky + 1 < kernelHeight; ky++) {
+      const int32_t *row = ring + ky * count;
+      for(size_t i = 0; i < count; i++) {
+        sums[i] += row[i];
+      }
+    }
+  }
+
+  for(size_t y = firstRow; y < lastRow; y++) {
+    // the newest source row replaces the one that just left the kernel
+    const size_t n = y - firstRow;
+    int32_t *slot = ring + ((n + kernelHeight - 1) % kernelHeight) * count;
+    if(box && n > 0) {
+      for(size_t i = 0; i < count; i++) {
+        sums[i] -= slot[i];
+      }
+    }
+    HorizontalSums(*job, *scratch, top + (ptrdiff_t)(n + kernelHeight - 1), slot);
+    if(box) {
+      for(size_t i = 0; i < count; i++) {
+        sums[i] += slot[i];
+      }
+    } else {
+      for(size_t ky = 0; ky < kernelHeight; ky++) {
+        scratch->ringRows[ky] = ring + ((n + ky) % kernelHeight) * count;
+      }
+      ColumnSums(*job, scratch->ringRows.data(), sums);
+    }
+    if(NULL != job->accumulators) {
+      int32_t *accumulators = AccumulatorRow(*job, y);
+      for(size_t i = 0; i < count; i++) {
+        accumulators[i] = Scale(sums[i], job->scale);
+      }
+      continue;
+    }
+    uint8_t *out = job->dest + y * job->destRowBytes;
+    Pack(*job, sums, out);
+    if(NULL != job->outputTable) {
+      LookUp(job->outputTable, out, out, job->width * job->channels);
+    }
+  }
+}
+
+// The total weight of the kernel taps that fall outside of the source for
+// dest pixel (x, y), which the background fills.
+uint32_t OutsideWeight(const Job &job, size_t x, size_t y) {
+  const ptrdiff_t left = (ptrdiff_t)(x + job.offsetX) - (ptrdiff_t)(job.kernelWidth / 2);
+  const ptrdiff_t top = (ptrdiff_t)(y + job.offsetY) - (ptrdiff_t)(job.kernelHeight / 2);
+  // the taps inside the source are the rectangle [x0, x1) x [y0, y1)
+  const size_t x0 = (size_t)std::max((ptrdiff_t)0, -left);
+  const size_t x1 = (size_t)std::min((ptrdiff_t)job.kernelWidth, (ptrdiff_t)job.srcWidth - left);
+  const size_t y0 = (size_t)std::max((ptrdiff_t)0, -top);
+  const size_t y1 = (size_t)std::min((ptrdiff_t)job.kernelHeight, (ptrdiff_t)job.srcHeight - top);
+  const size_t stride = job.kernelWidth + 1;
+  const uint32_t *sums = job.kernelSums.data();
+  const uint32_t inside = sums[y1 * stride + x1] - sums[y0 * stride + x1] -
+    sums[y1 * stride + x0] + sums[y0 * stride + x0];
+  return sums[job.kernelHeight * stride + job.kernelWidth] - inside;
+}
+
+// Divide kept sums into output rows [firstRow, lastRow). The sums were
+// taken with a zero background, so near the edges of the source the
+// background's share (its value times the weight hanging off the edge) is
+// added back first. Everywhere else it's a straight Pack.
+void PackRows(const Job *job, Scratch *scratch, size_t firstRow, size_t lastRow) {
+  const size_t channels = job->channels;
+  const size_t width = job->width;
+  const size_t haloLeft = job->kernelWidth / 2;
+  const size_t haloRight = job->kernelWidth - 1 - haloLeft;
+  const size_t haloTop = job->kernelHeight / 2;
+  const size_t haloBottom = job->kernelHeight - 1 - haloTop;
+  const uint8_t *background = (const uint8_t *)&job->background;
+  // dest columns [0, leftEnd) and [rightStart, width) hang off the source
+  const size_t leftEnd = std::min(width, haloLeft > job->offsetX ? haloLeft - job->offsetX : 0);
+  size_t rightStart = width;
+  if(job->offsetX + width + haloRight > job->srcWidth) {
+    rightStart = job->srcWidth > job->offsetX + haloRight ? job->srcWidth - job->offsetX - haloRight : 0;
+    rightStart = std::max(leftEnd, rightStart);
+  }
+  int32_t *sums = scratch->sums.data();
+
+  for(size_t y = firstRow; y < lastRow; y++) {
+    const int32_t *row = AccumulatorRow(*job, y);
+    uint8_t *out = job->dest + y * job->destRowBytes;
+    const size_t sourceY = y + job->offsetY;
+    const bool edgeRow = sourceY < haloTop || sourceY + haloBottom >= job->srcHeight;
+    if(0 == job->background || (!edgeRow && 0 == leftEnd && width == rightStart)) {
+      Pack(*job, row, out);
+      continue;
+    }
+    memcpy(sums, row, width * channels * sizeof(int32_t));
+    for(size_t x = 0; x < width; x++) {
+      if(!edgeRow && x == leftEnd) {
+        x = rightStart;
+        if(x == width) {
+          break;
+        }
+      }
+      const uint32_t outside = OutsideWeight(*job, x, y);
+      for(size_t c = 0; c < channels; c++) {
+        sums[x * channels + c] = (int32_t)((uint32_t)sums[x * channels + c] +
+                                           (uint32_t)Scale(background[c], (int32_t)outside));
+      }
+    }
+    Pack(*job, sums, out);
+  }
+}
+
+#pragma mark - Jobs
+
+GFSConvolutionError CheckBuffers(const GFSConvolutionBuffer *src,
+                                 const GFSConvolutionBuffer *dest,
+                                 size_t srcOffsetToROI_X,
+                                 size_t srcOffsetToROI_Y,
+                                 size_t channels) {
+  if(NULL == src || NULL == dest || NULL == src->data || NULL == dest->data ||
+     src->rowBytes < src->width * channels || dest->rowBytes < dest->width * channels) {
+    return GFSConvolutionInvalidBuffer;
+  }
+  if(srcOffsetToROI_X > src->width || dest->width > src->width - srcOffsetToROI_X ||
+     srcOffsetToROI_Y > src->height || dest->height > src->height - srcOffsetToROI_Y) {
+    return GFSConvolutionROILargerThanInputBuffer;
+  }
+  return GFSConvolutionNoError;
+}
+
+void SetupJob(Job &job, Mode mode,
+              const GFSConvolutionBuffer *src,
+              const GFSConvolutionBuffer *dest,
+              size_t srcOffsetToROI_X,
+              size_t srcOffsetToROI_Y,
+              size_t channels,
+              uint32_t kernelWidth,
+              uint32_t kernelHeight,
+              int32_t divisor,
+              const uint8_t backgroundColor[4],
+              uint32_t flags) {
+  job.mode = mode;
+  job.src = (const uint8_t *)src->data;
+  job.srcRowBytes = src->rowBytes;
+  job.dest = (uint8_t *)dest->data;
+  job.destRowBytes = dest->rowBytes;
+  job.width = dest->width;
+  job.height = dest->height;
+  job.srcWidth = src->width;
+  job.srcHeight = src->height;
+  job.offsetX = srcOffsetToROI_X;
+  job.offsetY = srcOffsetToROI_Y;
+  job.channels = channels;
+  job.kernelWidth = kernelWidth;
+  job.kernelHeight = kernelHeight;
+  job.divisor = divisor;
+  job.scale = 1;
+  job.inputTable = NULL;
+  job.outputTable = NULL;
+  job.accumulators = NULL;
+  job.accumulatorRowBytes = 0;
+  job.background = 0;
+  if(NULL != backgroundColor) {
+    memcpy(&job.background, backgroundColor, channels);
+  }
+  // a Planar8 background is the same in every byte, so code that works on
+  // all four at once (background sums) doesn't need to know
+  if(1 == channels) {
+    job.background *= 0x01010101;
+  }
+  job.scalar = 0 != (flags & GFSConvolutionScalar);
+}
+
+void ApplyHooks(Job &job, const Hooks *hooks) {
+  if(NULL != hooks) {
+    job.inputTable = hooks->inputTable;
+    job.outputTable = hooks->outputTable;
+    job.accumulators = hooks->accumulators;
+    job.accumulatorRowBytes = hooks->accumulatorRowBytes;
+  }
+}
+
+// kernel is kernelHeight rows of kernelWidth weights
+void AddTaps(Job &job, const int16_t *kernel, uint32_t kernelWidth, uint32_t kernelHeight) {
+  const uint32_t channels = (uint32_t)job.channels;
+  // zero weights add nothing, so leave them out
+  for(uint32_t ky = 0; ky < kernelHeight; ky++) {
+    for(uint32_t kx = 0; kx < kernelWidth; kx++) {
+      int16_t weight = kernel[ky * kernelWidth + kx];
+      if(0 != weight) {
+        Tap tap = { ky, kx * channels, weight };
+        job.taps.push_back(tap);
+      }
+    }
+  }
+  for(size_t t = 0; t < job.taps.size(); t += 2) {
+    uint32_t even = (uint16_t)job.taps[t].weight;
+    uint32_t odd = t + 1 < job.taps.size() ? (uint16_t)job.taps[t + 1].weight : 0;
+    job.pairedWeights.push_back((int32_t)(even | (odd << 16)));
+  }
+}
+
+void RunJob(const Job &job, uint32_t flags) {
+  void (*worker)(const Job *, Scratch *, size_t, size_t) = ConvolveRows;
+  if(ModePack == job.mode) {
+    worker = PackRows;
+  } else if(ModeFull != job.mode) {
+    worker = ConvolveSeparableRows;
+  }
+
+  size_t threadCount = 1;
+  if(0 == (flags & GFSConvolutionSingleThread)) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, std::max((size_t)1, job.height / kMinRowsPerThread));
+  }
+
+  std::vector<Scratch> scratch(threadCount);
+  size_t scratchBytes = 0;
+  for(size_t t = 0; t < threadCount; t++) {
+    AllocateScratch(job, scratch[t]);
+    scratchBytes += ScratchBytes(scratch[t]);
+  }
+  GFSMemoryCharge charge(GFSMemoryStageConvolve, scratchBytes);
+
+  // the calling thread takes the first band, and any band a thread
+  // couldn't be started for
+  const size_t band = (job.height + threadCount - 1) / threadCount;
+  std::vector<std::thread> threads;
+  for(size_t t = 1; t < threadCount; t++) {
+    const size_t first = t * band;
+    const size_t last = std::min(job.height, first + band);
+    if(first < last) {
+      try {
+        threads.push_back(std::thread(worker, &job, &scratch[t], first, last));
+      } catch(const std::system_error &) {
+        worker(&job, &scratch[0], first, last);
+      }
+    }
+  }
+  worker(&job, &scratch[0], 0, std::min(job.height, band));
+  for(size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+}
+
+int32_t GreatestCommonDivisor(int32_t a, int32_t b) {
+  a = a < 0 ? -a : a;
+  b = b < 0 ? -b : b;
+  while(0 != b) {
+    int32_t r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+GFSConvolutionError ConvolveFull(const GFSConvolutionBuffer *src,
+                                 const GFSConvolutionBuffer *dest,
+                                 size_t srcOffsetToROI_X,
+                                 size_t srcOffsetToROI_Y,
+                                 size_t channels,
+                                 const int16_t *kernel,
+                                 uint32_t kernelWidth,
+                                 uint32_t kernelHeight,
+                                 int32_t divisor,
+                                 const uint8_t backgroundColor[4],
+                                 uint32_t flags,
+                                 const Hooks *hooks) {
+  GFSConvolutionError err = CheckBuffers(src, dest, srcOffsetToROI_X, srcOffsetToROI_Y, channels);
+  if(GFSConvolutionNoError != err) {
+    return err;
+  }
+  if(NULL == kernel || 0 == (kernelWidth & 1) || 0 == (kernelHeight & 1)) {
+    return GFSConvolutionInvalidKernelSize;
+  }
+  if(0 == divisor) {
+    return GFSConvolutionInvalidDivisor;
+  }
+  if(0 == dest->width || 0 == dest->height) {
+    return GFSConvolutionNoError;
+  }
+
+  try {
+    Job job;
+    SetupJob(job, ModeFull, src, dest, srcOffsetToROI_X, srcOffsetToROI_Y, channels, kernelWidth, kernelHeight, divisor, backgroundColor, flags);
+    AddTaps(job, kernel, kernelWidth, kernelHeight);
+    ApplyHooks(job, hooks);
+    RunJob(job, flags);
+  } catch(const std::bad_alloc &) {
+    return GFSConvolutionMemoryAllocationError;
+  }
+  return GFSConvolutionNoError;
+}
+
+GFSConvolutionError ConvolveSeparable(const GFSConvolutionBuffer *src,
+                                      const GFSConvolutionBuffer *dest,
+                                      size_t srcOffsetToROI_X,
+                                      size_t srcOffsetToROI_Y,
+                                      size_t channels,
+                                      const int16_t *rowKernel,
+                                      uint32_t kernelWidth,
+                                      const int16_t *columnKernel,
+                                      uint32_t kernelHeight,
+                                      int32_t divisor,
+                                      const uint8_t backgroundColor[4],
+                                      uint32_t flags,
+                                      const Hooks *hooks) {
+  GFSConvolutionError err = CheckBuffers(src, dest, srcOffsetToROI_X, srcOffsetToROI_Y, channels);
+  if(GFSConvolutionNoError != err) {
+    return err;
+  }
+  if(NULL == rowKernel || NULL == columnKernel ||
+     0 == (kernelWidth & 1) || 0 == (kernelHeight & 1)) {
+    return GFSConvolutionInvalidKernelSize;
+  }
+  if(0 == divisor) {
+    return GFSConvolutionInvalidDivisor;
+  }
+  if(0 == dest->width || 0 == dest->height) {
+    return GFSConvolutionNoError;
+  }
+
+  // when every weight of the 2D kernel is the same it is a box, scaled by
+  // that weight
+  bool box = true;
+  for(uint32_t kx = 1; kx < kernelWidth; kx++) {
+    box = box && rowKernel[kx] == rowKernel[0];
+  }
+  for(uint32_t ky = 1; ky < kernelHeight; ky++) {
+    box = box && columnKernel[ky] == columnKernel[0];
+  }
+
+  try {
+    Job job;
+    SetupJob(job, box ? ModeBox : ModeSeparable, src, dest,
+             srcOffsetToROI_X, srcOffsetToROI_Y, channels,
+             kernelWidth, kernelHeight, divisor, backgroundColor, flags);
+    int32_t rowSum = 0;
+    if(box) {
+      job.scale = Scale(rowKernel[0], columnKernel[0]);
+      rowSum = kernelWidth;
+    } else {
+      AddTaps(job, rowKernel, kernelWidth, 1);
+      for(uint32_t ky = 0; ky < kernelHeight; ky++) {
+        job.columnWeights.push_back(columnKernel[ky]);
+      }
+      for(uint32_t kx = 0; kx < kernelWidth; kx++) {
+        rowSum += rowKernel[kx];
+      }
+    }
+    const uint8_t *background = (const uint8_t *)&job.background;
+    for(int c = 0; c < 4; c++) {
+      job.backgroundSums[c] = Scale(background[c], rowSum);
+    }
+    ApplyHooks(job, hooks);
+    RunJob(job, flags);
+  } catch(const std::bad_alloc &) {
+    return GFSConvolutionMemoryAllocationError;
+  }
+  return GFSConvolutionNoError;
+}
+
+} // namespace
+
+#pragma mark - Public
+
+GFSConvolutionError GFSConvolveARGB8888(const GFSConvolutionBuffer *src,
+                                        const GFSConvolutionBuffer *dest,
+                                        size_t srcOffsetToROI_X,
+                                        size_t srcOffsetToROI_Y,
+                                        const int16_t *kernel,
+                                        uint32_t kernelWidth,
+                                        uint32_t kernelHeight,
+                                        int32_t divisor,
+                                        const uint8_t backgroundColor[4],
+                                        uint32_t flags) {
+  return ConvolveFull(src, dest, srcOffsetToROI_X, srcOffsetToROI_Y, 4,
+                      kernel, kernelWidth, kernelHeight,
+                      divisor, backgroundColor, flags, NULL);
+}
+
+bool GFSConvolutionSeparateKernel(const int16_t *kernel,
+                                  uint32_t kernelWidth,
+                                  uint32_t kernelHeight,
+                                  int16_t *rowKernel,
+                                  int16_t *columnKernel) {
+  if(NULL == kernel || 0 == kernelWidth || 0 == kernelHeight) {
+    return false;
+  }
+  // the first non-zero row, divided through by the gcd of its weights, is
+  // the row kernel; every other row has to be a whole multiple of it
+  const int16_t *first = NULL;
+  for(uint32_t ky = 0; ky < kernelHeight && NULL == first; ky++) {
+    for(uint32_t kx = 0; kx < kernelWidth; kx++) {
+      if(0 != kernel[ky * kernelWidth + kx]) {
+        first = kernel + ky * kernelWidth;
+        break;
+      }
+    }
+  }
+  if(NULL == first) {
+    return false;
+  }
+  int32_t gcd = 0;
+  uint32_t pivot = kernelWidth;
+  for(uint32_t kx = 0; kx < kernelWidth; kx++) {
+    gcd = GreatestCommonDivisor(gcd, first[kx]);
+    if(pivot == kernelWidth && 0 != first[kx]) {
+      pivot = kx;
+    }
+  }
+  // keep the row kernel's first non-zero weight positive
+  if(first[pivot] < 0) {
+    gcd = -gcd;
+  }
+  std::vector<int32_t> row(kernelWidth);
+  std::vector<int32_t> column(kernelHeight);
+  for(uint32_t kx = 0; kx < kernelWidth; kx++) {
+    row[kx] = first[kx] / gcd;
+  }
+  for(uint32_t ky = 0; ky < kernelHeight; ky++) {
+    const int16_t *weights = kernel + ky * kernelWidth;
+    if(0 != weights[pivot] % row[pivot]) {
+      return false;
+    }
+    column[ky] = weights[pivot] / row[pivot];
+    for(uint32_t kx = 0; kx < kernelWidth; kx++) {
+      if(weights[kx] != column[ky] * row[kx]) {
+        return false;
+      }
+    }
+  }
+  // every factor divides a weight of the kernel, so they all fit in shorts
+  for(uint32_t kx = 0; kx < kernelWidth; kx++) {
+    rowKernel[kx] = (int16_t)row[kx];
+  }
+  for(uint32_t ky = 0; ky < kernelHeight; ky++) {
+    columnKernel[ky] = (int16_t)column[ky];
+  }
+  return true;
+}
+
+GFSConvolutionError GFSConvolveSeparableARGB8888(const GFSConvolutionBuffer *src,
+                                                 const GFSConvolutionBuffer *dest,
+                                                 size_t srcOffsetToROI_X,
+                                                 size_t srcOffsetToROI_Y,
+                                                 const int16_t *rowKernel,
+                                                 uint32_t kernelWidth,
+                                                 const int16_t *columnKernel,
+                                                 uint32_t kernelHeight,
+                                                 int32_t divisor,
+                                                 const uint8_t backgroundColor[4],
+                                                 uint32_t flags) {
+  return ConvolveSeparable(src, dest, srcOffsetToROI_X, srcOffsetToROI_Y, 4,
+                           rowKernel, kernelWidth, columnKernel, kernelHeight,
+                           divisor, backgroundColor, flags, NULL);
+}
+
+bool GFSConvolutionShouldSeparateKernel(const int16_t *kernel,
+                                        uint32_t kernelWidth,
+                                        uint32_t kernelHeight) {
+  if(NULL == kernel) {
+    return false;
+  }
+  if(kernelWidth > 1 && kernelHeight > 1) {
+    return true;
+  }
+  const uint32_t count = kernelWidth * kernelHeight;
+  for(uint32_t i = 1; i < count; i++) {
+    if(kernel[i] != kernel[0]) {
+      return false;
+    }
+  }
+  return count > 1;
+}
+
+GFSConvolutionError GFSConvolvePlanar8(const GFSConvolutionBuffer *src,
+                                       const GFSConvolutionBuffer *dest,
+                                       size_t srcOffsetToROI_X,
+                                       size_t srcOffsetToROI_Y,
+                                       const int16_t *kernel,
+                                       uint32_t kernelWidth,
+                                       uint32_t kernelHeight,
+                                       int32_t divisor,
+                                       uint8_t backgroundColor,
+                                       uint32_t flags) {
+  return ConvolveFull(src, dest, srcOffsetToROI_X, srcOffsetToROI_Y, 1,
+                      kernel, kernelWidth, kernelHeight,
+                      divisor, &backgroundColor, flags, NULL);
+}
+
+GFSConvolutionError GFSConvolveSeparablePlanar8(const GFSConvolutionBuffer *src,
+                                                const GFSConvolutionBuffer *dest,
+                                                size_t srcOffsetToROI_X,
+                                                size_t srcOffsetToROI_Y,
+                                                const int16_t *rowKernel,
+                                                uint32_t kernelWidth,
+                                                const int16_t *columnKernel,
+                                                uint32_t kernelHeight,
+                                                int32_t divisor,
+                                                uint8_t backgroundColor,
+                                                uint32_t flags) {
+  return ConvolveSeparable(src, dest, srcOffsetToROI_X, srcOffsetToROI_Y, 1,
+                           rowKernel, kernelWidth, columnKernel, kernelHeight,
+                           divisor, &backgroundColor, flags, NULL);
+}
+
+GFSConvolutionError GFSConvolvePipelineARGB8888(const GFSConvolutionBuffer *src,
+                                                const GFSConvolutionBuffer *dest,
+                                                const GFSConvolutionBuffer *scratch,
+                                                const GFSConvolutionStage *stages,
+                                                uint32_t stageCount,
+                                                const uint8_t backgroundColor[4],
+                                                uint32_t flags) {
+  GFSConvolutionError err = CheckBuffers(src, dest, 0, 0, 4);
+  if(GFSConvolutionNoError != err) {
+    return err;
+  }
+  if(src->width != dest->width || src->height != dest->height) {
+    return GFSConvolutionInvalidBuffer;
+  }
+  if(NULL == stages && 0 != stageCount) {
+    return GFSConvolutionInvalidKernelSize;
+  }
+  for(uint32_t s = 0; s < stageCount; s++) {
+    if(NULL == stages[s].kernel || 0 == (stages[s].kernelWidth & 1) || 0 == (stages[s].kernelHeight & 1)) {
+      return GFSConvolutionInvalidKernelSize;
+    }
+    if(0 == stages[s].divisor) {
+      return GFSConvolutionInvalidDivisor;
+    }
+  }
+
+  try {
+    // A 1x1 stage maps each channel value to another on its own, so it is
+    // a 256 entry table. Runs of them compose into one table, which is
+    // applied as the next real stage reads its source, or as the last one
+    // writes its output. Tables that change nothing are dropped.
+    std::vector<const GFSConvolutionStage *> passes;
+    std::vector<std::vector<uint8_t> > inputTables;
+    std::vector<uint8_t> pending;
+    for(uint32_t s = 0; s < stageCount; s++) {
+      const GFSConvolutionStage &stage = stages[s];
+      if(1 == stage.kernelWidth && 1 == stage.kernelHeight) {
+        std::vector<uint8_t> table(256);
+        bool identity = true;
+        for(int32_t value = 0; value < 256; value++) {
+          table[value] = Saturate(value * stage.kernel[0] / stage.divisor);
+          identity = identity && table[value] == value;
+        }
+        if(identity) {
+          continue;
+        }
+        if(!pending.empty()) {
+          for(int32_t value = 0; value < 256; value++) {
+            pending[value] = table[pending[value]];
+          }
+        } else {
+          pending.swap(table);
+        }
+      } else {
+        passes.push_back(&stage);
+        inputTables.push_back(std::vector<uint8_t>());
+        inputTables.back().swap(pending);
+      }
+    }
+    const uint8_t *outputTable = pending.empty() ? NULL : pending.data();
+
+    if(passes.empty()) {
+      const size_t count = src->width * 4;
+      for(size_t y = 0; y < src->height; y++) {
+        const uint8_t *in = (const uint8_t *)src->data + y * src->rowBytes;
+        uint8_t *out = (uint8_t *)dest->data + y * dest->rowBytes;
+        if(NULL != outputTable) {
+          LookUp(outputTable, in, out, count);
+        } else {
+          memcpy(out, in, count);
+        }
+      }
+      return GFSConvolutionNoError;
+    }
+    if(passes.size() > 1) {
+      err = CheckBuffers(src, scratch, 0, 0, 4);
+      if(GFSConvolutionNoError != err) {
+        return err;
+      }
+      if(src->width != scratch->width || src->height != scratch->height) {
+        return GFSConvolutionInvalidBuffer;
+      }
+    }
+
+    // ping-pong between dest and scratch, ending on dest
+    const GFSConvolutionBuffer *in = src;
+    for(size_t p = 0; p < passes.size() && GFSConvolutionNoError == err; p++) {
+      const GFSConvolutionStage &stage = *passes[p];
+      const GFSConvolutionBuffer *out = 0 == (passes.size() - 1 - p) % 2 ? dest : scratch;
+      Hooks hooks = { NULL, NULL, NULL, 0 };
+      hooks.inputTable = inputTables[p].empty() ? NULL : inputTables[p].data();
+      hooks.outputTable = p + 1 == passes.size() ? outputTable : NULL;
+      std::vector<int16_t> rowKernel(stage.kernelWidth);
+      std::vector<int16_t> columnKernel(stage.kernelHeight);
+      if(GFSConvolutionShouldSeparateKernel(stage.kernel, stage.kernelWidth, stage.kernelHeight) &&
+         GFSConvolutionSeparateKernel(stage.kernel, stage.kernelWidth, stage.kernelHeight,
+                                      rowKernel.data(), columnKernel.data())) {
+        err = ConvolveSeparable(in, out, 0, 0, 4, rowKernel.data(), stage.kernelWidth,
+                                columnKernel.data(), stage.kernelHeight, stage.divisor,
+                                backgroundColor, flags, &hooks);
+      } else {
+        err = ConvolveFull(in, out, 0, 0, 4, stage.kernel, stage.kernelWidth, stage.kernelHeight,
+                           stage.divisor, backgroundColor, flags, &hooks);
+      }
+      in = out;
+    }
+  } catch(const std::bad_alloc &) {
+    return GFSConvolutionMemoryAllocationError;
+  }
+  return err;
+}
+
+GFSConvolutionError GFSConvolveAccumulateARGB8888(const GFSConvolutionBuffer *src,
+                                                  const GFSConvolutionBuffer *accumulators,
+                                                  size_t srcOffsetToROI_X,
+                                                  size_t srcOffsetToROI_Y,
+                                                  const int16_t *kernel,
+                                                  uint32_t kernelWidth,
+                                                  uint32_t kernelHeight,
+                                                  uint32_t flags) {
+  if(NULL == accumulators || accumulators->rowBytes < accumulators->width * 4 * sizeof(int32_t)) {
+    return GFSConvolutionInvalidBuffer;
+  }
+  if(NULL == kernel) {
+    return GFSConvolutionInvalidKernelSize;
+  }
+  Hooks hooks = { NULL, NULL, (int32_t *)accumulators->data, accumulators->rowBytes };
+  try {
+    std::vector<int16_t> rowKernel(kernelWidth);
+    std::vector<int16_t> columnKernel(kernelHeight);
+    if(GFSConvolutionShouldSeparateKernel(kernel, kernelWidth, kernelHeight) &&
+       GFSConvolutionSeparateKernel(kernel, kernelWidth, kernelHeight,
+                                    rowKernel.data(), columnKernel.data())) {
+      return ConvolveSeparable(src, accumulators, srcOffsetToROI_X, srcOffsetToROI_Y, 4,
+                               rowKernel.data(), kernelWidth, columnKernel.data(), kernelHeight,
+                               1, NULL, flags, &hooks);
+    }
+  } catch(const std::bad_alloc &) {
+    return GFSConvolutionMemoryAllocationError;
+  }
+  return ConvolveFull(src, accumulators, srcOffsetToROI_X, srcOffsetToROI_Y, 4,
+                      kernel, kernelWidth, kernelHeight,
+                      1, NULL, flags, &hooks);
+}
+
+GFSConvolutionError GFSConvolutionPackARGB8888(const GFSConvolutionBuffer *accumulators,
+                                               const GFSConvolutionBuffer *src,
+                                               const GFSConvolutionBuffer *dest,
+                                               size_t srcOffsetToROI_X,
+                                               size_t srcOffsetToROI_Y,
+                                               const int16_t *kernel,
+                                               uint32_t kernelWidth,
+                                               uint32_t kernelHeight,
+                                               int32_t divisor,
+                                               const uint8_t backgroundColor[4],
+                                               uint32_t flags) {
+  GFSConvolutionError err = CheckBuffers(src, dest, srcOffsetToROI_X, srcOffsetToROI_Y, 4);
+  if(GFSConvolutionNoError != err) {
+    return err;
+  }
+  if(NULL == accumulators || NULL == accumulators->data ||
+     accumulators->width != dest->width || accumulators->height != dest->height ||
+     accumulators->rowBytes < accumulators->width * 4 * sizeof(int32_t)) {
+    return GFSConvolutionInvalidBuffer;
+  }
+  if(NULL == kernel || 0 == (kernelWidth & 1) || 0 == (kernelHeight & 1)) {
+    return GFSConvolutionInvalidKernelSize;
+  }
+  if(0 == divisor) {
+    return GFSConvolutionInvalidDivisor;
+  }
+  if(0 == dest->width || 0 == dest->height) {
+    return GFSConvolutionNoError;
+  }
+
+  try {
+    Job job;
+    SetupJob(job, ModePack, src, dest, srcOffsetToROI_X, srcOffsetToROI_Y, 4,
+             kernelWidth, kernelHeight, divisor, backgroundColor, flags);
+    job.accumulators = (int32_t *)accumulators->data;
+    job.accumulatorRowBytes = accumulators->rowBytes;
+    const size_t stride = kernelWidth + 1;
+    job.kernelSums.assign((kernelHeight + 1) * stride, 0);
+    for(uint32_t ky = 0; ky < kernelHeight; ky++) {
+      for(uint32_t kx = 0; kx < kernelWidth; kx++) {
+        job.kernelSums[(ky + 1) * stride + kx + 1] = (uint32_t)kernel[ky * kernelWidth + kx] +
+          job.kernelSums[ky * stride + kx + 1] + job.kernelSums[(ky + 1) * stride + kx] -
+          job.kernelSums[ky * stride + kx];
+      }
+    }
+    RunJob(job, flags);
+  } catch(const std::bad_alloc &) {
+    return GFSConvolutionMemoryAllocationError;
+  }
+  return GFSConvolutionNoError;
+}
@@ -0,0 +1,220 @@
+//
+//  GFSConvolutionEngine.h
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#ifndef GFSConvolutionEngine_h
+#define GFSConvolutionEngine_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A portable (no Accelerate) replacement for vImageConvolve_ARGB8888 with
+ * the kvImageBackgroundColorFill edge mode, so the same convolutions can run
+ * off of iOS.
+ *
+ * The results match vImage:
+ *  - the kernel is centered at (width / 2, height / 2) and is not rotated,
+ *    kernel[0] weighs the top left neighbor
+ *  - pixels outside of the source take the background color
+ *  - products are summed per channel in 32 bits
+ *  - the sum is divided by the divisor (truncating toward zero) and then
+ *    clamped to 0...255
+ *
+ * Channel order doesn't matter (all four are treated the same) so long as
+ * the background color is in the same order as the pixels.
+ *
+ * The inner loops use SSE4.1/AVX2 or NEON when the compiler targets them,
+ * and rows are split across threads.
+ *
+ * Kernels that are the outer product of a column and a row (blurs, Sobel,
+ * motion blurs...) can be split with GFSConvolutionSeparateKernel and run
+ * as two 1D passes, kernelWidth + kernelHeight multiplies per channel instead
+ * of kernelWidth * kernelHeight. Box kernels (every weight the same) use
+ * running sums and cost the same at any size. The intermediate sums are kept
+ * in 32 bits and the divisor is only applied at the end, so the results are
+ * identical to convolving with the whole kernel.
+ */
+
+// same layout as vImage_Buffer
+typedef struct GFSConvolutionBuffer {
+  void *data;
+  size_t height;
+  size_t width;
+  size_t rowBytes;
+} GFSConvolutionBuffer;
+
+typedef enum {
+  GFSConvolutionNoError = 0,
+  GFSConvolutionInvalidBuffer,
+  GFSConvolutionInvalidKernelSize,
+  GFSConvolutionInvalidDivisor,
+  GFSConvolutionMemoryAllocationError,
+  GFSConvolutionROILargerThanInputBuffer
+} GFSConvolutionError;
+
+typedef enum {
+  GFSConvolutionNoFlags = 0,
+  // run on the calling thread only
+  GFSConvolutionSingleThread = 1 << 0,
+  // skip the SIMD paths, handy for checking them against plain C
+  GFSConvolutionScalar = 1 << 1
+} GFSConvolutionFlags;
+
+// kernel is kernelWidth x kernelHeight shorts in row order, both sizes must
+// be odd. src and dest must not overlap.
+//
+// Like vImage, dest is the region of interest: dest pixel (x, y) is the
+// convolution at src pixel (x + srcOffsetToROI_X, y + srcOffsetToROI_Y), and
+// the region has to fit inside src. The kernel reads the src pixels around
+// the region where there are any, only past the edges of src does it see
+// the background. Pass 0, 0 and a dest the same size as src to convolve the
+// whole image.
+GFSConvolutionError GFSConvolveARGB8888(const GFSConvolutionBuffer *src,
+                                        const GFSConvolutionBuffer *dest,
+                                        size_t srcOffsetToROI_X,
+                                        size_t srcOffsetToROI_Y,
+                                        const int16_t *kernel,
+                                        uint32_t kernelWidth,
+                                        uint32_t kernelHeight,
+                                        int32_t divisor,
+                                        const uint8_t backgroundColor[4],
+                                        uint32_t flags);
+
+// Splits kernel into rowKernel (kernelWidth shorts) and columnKernel
+// (kernelHeight shorts) so that
+//   kernel[y * kernelWidth + x] == columnKernel[y] * rowKernel[x]
+// Returns false, and leaves rowKernel and columnKernel alone, when the kernel
+// doesn't split into integer factors.
+bool GFSConvolutionSeparateKernel(const int16_t *kernel,
+                                  uint32_t kernelWidth,
+                                  uint32_t kernelHeight,
+                                  int16_t *rowKernel,
+                                  int16_t *columnKernel);
+
+// Same results as GFSConvolveARGB8888 with the kernel that is the outer
+// product of columnKernel and rowKernel.
+GFSConvolutionError GFSConvolveSeparableARGB8888(const GFSConvolutionBuffer *src,
+                                                 const GFSConvolutionBuffer *dest,
+                                                 size_t srcOffsetToROI_X,
+                                                 size_t srcOffsetToROI_Y,
+                                                 const int16_t *rowKernel,
+                                                 uint32_t kernelWidth,
+                                                 const int16_t *columnKernel,
+                                                 uint32_t kernelHeight,
+                                                 int32_t divisor,
+                                                 const uint8_t backgroundColor[4],
+                                                 uint32_t flags);
+
+// Whether a kernel is worth running through GFSConvolveSeparableARGB8888
+// (if it splits): 2D kernels, and 1D kernels whose weights are all the same.
+// Other 1D kernels cost the same either way.
+bool GFSConvolutionShouldSeparateKernel(const int16_t *kernel,
+                                        uint32_t kernelWidth,
+                                        uint32_t kernelHeight);
+
+// Planar8 versions of the above, like vImageConvolve_Planar8: one byte per
+// pixel and a one byte background. A channel split out of an ARGB8888
+// image convolves to exactly the same values as it would have interleaved,
+// and the SIMD paths work on four times as many pixels at once.
+GFSConvolutionError GFSConvolvePlanar8(const GFSConvolutionBuffer *src,
+                                       const GFSConvolutionBuffer *dest,
+                                       size_t srcOffsetToROI_X,
+                                       size_t srcOffsetToROI_Y,
+                                       const int16_t *kernel,
+                                       uint32_t kernelWidth,
+                                       uint32_t kernelHeight,
+                                       int32_t divisor,
+                                       uint8_t backgroundColor,
+                                       uint32_t flags);
+
+GFSConvolutionError GFSConvolveSeparablePlanar8(const GFSConvolutionBuffer *src,
+                                                const GFSConvolutionBuffer *dest,
+                                                size_t srcOffsetToROI_X,
+                                                size_t srcOffsetToROI_Y,
+                                                const int16_t *rowKernel,
+                                                uint32_t kernelWidth,
+                                                const int16_t *columnKernel,
+                                                uint32_t kernelHeight,
+                                                int32_t divisor,
+                                                uint8_t backgroundColor,
+                                                uint32_t flags);
+
+typedef struct GFSConvolutionStage {
+  const int16_t *kernel;
+  uint32_t kernelWidth;
+  uint32_t kernelHeight;
+  int32_t divisor;
+} GFSConvolutionStage;
+
+// Runs the stages one after another, each one convolving the result of the
+// one before (with the usual clamping in between), and leaves the last
+// result in dest. The results go back and forth between dest and scratch,
+// which must be the same size as src, so memory doesn't grow with the
+// number of stages. scratch is only touched (and may be NULL) when there is
+// more than one stage left after 1x1 stages are folded into their
+// neighbors as lookup tables. Stages are split when worth it, just like a
+// single convolution.
+GFSConvolutionError GFSConvolvePipelineARGB8888(const GFSConvolutionBuffer *src,
+                                                const GFSConvolutionBuffer *dest,
+                                                const GFSConvolutionBuffer *scratch,
+                                                const GFSConvolutionStage *stages,
+                                                uint32_t stageCount,
+                                                const uint8_t backgroundColor[4],
+                                                uint32_t flags);
+
+// Convolving, split in two so the expensive half can be kept. Accumulate
+// leaves each channel's 32 bit sum, taken with a zero background, in
+// accumulators (dest->width * 4 int32_ts per row, the size of the region).
+// Pack then turns them into the same pixels GFSConvolveARGB8888 would give
+// for any divisor and background color, adding the background back in
+// where the kernel hangs off the source, in one pass over the sums. src
+// and the offsets must be the same for both, Pack only looks at the size
+// of src. Kernels are split as for GFSConvolutionShouldSeparateKernel.
+GFSConvolutionError GFSConvolveAccumulateARGB8888(const GFSConvolutionBuffer *src,
+                                                  const GFSConvolutionBuffer *accumulators,
+                                                  size_t srcOffsetToROI_X,
+                                                  size_t srcOffsetToROI_Y,
+                                                  const int16_t *kernel,
+                                                  uint32_t kernelWidth,
+                                                  uint32_t kernelHeight,
+                                                  uint32_t flags);
+
+GFSConvolutionError GFSConvolutionPackARGB8888(const GFSConvolutionBuffer *accumulators,
+                                               const GFSConvolutionBuffer *src,
+                                               const GFSConvolutionBuffer *dest,
+                                               size_t srcOffsetToROI_X,
+                                               size_t srcOffsetToROI_Y,
+                                               const int16_t *kernel,
+                                               uint32_t kernelWidth,
+                                               uint32_t kernelHeight,
+                                               int32_t divisor,
+                                               const uint8_t backgroundColor[4],
+                                               uint32_t flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+//
+//  GFSConvolutionPipeline.h
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "GFSVImageLoader.h"
+
+/*
+ * Run a list of convolutions one after the other on an image, each stage
+ * convolving the result of the one before it.
+ *
+ * Instead of a GFSImageConvolver (and a CGImage) per stage the stages go
+ * back and forth between two buffers the size of the image, so memory
+ * doesn't grow with the number of stages, and only the final result is
+ * made into a CGImage. 1x1 stages (brightness, invert...) are folded into
+ * the stages around them instead of getting a pass of their own.
+ *
+ * Like GFSImageConvolver the result is cached until a stage or the
+ * background color changes.
+ */
+@interface GFSConvolutionPipeline : GFSVImageLoader
+
++ (id)convolutionPipelineForURL:(NSURL *)originalImageURL;
+
+- (id)initWithURL:(NSURL *)orignalImageURL;
+
+- (id)initWithImageData:(NSData *)data imageSize:(CGSize)imageSize;
+
+// memcopy the values into a new stage at the end of the pipeline
+- (void)addKernel:(short *)values width:(short)width height:(short)height divisor:(int32_t)divisor;
+
+- (void)removeAllKernels;
+
+@property(nonatomic, readonly) NSUInteger kernelCount;
+@property(nonatomic, assign) GFSConvolverColor backgroundColor;
+
+// really a CGImageRef, see GFSImageConvolver
+@property(nonatomic, readonly, strong) id convolvedImage;
+
+@end
@@ -0,0 +1,164 @@
+//
+//  GFSConvolutionPipeline.m
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "GFSConvolutionPipeline.h"
+#import "GFSConvolutionEngine.h"
+#import "GFSImageSurfacePool.h"
+#import "GFSMemoryAccounting.h"
+
+@interface GFSConvolutionPipeline(Private)
+
+- (void)releaseConvolvedImage;
+
+@end
+
+@implementation GFSConvolutionPipeline {
+  // NSData of width * height shorts, one per stage
+  NSMutableArray *_kernels;
+  NSMutableArray *_kernelSizes;
+  NSMutableArray *_divisors;
+  // the other half of the ping pong, kept around between runs
+  NSMutableData *_scratchData;
+}
+
+@synthesize backgroundColor = _backgroundColor;
+@synthesize convolvedImage = _convolvedImage;
+
++ (id)convolutionPipelineForURL:(NSURL *)originalImageURL {
+  return [[self alloc] initWithURL:originalImageURL];
+}
+
+- (id)initWithURL:(NSURL *)orignalImageURL {
+  self = [super initWithURL:orignalImageURL];
+  if(nil != self) {
+    _kernels = [NSMutableArray array];
+    _kernelSizes = [NSMutableArray array];
+    _divisors = [NSMutableArray array];
+    // default to black background
+    self.backgroundColor = (GFSConvolverColor){0,0,0,0};
+  }
+  return self;
+}
+
+- (id)initWithImageData:(NSData *)data imageSize:(CGSize)imageSize {
+  self = [super initWithCompliantData:data imageSize:imageSize];
+  if(nil != self) {
+    _kernels = [NSMutableArray array];
+    _kernelSizes = [NSMutableArray array];
+    _divisors = [NSMutableArray array];
+    // default to black background
+    self.backgroundColor = (GFSConvolverColor){0,0,0,0};
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [self releaseConvolvedImage];
+  GFSMemoryRecordFree(GFSMemoryStageConvolve, [_scratchData length]);
+}
+
+- (void)addKernel:(short *)values width:(short)width height:(short)height divisor:(int32_t)divisor {
+  [_kernels addObject:[NSData dataWithBytes:values length:width * height * sizeof(short)]];
+  [_kernelSizes addObject:[NSValue valueWithCGSize:CGSizeMake(width, height)]];
+  [_divisors addObject:[NSNumber numberWithInt:divisor]];
+  [self releaseConvolvedImage];
+}
+
+- (void)removeAllKernels {
+  [_kernels removeAllObjects];
+  [_kernelSizes removeAllObjects];
+  [_divisors removeAllObjects];
+  [self releaseConvolvedImage];
+}
+
+- (NSUInteger)kernelCount {
+  return [_kernels count];
+}
+
+- (void)setBackgroundColor:(GFSConvolverColor)backgroundColor {
+  _backgroundColor = backgroundColor;
+  [self releaseConvolvedImage];
+}
+
+- (id)convolvedImage {
+  if(nil == _convolvedImage) {
+    NSUInteger length = [self.compliantData length];
+    GFSConvolutionBuffer src = { (void *)[self.compliantData bytes],
+      self.imageSize.height,
+      self.imageSize.width,
+      self.imageSize.width * 4};
+    GFSImageSurfacePool *pool = [GFSImageSurfacePool sharedPool];
+    void *outData = [pool bufferWithLength:length];
+    GFSConvolutionBuffer dest = { outData,
+      self.imageSize.height,
+      self.imageSize.width,
+      self.imageSize.width * 4};
+    if(nil == _scratchData || [_scratchData length] != length) {
+      GFSMemoryRecordFree(GFSMemoryStageConvolve, [_scratchData length]);
+      _scratchData = [NSMutableData dataWithLength:length];
+      GFSMemoryRecordAllocation(GFSMemoryStageConvolve, [_scratchData length]);
+    }
+    GFSConvolutionBuffer scratch = { [_scratchData mutableBytes],
+      self.imageSize.height,
+      self.imageSize.width,
+      self.imageSize.width * 4};
+    
+    NSUInteger stageCount = [_kernels count];
+    GFSConvolutionStage *stages = calloc(stageCount > 0 ? stageCount : 1, sizeof(GFSConvolutionStage));
+    for(NSUInteger i = 0;i < stageCount;i++) {
+      CGSize size = [[_kernelSizes objectAtIndex:i] CGSizeValue];
+      stages[i].kernel = [[_kernels objectAtIndex:i] bytes];
+      stages[i].kernelWidth = size.width;
+      stages[i].kernelHeight = size.height;
+      stages[i].divisor = [[_divisors objectAtIndex:i] intValue];
+    }
+    
+    GFSConvolutionError err = GFSConvolutionMemoryAllocationError;
+    if(NULL != outData && NULL != stages) {
+      err = GFSConvolvePipelineARGB8888(&src, &dest, &scratch,
+                                        stages, (uint32_t)stageCount,
+                                        (uint8_t *)&_backgroundColor,
+                                        GFSConvolutionNoFlags);
+    }
+    free(stages);
+    if(err == GFSConvolutionNoError) {
+      _convolvedImage = [pool newImageWithBuffer:outData
+                                           width:self.imageSize.width
+                                          height:self.imageSize.height];
+    } else {
+      [pool recycleBuffer:outData length:length];
+    }
+  }
+  return _convolvedImage;
+}
+
+@end
+
+
+@implementation GFSConvolutionPipeline (Private)
+
+- (void)releaseConvolvedImage {
+  if(nil != _convolvedImage) {
+    CGImageRelease((__bridge CGImageRef)_convolvedImage);
+    _convolvedImage = nil;
+  }
+}
+
+@end
@@ -55,7 +55,7 @@
     -1.0, -1.0, -1.0
   };
   [self.convolver setKernel:edgeDetectionKernel width:3 height:3];
-  self.imageView.image = [UIImage imageWithCGImage:(__bridge CGImageRef)self.convolver.convolvedImage];
+  [self showConvolvedImage];
 }
 
 - (IBAction)blur:(id)sender {
@@ -65,7 +65,7 @@
     0.0, 1.0, 0.0
   };
   [self.convolver setKernel:blurKernel width:3 height:3];
-  self.imageView.image = [UIImage imageWithCGImage:(__bridge CGImageRef)self.convolver.convolvedImage];
+  [self showConvolvedImage];
 }
 
 - (IBAction)alpha:(id)sender {
@@ -87,16 +87,27 @@
 - (IBAction)sliderChanged:(UISlider *)sender {
   self.convolver.divsor = [sender value];
   self.divisorLabel.text = [NSString stringWithFormat:@"%d", self.convolver.divsor];
-  self.imageView.image = [UIImage imageWithCGImage:(__bridge CGImageRef)self.convolver.convolvedImage];
+  [self showConvolvedImage];
+}
+
+// off the main thread, while the slider is moving only the last value
+// is shown, and not at all if the original was tapped back to meanwhile
+- (void)showConvolvedImage {
+  self.displayingConvolvedImage = YES;
+  [self.convolver convolveAsynchronouslyWithCompletion:^(id convolvedImage, GFSConvolutionLatency latency) {
+    if(self.displayingConvolvedImage) {
+      self.imageView.image = [UIImage imageWithCGImage:(__bridge CGImageRef)convolvedImage];
+    }
+  }];
 }
 
 - (void)handleGesture:(UIGestureRecognizer *)gestureRecognizer {
   if(self.displayingConvolvedImage) {
+    self.displayingConvolvedImage = NO;
     self.imageView.image = self.originalImage;
   } else {
-    self.imageView.image = [UIImage imageWithCGImage:(__bridge CGImageRef)self.convolver.convolvedImage];
+    [self showConvolvedImage];
   }
-  self.displayingConvolvedImage = !self.displayingConvolvedImage;
 }
 
 
@@ -124,8 +135,11 @@
   NSURL *url = [[NSBundle mainBundle] URLForResource:@"phillip" withExtension:@"jpg"];
   self.separator = [[GFSImageSeparator alloc] initWithURL:url];
   self.convolver = [GFSImageConvolver imageConvolverForURL:url];
-  self.imageView.image = [UIImage imageWithCGImage:(__bridge CGImageRef)self.convolver.convolvedImage];
-  self.displayingConvolvedImage = YES;
+  // the slider only changes the divisor, keep the sums around to repack
+  self.convolver.accumulatorCacheLimit = 32 * 1024 * 1024;
+  // the original until the convolved image is ready
+  self.imageView.image = self.originalImage;
+  [self showConvolvedImage];
   self.divisorLabel.text = @"1";
 
 }
@@ -20,8 +20,28 @@
 
 #import "GFSVImageLoader.h"
 
+typedef enum {
+  GFSConvolverChannelAlpha = 1 << 0,
+  GFSConvolverChannelRed = 1 << 1,
+  GFSConvolverChannelGreen = 1 << 2,
+  GFSConvolverChannelBlue = 1 << 3,
+  GFSConvolverChannelsColor = GFSConvolverChannelRed | GFSConvolverChannelGreen | GFSConvolverChannelBlue,
+  GFSConvolverChannelsAll = GFSConvolverChannelAlpha | GFSConvolverChannelsColor
+} GFSConvolverChannels;
+
+// How long an asynchronous convolution took, in seconds
+typedef struct GFSConvolutionLatency {
+  // from the request until the worker started on it
+  NSTimeInterval waiting;
+  NSTimeInterval convolving;
+  // from the request until the completion block was called
+  NSTimeInterval total;
+} GFSConvolutionLatency;
+
 /*
- * Use vImage to apply convolution filters to images.
+ * Apply convolution filters to images. The convolution itself is done by
+ * GFSConvolutionEngine, which gives the same results as vImage but also
+ * builds off of iOS.
  *
  * Create a new Image Convolver with a URL to an original image. Modify the
  * parameters as desired (kernel, background color, divisor).
@@ -31,20 +51,40 @@
  *
  * The original data is also cached in the vImage format.
  *
+ * To run several convolutions one after the other use GFSConvolutionPipeline.
+ *
+ * Set a regionOfInterest to convolve only part of the image, the pixels
+ * around the region still feed the convolution just like vImage's
+ * srcOffsetToROI. Images too big to convolve in one go (create them with
+ * initForStripsWithURL:, their convolvedImage is always nil) can be
+ * convolved a strip at a time with convolveStripsOfHeight:usingBlock:.
+ *
+ * The convolution-benchmark tool in TweakedSamples/Trajectories compares the
+ * engine's plain C and SIMD paths with OpenCL for speed, memory use and image
+ * sizes up to 16k x 16k, and writes the numbers out as CSV.
+ *
+ * Set planar to have convolvedImage split the image into one plane per
+ * channel (with GFSImageSeparator) and convolve only the planarChannels. The
+ * loaded data is always kCGImageAlphaNoneSkipFirst so by default alpha is
+ * left alone, a quarter less work than convolving all four, the other
+ * channels are passed through as they are.
+ *
+ * convolveAsynchronouslyWithCompletion: convolves on a background queue so
+ * the main thread never waits. Only the latest request is delivered,
+ * requests and results that a parameter change has made stale are dropped.
+ *
  * Stuff to do:
- *  - break the ARGB data into planar data for each component
- *  - allow multiple convolutions to be chained
- *  - provide a means to specify a ROI in the original image
- *  - build a means to compare performance of this approach vs OpenGL shaders
- *   - memory usage
- *   - wall time for various convolutions
- *   - performance as images get larger, esp beyond what will fit in a texture
+ *  - add OpenGL shaders to the performance comparison
  */
 @interface GFSImageConvolver : GFSVImageLoader
 
 + (id)imageConvolverForURL:(NSURL *)originalImageURL;
 
 - (id)initWithURL:(NSURL *)orignalImageURL;
+// only GFSPixelFormatARGB8888, anything else returns nil
+- (id)initWithURL:(NSURL *)orignalImageURL pixelFormat:(GFSPixelFormat)pixelFormat;
+
+- (id)initForStripsWithURL:(NSURL *)orignalImageURL;
 
 - (id)initWithImageData:(NSData *)data imageSize:(CGSize)imageSize;
 
@@ -53,9 +93,42 @@
 
 @property(nonatomic, assign) int32_t divsor;
 @property(nonatomic, assign) GFSConvolverColor backgroundColor;
+// in pixels from the top left of the image, CGRectNull (the default) for
+// the whole image. convolvedImage is the size of the region.
+@property(nonatomic, assign) CGRect regionOfInterest;
+@property(nonatomic, assign) BOOL planar;
+// only used when planar, defaults to GFSConvolverChannelsColor
+@property(nonatomic, assign) GFSConvolverChannels planarChannels;
+// Bytes convolvedImage may keep (16 per pixel of the region) so that a new
+// divisor or background color only repacks the last convolution's sums
+// instead of convolving again. 0, the default, keeps nothing. Not used when
+// planar.
+@property(nonatomic, assign) NSUInteger accumulatorCacheLimit;
 
 // really a CGImageRef but since we can't have a strong relationship
 // with a CGImageRef marking it id, memory managed with CGImageRelease/Retain
 @property(nonatomic, readonly, strong) id convolvedImage;
 
+// Convolve the region of interest stripHeight rows at a time, handing each
+// strip of output (width * 4 bytes per row) to block with the row it starts
+// at in the region. Only the strips being worked on, and the rows around
+// them the kernel reaches, are in memory at once. Strips run in parallel so
+// block is called on any thread in any order. Returns NO if any strip
+// failed.
+- (BOOL)convolveStripsOfHeight:(NSUInteger)stripHeight
+                    usingBlock:(void (^)(NSData *strip, NSUInteger firstRow, NSUInteger rowCount))block;
+
+// Convolve with the current parameters on a background queue and call
+// completion on the main queue with the result (also cached as
+// convolvedImage). Call on the main thread. When the parameters change or
+// another request is made before the result is ready, completion is never
+// called: requests that haven't started are skipped and a convolution that
+// is already running is thrown away, so at most one stale convolution is
+// ever wasted. Does nothing when there is no compliantData (strips).
+- (void)convolveAsynchronouslyWithCompletion:(void (^)(id convolvedImage, GFSConvolutionLatency latency))completion;
+
+// the latency of the last result convolveAsynchronouslyWithCompletion:
+// delivered, all zero until there is one. Main thread only.
+@property(nonatomic, readonly, assign) GFSConvolutionLatency lastLatency;
+
 @end
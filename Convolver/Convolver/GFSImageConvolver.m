@@ -19,7 +19,12 @@
 //
 
 #import "GFSImageConvolver.h"
+#import "GFSImageSeparator.h"
+#import "GFSImageSurfacePool.h"
+#import "GFSConvolutionEngine.h"
+#import "GFSMemoryAccounting.h"
 #import <Accelerate/Accelerate.h>
+#import <libkern/OSAtomic.h>
 
 @interface GFSImageConvolver()
 
@@ -31,11 +36,39 @@
 @interface GFSImageConvolver(Private)
 
 - (void)releaseConvolvedImage;
+- (void)releaseAccumulators;
+- (void)separateKernel;
+- (void)setDefaultParameters;
+- (CGRect)clippedRegionOfInterest;
+- (GFSConvolutionError)convolve:(const GFSConvolutionBuffer *)src
+                           into:(const GFSConvolutionBuffer *)dest
+                       atOffset:(CGPoint)offset
+                          flags:(uint32_t)flags;
+- (GFSConvolutionError)convolvePlanesInto:(const GFSConvolutionBuffer *)dest
+                                 atOffset:(CGPoint)offset;
+- (GFSConvolutionError)convolveAccumulated:(const GFSConvolutionBuffer *)src
+                                      into:(const GFSConvolutionBuffer *)dest
+                                  atOffset:(CGPoint)offset;
 
 @end
 
 @implementation GFSImageConvolver {
   short *_kernel;
+  // when the kernel is the outer product of a column and a row these are
+  // the factors, otherwise NULL
+  short *_rowKernel;
+  short *_columnKernel;
+  // the planes for planar convolution, made the first time they're needed
+  GFSImageSeparator *_separator;
+  // the 32 bit sums under the region, see accumulatorCacheLimit
+  NSMutableData *_accumulators;
+  // bumped whenever a parameter changes or a new asynchronous convolution is
+  // asked for, anything started under an older one is superseded
+  volatile int32_t _generation;
+  // asynchronous convolutions run on _worker, a copy of this convolver that
+  // only _convolutionQueue touches
+  dispatch_queue_t _convolutionQueue;
+  GFSImageConvolver *_worker;
 }
 
 @synthesize divsor = _divsor;
@@ -43,26 +76,39 @@
 @synthesize convolvedImage = _convolvedImage;
 @synthesize kernelWidth = _kernelWidth;
 @synthesize kernelHeight = _kernelHeight;
+@synthesize regionOfInterest = _regionOfInterest;
+@synthesize planar = _planar;
+@synthesize planarChannels = _planarChannels;
+@synthesize accumulatorCacheLimit = _accumulatorCacheLimit;
+@synthesize lastLatency = _lastLatency;
 
 + (id)imageConvolverForURL:(NSURL *)originalImageURL {
   return [[self alloc] initWithURL:originalImageURL];
 }
 
 - (id)initWithURL:(NSURL *)orignalImageURL {
-  self = [super initWithURL:orignalImageURL];
+  return [self initWithURL:orignalImageURL pixelFormat:GFSPixelFormatARGB8888];
+}
+
+- (id)initWithURL:(NSURL *)orignalImageURL pixelFormat:(GFSPixelFormat)pixelFormat {
+  // everything below reads 4 byte ARGB, imageSize.width * 4 bytes a row
+  NSParameterAssert(GFSPixelFormatARGB8888 == pixelFormat);
+  if(GFSPixelFormatARGB8888 != pixelFormat) {
+    return nil;
+  }
+  self = [super initWithURL:orignalImageURL pixelFormat:pixelFormat];
   if(nil != self) {
-    short edgeDetectionKernel[] = {
-      -1.0, -1.0, -1.0,
-      -1.0,  8.0, -1.0,
-      -1.0, -1.0, -1.0
-    };
-    [self setKernel:edgeDetectionKernel width:3 height:3];
-    // default to black background
-    self.backgroundColor = (GFSConvolverColor){0,0,0,0};
-    self.divsor = 1;
+    [self setDefaultParameters];
+  }
+  return self;
+}
+
+- (id)initForStripsWithURL:(NSURL *)orignalImageURL {
+  self = [super initForStripsWithURL:orignalImageURL];
+  if(nil != self) {
+    [self setDefaultParameters];
   }
   return self;
-  
 }
 
 - (id)initWithImageData:(NSData *)data imageSize:(CGSize)imageSize {
@@ -77,6 +123,8 @@
     // default to black background
     self.backgroundColor = (GFSConvolverColor){0,0,0,0};
     self.divsor = 81;
+    self.regionOfInterest = CGRectNull;
+    self.planarChannels = GFSConvolverChannelsColor;
   }
   return self;
 }
@@ -92,10 +140,23 @@
     _kernel = newKernel;
     self.kernelWidth = width;
     self.kernelHeight = height;
+    [self separateKernel];
+    [self releaseAccumulators];
     [self releaseConvolvedImage];
   }
 }
 
+- (void)dealloc {
+  [self releaseConvolvedImage];
+  [self releaseAccumulators];
+  if(NULL != _convolutionQueue) {
+    dispatch_release(_convolutionQueue);
+  }
+  free(_kernel);
+  free(_rowKernel);
+  free(_columnKernel);
+}
+
 - (void)setDivsor:(int32_t)divsor {
   _divsor = divsor;
   [self releaseConvolvedImage];
@@ -106,52 +167,388 @@
   [self releaseConvolvedImage];
 }
 
+- (void)setRegionOfInterest:(CGRect)regionOfInterest {
+  _regionOfInterest = regionOfInterest;
+  [self releaseAccumulators];
+  [self releaseConvolvedImage];
+}
+
+- (void)setPlanar:(BOOL)planar {
+  _planar = planar;
+  [self releaseAccumulators];
+  [self releaseConvolvedImage];
+}
+
+- (void)setPlanarChannels:(GFSConvolverChannels)planarChannels {
+  _planarChannels = planarChannels;
+  [self releaseAccumulators];
+  [self releaseConvolvedImage];
+}
+
+- (void)setAccumulatorCacheLimit:(NSUInteger)accumulatorCacheLimit {
+  _accumulatorCacheLimit = accumulatorCacheLimit;
+  [self releaseAccumulators];
+}
+
 - (id)convolvedImage {
-  if(nil == _convolvedImage) {
-    vImage_Buffer src = { (void *)[self.compliantData bytes],
-      self.imageSize.height,
-      self.imageSize.width,
-      self.imageSize.width * 4};
-    void *outData = malloc([self.compliantData length]);
-    vImage_Buffer dest = { outData,
+  if(nil == _convolvedImage && nil != self.compliantData) {
+    CGRect region = [self clippedRegionOfInterest];
+    GFSConvolutionBuffer src = { (void *)[self.compliantData bytes],
       self.imageSize.height,
       self.imageSize.width,
       self.imageSize.width * 4};
+    size_t length = region.size.width * region.size.height * 4;
+    GFSImageSurfacePool *pool = [GFSImageSurfacePool sharedPool];
+    void *outData = [pool bufferWithLength:length];
+    GFSConvolutionBuffer dest = { outData,
+      region.size.height,
+      region.size.width,
+      region.size.width * 4};
     
-    vImage_Error err = vImageConvolve_ARGB8888(&src, &dest, NULL, 0, 0,
-                                               _kernel, self.kernelWidth, self.kernelHeight, 
-                                               self.divsor,
-                                               (uint8_t *)&_backgroundColor,
-                                               kvImageBackgroundColorFill);
-    if(err == kvImageNoError) {
-      NSData *destData = [NSData dataWithBytesNoCopy:dest.data
-                                              length:[self.compliantData length]];
-      CGDataProviderRef dataProviderRef = CGDataProviderCreateWithCFData((__bridge CFDataRef)destData);
-      // divice RGB is fine for iOS but for the Mac we'd want to be more creative
-      CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
-      _convolvedImage = (__bridge id)CGImageCreate(self.imageSize.width, self.imageSize.height,
-                                                   8, 8 * 4, self.imageSize.width * 4,
-                                                   colorSpace,
-                                                   kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipFirst,
-                                                   dataProviderRef,
-                                                   NULL, NO, kCGRenderingIntentDefault);
-      CGDataProviderRelease(dataProviderRef);
-      CGColorSpaceRelease(colorSpace);
+    size_t accumulatorLength = length * sizeof(int32_t);
+    
+    GFSConvolutionError err = GFSConvolutionMemoryAllocationError;
+    if(NULL != outData && self.planar) {
+      err = [self convolvePlanesInto:&dest atOffset:region.origin];
+    } else if(NULL != outData && accumulatorLength > 0 && accumulatorLength <= self.accumulatorCacheLimit) {
+      err = [self convolveAccumulated:&src into:&dest atOffset:region.origin];
+    } else if(NULL != outData) {
+      err = [self convolve:&src into:&dest atOffset:region.origin flags:GFSConvolutionNoFlags];
+    }
+    if(err == GFSConvolutionNoError && length > 0) {
+      // no copy, the buffer goes back to the pool when the image goes away
+      _convolvedImage = [pool newImageWithBuffer:outData
+                                           width:region.size.width
+                                          height:region.size.height];
+    } else {
+      [pool recycleBuffer:outData length:length];
     }
   }
   return _convolvedImage;
 }
 
+- (void)convolveAsynchronouslyWithCompletion:(void (^)(id convolvedImage, GFSConvolutionLatency latency))completion {
+  CFAbsoluteTime requested = CFAbsoluteTimeGetCurrent();
+  if(nil != _convolvedImage) {
+    id convolvedImage = _convolvedImage;
+    dispatch_async(dispatch_get_main_queue(), ^{
+      _lastLatency = (GFSConvolutionLatency){ 0., 0., CFAbsoluteTimeGetCurrent() - requested };
+      completion(convolvedImage, _lastLatency);
+    });
+    return;
+  }
+  if(nil == self.compliantData) {
+    return;
+  }
+  if(NULL == _convolutionQueue) {
+    _convolutionQueue = dispatch_queue_create("com.galafactory.convolver", DISPATCH_QUEUE_SERIAL);
+    _worker = [[GFSImageConvolver alloc] initWithImageData:self.compliantData imageSize:self.imageSize];
+  }
+  
+  // everything the worker needs is copied now, on the caller's thread
+  int32_t generation = OSAtomicIncrement32Barrier(&_generation);
+  NSData *kernel = [NSData dataWithBytes:_kernel length:self.kernelWidth * self.kernelHeight * sizeof(short)];
+  short kernelWidth = self.kernelWidth;
+  short kernelHeight = self.kernelHeight;
+  int32_t divsor = self.divsor;
+  GFSConvolverColor backgroundColor = self.backgroundColor;
+  CGRect regionOfInterest = self.regionOfInterest;
+  BOOL planar = self.planar;
+  GFSConvolverChannels planarChannels = self.planarChannels;
+  NSUInteger accumulatorCacheLimit = self.accumulatorCacheLimit;
+  GFSImageConvolver *worker = _worker;
+  
+  dispatch_async(_convolutionQueue, ^{
+    // requests queued up behind a slow one are skipped, only the latest runs
+    if(generation != _generation) {
+      return;
+    }
+    CFAbsoluteTime started = CFAbsoluteTimeGetCurrent();
+    // only touch what changed so the worker keeps its accumulators and planes
+    if(kernelWidth != worker.kernelWidth || kernelHeight != worker.kernelHeight ||
+       0 != memcmp(worker->_kernel, [kernel bytes], [kernel length])) {
+      [worker setKernel:(short *)[kernel bytes] width:kernelWidth height:kernelHeight];
+    }
+    if(!CGRectEqualToRect(regionOfInterest, worker.regionOfInterest)) {
+      worker.regionOfInterest = regionOfInterest;
+    }
+    if(planar != worker.planar) {
+      worker.planar = planar;
+    }
+    if(planarChannels != worker.planarChannels) {
+      worker.planarChannels = planarChannels;
+    }
+    if(accumulatorCacheLimit != worker.accumulatorCacheLimit) {
+      worker.accumulatorCacheLimit = accumulatorCacheLimit;
+    }
+    worker.divsor = divsor;
+    worker.backgroundColor = backgroundColor;
+    GFSMemoryRequest *request = GFSMemoryRequestBegin("convolve");
+    id convolvedImage = worker.convolvedImage;
+    GFSMemoryRequestEnd(request);
+    CFAbsoluteTime finished = CFAbsoluteTimeGetCurrent();
+    
+    dispatch_async(dispatch_get_main_queue(), ^{
+      // the parameters changed while convolving, a newer result is coming
+      if(generation != _generation) {
+        return;
+      }
+      if(nil == _convolvedImage && nil != convolvedImage) {
+        _convolvedImage = (__bridge id)CGImageRetain((__bridge CGImageRef)convolvedImage);
+      }
+      _lastLatency = (GFSConvolutionLatency){ started - requested,
+        finished - started,
+        CFAbsoluteTimeGetCurrent() - requested };
+      completion(convolvedImage, _lastLatency);
+    });
+  });
+}
+
+- (BOOL)convolveStripsOfHeight:(NSUInteger)stripHeight
+                    usingBlock:(void (^)(NSData *strip, NSUInteger firstRow, NSUInteger rowCount))block {
+  if(0 == stripHeight) {
+    return NO;
+  }
+  CGRect region = [self clippedRegionOfInterest];
+  size_t regionWidth = region.size.width;
+  size_t regionHeight = region.size.height;
+  size_t imageWidth = self.imageSize.width;
+  size_t imageHeight = self.imageSize.height;
+  size_t haloTop = self.kernelHeight / 2;
+  size_t haloBottom = self.kernelHeight - 1 - haloTop;
+  size_t stripCount = (regionHeight + stripHeight - 1) / stripHeight;
+  __block int32_t failures = 0;
+  // strips decoded on the fly are counted, slices of compliantData aren't
+  BOOL decodesStrips = nil == self.compliantData;
+  GFSMemoryRequest *request = GFSMemoryCurrentRequest();
+  
+  // each strip is one job on the calling thread, dispatch_apply keeps about
+  // one per core going which is what bounds the memory
+  dispatch_apply(stripCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+    // the strip's memory goes when it's done, not when dispatch_apply is
+    @autoreleasepool {
+      GFSMemoryRequest *previousRequest = GFSMemorySetCurrentRequest(request);
+      size_t firstRow = i * stripHeight;
+      size_t rowCount = MIN(stripHeight, regionHeight - firstRow);
+      // the image rows under the strip plus the kernel's reach above and
+      // below, anything past the edges of the image is background anyway
+      size_t top = region.origin.y + firstRow;
+      size_t loadTop = top > haloTop ? top - haloTop : 0;
+      size_t loadBottom = MIN(imageHeight, top + rowCount + haloBottom);
+      NSData *srcData = [self compliantDataForRows:NSMakeRange(loadTop, loadBottom - loadTop)];
+      size_t srcLength = decodesStrips ? [srcData length] : 0;
+      GFSMemoryRecordAllocation(GFSMemoryStageLoad, srcLength);
+      NSMutableData *destData = [NSMutableData dataWithLength:regionWidth * rowCount * 4];
+      GFSMemoryRecordAllocation(GFSMemoryStageConvolve, [destData length]);
+      GFSConvolutionError err = GFSConvolutionMemoryAllocationError;
+      if(nil != srcData && nil != destData) {
+        GFSConvolutionBuffer src = { (void *)[srcData bytes], loadBottom - loadTop, imageWidth, imageWidth * 4 };
+        GFSConvolutionBuffer dest = { [destData mutableBytes], rowCount, regionWidth, regionWidth * 4 };
+        err = [self convolve:&src
+                        into:&dest
+                    atOffset:CGPointMake(region.origin.x, top - loadTop)
+                       flags:GFSConvolutionSingleThread];
+      }
+      if(err == GFSConvolutionNoError) {
+        block(destData, firstRow, rowCount);
+      } else {
+        OSAtomicIncrement32(&failures);
+      }
+      GFSMemoryRecordFree(GFSMemoryStageConvolve, [destData length]);
+      GFSMemoryRecordFree(GFSMemoryStageLoad, srcLength);
+      GFSMemorySetCurrentRequest(previousRequest);
+    }
+  });
+  return 0 == failures;
+}
+
 @end
 
 
 @implementation GFSImageConvolver (Private)
 
+- (void)setDefaultParameters {
+  short edgeDetectionKernel[] = {
+    -1.0, -1.0, -1.0,
+    -1.0,  8.0, -1.0,
+    -1.0, -1.0, -1.0
+  };
+  [self setKernel:edgeDetectionKernel width:3 height:3];
+  // default to black background
+  self.backgroundColor = (GFSConvolverColor){0,0,0,0};
+  self.divsor = 1;
+  self.regionOfInterest = CGRectNull;
+  self.planarChannels = GFSConvolverChannelsColor;
+}
+
+// the region of interest in whole pixels inside the image
+- (CGRect)clippedRegionOfInterest {
+  CGRect image = CGRectMake(0., 0., self.imageSize.width, self.imageSize.height);
+  if(CGRectIsNull(self.regionOfInterest)) {
+    return image;
+  }
+  CGRect region = CGRectIntersection(CGRectIntegral(self.regionOfInterest), image);
+  if(CGRectIsNull(region)) {
+    return CGRectZero;
+  }
+  return region;
+}
+
+// same results as vImageConvolve_ARGB8888 with kvImageBackgroundColorFill
+- (GFSConvolutionError)convolve:(const GFSConvolutionBuffer *)src
+                           into:(const GFSConvolutionBuffer *)dest
+                       atOffset:(CGPoint)offset
+                          flags:(uint32_t)flags {
+  if(NULL != _rowKernel) {
+    return GFSConvolveSeparableARGB8888(src, dest, offset.x, offset.y,
+                                        _rowKernel, self.kernelWidth,
+                                        _columnKernel, self.kernelHeight,
+                                        self.divsor,
+                                        (uint8_t *)&_backgroundColor,
+                                        flags);
+  }
+  return GFSConvolveARGB8888(src, dest, offset.x, offset.y,
+                             _kernel, self.kernelWidth, self.kernelHeight,
+                             self.divsor,
+                             (uint8_t *)&_backgroundColor,
+                             flags);
+}
+
+// Convolve the planarChannels planes on their own and put them back
+// together with the untouched planes of the other channels.
+- (GFSConvolutionError)convolvePlanesInto:(const GFSConvolutionBuffer *)dest
+                                 atOffset:(CGPoint)offset {
+  if(nil == _separator) {
+    _separator = [[GFSImageSeparator alloc] initWithCompliantData:self.compliantData
+                                                        imageSize:self.imageSize];
+  }
+  // same order as the channels in the ARGB data and GFSConvolverColor
+  NSData *alphaData = _separator.alphaData;
+  NSData *redData = _separator.redData;
+  NSData *greenData = _separator.greenData;
+  NSData *blueData = _separator.blueData;
+  if(nil == alphaData || nil == redData || nil == greenData || nil == blueData) {
+    return GFSConvolutionMemoryAllocationError;
+  }
+  NSArray *planes = [NSArray arrayWithObjects:alphaData, redData, greenData, blueData, nil];
+  uint8_t *background = (uint8_t *)&_backgroundColor;
+  size_t width = self.imageSize.width;
+  size_t planeLength = dest->width * dest->height;
+  
+  GFSConvolutionError err = GFSConvolutionNoError;
+  vImage_Buffer channels[4];
+  GFSImageSurfacePool *pool = [GFSImageSurfacePool sharedPool];
+  uint8_t *convolvedData = [pool bufferWithLength:planeLength * 4];
+  if(NULL == convolvedData) {
+    return GFSConvolutionMemoryAllocationError;
+  }
+  for(NSUInteger i = 0;i < 4 && err == GFSConvolutionNoError;i++) {
+    uint8_t *plane = (uint8_t *)[[planes objectAtIndex:i] bytes];
+    if(0 == (self.planarChannels & (1 << i))) {
+      // passed through, straight out of the source under the region
+      channels[i] = (vImage_Buffer){ plane + (size_t)offset.y * width + (size_t)offset.x,
+        dest->height,
+        dest->width,
+        width };
+      continue;
+    }
+    channels[i] = (vImage_Buffer){ convolvedData + i * planeLength,
+      dest->height,
+      dest->width,
+      dest->width };
+    GFSConvolutionBuffer src = { plane, self.imageSize.height, width, width };
+    GFSConvolutionBuffer planeDest = { channels[i].data, dest->height, dest->width, dest->width };
+    if(NULL != _rowKernel) {
+      err = GFSConvolveSeparablePlanar8(&src, &planeDest, offset.x, offset.y,
+                                        _rowKernel, self.kernelWidth,
+                                        _columnKernel, self.kernelHeight,
+                                        self.divsor, background[i],
+                                        GFSConvolutionNoFlags);
+    } else {
+      err = GFSConvolvePlanar8(&src, &planeDest, offset.x, offset.y,
+                               _kernel, self.kernelWidth, self.kernelHeight,
+                               self.divsor, background[i],
+                               GFSConvolutionNoFlags);
+    }
+  }
+  if(err == GFSConvolutionNoError) {
+    vImage_Buffer argb = { dest->data, dest->height, dest->width, dest->rowBytes };
+    vImageConvert_Planar8toARGB8888(&channels[0], &channels[1], &channels[2], &channels[3],
+                                    &argb, kvImageNoFlags);
+  }
+  [pool recycleBuffer:convolvedData length:planeLength * 4];
+  return err;
+}
+
+// Convolve once into _accumulators and keep them, so after a new divisor
+// or background color all that's left is packing them into pixels again.
+- (GFSConvolutionError)convolveAccumulated:(const GFSConvolutionBuffer *)src
+                                      into:(const GFSConvolutionBuffer *)dest
+                                  atOffset:(CGPoint)offset {
+  GFSConvolutionBuffer accumulators = { NULL,
+    dest->height,
+    dest->width,
+    dest->width * 4 * sizeof(int32_t) };
+  if(nil == _accumulators) {
+    NSMutableData *data = [NSMutableData dataWithLength:accumulators.rowBytes * accumulators.height];
+    if(nil == data) {
+      return GFSConvolutionMemoryAllocationError;
+    }
+    GFSMemoryRecordAllocation(GFSMemoryStageConvolve, [data length]);
+    accumulators.data = [data mutableBytes];
+    GFSConvolutionError err = GFSConvolveAccumulateARGB8888(src, &accumulators, offset.x, offset.y,
+                                                            _kernel, self.kernelWidth, self.kernelHeight,
+                                                            GFSConvolutionNoFlags);
+    if(err != GFSConvolutionNoError) {
+      GFSMemoryRecordFree(GFSMemoryStageConvolve, [data length]);
+      return err;
+    }
+    _accumulators = data;
+  }
+  accumulators.data = [_accumulators mutableBytes];
+  return GFSConvolutionPackARGB8888(&accumulators, src, dest, offset.x, offset.y,
+                                    _kernel, self.kernelWidth, self.kernelHeight,
+                                    self.divsor,
+                                    (uint8_t *)&_backgroundColor,
+                                    GFSConvolutionNoFlags);
+}
+
 - (void)releaseConvolvedImage {
+  OSAtomicIncrement32Barrier(&_generation);
   if(nil != _convolvedImage) {
     CGImageRelease((__bridge CGImageRef)_convolvedImage);
     _convolvedImage = nil;
   }
 }
 
+- (void)releaseAccumulators {
+  GFSMemoryRecordFree(GFSMemoryStageConvolve, [_accumulators length]);
+  _accumulators = nil;
+}
+
+// Split the kernel into a row and a column kernel when it is worth it, see
+// GFSConvolutionShouldSeparateKernel.
+- (void)separateKernel {
+  free(_rowKernel);
+  free(_columnKernel);
+  _rowKernel = NULL;
+  _columnKernel = NULL;
+  
+  if(!GFSConvolutionShouldSeparateKernel(_kernel, self.kernelWidth, self.kernelHeight)) {
+    return;
+  }
+  
+  short *rowKernel = calloc(self.kernelWidth, sizeof(short));
+  short *columnKernel = calloc(self.kernelHeight, sizeof(short));
+  if(NULL != rowKernel && NULL != columnKernel &&
+     GFSConvolutionSeparateKernel(_kernel, self.kernelWidth, self.kernelHeight,
+                                  rowKernel, columnKernel)) {
+    _rowKernel = rowKernel;
+    _columnKernel = columnKernel;
+  } else {
+    free(rowKernel);
+    free(columnKernel);
+  }
+}
+
 @end
\ No newline at end of file
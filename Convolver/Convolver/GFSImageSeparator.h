@@ -10,9 +10,16 @@
 
 /*
  * original image separated into A, R, G, B components
+ *
+ * The components are available as grayscale images, or as the Planar8 data
+ * behind them (imageSize.width bytes per row) for GFSConvolvePlanar8 and
+ * friends.
  */
 @interface GFSImageSeparator : GFSVImageLoader
 
+// only GFSPixelFormatARGB8888, anything else returns nil
+- (id)initWithURL:(NSURL *)orignalImageURL pixelFormat:(GFSPixelFormat)pixelFormat;
+
 // CGImageRef in the DeviceGray color space
 @property(nonatomic, readonly, strong) id alphaComponent;
 // CGImageRef in the DeviceGray color space
@@ -22,4 +29,9 @@
 // CGImageRef in the DeviceGray color space
 @property(nonatomic, readonly, strong) id blueComponent;
 
+@property(nonatomic, readonly, strong) NSData *alphaData;
+@property(nonatomic, readonly, strong) NSData *redData;
+@property(nonatomic, readonly, strong) NSData *greenData;
+@property(nonatomic, readonly, strong) NSData *blueData;
+
 @end
@@ -7,12 +7,14 @@
 //
 
 #import "GFSImageSeparator.h"
+#import "GFSImageSurfacePool.h"
+#import "GFSMemoryAccounting.h"
 #import <Accelerate/Accelerate.h>
 
 
 @interface GFSImageSeparator(Private)
 
-- (id)newImageFromData:(void *)ptr;
+- (id)newImageFromData:(NSData *)data;
 - (void)separateComponents;
 
 @end
@@ -23,6 +25,35 @@
 @synthesize redComponent = _redComponent;
 @synthesize greenComponent = _greenComponent;
 @synthesize blueComponent = _blueComponent;
+@synthesize alphaData = _alphaData;
+@synthesize redData = _redData;
+@synthesize greenData = _greenData;
+@synthesize blueData = _blueData;
+
+- (id)initWithURL:(NSURL *)orignalImageURL pixelFormat:(GFSPixelFormat)pixelFormat {
+  // the components are split out of 4 byte ARGB
+  NSParameterAssert(GFSPixelFormatARGB8888 == pixelFormat);
+  if(GFSPixelFormatARGB8888 != pixelFormat) {
+    return nil;
+  }
+  return [super initWithURL:orignalImageURL pixelFormat:pixelFormat];
+}
+
+- (void)dealloc {
+  // the reference newImageFromData: returned, as when they're replaced
+  if(NULL != _alphaComponent) {
+    CGImageRelease((__bridge CGImageRef)_alphaComponent);
+  }
+  if(NULL != _redComponent) {
+    CGImageRelease((__bridge CGImageRef)_redComponent);
+  }
+  if(NULL != _greenComponent) {
+    CGImageRelease((__bridge CGImageRef)_greenComponent);
+  }
+  if(NULL != _blueComponent) {
+    CGImageRelease((__bridge CGImageRef)_blueComponent);
+  }
+}
 
 - (id)alphaComponent {
   if(nil == _alphaComponent) {
@@ -52,8 +83,42 @@
   return _blueComponent;
 }
 
+- (NSData *)alphaData {
+  if(nil == _alphaData) {
+    [self separateComponents];
+  }
+  return _alphaData;
+}
+
+- (NSData *)redData {
+  if(nil == _redData) {
+    [self separateComponents];
+  }
+  return _redData;
+}
+
+- (NSData *)greenData {
+  if(nil == _greenData) {
+    [self separateComponents];
+  }
+  return _greenData;
+}
+
+- (NSData *)blueData {
+  if(nil == _blueData) {
+    [self separateComponents];
+  }
+  return _blueData;
+}
+
 @end
 
+// called by Quartz when the last image using a plane goes away
+static void GFSReleasePlane(void *info, const void *data, size_t size) {
+  GFSMemoryRecordFree(GFSMemoryStageSeparate, size);
+  CFRelease(info);
+}
+
 @implementation GFSImageSeparator(Private)
 
 - (void)separateComponents {
@@ -61,23 +126,25 @@
     self.imageSize.height,
     self.imageSize.width,
     self.imageSize.width * 4};
-  void *alphaData = malloc(self.imageSize.width * self.imageSize.height);
-  vImage_Buffer alpha = { alphaData,
+  NSUInteger length = self.imageSize.width * self.imageSize.height;
+  NSMutableData *alphaData = [NSMutableData dataWithLength:length];
+  vImage_Buffer alpha = { [alphaData mutableBytes],
     self.imageSize.height,
     self.imageSize.width,
     self.imageSize.width };
-  void *redData = malloc(self.imageSize.width * self.imageSize.height);
-  vImage_Buffer red = { redData,
+  NSMutableData *redData = [NSMutableData dataWithLength:length];
+  vImage_Buffer red = { [redData mutableBytes],
     self.imageSize.height,
     self.imageSize.width,
     self.imageSize.width };
-  void *greenData = malloc(self.imageSize.width * self.imageSize.height);
-  vImage_Buffer green = { greenData,
+  NSMutableData *greenData = [NSMutableData dataWithLength:length];
+  vImage_Buffer green = { [greenData mutableBytes],
     self.imageSize.height,
     self.imageSize.width,
     self.imageSize.width };
-  void *blueData = malloc(self.imageSize.width * self.imageSize.height);
-  vImage_Buffer blue = { blueData,
+  NSMutableData *blueData = [NSMutableData dataWithLength:length];
+  GFSMemoryRecordAllocation(GFSMemoryStageSeparate, 4 * length);
+  vImage_Buffer blue = { [blueData mutableBytes],
     self.imageSize.height,
     self.imageSize.width,
     self.imageSize.width };
@@ -100,23 +167,33 @@
     _redComponent = [self newImageFromData:redData];
     _blueComponent = [self newImageFromData:blueData];
     _greenComponent = [self newImageFromData:greenData];    
+    _alphaData = alphaData;
+    _redData = redData;
+    _greenData = greenData;
+    _blueData = blueData;
+  } else {
+    GFSMemoryRecordFree(GFSMemoryStageSeparate, 4 * length);
   }
 }
 
-- (id)newImageFromData:(void *)ptr {
-  NSData *data = [NSData dataWithBytesNoCopy:ptr
-                                      length:self.imageSize.width * self.imageSize.height];
-  CGDataProviderRef dataProviderRef = CGDataProviderCreateWithCFData((__bridge CFDataRef)data);
-  // divice RGB is fine for iOS but for the Mac we'd want to be more creative
-  CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceGray();
+// The plane is counted under GFSMemoryStageSeparate until the image lets go
+// of it, or until here when there's no image.
+- (id)newImageFromData:(NSData *)data {
+  // no copy, the image keeps data (which the planar data shares) alive
+  CGDataProviderRef dataProviderRef = CGDataProviderCreateWithData((__bridge_retained void *)data,
+                                                                   [data bytes], [data length],
+                                                                   GFSReleasePlane);
+  if(NULL == dataProviderRef) {
+    GFSReleasePlane((__bridge void *)data, [data bytes], [data length]);
+    return nil;
+  }
   id image = (__bridge id)CGImageCreate(self.imageSize.width, self.imageSize.height,
                                         8, 8, self.imageSize.width,
-                                        colorSpace,
+                                        [GFSImageSurfacePool deviceGrayColorSpace],
                                         kCGBitmapByteOrder32Big | kCGImageAlphaNone,
                                         dataProviderRef,
                                         NULL, NO, kCGRenderingIntentDefault);
   CGDataProviderRelease(dataProviderRef);
-  CGColorSpaceRelease(colorSpace);
   return image;
 }
 
@@ -0,0 +1,56 @@
+//
+//  GFSImageSurfacePool.h
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreGraphics/CoreGraphics.h>
+
+/*
+ * Hands out pixel buffers for convolution results and wraps them in
+ * CGImages without copying. When the image (and everything holding on to
+ * it, UIImage, the image view's layer...) lets go, the buffer comes back to
+ * the pool for the next result instead of being freed, so recomputing an
+ * image of the same size over and over (dragging the divisor slider)
+ * doesn't malloc or free any image memory.
+ *
+ * A few buffers are kept (the one on screen and the one being computed is
+ * the usual case), they are all let go on a memory warning.
+ */
+@interface GFSImageSurfacePool : NSObject
+
++ (GFSImageSurfacePool *)sharedPool;
+
+// created once and never released, don't release them either
++ (CGColorSpaceRef)deviceRGBColorSpace;
++ (CGColorSpaceRef)deviceGrayColorSpace;
+
+// NULL if there's no memory
+- (void *)bufferWithLength:(size_t)length;
+
+// for a buffer from bufferWithLength: that didn't end up in an image
+- (void)recycleBuffer:(void *)buffer length:(size_t)length;
+
+// A +1 CGImageRef, kCGImageAlphaNoneSkipFirst like the loaded data, drawn
+// straight from buffer (which has to come from bufferWithLength:). The pool
+// owns the buffer from here on, even if this returns nil.
+- (id)newImageWithBuffer:(void *)buffer width:(size_t)width height:(size_t)height;
+
+- (void)releaseBuffers;
+
+@end
@@ -0,0 +1,160 @@
+//
+//  GFSImageSurfacePool.m
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "GFSImageSurfacePool.h"
+#import "GFSMemoryAccounting.h"
+#import <UIKit/UIKit.h>
+
+// enough for the image on screen, the one being computed and one more
+#define GFSMaxPooledBuffers 4
+
+// called by Quartz, on whatever thread lets go of the image last
+static void GFSImageSurfacePoolReleaseData(void *info, const void *data, size_t size) {
+  GFSImageSurfacePool *pool = (__bridge_transfer GFSImageSurfacePool *)info;
+  [pool recycleBuffer:(void *)data length:size];
+}
+
+@implementation GFSImageSurfacePool {
+  // oldest first
+  void *_buffers[GFSMaxPooledBuffers];
+  size_t _lengths[GFSMaxPooledBuffers];
+  NSUInteger _count;
+}
+
++ (GFSImageSurfacePool *)sharedPool {
+  static GFSImageSurfacePool *sharedPool = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    sharedPool = [[GFSImageSurfacePool alloc] init];
+  });
+  return sharedPool;
+}
+
++ (CGColorSpaceRef)deviceRGBColorSpace {
+  static CGColorSpaceRef colorSpace = NULL;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    // divice RGB is fine for iOS but for the Mac we'd want to be more creative
+    colorSpace = CGColorSpaceCreateDeviceRGB();
+  });
+  return colorSpace;
+}
+
++ (CGColorSpaceRef)deviceGrayColorSpace {
+  static CGColorSpaceRef colorSpace = NULL;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    colorSpace = CGColorSpaceCreateDeviceGray();
+  });
+  return colorSpace;
+}
+
+- (id)init {
+  self = [super init];
+  if(nil != self) {
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(releaseBuffers)
+                                                 name:UIApplicationDidReceiveMemoryWarningNotification
+                                               object:nil];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [[NSNotificationCenter defaultCenter] removeObserver:self];
+  [self releaseBuffers];
+}
+
+- (void *)bufferWithLength:(size_t)length {
+  @synchronized(self) {
+    // newest first, it's the most likely to still be in the cache
+    for(NSUInteger i = _count;i > 0;i--) {
+      if(_lengths[i - 1] == length) {
+        void *buffer = _buffers[i - 1];
+        memmove(&_buffers[i - 1], &_buffers[i], (_count - i) * sizeof(void *));
+        memmove(&_lengths[i - 1], &_lengths[i], (_count - i) * sizeof(size_t));
+        _count--;
+        return buffer;
+      }
+    }
+  }
+  void *buffer = malloc(length);
+  if(NULL != buffer) {
+    GFSMemoryRecordAllocation(GFSMemoryStageConvolve, length);
+  }
+  return buffer;
+}
+
+- (void)recycleBuffer:(void *)buffer length:(size_t)length {
+  if(NULL == buffer) {
+    return;
+  }
+  void *evicted = NULL;
+  size_t evictedLength = 0;
+  @synchronized(self) {
+    if(GFSMaxPooledBuffers == _count) {
+      evicted = _buffers[0];
+      evictedLength = _lengths[0];
+      memmove(&_buffers[0], &_buffers[1], (_count - 1) * sizeof(void *));
+      memmove(&_lengths[0], &_lengths[1], (_count - 1) * sizeof(size_t));
+      _count--;
+    }
+    _buffers[_count] = buffer;
+    _lengths[_count] = length;
+    _count++;
+  }
+  if(NULL != evicted) {
+    free(evicted);
+    GFSMemoryRecordFree(GFSMemoryStageConvolve, evictedLength);
+  }
+}
+
+- (id)newImageWithBuffer:(void *)buffer width:(size_t)width height:(size_t)height {
+  size_t length = width * height * 4;
+  CGDataProviderRef dataProviderRef = CGDataProviderCreateWithData((__bridge_retained void *)self,
+                                                                   buffer, length,
+                                                                   GFSImageSurfacePoolReleaseData);
+  if(NULL == dataProviderRef) {
+    CFRelease((__bridge CFTypeRef)self);
+    [self recycleBuffer:buffer length:length];
+    return nil;
+  }
+  id image = (__bridge id)CGImageCreate(width, height,
+                                        8, 8 * 4, width * 4,
+                                        [GFSImageSurfacePool deviceRGBColorSpace],
+                                        kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipFirst,
+                                        dataProviderRef,
+                                        NULL, NO, kCGRenderingIntentDefault);
+  // the image has its own reference, when it goes the buffer comes back
+  CGDataProviderRelease(dataProviderRef);
+  return image;
+}
+
+- (void)releaseBuffers {
+  @synchronized(self) {
+    for(NSUInteger i = 0;i < _count;i++) {
+      free(_buffers[i]);
+      GFSMemoryRecordFree(GFSMemoryStageConvolve, _lengths[i]);
+    }
+    _count = 0;
+  }
+}
+
+@end
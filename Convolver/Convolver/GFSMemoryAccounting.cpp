@@ -0,0 +1,254 @@
+//
+//  GFSMemoryAccounting.cpp
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "GFSMemoryAccounting.h"
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <string.h>
+
+#include <pthread.h>
+
+namespace {
+
+// how many ended requests the report shows
+const size_t kReportedRequests = 8;
+
+struct Counters {
+  std::atomic<int64_t> live;
+  std::atomic<int64_t> peak;
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> frees;
+  std::atomic<uint64_t> allocatedBytes;
+
+  Counters() : live(0), peak(0), allocations(0), frees(0), allocatedBytes(0) {
+  }
+};
+
+// per stage, and the total kept separately so it has a peak of its own
+struct Account {
+  Counters stages[GFSMemoryStageCount];
+  Counters total;
+};
+
+void RaisePeak(std::atomic<int64_t> &peak, int64_t live) {
+  int64_t current = peak.load(std::memory_order_relaxed);
+  while(live > current && !peak.compare_exchange_weak(current, live, std::memory_order_relaxed)) {
+  }
+}
+
+void Allocate(Counters &counters, int64_t bytes) {
+  int64_t live = counters.live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  counters.allocations.fetch_add(1, std::memory_order_relaxed);
+  counters.allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+  RaisePeak(counters.peak, live);
+}
+
+void Free(Counters &counters, int64_t bytes) {
+  counters.live.fetch_sub(bytes, std::memory_order_relaxed);
+  counters.frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Copy(const Counters &counters, GFSMemoryStats *stats) {
+  stats->liveBytes = counters.live.load(std::memory_order_relaxed);
+  stats->peakBytes = counters.peak.load(std::memory_order_relaxed);
+  stats->allocations = counters.allocations.load(std::memory_order_relaxed);
+  stats->frees = counters.frees.load(std::memory_order_relaxed);
+  stats->allocatedBytes = counters.allocatedBytes.load(std::memory_order_relaxed);
+}
+
+void Copy(const Account &account, GFSMemoryStage stage, GFSMemoryStats *stats) {
+  Copy(stage < GFSMemoryStageCount ? account.stages[stage] : account.total, stats);
+}
+
+Account gAccount;
+
+#pragma mark - Current request
+
+pthread_key_t gCurrentRequestKey;
+pthread_once_t gCurrentRequestOnce = PTHREAD_ONCE_INIT;
+
+void CreateCurrentRequestKey() {
+  pthread_key_create(&gCurrentRequestKey, NULL);
+}
+
+GFSMemoryRequest *CurrentRequest() {
+  pthread_once(&gCurrentRequestOnce, CreateCurrentRequestKey);
+  return (GFSMemoryRequest *)pthread_getspecific(gCurrentRequestKey);
+}
+
+// a request that's ended, for the report
+struct EndedRequest {
+  char name[64];
+  GFSMemoryStats stages[GFSMemoryStageCount + 1];
+};
+
+std::mutex gEndedMutex;
+EndedRequest gEnded[kReportedRequests];
+size_t gEndedCount = 0;
+
+void WriteStats(FILE *file, const char *request, const char *stage, const GFSMemoryStats &stats) {
+  if(NULL != request) {
+    fprintf(file, "%s,", request);
+  }
+  fprintf(file, "%s,%lld,%lld,%llu,%llu,%llu\n", stage, (long long)stats.liveBytes, (long long)stats.peakBytes,
+          (unsigned long long)stats.allocations, (unsigned long long)stats.frees,
+          (unsigned long long)stats.allocatedBytes);
+}
+
+}
+
+struct GFSMemoryRequest {
+  char name[64];
+  // the request this one began inside of, counted as well
+  GFSMemoryRequest *parent;
+  Account account;
+};
+
+#pragma mark - Recording
+
+void GFSMemoryRecordAllocation(GFSMemoryStage stage, size_t bytes) {
+  if(stage >= GFSMemoryStageCount || 0 == bytes) {
+    return;
+  }
+  Allocate(gAccount.stages[stage], (int64_t)bytes);
+  Allocate(gAccount.total, (int64_t)bytes);
+  for(GFSMemoryRequest *request = CurrentRequest();NULL != request;request = request->parent) {
+    Allocate(request->account.stages[stage], (int64_t)bytes);
+    Allocate(request->account.total, (int64_t)bytes);
+  }
+}
+
+void GFSMemoryRecordFree(GFSMemoryStage stage, size_t bytes) {
+  if(stage >= GFSMemoryStageCount || 0 == bytes) {
+    return;
+  }
+  Free(gAccount.stages[stage], (int64_t)bytes);
+  Free(gAccount.total, (int64_t)bytes);
+  for(GFSMemoryRequest *request = CurrentRequest();NULL != request;request = request->parent) {
+    Free(request->account.stages[stage], (int64_t)bytes);
+    Free(request->account.total, (int64_t)bytes);
+  }
+}
+
+void GFSMemoryGetStats(GFSMemoryStage stage, GFSMemoryStats *stats) {
+  if(NULL != stats) {
+    Copy(gAccount, stage, stats);
+  }
+}
+
+void GFSMemoryResetPeaks(void) {
+  for(size_t i = 0;i < GFSMemoryStageCount;i++) {
+    gAccount.stages[i].peak.store(gAccount.stages[i].live.load());
+  }
+  gAccount.total.peak.store(gAccount.total.live.load());
+}
+
+const char *GFSMemoryStageName(GFSMemoryStage stage) {
+  static const char *names[GFSMemoryStageCount + 1] = {
+    "load", "separate", "convolve", "decode", "resample", "total"
+  };
+  return names[stage < GFSMemoryStageCount ? stage : GFSMemoryStageCount];
+}
+
+#pragma mark - Requests
+
+GFSMemoryRequest *GFSMemoryRequestBegin(const char *name) {
+  GFSMemoryRequest *request = new (std::nothrow) GFSMemoryRequest();
+  if(NULL == request) {
+    return NULL;
+  }
+  strncpy(request->name, NULL != name ? name : "", sizeof(request->name) - 1);
+  request->name[sizeof(request->name) - 1] = '\0';
+  request->parent = CurrentRequest();
+  pthread_setspecific(gCurrentRequestKey, request);
+  return request;
+}
+
+GFSMemoryRequest *GFSMemoryCurrentRequest(void) {
+  return CurrentRequest();
+}
+
+GFSMemoryRequest *GFSMemorySetCurrentRequest(GFSMemoryRequest *request) {
+  GFSMemoryRequest *previous = CurrentRequest();
+  pthread_setspecific(gCurrentRequestKey, request);
+  return previous;
+}
+
+void GFSMemoryRequestGetStats(const GFSMemoryRequest *request, GFSMemoryStage stage, GFSMemoryStats *stats) {
+  if(NULL == stats) {
+    return;
+  }
+  if(NULL == request) {
+    memset(stats, 0, sizeof(*stats));
+    return;
+  }
+  Copy(request->account, stage, stats);
+}
+
+void GFSMemoryRequestEnd(GFSMemoryRequest *request) {
+  if(NULL == request) {
+    return;
+  }
+  if(CurrentRequest() == request) {
+    pthread_setspecific(gCurrentRequestKey, request->parent);
+  }
+  {
+    std::lock_guard<std::mutex> lock(gEndedMutex);
+    // oldest first, the oldest goes when it's full
+    if(kReportedRequests == gEndedCount) {
+      memmove(&gEnded[0], &gEnded[1], (kReportedRequests - 1) * sizeof(EndedRequest));
+      gEndedCount--;
+    }
+    EndedRequest &ended = gEnded[gEndedCount++];
+    memcpy(ended.name, request->name, sizeof(ended.name));
+    for(size_t i = 0;i <= GFSMemoryStageCount;i++) {
+      Copy(request->account, (GFSMemoryStage)i, &ended.stages[i]);
+    }
+  }
+  delete request;
+}
+
+#pragma mark - Report
+
+void GFSMemoryWriteReport(FILE *file) {
+  GFSMemoryStats stats;
+  fprintf(file, "stage,live_bytes,peak_bytes,allocations,frees,allocated_bytes\n");
+  for(size_t i = 0;i <= GFSMemoryStageCount;i++) {
+    GFSMemoryGetStats((GFSMemoryStage)i, &stats);
+    WriteStats(file, NULL, GFSMemoryStageName((GFSMemoryStage)i), stats);
+  }
+
+  std::lock_guard<std::mutex> lock(gEndedMutex);
+  if(0 == gEndedCount) {
+    return;
+  }
+  fprintf(file, "request,stage,live_bytes,peak_bytes,allocations,frees,allocated_bytes\n");
+  for(size_t r = 0;r < gEndedCount;r++) {
+    // only the stages the request touched, and its total
+    for(size_t i = 0;i <= GFSMemoryStageCount;i++) {
+      const GFSMemoryStats &requestStats = gEnded[r].stages[i];
+      if(GFSMemoryStageCount == i || 0 != requestStats.allocations || 0 != requestStats.frees) {
+        WriteStats(file, gEnded[r].name, GFSMemoryStageName((GFSMemoryStage)i), requestStats);
+      }
+    }
+  }
+}
@@ -0,0 +1,148 @@
+//
+//  GFSMemoryAccounting.h
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#ifndef GFSMemoryAccounting_h
+#define GFSMemoryAccounting_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Counts the memory the image code uses, by stage and by request, so the
+ * footprint is measured rather than worked out by hand. Only what's worth
+ * counting is counted: the image sized buffers and the engines' per band
+ * scratch, each recorded where it's allocated and freed (or let go of, for
+ * buffers handed to Core Graphics).
+ *
+ * For every stage there are the live bytes, their peak since the last
+ * GFSMemoryResetPeaks, the number of allocations and frees and the bytes
+ * allocated in all. The counters are atomics, nothing next to the
+ * allocations they count.
+ *
+ * A request (one decode, one convolution) collects the same numbers for
+ * what's allocated and freed on a thread while it's current there. It's
+ * current on the thread that begins it, GFSMemorySetCurrentRequest makes
+ * it current on the threads it hands work to. Requests nest, and count
+ * toward every request they're inside of. A request's live bytes are what
+ * it's added so far, below zero when it's freed more than it allocated, and
+ * what's live when it ends is what it left behind (the image it made).
+ *
+ * GFSMemoryWriteReport prints all of it, and the last few requests, as CSV.
+ */
+
+typedef enum {
+  // decoded source pixels, GFSVImageLoader
+  GFSMemoryStageLoad = 0,
+  // planes split out of an image, GFSImageSeparator
+  GFSMemoryStageSeparate,
+  // results, sums and scratch of GFSImageConvolver, GFSConvolutionPipeline,
+  // GFSImageSurfacePool and GFSConvolutionEngine
+  GFSMemoryStageConvolve,
+  // decoded images and the progressive decoder's scratch
+  GFSMemoryStageDecode,
+  // GFSResampler's intermediate rows
+  GFSMemoryStageResample,
+  GFSMemoryStageCount
+} GFSMemoryStage;
+
+typedef struct GFSMemoryStats {
+  int64_t liveBytes;
+  int64_t peakBytes;
+  uint64_t allocations;
+  uint64_t frees;
+  uint64_t allocatedBytes;
+} GFSMemoryStats;
+
+typedef struct GFSMemoryRequest GFSMemoryRequest;
+
+void GFSMemoryRecordAllocation(GFSMemoryStage stage, size_t bytes);
+void GFSMemoryRecordFree(GFSMemoryStage stage, size_t bytes);
+
+// stage's numbers, or all of the stages' together for GFSMemoryStageCount
+// (the peak of the total, not the total of the peaks)
+void GFSMemoryGetStats(GFSMemoryStage stage, GFSMemoryStats *stats);
+
+// Peaks start over from what's live now, between benchmark runs say.
+void GFSMemoryResetPeaks(void);
+
+// "load", "separate"... "total" for GFSMemoryStageCount
+const char *GFSMemoryStageName(GFSMemoryStage stage);
+
+// Begins a request, current on the calling thread, inside whichever one was
+// current. name is copied. NULL if there's no memory for it, which the rest
+// of the functions take as no request.
+GFSMemoryRequest *GFSMemoryRequestBegin(const char *name);
+
+// the calling thread's request, NULL outside of one
+GFSMemoryRequest *GFSMemoryCurrentRequest(void);
+
+// Makes request (or NULL) current on the calling thread, for work done for
+// it on other threads. Returns the one that was, to put back after.
+GFSMemoryRequest *GFSMemorySetCurrentRequest(GFSMemoryRequest *request);
+
+// request's numbers so far, like GFSMemoryGetStats
+void GFSMemoryRequestGetStats(const GFSMemoryRequest *request, GFSMemoryStage stage, GFSMemoryStats *stats);
+
+// Ends request on the thread that began it, the one it began inside of is
+// current again. Work on other threads for it must be done. Its numbers are
+// kept for GFSMemoryWriteReport and request is freed.
+void GFSMemoryRequestEnd(GFSMemoryRequest *request);
+
+// Every stage, then the last few requests to end, as CSV.
+void GFSMemoryWriteReport(FILE *file);
+
+#ifdef __cplusplus
+}
+
+// Counts bytes under stage for as long as it's in scope, so scratch that an
+// exception unwinds past is still let go of.
+struct GFSMemoryCharge {
+  GFSMemoryStage stage;
+  size_t bytes;
+
+  explicit GFSMemoryCharge(GFSMemoryStage chargedStage, size_t chargedBytes = 0) : stage(chargedStage), bytes(0) {
+    Resize(chargedBytes);
+  }
+
+  ~GFSMemoryCharge() {
+    Resize(0);
+  }
+
+  GFSMemoryCharge(const GFSMemoryCharge &) = delete;
+  GFSMemoryCharge &operator=(const GFSMemoryCharge &) = delete;
+
+  // what's counted is newBytes from here on
+  void Resize(size_t newBytes) {
+    if(newBytes > bytes) {
+      GFSMemoryRecordAllocation(stage, newBytes - bytes);
+    } else if(newBytes < bytes) {
+      GFSMemoryRecordFree(stage, bytes - newBytes);
+    }
+    bytes = newBytes;
+  }
+};
+#endif
+
+#endif
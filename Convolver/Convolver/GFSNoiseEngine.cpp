@@ -0,0 +1,881 @@
+//
+//  GFSNoiseEngine.cpp
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "GFSNoiseEngine.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__)
+  #include <immintrin.h>
+  #define GFS_NOISE_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define GFS_NOISE_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define GFS_NOISE_NEON 1
+#endif
+
+namespace {
+
+// pixels per random block
+const size_t kBlockPixels = 16;
+// don't bother starting a thread for less work than this
+const size_t kMinBlocksPerThread = 4096;
+const size_t kMinRowsPerThread = 16;
+// octave keys come from blocks far past any white noise buffer
+const uint64_t kOctaveKeyCounter = 0xFFFFFFFF00000000ULL;
+
+#pragma mark - Philox
+
+const uint32_t kPhiloxM0 = 0xD2511F53;
+const uint32_t kPhiloxM1 = 0xCD9E8D57;
+const uint32_t kPhiloxW0 = 0x9E3779B9;
+const uint32_t kPhiloxW1 = 0xBB67AE85;
+
+inline void Philox(uint64_t seed, uint64_t counter, uint32_t out[4]) {
+  uint32_t c0 = (uint32_t)counter;
+  uint32_t c1 = (uint32_t)(counter >> 32);
+  uint32_t c2 = 0;
+  uint32_t c3 = 0;
+  uint32_t k0 = (uint32_t)seed;
+  uint32_t k1 = (uint32_t)(seed >> 32);
+  for(int round = 0; round < 10; round++) {
+    const uint64_t p0 = (uint64_t)kPhiloxM0 * c0;
+    const uint64_t p1 = (uint64_t)kPhiloxM1 * c2;
+    const uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+    const uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+    c1 = (uint32_t)p1;
+    c3 = (uint32_t)p0;
+    c0 = n0;
+    c2 = n2;
+    k0 += kPhiloxW0;
+    k1 += kPhiloxW1;
+  }
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+// the words little endian whatever the machine, so the bytes are the same
+// everywhere
+inline void RandomBlock(uint64_t seed, uint64_t counter, uint8_t bytes[16]) {
+  uint32_t words[4];
+  Philox(seed, counter, words);
+  for(int i = 0; i < 4; i++) {
+    bytes[i * 4] = (uint8_t)words[i];
+    bytes[i * 4 + 1] = (uint8_t)(words[i] >> 8);
+    bytes[i * 4 + 2] = (uint8_t)(words[i] >> 16);
+    bytes[i * 4 + 3] = (uint8_t)(words[i] >> 24);
+  }
+}
+
+#pragma mark - Expanding
+
+// 16 random bytes into 16 gray pixels
+inline void ExpandARGBScalar(const uint8_t *values, uint8_t *pixels, size_t count) {
+  for(size_t i = 0; i < count; i++) {
+    pixels[i * 4] = 255;
+    pixels[i * 4 + 1] = values[i];
+    pixels[i * 4 + 2] = values[i];
+    pixels[i * 4 + 3] = values[i];
+  }
+}
+
+inline void ExpandALScalar(const uint8_t *values, uint8_t *pixels, size_t count) {
+  for(size_t i = 0; i < count; i++) {
+    pixels[i * 2] = 255;
+    pixels[i * 2 + 1] = values[i];
+  }
+}
+
+#if GFS_NOISE_SSE2 || GFS_NOISE_AVX2
+
+inline void ExpandARGB(const uint8_t *values, uint8_t *pixels) {
+  const __m128i v = _mm_loadu_si128((const __m128i *)values);
+  const __m128i opaque = _mm_set1_epi8((char)0xFF);
+  // (255, v) and (v, v) pairs, interleaved again into 255, v, v, v
+  const __m128i av0 = _mm_unpacklo_epi8(opaque, v);
+  const __m128i av1 = _mm_unpackhi_epi8(opaque, v);
+  const __m128i vv0 = _mm_unpacklo_epi8(v, v);
+  const __m128i vv1 = _mm_unpackhi_epi8(v, v);
+  const __m128i p0 = _mm_unpacklo_epi16(av0, vv0);
+  const __m128i p1 = _mm_unpackhi_epi16(av0, vv0);
+  const __m128i p2 = _mm_unpacklo_epi16(av1, vv1);
+  const __m128i p3 = _mm_unpackhi_epi16(av1, vv1);
+#if GFS_NOISE_AVX2
+  _mm256_storeu_si256((__m256i *)pixels, _mm256_inserti128_si256(_mm256_castsi128_si256(p0), p1, 1));
+  _mm256_storeu_si256((__m256i *)(pixels + 32), _mm256_inserti128_si256(_mm256_castsi128_si256(p2), p3, 1));
+#else
+  _mm_storeu_si128((__m128i *)pixels, p0);
+  _mm_storeu_si128((__m128i *)(pixels + 16), p1);
+  _mm_storeu_si128((__m128i *)(pixels + 32), p2);
+  _mm_storeu_si128((__m128i *)(pixels + 48), p3);
+#endif
+}
+
+inline void ExpandAL(const uint8_t *values, uint8_t *pixels) {
+  const __m128i v = _mm_loadu_si128((const __m128i *)values);
+  const __m128i opaque = _mm_set1_epi8((char)0xFF);
+  const __m128i p0 = _mm_unpacklo_epi8(opaque, v);
+  const __m128i p1 = _mm_unpackhi_epi8(opaque, v);
+#if GFS_NOISE_AVX2
+  _mm256_storeu_si256((__m256i *)pixels, _mm256_inserti128_si256(_mm256_castsi128_si256(p0), p1, 1));
+#else
+  _mm_storeu_si128((__m128i *)pixels, p0);
+  _mm_storeu_si128((__m128i *)(pixels + 16), p1);
+#endif
+}
+
+#elif GFS_NOISE_NEON
+
+inline void ExpandARGB(const uint8_t *values, uint8_t *pixels) {
+  const uint8x16_t v = vld1q_u8(values);
+  uint8x16x4_t p;
+  p.val[0] = vdupq_n_u8(255);
+  p.val[1] = v;
+  p.val[2] = v;
+  p.val[3] = v;
+  vst4q_u8(pixels, p);
+}
+
+inline void ExpandAL(const uint8_t *values, uint8_t *pixels) {
+  uint8x16x2_t p;
+  p.val[0] = vdupq_n_u8(255);
+  p.val[1] = vld1q_u8(values);
+  vst2q_u8(pixels, p);
+}
+
+#else
+
+inline void ExpandARGB(const uint8_t *values, uint8_t *pixels) {
+  ExpandARGBScalar(values, pixels, kBlockPixels);
+}
+
+inline void ExpandAL(const uint8_t *values, uint8_t *pixels) {
+  ExpandALScalar(values, pixels, kBlockPixels);
+}
+
+#endif
+
+#pragma mark - Filling
+
+struct Fill {
+  uint8_t *data;
+  size_t count;
+  // bytes per pixel, 4 or 2
+  size_t pixelBytes;
+  uint64_t seed;
+  bool scalar;
+};
+
+void FillBlocks(const Fill *fill, size_t firstBlock, size_t lastBlock) {
+  uint8_t values[kBlockPixels];
+  for(size_t block = firstBlock; block < lastBlock; block++) {
+    RandomBlock(fill->seed, block, values);
+    const size_t first = block * kBlockPixels;
+    const size_t count = std::min(kBlockPixels, fill->count - first);
+    uint8_t *pixels = fill->data + first * fill->pixelBytes;
+    if(count < kBlockPixels || fill->scalar) {
+      if(4 == fill->pixelBytes) {
+        ExpandARGBScalar(values, pixels, count);
+      } else {
+        ExpandALScalar(values, pixels, count);
+      }
+    } else if(4 == fill->pixelBytes) {
+      ExpandARGB(values, pixels);
+    } else {
+      ExpandAL(values, pixels);
+    }
+  }
+}
+
+void RunFill(const Fill &fill, uint32_t flags) {
+  const size_t blockCount = (fill.count + kBlockPixels - 1) / kBlockPixels;
+  size_t threadCount = 1;
+  if(0 == (flags & GFSNoiseSingleThread)) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, std::max((size_t)1, blockCount / kMinBlocksPerThread));
+  }
+
+  // the calling thread takes the first band, and any band a thread
+  // couldn't be started for
+  const size_t band = (blockCount + threadCount - 1) / threadCount;
+  std::vector<std::thread> threads;
+  for(size_t t = 1; t < threadCount; t++) {
+    const size_t first = t * band;
+    const size_t last = std::min(blockCount, first + band);
+    if(first < last) {
+      try {
+        threads.push_back(std::thread(FillBlocks, &fill, first, last));
+      } catch(const std::system_error &) {
+        FillBlocks(&fill, first, last);
+      }
+    }
+  }
+  FillBlocks(&fill, 0, std::min(blockCount, band));
+  for(size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+}
+
+#pragma mark - Gradient noise
+
+// 2D Perlin gradient noise. Each lattice point gets one of 8 gradients by
+// hashing its coordinates with the octave's key, so any point can be
+// evaluated on its own: rows in parallel, tiles that line up, no
+// permutation table.
+//
+// Along a row the lattice row and fy are fixed, so for each lattice column
+// the two corners above and below are folded into one linear function of
+// dx, P + Q * dx. Each pixel is then a fade weighted lerp of the functions
+// of the columns on either side of it, which is straight float math across
+// pixels once P and Q are gathered.
+
+const float kGradientX[8] = { 1.f, -1.f, 1.f, -1.f, 1.f, -1.f, 0.f, 0.f };
+const float kGradientY[8] = { 1.f, 1.f, -1.f, -1.f, 0.f, 0.f, 1.f, -1.f };
+
+inline uint32_t LatticeHash(uint32_t key, int32_t x, int32_t y) {
+  uint32_t h = ((uint32_t)x * 0x8DA6B343u) ^ ((uint32_t)y * 0xD8163841u) ^ key;
+  h ^= h >> 16;
+  h *= 0x7FEB352Du;
+  h ^= h >> 15;
+  h *= 0x846CA68Bu;
+  h ^= h >> 16;
+  return h & 7;
+}
+
+inline float Fade(float t) {
+  return t * t * t * (t * (t * 6.f - 15.f) + 10.f);
+}
+
+struct Octave {
+  uint32_t key;
+  float amplitude;
+  double frequency;
+  // lattice column of the first pixel
+  int32_t firstColumn;
+  // lattice columns P and Q are needed for, the last pixel's right one too
+  size_t columnCount;
+  // per pixel: its lattice column (from firstColumn), its distance from it
+  // and the fade of that distance
+  std::vector<int32_t> columns;
+  std::vector<float> dx;
+  std::vector<float> fadeX;
+};
+
+struct Fractal {
+  uint8_t *data;
+  size_t width;
+  size_t height;
+  size_t rowBytes;
+  int32_t originX;
+  int32_t originY;
+  std::vector<Octave> octaves;
+  // the sum of the octaves to 0...255
+  float scale;
+  float bias;
+  bool scalar;
+};
+
+void SetupOctave(Octave &octave, const Fractal &fractal, uint64_t seed, uint32_t index,
+                 double frequency, float amplitude) {
+  uint8_t key[16];
+  RandomBlock(seed, kOctaveKeyCounter + index, key);
+  octave.key = key[0] | (key[1] << 8) | (key[2] << 16) | ((uint32_t)key[3] << 24);
+  octave.amplitude = amplitude;
+  octave.frequency = frequency;
+  octave.firstColumn = (int32_t)floor(fractal.originX * frequency);
+  octave.columns.resize(fractal.width);
+  octave.dx.resize(fractal.width);
+  octave.fadeX.resize(fractal.width);
+  for(size_t x = 0; x < fractal.width; x++) {
+    const double position = ((double)fractal.originX + x) * frequency;
+    const double column = floor(position);
+    octave.columns[x] = (int32_t)column - octave.firstColumn;
+    octave.dx[x] = (float)(position - column);
+    octave.fadeX[x] = Fade(octave.dx[x]);
+  }
+  octave.columnCount = octave.columns[fractal.width - 1] + 2;
+}
+
+// P and Q for each lattice column of the octave at row y
+void FoldColumns(const Octave &octave, int32_t y, float *p, float *q) {
+  const double position = y * octave.frequency;
+  const double row = floor(position);
+  const int32_t lattice = (int32_t)row;
+  const float fy = (float)(position - row);
+  const float sy = Fade(fy);
+  for(size_t c = 0; c < octave.columnCount; c++) {
+    const int32_t x = octave.firstColumn + (int32_t)c;
+    const uint32_t top = LatticeHash(octave.key, x, lattice);
+    const uint32_t bottom = LatticeHash(octave.key, x, lattice + 1);
+    const float a = kGradientY[top] * fy;
+    const float b = kGradientY[bottom] * (fy - 1.f);
+    p[c] = a + sy * (b - a);
+    q[c] = kGradientX[top] + sy * (kGradientX[bottom] - kGradientX[top]);
+  }
+}
+
+inline float NoiseScalar(const Octave &octave, const float *p, const float *q, size_t x) {
+  const int32_t c = octave.columns[x];
+  const float dx = octave.dx[x];
+  const float left = p[c] + q[c] * dx;
+  const float right = p[c + 1] + q[c + 1] * (dx - 1.f);
+  return left + octave.fadeX[x] * (right - left);
+}
+
+void AddOctaveScalar(const Octave &octave, const float *p, const float *q,
+                     float *sums, size_t first, size_t last) {
+  for(size_t x = first; x < last; x++) {
+    sums[x] += octave.amplitude * NoiseScalar(octave, p, q, x);
+  }
+}
+
+#if GFS_NOISE_AVX2
+
+size_t AddOctave(const Octave &octave, const float *p, const float *q, float *sums, size_t width) {
+  const __m256 amplitude = _mm256_set1_ps(octave.amplitude);
+  const __m256 one = _mm256_set1_ps(1.f);
+  size_t x = 0;
+  for(; x + 8 <= width; x += 8) {
+    const __m256i c = _mm256_loadu_si256((const __m256i *)&octave.columns[x]);
+    const __m256 dx = _mm256_loadu_ps(&octave.dx[x]);
+    const __m256 left = _mm256_add_ps(_mm256_i32gather_ps(p, c, 4),
+                                      _mm256_mul_ps(_mm256_i32gather_ps(q, c, 4), dx));
+    const __m256 right = _mm256_add_ps(_mm256_i32gather_ps(p + 1, c, 4),
+                                       _mm256_mul_ps(_mm256_i32gather_ps(q + 1, c, 4), _mm256_sub_ps(dx, one)));
+    const __m256 noise = _mm256_add_ps(left, _mm256_mul_ps(_mm256_loadu_ps(&octave.fadeX[x]),
+                                                           _mm256_sub_ps(right, left)));
+    _mm256_storeu_ps(sums + x, _mm256_add_ps(_mm256_loadu_ps(sums + x), _mm256_mul_ps(amplitude, noise)));
+  }
+  return x;
+}
+
+#elif GFS_NOISE_SSE2
+
+inline __m128 Gather(const float *values, const int32_t *c) {
+  return _mm_setr_ps(values[c[0]], values[c[1]], values[c[2]], values[c[3]]);
+}
+
+size_t AddOctave(const Octave &octave, const float *p, const float *q, float *sums, size_t width) {
+  const __m128 amplitude = _mm_set1_ps(octave.amplitude);
+  const __m128 one = _mm_set1_ps(1.f);
+  size_t x = 0;
+  for(; x + 4 <= width; x += 4) {
+    const int32_t *c = &octave.columns[x];
+    const __m128 dx = _mm_loadu_ps(&octave.dx[x]);
+    const __m128 left = _mm_add_ps(Gather(p, c), _mm_mul_ps(Gather(q, c), dx));
+    const __m128 right = _mm_add_ps(Gather(p + 1, c), _mm_mul_ps(Gather(q + 1, c), _mm_sub_ps(dx, one)));
+    const __m128 noise = _mm_add_ps(left, _mm_mul_ps(_mm_loadu_ps(&octave.fadeX[x]), _mm_sub_ps(right, left)));
+    _mm_storeu_ps(sums + x, _mm_add_ps(_mm_loadu_ps(sums + x), _mm_mul_ps(amplitude, noise)));
+  }
+  return x;
+}
+
+#elif GFS_NOISE_NEON
+
+inline float32x4_t Gather(const float *values, const int32_t *c) {
+  float32x4_t v = vdupq_n_f32(values[c[0]]);
+  v = vsetq_lane_f32(values[c[1]], v, 1);
+  v = vsetq_lane_f32(values[c[2]], v, 2);
+  return vsetq_lane_f32(values[c[3]], v, 3);
+}
+
+size_t AddOctave(const Octave &octave, const float *p, const float *q, float *sums, size_t width) {
+  const float32x4_t amplitude = vdupq_n_f32(octave.amplitude);
+  const float32x4_t one = vdupq_n_f32(1.f);
+  size_t x = 0;
+  for(; x + 4 <= width; x += 4) {
+    const int32_t *c = &octave.columns[x];
+    const float32x4_t dx = vld1q_f32(&octave.dx[x]);
+    const float32x4_t left = vaddq_f32(Gather(p, c), vmulq_f32(Gather(q, c), dx));
+    const float32x4_t right = vaddq_f32(Gather(p + 1, c), vmulq_f32(Gather(q + 1, c), vsubq_f32(dx, one)));
+    const float32x4_t noise = vaddq_f32(left, vmulq_f32(vld1q_f32(&octave.fadeX[x]), vsubq_f32(right, left)));
+    vst1q_f32(sums + x, vaddq_f32(vld1q_f32(sums + x), vmulq_f32(amplitude, noise)));
+  }
+  return x;
+}
+
+#else
+
+size_t AddOctave(const Octave &, const float *, const float *, float *, size_t) {
+  return 0;
+}
+
+#endif
+
+// sums to gray pixels
+void PackNoiseRow(const Fractal &fractal, const float *sums, uint8_t *pixels) {
+  uint8_t values[kBlockPixels];
+  size_t x = 0;
+  while(x < fractal.width) {
+    const size_t count = std::min(kBlockPixels, fractal.width - x);
+    for(size_t i = 0; i < count; i++) {
+      float v = sums[x + i] * fractal.scale + fractal.bias;
+      v = std::min(std::max(v, 0.f), 255.f);
+      values[i] = (uint8_t)(v + .5f);
+    }
+    if(count < kBlockPixels || fractal.scalar) {
+      ExpandARGBScalar(values, pixels + x * 4, count);
+    } else {
+      ExpandARGB(values, pixels + x * 4);
+    }
+    x += count;
+  }
+}
+
+void FractalRows(const Fractal *fractal, size_t first, size_t last) {
+  size_t columnCount = 0;
+  for(size_t o = 0; o < fractal->octaves.size(); o++) {
+    columnCount = std::max(columnCount, fractal->octaves[o].columnCount);
+  }
+  std::vector<float> sums(fractal->width);
+  std::vector<float> p(columnCount);
+  std::vector<float> q(columnCount);
+  for(size_t y = first; y < last; y++) {
+    std::fill(sums.begin(), sums.end(), 0.f);
+    for(size_t o = 0; o < fractal->octaves.size(); o++) {
+      const Octave &octave = fractal->octaves[o];
+      FoldColumns(octave, fractal->originY + (int32_t)y, p.data(), q.data());
+      size_t done = 0;
+      if(!fractal->scalar) {
+        done = AddOctave(octave, p.data(), q.data(), sums.data(), fractal->width);
+      }
+      AddOctaveScalar(octave, p.data(), q.data(), sums.data(), done, fractal->width);
+    }
+    PackNoiseRow(*fractal, sums.data(), fractal->data + y * fractal->rowBytes);
+  }
+}
+
+void RunFractal(const Fractal &fractal, uint32_t flags) {
+  size_t threadCount = 1;
+  if(0 == (flags & GFSNoiseSingleThread)) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, std::max((size_t)1, fractal.height / kMinRowsPerThread));
+  }
+
+  const size_t band = (fractal.height + threadCount - 1) / threadCount;
+  std::vector<std::thread> threads;
+  for(size_t t = 1; t < threadCount; t++) {
+    const size_t first = t * band;
+    const size_t last = std::min(fractal.height, first + band);
+    if(first < last) {
+      try {
+        threads.push_back(std::thread(FractalRows, &fractal, first, last));
+      } catch(const std::system_error &) {
+        FractalRows(&fractal, first, last);
+      }
+    }
+  }
+  FractalRows(&fractal, 0, std::min(fractal.height, band));
+  for(size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+}
+
+// octaves firstOctave up to lastOctave of the fractal, scaled as if they
+// were the whole thing
+bool FillFractal(void *data, size_t width, size_t height, size_t rowBytes,
+                 int32_t originX, int32_t originY, uint64_t seed,
+                 const GFSNoiseFractal *parameters, uint32_t firstOctave, uint32_t lastOctave,
+                 uint32_t flags) {
+  if(NULL == data || NULL == parameters || rowBytes < width * 4 || firstOctave >= lastOctave) {
+    return false;
+  }
+  if(0 == width || 0 == height) {
+    return true;
+  }
+  try {
+    Fractal fractal;
+    fractal.data = (uint8_t *)data;
+    fractal.width = width;
+    fractal.height = height;
+    fractal.rowBytes = rowBytes;
+    fractal.originX = originX;
+    fractal.originY = originY;
+    fractal.scalar = 0 != (flags & GFSNoiseScalar);
+    fractal.octaves.resize(lastOctave - firstOctave);
+    double frequency = parameters->frequency;
+    float amplitude = 1.f;
+    float amplitudes = 0.f;
+    for(uint32_t o = 0; o < lastOctave; o++) {
+      if(o >= firstOctave) {
+        SetupOctave(fractal.octaves[o - firstOctave], fractal, seed, o, frequency, amplitude);
+        amplitudes += amplitude;
+      }
+      frequency *= parameters->lacunarity;
+      amplitude *= parameters->persistence;
+    }
+    if(0.f == amplitudes) {
+      return false;
+    }
+    // the noise is in -1...1
+    fractal.scale = 127.5f / amplitudes;
+    fractal.bias = 127.5f;
+    RunFractal(fractal, flags);
+  } catch(const std::bad_alloc &) {
+    return false;
+  }
+  return true;
+}
+
+#pragma mark - Cross blur
+
+// A box blur across and a box blur down of the same image, multiplied
+// together, in one pass with no intermediate images. Down the image each
+// thread keeps a running sum per column (add the row entering the box,
+// take away the one leaving it), across a row a running sum per channel,
+// so the cost doesn't depend on the radius. Each pixel's two averages are
+// multiplied and rounded right there.
+
+struct CrossBlur {
+  const uint8_t *src;
+  size_t srcRowBytes;
+  uint8_t *dest;
+  size_t destRowBytes;
+  size_t width;
+  size_t height;
+  int32_t radius;
+  uint8_t background[4];
+  bool scalar;
+};
+
+// the src row, or a row of background past the top and bottom
+inline const uint8_t *SourceRow(const CrossBlur &blur, ptrdiff_t y, const uint8_t *backgroundRow) {
+  if(y < 0 || y >= (ptrdiff_t)blur.height) {
+    return backgroundRow;
+  }
+  return blur.src + y * blur.srcRowBytes;
+}
+
+inline const uint8_t *SourcePixel(const CrossBlur &blur, const uint8_t *row, ptrdiff_t x) {
+  if(x < 0 || x >= (ptrdiff_t)blur.width) {
+    return blur.background;
+  }
+  return row + x * 4;
+}
+
+// columns += entering - leaving, per byte
+void SlideColumnsScalar(const uint8_t *entering, const uint8_t *leaving, int32_t *columns,
+                        size_t first, size_t count) {
+  for(size_t i = first; i < count; i++) {
+    columns[i] += (int32_t)entering[i] - (int32_t)leaving[i];
+  }
+}
+
+inline uint8_t CrossProduct(int32_t across, int32_t down, int32_t size) {
+  const int32_t h = across / size;
+  const int32_t v = down / size;
+  return (uint8_t)std::min(255, (h * v + 127) / 255);
+}
+
+#if GFS_NOISE_SSE2 || GFS_NOISE_AVX2
+
+size_t SlideColumns(const uint8_t *entering, const uint8_t *leaving, int32_t *columns, size_t count) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for(; i + 16 <= count; i += 16) {
+    const __m128i in = _mm_loadu_si128((const __m128i *)(entering + i));
+    const __m128i out = _mm_loadu_si128((const __m128i *)(leaving + i));
+    const __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(in, zero), _mm_unpacklo_epi8(out, zero));
+    const __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(in, zero), _mm_unpackhi_epi8(out, zero));
+    // sign extend the 16 bit differences
+    const __m128i d0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16);
+    const __m128i d1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16);
+    const __m128i d2 = _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16);
+    const __m128i d3 = _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16);
+    __m128i *c = (__m128i *)(columns + i);
+    _mm_storeu_si128(c, _mm_add_epi32(_mm_loadu_si128(c), d0));
+    _mm_storeu_si128(c + 1, _mm_add_epi32(_mm_loadu_si128(c + 1), d1));
+    _mm_storeu_si128(c + 2, _mm_add_epi32(_mm_loadu_si128(c + 2), d2));
+    _mm_storeu_si128(c + 3, _mm_add_epi32(_mm_loadu_si128(c + 3), d3));
+  }
+  return i;
+}
+
+inline __m128i LoadChannels(const uint8_t *pixel) {
+  const __m128i zero = _mm_setzero_si128();
+  int32_t value;
+  memcpy(&value, pixel, 4);
+  const __m128i bytes = _mm_cvtsi32_si128(value);
+  return _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero);
+}
+
+// a whole row of products, four channels per vector. Sums and products are
+// small enough to be exact in float and a correctly rounded divide never
+// lands on the wrong side of a whole number, so truncating gives the same
+// quotients as integer division.
+void CrossRow(const CrossBlur &blur, const uint8_t *row, const int32_t *columns, uint8_t *dest) {
+  const ptrdiff_t radius = blur.radius;
+  const __m128 size = _mm_set1_ps((float)(2 * radius + 1));
+  const __m128 bias = _mm_set1_ps(127.f);
+  const __m128 levels = _mm_set1_ps(255.f);
+  __m128i across = _mm_setzero_si128();
+  for(ptrdiff_t x = -radius; x <= radius; x++) {
+    across = _mm_add_epi32(across, LoadChannels(SourcePixel(blur, row, x)));
+  }
+  for(size_t x = 0; x < blur.width; x++) {
+    const __m128 h = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(across), size)));
+    const __m128i down = _mm_loadu_si128((const __m128i *)(columns + x * 4));
+    const __m128 v = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(down), size)));
+    const __m128i product = _mm_cvttps_epi32(_mm_div_ps(_mm_add_ps(_mm_mul_ps(h, v), bias), levels));
+    const __m128i packed = _mm_packs_epi32(product, product);
+    const int32_t value = _mm_cvtsi128_si32(_mm_packus_epi16(packed, packed));
+    memcpy(dest + x * 4, &value, 4);
+    across = _mm_add_epi32(across, _mm_sub_epi32(LoadChannels(SourcePixel(blur, row, x + radius + 1)),
+                                                 LoadChannels(SourcePixel(blur, row, x - radius))));
+  }
+}
+
+#elif GFS_NOISE_NEON
+
+size_t SlideColumns(const uint8_t *entering, const uint8_t *leaving, int32_t *columns, size_t count) {
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8) {
+    const int16x8_t d = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(entering + i), vld1_u8(leaving + i)));
+    vst1q_s32(columns + i, vaddw_s16(vld1q_s32(columns + i), vget_low_s16(d)));
+    vst1q_s32(columns + i + 4, vaddw_s16(vld1q_s32(columns + i + 4), vget_high_s16(d)));
+  }
+  return i;
+}
+
+inline int32x4_t LoadChannels(const uint8_t *pixel) {
+  uint32_t value;
+  memcpy(&value, pixel, 4);
+  const uint8x8_t bytes = vreinterpret_u8_u32(vdup_n_u32(value));
+  return vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(vmovl_u8(bytes))));
+}
+
+// x / divisor for 0 <= x, from the float estimate fixed up by one either
+// way, NEON has no divide
+inline int32x4_t Divide(int32x4_t x, int32_t divisor, float inverse) {
+  int32x4_t q = vcvtq_s32_f32(vmulq_n_f32(vcvtq_f32_s32(x), inverse));
+  const int32x4_t d = vdupq_n_s32(divisor);
+  const int32x4_t one = vdupq_n_s32(1);
+  q = vsubq_s32(q, vandq_s32(vreinterpretq_s32_u32(vcgtq_s32(vmulq_s32(q, d), x)), one));
+  return vaddq_s32(q, vandq_s32(vreinterpretq_s32_u32(vcleq_s32(vmulq_s32(vaddq_s32(q, one), d), x)), one));
+}
+
+void CrossRow(const CrossBlur &blur, const uint8_t *row, const int32_t *columns, uint8_t *dest) {
+  const ptrdiff_t radius = blur.radius;
+  const int32_t size = (int32_t)(2 * radius + 1);
+  const float inverseSize = 1.f / size;
+  const int32x4_t bias = vdupq_n_s32(127);
+  int32x4_t across = vdupq_n_s32(0);
+  for(ptrdiff_t x = -radius; x <= radius; x++) {
+    across = vaddq_s32(across, LoadChannels(SourcePixel(blur, row, x)));
+  }
+  for(size_t x = 0; x < blur.width; x++) {
+    const int32x4_t h = Divide(across, size, inverseSize);
+    const int32x4_t v = Divide(vld1q_s32(columns + x * 4), size, inverseSize);
+    const int32x4_t product = Divide(vaddq_s32(vmulq_s32(h, v), bias), 255, 1.f / 255.f);
+    const uint16x4_t narrow = vqmovun_s32(product);
+    const uint8x8_t bytes = vqmovn_u16(vcombine_u16(narrow, narrow));
+    const uint32_t value = vget_lane_u32(vreinterpret_u32_u8(bytes), 0);
+    memcpy(dest + x * 4, &value, 4);
+    across = vaddq_s32(across, vsubq_s32(LoadChannels(SourcePixel(blur, row, x + radius + 1)),
+                                         LoadChannels(SourcePixel(blur, row, x - radius))));
+  }
+}
+
+#else
+
+size_t SlideColumns(const uint8_t *, const uint8_t *, int32_t *, size_t) {
+  return 0;
+}
+
+#endif
+
+void CrossRowScalar(const CrossBlur &blur, const uint8_t *row, const int32_t *columns, uint8_t *dest) {
+  const ptrdiff_t radius = blur.radius;
+  const int32_t size = (int32_t)(2 * radius + 1);
+  int32_t across[4] = { 0, 0, 0, 0 };
+  for(ptrdiff_t x = -radius; x <= radius; x++) {
+    const uint8_t *pixel = SourcePixel(blur, row, x);
+    for(int c = 0; c < 4; c++) {
+      across[c] += pixel[c];
+    }
+  }
+  for(size_t x = 0; x < blur.width; x++) {
+    const uint8_t *entering = SourcePixel(blur, row, x + radius + 1);
+    const uint8_t *leaving = SourcePixel(blur, row, x - radius);
+    for(int c = 0; c < 4; c++) {
+      dest[x * 4 + c] = CrossProduct(across[c], columns[x * 4 + c], size);
+      across[c] += (int32_t)entering[c] - (int32_t)leaving[c];
+    }
+  }
+}
+
+void CrossBlurRows(const CrossBlur *blur, size_t first, size_t last) {
+  const size_t count = blur->width * 4;
+  const ptrdiff_t radius = blur->radius;
+  std::vector<uint8_t> backgroundRow(count);
+  for(size_t i = 0; i < count; i++) {
+    backgroundRow[i] = blur->background[i & 3];
+  }
+  // the column sums for the box around row first
+  std::vector<int32_t> columns(count, 0);
+  for(ptrdiff_t y = (ptrdiff_t)first - radius; y <= (ptrdiff_t)first + radius; y++) {
+    const uint8_t *row = SourceRow(*blur, y, backgroundRow.data());
+    for(size_t i = 0; i < count; i++) {
+      columns[i] += row[i];
+    }
+  }
+  for(size_t y = first; y < last; y++) {
+    const uint8_t *row = blur->src + y * blur->srcRowBytes;
+    uint8_t *dest = blur->dest + y * blur->destRowBytes;
+#if GFS_NOISE_SSE2 || GFS_NOISE_AVX2 || GFS_NOISE_NEON
+    if(!blur->scalar) {
+      CrossRow(*blur, row, columns.data(), dest);
+    } else {
+      CrossRowScalar(*blur, row, columns.data(), dest);
+    }
+#else
+    CrossRowScalar(*blur, row, columns.data(), dest);
+#endif
+    if(y + 1 < last) {
+      const uint8_t *entering = SourceRow(*blur, (ptrdiff_t)y + radius + 1, backgroundRow.data());
+      const uint8_t *leaving = SourceRow(*blur, (ptrdiff_t)y - radius, backgroundRow.data());
+      const size_t done = blur->scalar ? 0 : SlideColumns(entering, leaving, columns.data(), count);
+      SlideColumnsScalar(entering, leaving, columns.data(), done, count);
+    }
+  }
+}
+
+void RunCrossBlur(const CrossBlur &blur, uint32_t flags) {
+  size_t threadCount = 1;
+  if(0 == (flags & GFSNoiseSingleThread)) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, std::max((size_t)1, blur.height / kMinRowsPerThread));
+  }
+
+  const size_t band = (blur.height + threadCount - 1) / threadCount;
+  std::vector<std::thread> threads;
+  for(size_t t = 1; t < threadCount; t++) {
+    const size_t first = t * band;
+    const size_t last = std::min(blur.height, first + band);
+    if(first < last) {
+      try {
+        threads.push_back(std::thread(CrossBlurRows, &blur, first, last));
+      } catch(const std::system_error &) {
+        CrossBlurRows(&blur, first, last);
+      }
+    }
+  }
+  CrossBlurRows(&blur, 0, std::min(blur.height, band));
+  for(size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+}
+
+} // namespace
+
+#pragma mark - Public
+
+void GFSNoiseRandomBlock(uint64_t seed, uint64_t counter, uint8_t bytes[16]) {
+  RandomBlock(seed, counter, bytes);
+}
+
+void GFSNoiseFillARGB8888(void *data, size_t count, uint64_t seed, uint32_t flags) {
+  if(NULL == data || 0 == count) {
+    return;
+  }
+  Fill fill = { (uint8_t *)data, count, 4, seed, 0 != (flags & GFSNoiseScalar) };
+  RunFill(fill, flags);
+}
+
+void GFSNoiseFillAlphaLuminance88(void *data, size_t count, uint64_t seed, uint32_t flags) {
+  if(NULL == data || 0 == count) {
+    return;
+  }
+  Fill fill = { (uint8_t *)data, count, 2, seed, 0 != (flags & GFSNoiseScalar) };
+  RunFill(fill, flags);
+}
+
+bool GFSNoiseFractalARGB8888(void *data,
+                             size_t width,
+                             size_t height,
+                             size_t rowBytes,
+                             int32_t originX,
+                             int32_t originY,
+                             uint64_t seed,
+                             const GFSNoiseFractal *fractal,
+                             uint32_t flags) {
+  if(NULL == fractal) {
+    return false;
+  }
+  return FillFractal(data, width, height, rowBytes, originX, originY, seed,
+                     fractal, 0, fractal->octaveCount, flags);
+}
+
+bool GFSNoiseOctaveARGB8888(void *data,
+                            size_t width,
+                            size_t height,
+                            size_t rowBytes,
+                            int32_t originX,
+                            int32_t originY,
+                            uint64_t seed,
+                            const GFSNoiseFractal *fractal,
+                            uint32_t octave,
+                            uint32_t flags) {
+  if(NULL == fractal || octave >= fractal->octaveCount) {
+    return false;
+  }
+  return FillFractal(data, width, height, rowBytes, originX, originY, seed,
+                     fractal, octave, octave + 1, flags);
+}
+
+bool GFSNoiseCrossBlurARGB8888(const void *src,
+                               size_t srcRowBytes,
+                               void *dest,
+                               size_t destRowBytes,
+                               size_t width,
+                               size_t height,
+                               uint32_t radius,
+                               const uint8_t backgroundColor[4],
+                               uint32_t flags) {
+  if(NULL == src || NULL == dest || src == dest ||
+     srcRowBytes < width * 4 || destRowBytes < width * 4 || radius > 0xFFFF) {
+    return false;
+  }
+  if(0 == width || 0 == height) {
+    return true;
+  }
+  try {
+    CrossBlur blur = { (const uint8_t *)src, srcRowBytes, (uint8_t *)dest, destRowBytes,
+      width, height, (int32_t)radius, { 0, 0, 0, 0 }, 0 != (flags & GFSNoiseScalar) };
+    if(NULL != backgroundColor) {
+      memcpy(blur.background, backgroundColor, 4);
+    }
+    RunCrossBlur(blur, flags);
+  } catch(const std::bad_alloc &) {
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,126 @@
+//
+//  GFSNoiseEngine.h
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#ifndef GFSNoiseEngine_h
+#define GFSNoiseEngine_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Portable noise generation for GFSNoiseGenerator.
+ *
+ * The random numbers come from Philox4x32-10, a counter based generator:
+ * block n of 16 random bytes is a function of the seed and n alone, there
+ * is no state to share or lock. So buffers are filled a block at a time on
+ * as many threads as there are cores, and the results are the same on any
+ * machine, with any number of threads, SIMD or not, for the same seed.
+ *
+ * Fractal noise is octaves of 2D Perlin gradient noise added together, each
+ * lacunarity times the frequency and persistence times the amplitude of the
+ * one before. Rows are split across threads and the pixels of a row are
+ * worked out four or eight at a time. The lattice gradients are hashed from
+ * the seed and their coordinates, so any tile of the noise can be made on
+ * its own and lines up with its neighbors.
+ */
+
+typedef enum {
+  GFSNoiseNoFlags = 0,
+  // run on the calling thread only
+  GFSNoiseSingleThread = 1 << 0,
+  // skip the SIMD paths, handy for checking them against plain C
+  GFSNoiseScalar = 1 << 1
+} GFSNoiseFlags;
+
+// The 16 random bytes of block counter for seed.
+void GFSNoiseRandomBlock(uint64_t seed, uint64_t counter, uint8_t bytes[16]);
+
+// count pixels of white noise, pixel i is byte i % 16 of block i / 16 as
+// gray: alpha 255 and red, green and blue all that byte.
+void GFSNoiseFillARGB8888(void *data, size_t count, uint64_t seed, uint32_t flags);
+
+// Same values as GFSNoiseFillARGB8888, two bytes per pixel, alpha then
+// luminance.
+void GFSNoiseFillAlphaLuminance88(void *data, size_t count, uint64_t seed, uint32_t flags);
+
+typedef struct GFSNoiseFractal {
+  uint32_t octaveCount;
+  // of the first octave in lattice cells per pixel, 1/64 is a cell every 64
+  // pixels
+  float frequency;
+  // each octave's amplitude over the one before's, 0.5 is the usual
+  float persistence;
+  // each octave's frequency over the one before's, 2 is the usual
+  float lacunarity;
+} GFSNoiseFractal;
+
+// Gray fractal noise, alpha 255, in width x height ARGB8888 pixels. Pixel
+// (x, y) is the noise at (originX + x, originY + y), pass the tile's
+// position to make a tile of a larger image. The sum is scaled so -1...1
+// goes to 0...255. Returns false for bad arguments or no memory.
+bool GFSNoiseFractalARGB8888(void *data,
+                             size_t width,
+                             size_t height,
+                             size_t rowBytes,
+                             int32_t originX,
+                             int32_t originY,
+                             uint64_t seed,
+                             const GFSNoiseFractal *fractal,
+                             uint32_t flags);
+
+// Just octave (from 0) of the same noise, over the whole 0...255 range.
+// Returns false for an octave past fractal->octaveCount too.
+bool GFSNoiseOctaveARGB8888(void *data,
+                            size_t width,
+                            size_t height,
+                            size_t rowBytes,
+                            int32_t originX,
+                            int32_t originY,
+                            uint64_t seed,
+                            const GFSNoiseFractal *fractal,
+                            uint32_t octave,
+                            uint32_t flags);
+
+// src blurred across with a 2 * radius + 1 wide box, and down with a box as
+// tall, and the two multiplied, per channel. The same pixels as convolving
+// src twice with GFSConvolveARGB8888 (kernels of ones, 1 x n and n x 1,
+// divisor n, backgroundColor past the edges) and multiplying the results
+// (a * b / 255, rounded), but in one pass with no intermediate images, and
+// the cost doesn't grow with the radius. src and dest must not overlap.
+bool GFSNoiseCrossBlurARGB8888(const void *src,
+                               size_t srcRowBytes,
+                               void *dest,
+                               size_t destRowBytes,
+                               size_t width,
+                               size_t height,
+                               uint32_t radius,
+                               const uint8_t backgroundColor[4],
+                               uint32_t flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
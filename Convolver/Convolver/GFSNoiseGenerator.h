@@ -10,11 +10,33 @@
 
 @interface GFSNoiseGenerator : NSObject
 
+// seeded at random
 - (id)initWithSize:(CGSize)size octaves:(NSUInteger)octaveCount;
 
+// the same seed always makes the same noise, see GFSNoiseEngine
+- (id)initWithSize:(CGSize)size octaves:(NSUInteger)octaveCount seed:(uint64_t)seed;
+
 @property(nonatomic, assign) NSUInteger octaveCount;
 @property(nonatomic, assign) CGSize size;
+@property(nonatomic, assign) uint64_t seed;
+// fractal noise parameters, see GFSNoiseFractal. Default to a lattice cell
+// every 64 pixels, 0.5 and 2.
+@property(nonatomic, assign) CGFloat frequency;
+@property(nonatomic, assign) CGFloat persistence;
+@property(nonatomic, assign) CGFloat lacunarity;
 
+// white noise blurred across and down
 - (UIImage *)noiseImage;
 
+// octaveCount UIImages, each octave of fractalNoiseImage on its own
+- (NSArray *)noiseImages;
+
+// the octaves added together, size big
+- (UIImage *)fractalNoiseImage;
+
+// Just rect (in pixels) of the fractal noise, not cached. Tiles line up with
+// each other and with fractalNoiseImage, so a big texture can be made a
+// tile at a time as it's needed.
+- (UIImage *)fractalNoiseImageInRect:(CGRect)rect;
+
 @end
@@ -8,39 +8,90 @@
 
 #import "GFSNoiseGenerator.h"
 #import "GFSVImageLoader.h"
-#import "GFSImageConvolver.h"
+#import "GFSNoiseEngine.h"
+#import "GFSImageSurfacePool.h"
 
 @interface GFSNoiseGenerator()
 
 @property(nonatomic, strong) NSData *baseNoise;
-@property(nonatomic, strong) GFSImageConvolver *horizontalConvolver;
-@property(nonatomic, strong) GFSImageConvolver *verticalConvolver;
 @property(nonatomic, strong) UIImage *bluredImage;
+@property(nonatomic, strong) NSArray *octaveImages;
+@property(nonatomic, strong) UIImage *fractalImage;
 
 @end
 
 @interface GFSNoiseGenerator(Private)
 
+- (GFSNoiseFractal)fractal;
+- (UIImage *)imageInRect:(CGRect)rect octave:(NSInteger)octave;
+- (void)releaseFractalImages;
+
 @end
 
 @implementation GFSNoiseGenerator
 
-@synthesize horizontalConvolver = _horizontalConvolver;
-@synthesize verticalConvolver = _verticalConvolver;
 @synthesize baseNoise = _baseNoise;
 @synthesize bluredImage = _bluredImage;
 @synthesize octaveCount = _octaveCount;
 @synthesize size = _size;
+@synthesize seed = _seed;
+@synthesize frequency = _frequency;
+@synthesize persistence = _persistence;
+@synthesize lacunarity = _lacunarity;
+@synthesize octaveImages = _octaveImages;
+@synthesize fractalImage = _fractalImage;
 
 - (id)initWithSize:(CGSize)size octaves:(NSUInteger)octaveCount {
+  uint64_t seed = ((uint64_t)arc4random() << 32) | arc4random();
+  return [self initWithSize:size octaves:octaveCount seed:seed];
+}
+
+- (id)initWithSize:(CGSize)size octaves:(NSUInteger)octaveCount seed:(uint64_t)seed {
   self = [super init];
   if(nil != self) {
     self.size = size;
     self.octaveCount = octaveCount;
+    self.seed = seed;
+    self.frequency = 1.0 / 64.0;
+    self.persistence = 0.5;
+    self.lacunarity = 2.0;
   }
   return self;
 }
 
+- (void)setSeed:(uint64_t)seed {
+  _seed = seed;
+  // everything else is made from the base noise
+  self.baseNoise = nil;
+  self.bluredImage = nil;
+  [self releaseFractalImages];
+}
+
+- (void)setSize:(CGSize)size {
+  _size = size;
+  [self releaseFractalImages];
+}
+
+- (void)setOctaveCount:(NSUInteger)octaveCount {
+  _octaveCount = octaveCount;
+  [self releaseFractalImages];
+}
+
+- (void)setFrequency:(CGFloat)frequency {
+  _frequency = frequency;
+  [self releaseFractalImages];
+}
+
+- (void)setPersistence:(CGFloat)persistence {
+  _persistence = persistence;
+  [self releaseFractalImages];
+}
+
+- (void)setLacunarity:(CGFloat)lacunarity {
+  _lacunarity = lacunarity;
+  [self releaseFractalImages];
+}
+
 typedef struct GFSConvolverLumance { // this order only works for big endian
 uint8_t a;
 uint8_t l;
@@ -50,13 +101,11 @@ uint8_t l;
 - (NSData *)baseLANoise {
   if(nil == _baseNoise) {
     NSUInteger count = self.size.width * self.size.height;
-    GFSConvolverLumance *colors = (GFSConvolverLumance *)calloc(count, sizeof(GFSConvolverLumance));
-    srandomdev();
-    for(NSUInteger i = 0;i < count;i++) {
-      uint8_t value = random() % 256;
-      colors[i].l = value;
-      colors[i].a = 255;
+    GFSConvolverLumance *colors = (GFSConvolverLumance *)malloc(count * sizeof(GFSConvolverLumance));
+    if(NULL == colors) {
+      return nil;
     }
+    GFSNoiseFillAlphaLuminance88(colors, count, self.seed, GFSNoiseNoFlags);
     self.baseNoise = [NSData dataWithBytesNoCopy:(void *)colors
                                           length:sizeof(GFSConvolverLumance) * count
                                     freeWhenDone:YES];
@@ -67,15 +116,11 @@ uint8_t l;
 - (NSData *)baseRGBANoise {
   if(nil == _baseNoise) {
     NSUInteger count = self.size.width * self.size.height;
-    GFSConvolverColor *colors = (GFSConvolverColor *)calloc(count, sizeof(GFSConvolverColor));
-    srandomdev();
-    for(NSUInteger i = 0;i < count;i++) {
-      uint8_t value = random() % 256;
-      colors[i].r = value;
-      colors[i].g = value;
-      colors[i].b = value;
-      colors[i].a = 255;
+    GFSConvolverColor *colors = (GFSConvolverColor *)malloc(count * sizeof(GFSConvolverColor));
+    if(NULL == colors) {
+      return nil;
     }
+    GFSNoiseFillARGB8888(colors, count, self.seed, GFSNoiseNoFlags);
     self.baseNoise = [NSData dataWithBytesNoCopy:(void *)colors
                                           length:sizeof(GFSConvolverColor) * count
                                     freeWhenDone:YES];
@@ -91,49 +136,55 @@ uint8_t l;
 }
 
 - (NSArray *)noiseImages {
-  return nil;
-}
-
-- (GFSImageConvolver *)horizontalConvolver {
-  if(nil == _horizontalConvolver) {
-    self.horizontalConvolver = [[GFSImageConvolver alloc] initWithImageData:self.baseNoise imageSize:self.size];
-    
-    short *motionBlurKernel = calloc(25, sizeof(short));
-    for(int i = 0;i < 25;i++) {
-      motionBlurKernel[i] = 1.0;
+  if(nil == self.octaveImages) {
+    NSMutableArray *images = [NSMutableArray arrayWithCapacity:self.octaveCount];
+    CGRect rect = CGRectMake(0.0, 0.0, self.size.width, self.size.height);
+    for(NSUInteger i = 0;i < self.octaveCount;i++) {
+      UIImage *image = [self imageInRect:rect octave:i];
+      if(nil == image) {
+        return nil;
+      }
+      [images addObject:image];
     }
-    [self.horizontalConvolver setKernel:motionBlurKernel width:25 height:1];
-    self.horizontalConvolver.divsor = 25;
+    self.octaveImages = images;
   }
-  return _horizontalConvolver;
+  return _octaveImages;
 }
 
-- (GFSImageConvolver *)verticalConvolver {
-  if(nil == _verticalConvolver) {
-    self.verticalConvolver = [[GFSImageConvolver alloc] initWithImageData:self.baseNoise imageSize:self.size];
-    
-    short *motionBlurKernel = calloc(25, sizeof(short));
-    for(int i = 0;i < 25;i++) {
-      motionBlurKernel[i] = 1.0;
-    }
-    [self.verticalConvolver setKernel:motionBlurKernel width:1 height:25];
-    self.verticalConvolver.divsor = 25;
+- (UIImage *)fractalNoiseImage {
+  if(nil == self.fractalImage) {
+    self.fractalImage = [self fractalNoiseImageInRect:CGRectMake(0.0, 0.0, self.size.width, self.size.height)];
   }
-  return _verticalConvolver;
+  return _fractalImage;
+}
+
+- (UIImage *)fractalNoiseImageInRect:(CGRect)rect {
+  return [self imageInRect:rect octave:-1];
 }
 
+// The white noise blurred across and down with 25 pixel boxes and the two
+// blurs multiplied, in one pass, see GFSNoiseCrossBlurARGB8888
 - (UIImage *)noiseImage {
   if(nil == self.bluredImage) {
-    UIGraphicsBeginImageContext(self.size);
-    CGContextRef ctx = UIGraphicsGetCurrentContext();
-    CGContextSetFillColorWithColor(ctx, [[UIColor whiteColor] CGColor]);
-    CGRect rect = CGRectMake(0.0, 0.0, self.size.width, self.size.height);
-    CGContextFillRect(ctx, rect);
-    CGContextSetBlendMode(ctx, kCGBlendModeMultiply);
-    CGContextDrawImage(ctx, rect, (__bridge CGImageRef)self.horizontalConvolver.convolvedImage);
-    CGContextDrawImage(ctx, rect, (__bridge CGImageRef)self.verticalConvolver.convolvedImage);
-    self.bluredImage = UIGraphicsGetImageFromCurrentImageContext();
-    UIGraphicsEndImageContext();
+    NSData *noise = self.baseNoise;
+    size_t width = self.size.width;
+    size_t height = self.size.height;
+    GFSImageSurfacePool *pool = [GFSImageSurfacePool sharedPool];
+    void *data = [pool bufferWithLength:width * height * 4];
+    if(nil == noise || NULL == data) {
+      [pool recycleBuffer:data length:width * height * 4];
+      return nil;
+    }
+    // opaque black past the edges
+    uint8_t background[4] = { 255, 0, 0, 0 };
+    if(!GFSNoiseCrossBlurARGB8888([noise bytes], width * 4, data, width * 4, width, height,
+                                  12, background, GFSNoiseNoFlags)) {
+      [pool recycleBuffer:data length:width * height * 4];
+      return nil;
+    }
+    id imageRef = [pool newImageWithBuffer:data width:width height:height];
+    self.bluredImage = [UIImage imageWithCGImage:(__bridge CGImageRef)imageRef];
+    CGImageRelease((__bridge CGImageRef)imageRef);
   }
   return _bluredImage;
 }
@@ -143,4 +194,51 @@ uint8_t l;
 
 @implementation GFSNoiseGenerator(Private)
 
+- (GFSNoiseFractal)fractal {
+  GFSNoiseFractal fractal = { self.octaveCount, self.frequency, self.persistence, self.lacunarity };
+  return fractal;
+}
+
+// one octave, or all of them added up when octave is -1
+- (UIImage *)imageInRect:(CGRect)rect octave:(NSInteger)octave {
+  rect = CGRectIntegral(rect);
+  size_t width = rect.size.width;
+  size_t height = rect.size.height;
+  if(0 == width || 0 == height || 0 == self.octaveCount) {
+    return nil;
+  }
+  GFSImageSurfacePool *pool = [GFSImageSurfacePool sharedPool];
+  void *data = [pool bufferWithLength:width * height * 4];
+  if(NULL == data) {
+    return nil;
+  }
+  GFSNoiseFractal fractal = [self fractal];
+  bool filled = false;
+  if(octave < 0) {
+    filled = GFSNoiseFractalARGB8888(data, width, height, width * 4,
+                                     rect.origin.x, rect.origin.y,
+                                     self.seed, &fractal, GFSNoiseNoFlags);
+  } else {
+    filled = GFSNoiseOctaveARGB8888(data, width, height, width * 4,
+                                    rect.origin.x, rect.origin.y,
+                                    self.seed, &fractal, octave, GFSNoiseNoFlags);
+  }
+  if(!filled) {
+    [pool recycleBuffer:data length:width * height * 4];
+    return nil;
+  }
+  id imageRef = [pool newImageWithBuffer:data width:width height:height];
+  if(nil == imageRef) {
+    return nil;
+  }
+  UIImage *image = [UIImage imageWithCGImage:(__bridge CGImageRef)imageRef];
+  CGImageRelease((__bridge CGImageRef)imageRef);
+  return image;
+}
+
+- (void)releaseFractalImages {
+  self.octaveImages = nil;
+  self.fractalImage = nil;
+}
+
 @end
\ No newline at end of file
@@ -0,0 +1,175 @@
+//
+//  GFSPixelConversion.cpp
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "GFSPixelConversion.h"
+
+#include <string.h>
+
+namespace {
+
+// x * y / 255 rounded, for x and y in 0...255
+inline uint32_t MultiplyBytes(uint32_t x, uint32_t y) {
+  const uint32_t t = x * y + 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+// Rec. 601 weights out of 256
+inline uint32_t Luminance(uint32_t r, uint32_t g, uint32_t b) {
+  return (r * 77 + g * 150 + b * 29 + 128) >> 8;
+}
+
+template<class Store>
+void ConvertRows(const uint8_t *src, size_t srcRowBytes, const GFSPixelLayout &layout,
+                 uint8_t *dest, size_t destRowBytes, size_t width, size_t height, Store store) {
+  const bool gray = layout.green < 0 || layout.blue < 0;
+  const bool straightAlpha = layout.alpha >= 0 && !layout.premultiplied;
+  for(size_t y = 0; y < height; y++) {
+    const uint8_t *pixel = src + y * srcRowBytes;
+    uint8_t *out = dest + y * destRowBytes;
+    for(size_t x = 0; x < width; x++, pixel += layout.bytesPerPixel) {
+      uint32_t r = pixel[layout.red];
+      uint32_t g = gray ? r : pixel[layout.green];
+      uint32_t b = gray ? r : pixel[layout.blue];
+      if(straightAlpha) {
+        const uint32_t a = pixel[layout.alpha];
+        r = MultiplyBytes(r, a);
+        g = MultiplyBytes(g, a);
+        b = MultiplyBytes(b, a);
+      }
+      store(out, x, r, g, b);
+    }
+  }
+}
+
+struct StoreARGB8888 {
+  void operator()(uint8_t *row, size_t x, uint32_t r, uint32_t g, uint32_t b) const {
+    uint8_t *p = row + x * 4;
+    p[0] = 255;
+    p[1] = (uint8_t)r;
+    p[2] = (uint8_t)g;
+    p[3] = (uint8_t)b;
+  }
+};
+
+struct StoreBGRA8888 {
+  void operator()(uint8_t *row, size_t x, uint32_t r, uint32_t g, uint32_t b) const {
+    uint8_t *p = row + x * 4;
+    p[0] = (uint8_t)b;
+    p[1] = (uint8_t)g;
+    p[2] = (uint8_t)r;
+    p[3] = 255;
+  }
+};
+
+struct StorePlanar8 {
+  void operator()(uint8_t *row, size_t x, uint32_t r, uint32_t g, uint32_t b) const {
+    row[x] = (uint8_t)Luminance(r, g, b);
+  }
+};
+
+struct StorePlanarF {
+  void operator()(uint8_t *row, size_t x, uint32_t r, uint32_t g, uint32_t b) const {
+    const float value = (r * .299f + g * .587f + b * .114f) * (1.f / 255.f);
+    memcpy(row + x * sizeof(float), &value, sizeof(float));
+  }
+};
+
+struct StoreARGB16U {
+  void operator()(uint8_t *row, size_t x, uint32_t r, uint32_t g, uint32_t b) const {
+    // * 257 spreads 0...255 over 0...65535 exactly
+    const uint16_t p[4] = { 65535, (uint16_t)(r * 257), (uint16_t)(g * 257), (uint16_t)(b * 257) };
+    memcpy(row + x * sizeof(p), p, sizeof(p));
+  }
+};
+
+inline bool ValidOffset(int8_t offset, uint32_t bytesPerPixel) {
+  return offset < (int32_t)bytesPerPixel;
+}
+
+} // namespace
+
+size_t GFSPixelFormatBytesPerPixel(GFSPixelFormat format) {
+  switch(format) {
+    case GFSPixelFormatARGB8888: return 4;
+    case GFSPixelFormatBGRA8888: return 4;
+    case GFSPixelFormatPlanar8: return 1;
+    case GFSPixelFormatPlanarF: return sizeof(float);
+    case GFSPixelFormatARGB16U: return 4 * sizeof(uint16_t);
+  }
+  return 0;
+}
+
+bool GFSPixelLayoutIsFormat(const GFSPixelLayout *layout, GFSPixelFormat format) {
+  if(NULL == layout) {
+    return false;
+  }
+  switch(format) {
+    // never, a skipped byte isn't necessarily 255 and a real alpha isn't
+    // either, and the convolver and separator read that byte as alpha.
+    // Converting writes the 255.
+    case GFSPixelFormatARGB8888:
+    case GFSPixelFormatBGRA8888:
+      return false;
+    case GFSPixelFormatPlanar8:
+      return 1 == layout->bytesPerPixel && 0 == layout->red && layout->green < 0 && layout->alpha < 0;
+    default:
+      return false;
+  }
+}
+
+bool GFSConvertPixels(const void *src,
+                      size_t srcRowBytes,
+                      const GFSPixelLayout *layout,
+                      void *dest,
+                      size_t destRowBytes,
+                      GFSPixelFormat format,
+                      size_t width,
+                      size_t height) {
+  if(NULL == src || NULL == dest || NULL == layout) {
+    return false;
+  }
+  const uint32_t bpp = layout->bytesPerPixel;
+  if((1 != bpp && 3 != bpp && 4 != bpp) || layout->red < 0 ||
+     !ValidOffset(layout->red, bpp) || !ValidOffset(layout->green, bpp) ||
+     !ValidOffset(layout->blue, bpp) || !ValidOffset(layout->alpha, bpp) ||
+     srcRowBytes < width * bpp || destRowBytes < width * GFSPixelFormatBytesPerPixel(format)) {
+    return false;
+  }
+  const uint8_t *s = (const uint8_t *)src;
+  uint8_t *d = (uint8_t *)dest;
+  switch(format) {
+    case GFSPixelFormatARGB8888:
+      ConvertRows(s, srcRowBytes, *layout, d, destRowBytes, width, height, StoreARGB8888());
+      return true;
+    case GFSPixelFormatBGRA8888:
+      ConvertRows(s, srcRowBytes, *layout, d, destRowBytes, width, height, StoreBGRA8888());
+      return true;
+    case GFSPixelFormatPlanar8:
+      ConvertRows(s, srcRowBytes, *layout, d, destRowBytes, width, height, StorePlanar8());
+      return true;
+    case GFSPixelFormatPlanarF:
+      ConvertRows(s, srcRowBytes, *layout, d, destRowBytes, width, height, StorePlanarF());
+      return true;
+    case GFSPixelFormatARGB16U:
+      ConvertRows(s, srcRowBytes, *layout, d, destRowBytes, width, height, StoreARGB16U());
+      return true;
+  }
+  return false;
+}
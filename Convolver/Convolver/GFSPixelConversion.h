@@ -0,0 +1,88 @@
+//
+//  GFSPixelConversion.h
+//  Convolver
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#ifndef GFSPixelConversion_h
+#define GFSPixelConversion_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Converts decoded pixels, however the decoder laid them out, into one of
+ * the formats the rest of the code works on, in one pass.
+ *
+ * Colors with alpha come out premultiplied and the alpha of the 8 bit
+ * formats is 255, the same as drawing the image into a
+ * kCGImageAlphaNoneSkipFirst context (over black). Gray formats are the
+ * Rec. 601 luminance of the color.
+ */
+
+typedef enum {
+  // alpha (always 255) first, what vImage and the convolver use
+  GFSPixelFormatARGB8888 = 0,
+  GFSPixelFormatBGRA8888,
+  // one byte of luminance per pixel
+  GFSPixelFormatPlanar8,
+  // one float of luminance per pixel, 0...1
+  GFSPixelFormatPlanarF,
+  // 16 bits a channel in native byte order, 0...65535
+  GFSPixelFormatARGB16U
+} GFSPixelFormat;
+
+// Where the channels of a source pixel are. Offsets are bytes into the
+// pixel, -1 for channels it doesn't have. Gray pixels have only red.
+typedef struct GFSPixelLayout {
+  uint32_t bytesPerPixel;
+  int8_t red;
+  int8_t green;
+  int8_t blue;
+  int8_t alpha;
+  bool premultiplied;
+} GFSPixelLayout;
+
+size_t GFSPixelFormatBytesPerPixel(GFSPixelFormat format);
+
+// Whether pixels in layout already are format, byte for byte, so they can
+// be used as they are. Never for the 8 bit color formats, whose alpha has
+// to be 255.
+bool GFSPixelLayoutIsFormat(const GFSPixelLayout *layout, GFSPixelFormat format);
+
+// width x height pixels from src in layout to dest in format. Returns false
+// for layouts it doesn't know (bytesPerPixel other than 1, 3 or 4, offsets
+// outside the pixel).
+bool GFSConvertPixels(const void *src,
+                      size_t srcRowBytes,
+                      const GFSPixelLayout *layout,
+                      void *dest,
+                      size_t destRowBytes,
+                      GFSPixelFormat format,
+                      size_t width,
+                      size_t height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
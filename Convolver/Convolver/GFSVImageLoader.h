@@ -20,6 +20,7 @@
 
 #import <Foundation/Foundation.h>
 #import <ImageIO/ImageIO.h>
+#import "GFSPixelConversion.h"
 
 // this is just a debugging struct to look at the argb colors
 // coming back from the convolution, not currently used, but you
@@ -39,10 +40,29 @@ typedef struct GFSConvolverColor { // this order only works for big endian
 @interface GFSVImageLoader : NSObject
 
 - (id)initWithURL:(NSURL *)orignalImageURL;
+// Decode into pixelFormat rather than ARGB8888. The decoder's own pixels
+// are kept as they are when they already are the format, otherwise they
+// are converted in one pass, so the whole image is in memory at most twice
+// while loading.
+- (id)initWithURL:(NSURL *)orignalImageURL pixelFormat:(GFSPixelFormat)pixelFormat;
 - (id)initWithCompliantData:(NSData *)data imageSize:(CGSize)imageSize;
+// Only reads the size of the image, compliantData stays nil and the pixels
+// are decoded a strip at a time by compliantDataForRows:, so images too big
+// to hold in memory can still be worked on
+- (id)initForStripsWithURL:(NSURL *)orignalImageURL;
+
+// rows.length rows of vImage compliant data starting at row rows.location
+// (from the top), bytesPerRow bytes per row. When compliantData is
+// loaded this points into it rather than copying. Safe to call from any
+// thread.
+- (NSData *)compliantDataForRows:(NSRange)rows;
 
 @property(nonatomic, strong, readonly) NSURL *originalImageURL;
 @property(nonatomic, strong, readonly) NSData *compliantData;
 @property(nonatomic, assign, readonly) CGSize imageSize;
+// the format of compliantData, GFSPixelFormatARGB8888 unless asked for
+// otherwise
+@property(nonatomic, assign, readonly) GFSPixelFormat pixelFormat;
+@property(nonatomic, assign, readonly) size_t bytesPerRow;
 
 @end
@@ -7,32 +7,53 @@
 //
 
 #import "GFSVImageLoader.h"
+#import "GFSImageSurfacePool.h"
+#import "GFSMemoryAccounting.h"
 
 @interface GFSVImageLoader()
 
 @property(nonatomic, assign, readwrite) CGSize imageSize;
 @property(nonatomic, strong, readwrite) NSURL *originalImageURL;
 @property(nonatomic, strong, readwrite) NSData *compliantData;
+@property(nonatomic, assign, readwrite) GFSPixelFormat pixelFormat;
+@property(nonatomic, assign, readwrite) size_t bytesPerRow;
 
 @end
 
 @interface GFSVImageLoader(Private)
 
 - (BOOL)loadCompliantImageData;
+- (BOOL)loadStripImage;
+- (BOOL)getLayout:(GFSPixelLayout *)layout ofImage:(CGImageRef)imageRef;
+- (NSData *)drawImage:(CGImageRef)imageRef;
 
 @end
 
-@implementation GFSVImageLoader
+@implementation GFSVImageLoader {
+  // really a CGImageRef, only set up by initForStripsWithURL:, decoded
+  // each time a strip is drawn out of it rather than cached
+  id _stripImage;
+  // the part of compliantData counted under GFSMemoryStageLoad, none of it
+  // when it was handed in
+  size_t _chargedLength;
+}
 
 @synthesize imageSize = _imageSize;
 @synthesize originalImageURL = _originalImageURL;
 @synthesize compliantData = _compliantData;
+@synthesize pixelFormat = _pixelFormat;
+@synthesize bytesPerRow = _bytesPerRow;
 
 
 - (id)initWithURL:(NSURL *)orignalImageURL {
+  return [self initWithURL:orignalImageURL pixelFormat:GFSPixelFormatARGB8888];
+}
+
+- (id)initWithURL:(NSURL *)orignalImageURL pixelFormat:(GFSPixelFormat)pixelFormat {
   self = [super init];
   if(nil != self) {
     self.originalImageURL = orignalImageURL;
+    self.pixelFormat = pixelFormat;
     // load the image and get the vImage compliant data
     if(![self loadCompliantImageData]) {
       self = nil;
@@ -47,49 +68,255 @@
   if(nil != self) {
     self.compliantData = data;
     self.imageSize = imageSize;
+    self.pixelFormat = GFSPixelFormatARGB8888;
+    self.bytesPerRow = imageSize.width * 4;
+  }
+  return self;
+}
+
+- (id)initForStripsWithURL:(NSURL *)orignalImageURL {
+  self = [super init];
+  if(nil != self) {
+    self.originalImageURL = orignalImageURL;
+    if(![self loadStripImage]) {
+      self = nil;
+    }
   }
   return self;
 }
 
+- (void)dealloc {
+  GFSMemoryRecordFree(GFSMemoryStageLoad, _chargedLength);
+  if(nil != _stripImage) {
+    CGImageRelease((__bridge CGImageRef)_stripImage);
+  }
+}
+
+- (NSData *)compliantDataForRows:(NSRange)rows {
+  size_t width = self.imageSize.width;
+  size_t height = self.imageSize.height;
+  if(NSMaxRange(rows) > height) {
+    return nil;
+  }
+  if(nil != self.compliantData) {
+    return [NSData dataWithBytesNoCopy:(void *)((uint8_t *)[self.compliantData bytes] + rows.location * self.bytesPerRow)
+                                length:rows.length * self.bytesPerRow
+                          freeWhenDone:NO];
+  }
+  if(nil == _stripImage) {
+    return nil;
+  }
+  NSMutableData *strip = [NSMutableData dataWithLength:rows.length * width * 4];
+  CGContextRef stripContext = CGBitmapContextCreate([strip mutableBytes], width, rows.length,
+                                                    8, 4 * width,
+                                                    [GFSImageSurfacePool deviceRGBColorSpace],
+                                                    kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipFirst);
+  if(NULL != stripContext) {
+    // Quartz counts up from the bottom, slide the image down so the top
+    // row of the strip lands at the top of the context, the rest is clipped
+    CGContextDrawImage(stripContext, CGRectMake(0., (CGFloat)rows.length + rows.location - height,
+                                                width, height),
+                       (__bridge CGImageRef)_stripImage);
+    CGContextRelease(stripContext);
+  } else {
+    strip = nil;
+  }
+  return strip;
+}
+
 @end
 
 @implementation GFSVImageLoader(Private)
 
+// Decode straight into pixelFormat. Pixels the decoder already laid out
+// that way are kept as they are, other 8 bit RGB and gray layouts are
+// converted in one pass. Only what GFSConvertPixels can't read, and colors
+// that have to be matched to the device, are drawn with Quartz.
 - (BOOL)loadCompliantImageData {
   BOOL success = NO;
+  // the decoded pixels are handed over to compliantData, ImageIO doesn't
+  // need to keep its own copy
+  NSDictionary *options = [NSDictionary dictionaryWithObject:[NSNumber numberWithBool:NO]
+                                                      forKey:(__bridge NSString *)kCGImageSourceShouldCache];
   CGImageSourceRef imageSource = CGImageSourceCreateWithURL((__bridge CFURLRef)self.originalImageURL, NULL);
   if(NULL != imageSource) {
-    CGImageRef imageRef = CGImageSourceCreateImageAtIndex(imageSource, 0, NULL);
+    CGImageRef imageRef = CGImageSourceCreateImageAtIndex(imageSource, 0, (__bridge CFDictionaryRef)options);
     if(NULL != imageRef) {
-      self.imageSize = CGSizeMake(CGImageGetWidth(imageRef), CGImageGetHeight(imageRef));
-      // this call is fine on iOS, but on the mac we'd want this to be
-      // more careful to buidl the correct color sapce
-      CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
-      // this context conforms to the vImage requirments with alpha skip first
-      CGContextRef conformantContext = CGBitmapContextCreate(NULL, self.imageSize.width, 
-                                                             self.imageSize.height, 8, 
-                                                             4 * self.imageSize.width, 
-                                                             colorSpace,
-                                                             kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipFirst);
-      if(NULL != conformantContext) {
-        CGContextDrawImage(conformantContext, CGRectMake(0., 0., self.imageSize.width, self.imageSize.height), imageRef);
-        CGImageRef compliantImageRef = CGBitmapContextCreateImage(conformantContext);
-        if(NULL != compliantImageRef) {
-          CFDataRef dataRef = CGDataProviderCopyData(CGImageGetDataProvider(compliantImageRef));
-          self.compliantData = (__bridge NSData *)dataRef;
-          success = YES;
-          CFRelease(dataRef);
+      size_t width = CGImageGetWidth(imageRef);
+      size_t height = CGImageGetHeight(imageRef);
+      self.imageSize = CGSizeMake(width, height);
+      self.bytesPerRow = width * GFSPixelFormatBytesPerPixel(self.pixelFormat);
+      GFSPixelLayout layout;
+      CFDataRef decodedData = NULL;
+      if([self getLayout:&layout ofImage:imageRef]) {
+        decodedData = CGDataProviderCopyData(CGImageGetDataProvider(imageRef));
+      }
+      size_t decodedLength = NULL != decodedData ? CFDataGetLength(decodedData) : 0;
+      GFSMemoryRecordAllocation(GFSMemoryStageLoad, decodedLength);
+      if(NULL == decodedData) {
+        self.compliantData = [self drawImage:imageRef];
+      } else if(GFSPixelLayoutIsFormat(&layout, self.pixelFormat) &&
+                CGImageGetBytesPerRow(imageRef) == self.bytesPerRow) {
+        self.compliantData = (__bridge_transfer NSData *)decodedData;
+        decodedData = NULL;
+      } else {
+        NSMutableData *pixels = [NSMutableData dataWithLength:height * self.bytesPerRow];
+        GFSMemoryRecordAllocation(GFSMemoryStageLoad, [pixels length]);
+        if(nil != pixels && GFSConvertPixels(CFDataGetBytePtr(decodedData), CGImageGetBytesPerRow(imageRef),
+                                             &layout, [pixels mutableBytes], self.bytesPerRow,
+                                             self.pixelFormat, width, height)) {
+          self.compliantData = pixels;
+        } else {
+          GFSMemoryRecordFree(GFSMemoryStageLoad, [pixels length]);
         }
-        CGImageRelease(compliantImageRef);
-        CGContextRelease(conformantContext);
       }
-      CGColorSpaceRelease(colorSpace);
+      if(NULL != decodedData) {
+        CFRelease(decodedData);
+        GFSMemoryRecordFree(GFSMemoryStageLoad, decodedLength);
+      }
+      _chargedLength = [self.compliantData length];
+      success = nil != self.compliantData;
       CGImageRelease(imageRef);
     }
     CFRelease(imageSource);
   }
-  
+
+  return success;
+}
+
+- (BOOL)loadStripImage {
+  BOOL success = NO;
+  // don't keep the decoded pixels around, every strip decodes what it needs
+  NSDictionary *options = [NSDictionary dictionaryWithObject:[NSNumber numberWithBool:NO]
+                                                      forKey:(__bridge NSString *)kCGImageSourceShouldCache];
+  CGImageSourceRef imageSource = CGImageSourceCreateWithURL((__bridge CFURLRef)self.originalImageURL, NULL);
+  if(NULL != imageSource) {
+    CGImageRef imageRef = CGImageSourceCreateImageAtIndex(imageSource, 0, (__bridge CFDictionaryRef)options);
+    if(NULL != imageRef) {
+      self.imageSize = CGSizeMake(CGImageGetWidth(imageRef), CGImageGetHeight(imageRef));
+      self.pixelFormat = GFSPixelFormatARGB8888;
+      self.bytesPerRow = CGImageGetWidth(imageRef) * 4;
+      _stripImage = (__bridge id)imageRef;
+      success = YES;
+    }
+    CFRelease(imageSource);
+  }
   return success;
 }
 
+// Where the channels are in the image's own pixels. NO unless they're 8 bit
+// RGB or gray that can be read without color matching.
+- (BOOL)getLayout:(GFSPixelLayout *)layout ofImage:(CGImageRef)imageRef {
+  CGColorSpaceRef colorSpace = CGImageGetColorSpace(imageRef);
+  CGBitmapInfo bitmapInfo = CGImageGetBitmapInfo(imageRef);
+  if(NULL == colorSpace || 8 != CGImageGetBitsPerComponent(imageRef) ||
+     0 != (bitmapInfo & kCGBitmapFloatComponents) || NULL != CGImageGetDecode(imageRef)) {
+    return NO;
+  }
+  // an embedded profile means the colors have to be matched, leave that
+  // to Quartz
+  CFDataRef profile = CGColorSpaceCopyICCProfile(colorSpace);
+  if(NULL != profile) {
+    CFRelease(profile);
+    return NO;
+  }
+  CGColorSpaceModel model = CGColorSpaceGetModel(colorSpace);
+  CGImageAlphaInfo alphaInfo = CGImageGetAlphaInfo(imageRef);
+  size_t bitsPerPixel = CGImageGetBitsPerPixel(imageRef);
+  if(kCGColorSpaceModelMonochrome == model && 8 == bitsPerPixel && kCGImageAlphaNone == alphaInfo) {
+    *layout = (GFSPixelLayout){ 1, 0, -1, -1, -1, false };
+    return YES;
+  }
+  if(kCGColorSpaceModelRGB != model) {
+    return NO;
+  }
+  if(24 == bitsPerPixel && kCGImageAlphaNone == alphaInfo) {
+    *layout = (GFSPixelLayout){ 3, 0, 1, 2, -1, false };
+    return YES;
+  }
+  if(32 != bitsPerPixel) {
+    return NO;
+  }
+  // byte offsets of red, green, blue and alpha in big endian order
+  int8_t offsets[4];
+  BOOL hasAlpha = YES;
+  switch(alphaInfo) {
+    case kCGImageAlphaNoneSkipFirst:
+      hasAlpha = NO;
+    case kCGImageAlphaFirst:
+    case kCGImageAlphaPremultipliedFirst:
+      offsets[0] = 1;
+      offsets[1] = 2;
+      offsets[2] = 3;
+      offsets[3] = 0;
+      break;
+    case kCGImageAlphaNoneSkipLast:
+      hasAlpha = NO;
+    case kCGImageAlphaLast:
+    case kCGImageAlphaPremultipliedLast:
+      offsets[0] = 0;
+      offsets[1] = 1;
+      offsets[2] = 2;
+      offsets[3] = 3;
+      break;
+    default:
+      return NO;
+  }
+  CGBitmapInfo byteOrder = bitmapInfo & kCGBitmapByteOrderMask;
+  if(kCGBitmapByteOrder32Little == byteOrder) {
+    for(NSUInteger i = 0;i < 4;i++) {
+      offsets[i] = 3 - offsets[i];
+    }
+  } else if(kCGBitmapByteOrderDefault != byteOrder && kCGBitmapByteOrder32Big != byteOrder) {
+    return NO;
+  }
+  *layout = (GFSPixelLayout){ 4, offsets[0], offsets[1], offsets[2], hasAlpha ? offsets[3] : -1,
+    kCGImageAlphaPremultipliedFirst == alphaInfo || kCGImageAlphaPremultipliedLast == alphaInfo };
+  return YES;
+}
+
+// Quartz decodes and color matches into the 8 bit format closest to
+// pixelFormat, drawing right into the pixels that are kept unless the
+// channels are wider than 8 bits.
+- (NSData *)drawImage:(CGImageRef)imageRef {
+  size_t width = self.imageSize.width;
+  size_t height = self.imageSize.height;
+  BOOL gray = GFSPixelFormatPlanar8 == self.pixelFormat || GFSPixelFormatPlanarF == self.pixelFormat;
+  GFSPixelFormat drawnFormat = GFSPixelFormatARGB8888;
+  CGColorSpaceRef colorSpace = [GFSImageSurfacePool deviceRGBColorSpace];
+  CGBitmapInfo bitmapInfo = kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipFirst;
+  if(gray) {
+    drawnFormat = GFSPixelFormatPlanar8;
+    colorSpace = [GFSImageSurfacePool deviceGrayColorSpace];
+    bitmapInfo = kCGImageAlphaNone;
+  } else if(GFSPixelFormatBGRA8888 == self.pixelFormat) {
+    drawnFormat = GFSPixelFormatBGRA8888;
+    bitmapInfo = kCGBitmapByteOrder32Little | kCGImageAlphaNoneSkipFirst;
+  }
+  size_t drawnBytesPerRow = width * GFSPixelFormatBytesPerPixel(drawnFormat);
+  NSMutableData *drawn = [NSMutableData dataWithLength:height * drawnBytesPerRow];
+  GFSMemoryRecordAllocation(GFSMemoryStageLoad, [drawn length]);
+  CGContextRef context = CGBitmapContextCreate([drawn mutableBytes], width, height, 8,
+                                               drawnBytesPerRow, colorSpace, bitmapInfo);
+  if(NULL == context) {
+    GFSMemoryRecordFree(GFSMemoryStageLoad, [drawn length]);
+    return nil;
+  }
+  CGContextDrawImage(context, CGRectMake(0., 0., width, height), imageRef);
+  CGContextRelease(context);
+  if(drawnFormat == self.pixelFormat) {
+    return drawn;
+  }
+  GFSPixelLayout layout = gray ? (GFSPixelLayout){ 1, 0, -1, -1, -1, false } : (GFSPixelLayout){ 4, 1, 2, 3, -1, false };
+  NSMutableData *pixels = [NSMutableData dataWithLength:height * self.bytesPerRow];
+  GFSMemoryRecordAllocation(GFSMemoryStageLoad, [pixels length]);
+  GFSMemoryRecordFree(GFSMemoryStageLoad, [drawn length]);
+  if(nil == pixels || !GFSConvertPixels([drawn bytes], drawnBytesPerRow, &layout, [pixels mutableBytes],
+                                        self.bytesPerRow, self.pixelFormat, width, height)) {
+    GFSMemoryRecordFree(GFSMemoryStageLoad, [pixels length]);
+    return nil;
+  }
+  return pixels;
+}
+
 @end
\ No newline at end of file
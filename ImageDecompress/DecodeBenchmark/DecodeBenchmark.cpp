@@ -0,0 +1,345 @@
+//
+//  DecodeBenchmark.cpp
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+//  Times getting JPEGs and PNGs down to a display size with GFSImageDecoder
+//  two ways, a full size decode then a resample (what drawing the decoded
+//  image into a small context does) and a scaled decode then a resample of
+//  what's left, plus decoding just a region against cropping a full decode.
+//  GFSResampler's filters are timed the same two ways, on the whole
+//  downscale and on what's left after the scaled decode. GFSProgressiveDecoder
+//  is timed to its first (preview) stage, and through to the final one.
+//  Prints CSV: the time (best of several runs), the peak bytes allocated, the
+//  part of that GFSMemoryAccounting saw (the engines' own scratch, the
+//  benchmark's buffers aren't counted) and how close the image came out
+//  (PSNR, against the full decode's) for each.
+//
+//  Needs nothing but zlib, so it runs on Linux as well as OS X:
+//
+//    c++ -O2 -std=c++11 -I../ImageDecompress -I../../Convolver/Convolver -o DecodeBenchmark
+//        ../ImageDecompress/GFSImageDecoder.cpp ../ImageDecompress/GFSResampler.cpp
+//        ../ImageDecompress/GFSProgressiveDecoder.cpp ../../Convolver/Convolver/GFSMemoryAccounting.cpp
+//        DecodeBenchmark.cpp -lz -lpthread
+//    ./DecodeBenchmark -w 512 -h 512 ../ImageDecompress/IMG_4087.jpg
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "GFSImageDecoder.h"
+#include "GFSMemoryAccounting.h"
+#include "GFSProgressiveDecoder.h"
+#include "GFSResampler.h"
+
+namespace {
+
+const unsigned kMaxIterations = 10;
+const double kMinSeconds = 0.5;
+
+#pragma mark - Allocations
+
+// Every C++ allocation goes through here so the peak number of bytes live
+// during each run can be reported. Each block starts with its size.
+std::atomic<size_t> gLiveBytes(0);
+std::atomic<size_t> gPeakBytes(0);
+const size_t kHeaderBytes = 16;
+
+void ResetPeakBytes() {
+  gPeakBytes = gLiveBytes.load();
+}
+
+}
+
+void *operator new(size_t size) {
+  uint8_t *block = (uint8_t *)malloc(size + kHeaderBytes);
+  if(NULL == block) {
+    throw std::bad_alloc();
+  }
+  memcpy(block, &size, sizeof(size));
+  size_t live = gLiveBytes += size;
+  size_t peak = gPeakBytes.load();
+  while(live > peak && !gPeakBytes.compare_exchange_weak(peak, live)) {
+  }
+  return block + kHeaderBytes;
+}
+
+void operator delete(void *memory) noexcept {
+  if(NULL == memory) {
+    return;
+  }
+  uint8_t *block = (uint8_t *)((uintptr_t)memory - kHeaderBytes);
+  size_t size;
+  memcpy(&size, block, sizeof(size));
+  gLiveBytes -= size;
+  free(block);
+}
+
+namespace {
+
+#pragma mark - Resampling
+
+// Area averaging, each destination pixel is the average of the source
+// pixels under it, weighted by how much of each it covers. Close to what
+// Quartz's high quality interpolation does for downscales.
+void Resample(const uint8_t *src, uint32_t srcWidth, uint32_t srcHeight,
+              uint8_t *dest, uint32_t destWidth, uint32_t destHeight) {
+  double scaleX = (double)srcWidth / destWidth;
+  double scaleY = (double)srcHeight / destHeight;
+  std::vector<double> row((size_t)destWidth * 3);
+  for(uint32_t dy = 0;dy < destHeight;dy++) {
+    double top = dy * scaleY;
+    double bottom = top + scaleY;
+    std::fill(row.begin(), row.end(), 0.0);
+    for(uint32_t sy = (uint32_t)top;sy < srcHeight && sy < bottom;sy++) {
+      double weightY = std::min(bottom, sy + 1.0) - std::max(top, (double)sy);
+      const uint8_t *srcRow = src + (size_t)sy * srcWidth * 4;
+      for(uint32_t dx = 0;dx < destWidth;dx++) {
+        double left = dx * scaleX;
+        double right = left + scaleX;
+        for(uint32_t sx = (uint32_t)left;sx < srcWidth && sx < right;sx++) {
+          double weight = weightY * (std::min(right, sx + 1.0) - std::max(left, (double)sx));
+          row[dx * 3] += weight * srcRow[sx * 4 + 1];
+          row[dx * 3 + 1] += weight * srcRow[sx * 4 + 2];
+          row[dx * 3 + 2] += weight * srcRow[sx * 4 + 3];
+        }
+      }
+    }
+    uint8_t *out = dest + (size_t)dy * destWidth * 4;
+    double area = scaleX * scaleY;
+    for(uint32_t dx = 0;dx < destWidth;dx++) {
+      out[dx * 4] = 255;
+      for(uint32_t c = 0;c < 3;c++) {
+        out[dx * 4 + 1 + c] = (uint8_t)std::min(255.0, row[dx * 3 + c] / area + 0.5);
+      }
+    }
+  }
+}
+
+double PSNR(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b) {
+  double sum = 0.0;
+  for(size_t i = 0;i < a.size();i++) {
+    double difference = (double)a[i] - b[i];
+    sum += difference * difference;
+  }
+  if(0.0 == sum) {
+    return INFINITY;
+  }
+  return 10.0 * log10(255.0 * 255.0 / (sum / (a.size() * 3 / 4)));
+}
+
+#pragma mark - Runs
+
+struct Run {
+  double milliseconds;
+  size_t peakBytes;
+  int64_t accountedPeakBytes;
+  bool ok;
+};
+
+// Best time of up to kMaxIterations runs of block, stopping once they've
+// taken kMinSeconds.
+template <typename Block>
+Run Time(Block block) {
+  Run run = { INFINITY, 0, 0, true };
+  double total = 0.0;
+  for(unsigned i = 0;i < kMaxIterations && total < kMinSeconds;i++) {
+    ResetPeakBytes();
+    size_t before = gLiveBytes.load();
+    GFSMemoryResetPeaks();
+    GFSMemoryStats accountedBefore;
+    GFSMemoryGetStats(GFSMemoryStageCount, &accountedBefore);
+    auto start = std::chrono::steady_clock::now();
+    bool ok = block();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    run.ok = run.ok && ok;
+    run.milliseconds = std::min(run.milliseconds, elapsed.count() * 1000.0);
+    run.peakBytes = std::max(run.peakBytes, gPeakBytes.load() - before);
+    GFSMemoryStats accounted;
+    GFSMemoryGetStats(GFSMemoryStageCount, &accounted);
+    run.accountedPeakBytes = std::max(run.accountedPeakBytes, accounted.peakBytes - accountedBefore.liveBytes);
+    total += elapsed.count();
+  }
+  return run;
+}
+
+void Print(const char *path, const char *method, uint32_t scale, uint32_t decodedWidth, uint32_t decodedHeight,
+           const Run &run, double psnr) {
+  printf("%s,%s,%u,%u,%u,%.3f,%zu,%lld,", path, method, scale, decodedWidth, decodedHeight,
+         run.milliseconds, run.peakBytes, (long long)run.accountedPeakBytes);
+  if(!run.ok) {
+    printf("failed\n");
+  } else if(std::isinf(psnr)) {
+    printf("identical\n");
+  } else {
+    printf("%.2f\n", psnr);
+  }
+}
+
+// stops the progressive decode after its first stage
+bool StopAfterPreview(void *, GFSProgressiveStage, const GFSResampleBuffer *) {
+  return false;
+}
+
+// keeps going through every stage
+bool ContinueAfterPreview(void *, GFSProgressiveStage, const GFSResampleBuffer *) {
+  return true;
+}
+
+bool ReadFile(const char *path, std::vector<uint8_t> &data) {
+  FILE *file = fopen(path, "rb");
+  if(NULL == file) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  data.resize(length > 0 ? (size_t)length : 0);
+  bool ok = length > 0 && fread(data.data(), 1, data.size(), file) == data.size();
+  fclose(file);
+  return ok;
+}
+
+void Benchmark(const char *path, uint32_t targetWidth, uint32_t targetHeight) {
+  std::vector<uint8_t> data;
+  GFSImageInfo info;
+  if(!ReadFile(path, data) || GFSImageDecoderNoError != GFSImageDecoderReadInfo(data.data(), data.size(), &info)) {
+    fprintf(stderr, "%s: not a JPEG or PNG\n", path);
+    return;
+  }
+  targetWidth = std::min(targetWidth, info.width);
+  targetHeight = std::min(targetHeight, info.height);
+
+  // full decode, then resample the whole thing
+  std::vector<uint8_t> reference((size_t)targetWidth * targetHeight * 4);
+  Run full = Time([&]() {
+    std::vector<uint8_t> decoded((size_t)info.width * info.height * 4);
+    if(GFSImageDecoderNoError != GFSImageDecodeARGB8888(data.data(), data.size(), 1, NULL,
+                                                        decoded.data(), info.width * 4)) {
+      return false;
+    }
+    Resample(decoded.data(), info.width, info.height, reference.data(), targetWidth, targetHeight);
+    return true;
+  });
+  Print(path, "full+resample", 1, info.width, info.height, full, INFINITY);
+
+  // every scale down to the one that just covers the target
+  uint32_t largestScale = GFSImageDecoderScaleForSize(&info, targetWidth, targetHeight);
+  for(uint32_t scale = 2;scale <= largestScale;scale *= 2) {
+    uint32_t width, height;
+    GFSImageDecoderScaledSize(&info, scale, &width, &height);
+    std::vector<uint8_t> thumbnail((size_t)targetWidth * targetHeight * 4);
+    Run scaled = Time([&]() {
+      std::vector<uint8_t> decoded((size_t)width * height * 4);
+      if(GFSImageDecoderNoError != GFSImageDecodeARGB8888(data.data(), data.size(), scale, NULL,
+                                                          decoded.data(), width * 4)) {
+        return false;
+      }
+      Resample(decoded.data(), width, height, thumbnail.data(), targetWidth, targetHeight);
+      return true;
+    });
+    Print(path, "scaled+resample", scale, width, height, scaled, PSNR(reference, thumbnail));
+  }
+
+  // GFSResampler on the whole downscale, and on what's left after the
+  // largest scaled decode
+  const char *filterNames[] = { "box", "bilinear", "lanczos3", "mitchell" };
+  const uint32_t scales[] = { 1, largestScale };
+  const size_t scaleCount = largestScale > 1 ? 2 : 1;
+  for(int filter = GFSResampleFilterBox;filter <= GFSResampleFilterMitchell;filter++) {
+    for(size_t s = 0;s < scaleCount;s++) {
+      uint32_t scale = scales[s];
+      uint32_t width, height;
+      GFSImageDecoderScaledSize(&info, scale, &width, &height);
+      std::vector<uint8_t> thumbnail((size_t)targetWidth * targetHeight * 4);
+      Run resampled = Time([&]() {
+        std::vector<uint8_t> decoded((size_t)width * height * 4);
+        if(GFSImageDecoderNoError != GFSImageDecodeARGB8888(data.data(), data.size(), scale, NULL,
+                                                            decoded.data(), width * 4)) {
+          return false;
+        }
+        GFSResampleBuffer src = { decoded.data(), height, width, width * 4 };
+        GFSResampleBuffer dest = { thumbnail.data(), targetHeight, targetWidth, targetWidth * 4 };
+        return GFSResampleNoError == GFSResampleARGB8888(&src, &dest, (GFSResampleFilter)filter, GFSResampleNoFlags);
+      });
+      char method[64];
+      snprintf(method, sizeof(method), "%s+%s", 1 == scale ? "full" : "scaled", filterNames[filter]);
+      Print(path, method, scale, width, height, resampled, PSNR(reference, thumbnail));
+    }
+  }
+
+  // how soon there's something to show, and what showing it first costs
+  // the whole decode
+  GFSProgressiveCallback callbacks[] = { StopAfterPreview, ContinueAfterPreview };
+  const char *progressiveNames[] = { "progressive-preview", "progressive" };
+  for(size_t c = 0;c < 2;c++) {
+    std::vector<uint8_t> thumbnail((size_t)targetWidth * targetHeight * 4);
+    Run progressive = Time([&]() {
+      GFSResampleBuffer dest = { thumbnail.data(), targetHeight, targetWidth, targetWidth * 4 };
+      return GFSImageDecoderNoError == GFSProgressiveDecodeARGB8888(data.data(), data.size(), &dest,
+                                                                    GFSResampleFilterLanczos3, callbacks[c], NULL);
+    });
+    Print(path, progressiveNames[c], largestScale, targetWidth, targetHeight, progressive,
+          PSNR(reference, thumbnail));
+  }
+
+  // a target sized window out of the middle, at full resolution
+  GFSImageRegion region = { (info.width - targetWidth) / 2, (info.height - targetHeight) / 2,
+                            targetWidth, targetHeight };
+  std::vector<uint8_t> cropped((size_t)targetWidth * targetHeight * 4);
+  Run crop = Time([&]() {
+    std::vector<uint8_t> decoded((size_t)info.width * info.height * 4);
+    if(GFSImageDecoderNoError != GFSImageDecodeARGB8888(data.data(), data.size(), 1, NULL,
+                                                        decoded.data(), info.width * 4)) {
+      return false;
+    }
+    for(uint32_t y = 0;y < targetHeight;y++) {
+      memcpy(cropped.data() + (size_t)y * targetWidth * 4,
+             decoded.data() + ((size_t)(region.y + y) * info.width + region.x) * 4, targetWidth * 4);
+    }
+    return true;
+  });
+  Print(path, "full+crop", 1, info.width, info.height, crop, INFINITY);
+  std::vector<uint8_t> window((size_t)targetWidth * targetHeight * 4);
+  Run regional = Time([&]() {
+    return GFSImageDecoderNoError == GFSImageDecodeARGB8888(data.data(), data.size(), 1, &region,
+                                                            window.data(), targetWidth * 4);
+  });
+  Print(path, "region", 1, targetWidth, targetHeight, regional, PSNR(cropped, window));
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t targetWidth = 512;
+  uint32_t targetHeight = 512;
+  int first = 1;
+  while(first + 1 < argc && '-' == argv[first][0]) {
+    if(0 == strcmp(argv[first], "-w")) {
+      targetWidth = (uint32_t)atoi(argv[first + 1]);
+    } else if(0 == strcmp(argv[first], "-h")) {
+      targetHeight = (uint32_t)atoi(argv[first + 1]);
+    } else {
+      break;
+    }
+    first += 2;
+  }
+  if(first >= argc || 0 == targetWidth || 0 == targetHeight) {
+    fprintf(stderr, "usage: %s [-w width] [-h height] image...\n", argv[0]);
+    return 1;
+  }
+  printf("file,method,scale,decoded_width,decoded_height,ms,peak_bytes,accounted_peak_bytes,psnr\n");
+  for(int i = first;i < argc;i++) {
+    Benchmark(argv[i], targetWidth, targetHeight);
+  }
+  return 0;
+}
@@ -0,0 +1,164 @@
+//
+//  DecoderConformance.cpp
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 10/19/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+//  Checks that GFSImageDecoder turns corrupt JPEGs away with
+//  GFSImageDecoderInvalidData instead of reading or writing out of bounds.
+//  Each case is a copy of a good JPEG with one of its Huffman tables (DHT)
+//  broken:
+//
+//   - oversubscribed: every code moved to length 1, more codes than it has
+//     room for. The codes would run past the end of the lookahead tables.
+//   - too many symbols: counts adding up to more than 256.
+//   - short segment: a segment too short for the symbols its counts say it
+//     holds.
+//
+//  The untouched JPEG has to decode, at every scale. Prints CSV and fails
+//  when a case doesn't come back as expected. Build with the sanitizers to
+//  catch what doesn't show up as a wrong result:
+//
+//    c++ -g -O1 -std=c++11 -fsanitize=address,undefined -I../ImageDecompress
+//        -o DecoderConformance ../ImageDecompress/GFSImageDecoder.cpp
+//        DecoderConformance.cpp -lz
+//    ./DecoderConformance ../ImageDecompress/IMG_4087.jpg
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "GFSImageDecoder.h"
+
+namespace {
+
+struct HuffmanTableAt {
+  // of the table's class/index byte, its 16 counts follow
+  size_t offset;
+  // of the segment's length field
+  size_t segmentOffset;
+  uint32_t symbolCount;
+};
+
+bool ReadFile(const char *path, std::vector<uint8_t> &data) {
+  FILE *file = fopen(path, "rb");
+  if(NULL == file) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  data.resize(length > 0 ? (size_t)length : 0);
+  bool ok = length > 0 && fread(data.data(), 1, data.size(), file) == data.size();
+  fclose(file);
+  return ok;
+}
+
+// every Huffman table in the headers, up to the first scan
+std::vector<HuffmanTableAt> FindHuffmanTables(const std::vector<uint8_t> &data) {
+  std::vector<HuffmanTableAt> tables;
+  size_t at = 2;
+  while(at + 4 <= data.size() && 0xFF == data[at]) {
+    uint8_t marker = data[at + 1];
+    size_t length = (size_t)data[at + 2] << 8 | data[at + 3];
+    if(0xDA == marker || length < 2 || at + 2 + length > data.size()) {
+      break;
+    }
+    if(0xC4 == marker) {
+      size_t table = at + 4;
+      while(table + 17 <= at + 2 + length) {
+        uint32_t symbolCount = 0;
+        for(uint32_t i = 0;i < 16;i++) {
+          symbolCount += data[table + 1 + i];
+        }
+        tables.push_back({table, at + 2, symbolCount});
+        table += 17 + symbolCount;
+      }
+    }
+    at += 2 + length;
+  }
+  return tables;
+}
+
+GFSImageDecoderError Decode(const std::vector<uint8_t> &data, uint32_t scale) {
+  GFSImageInfo info;
+  GFSImageDecoderError error = GFSImageDecoderReadInfo(data.data(), data.size(), &info);
+  if(GFSImageDecoderNoError != error) {
+    return error;
+  }
+  uint32_t width = 0;
+  uint32_t height = 0;
+  GFSImageDecoderScaledSize(&info, scale, &width, &height);
+  std::vector<uint8_t> dest((size_t)width * height * 4);
+  return GFSImageDecodeARGB8888(data.data(), data.size(), scale, NULL, dest.data(), (size_t)width * 4);
+}
+
+bool Check(const char *name, size_t table, uint32_t scale, GFSImageDecoderError error, GFSImageDecoderError expected) {
+  bool passed = error == expected;
+  printf("%s,%zu,%u,%d,%d,%s\n", name, table, scale, (int)error, (int)expected, passed ? "pass" : "FAIL");
+  return passed;
+}
+
+// all of the table's codes at length 1, which has room for two. The third
+// would start at lookahead entry 512, one past the end.
+void Oversubscribe(std::vector<uint8_t> &data, const HuffmanTableAt &table) {
+  uint8_t *counts = &data[table.offset + 1];
+  memset(counts, 0, 16);
+  counts[0] = (uint8_t)table.symbolCount;
+}
+
+void TooManySymbols(std::vector<uint8_t> &data, const HuffmanTableAt &table) {
+  memset(&data[table.offset + 1], 0xFF, 16);
+}
+
+void ShortSegment(std::vector<uint8_t> &data, const HuffmanTableAt &table) {
+  size_t length = (size_t)data[table.segmentOffset] << 8 | data[table.segmentOffset + 1];
+  size_t shorter = table.offset + 17 + table.symbolCount - 1 - table.segmentOffset;
+  if(shorter < length) {
+    data[table.segmentOffset] = (uint8_t)(shorter >> 8);
+    data[table.segmentOffset + 1] = (uint8_t)shorter;
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::vector<uint8_t> data;
+  if(2 != argc || !ReadFile(argv[1], data)) {
+    fprintf(stderr, "usage: %s image.jpg\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::vector<HuffmanTableAt> tables = FindHuffmanTables(data);
+  if(tables.empty()) {
+    fprintf(stderr, "%s has no Huffman tables\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  printf("case,table,scale,error,expected,result\n");
+  bool passed = true;
+  const uint32_t scales[] = {1, 2, 4, 8};
+  for(uint32_t scale : scales) {
+    passed = Check("intact", 0, scale, Decode(data, scale), GFSImageDecoderNoError) && passed;
+  }
+  struct {
+    const char *name;
+    void (*corrupt)(std::vector<uint8_t> &, const HuffmanTableAt &);
+  } cases[] = {
+    {"oversubscribed", Oversubscribe},
+    {"too many symbols", TooManySymbols},
+    {"short segment", ShortSegment},
+  };
+  for(const auto &corruption : cases) {
+    for(size_t i = 0;i < tables.size();i++) {
+      if(Oversubscribe == corruption.corrupt && tables[i].symbolCount <= 2) {
+        continue;
+      }
+      std::vector<uint8_t> corrupt = data;
+      corruption.corrupt(corrupt, tables[i]);
+      passed = Check(corruption.name, i, 1, Decode(corrupt, 1), GFSImageDecoderInvalidData) && passed;
+    }
+  }
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,87 @@
+//
+//  GFSDecodeScheduler.h
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef enum {
+  // on screen now, always run before any prefetch
+  GFSDecodePriorityVisible = 0,
+  // likely to be on screen soon
+  GFSDecodePriorityPrefetch,
+  GFSDecodePriorityCount
+} GFSDecodePriority;
+
+typedef struct GFSDecodeSchedulerMetrics {
+  // waiting to start, in each lane
+  NSUInteger queued[GFSDecodePriorityCount];
+  NSUInteger running;
+  // decoded bytes of the running decodes
+  size_t bytesInFlight;
+  size_t peakBytesInFlight;
+  NSUInteger completed;
+  NSUInteger cancelled;
+  // seconds, from being scheduled until starting, and running
+  NSTimeInterval averageWait;
+  NSTimeInterval maximumWait;
+  NSTimeInterval averageDecode;
+} GFSDecodeSchedulerMetrics;
+
+@interface GFSDecodeRequest : NSObject
+
+@property(nonatomic, assign, readonly) GFSDecodePriority priority;
+@property(nonatomic, assign, readonly) size_t decodedBytes;
+
+// Cancelling a request that hasn't started drops it, one that is running
+// can check isCancelled to stop early. Either way its completion is never
+// called, cancellationHandler is instead. Safe to call from any thread.
+- (void)cancel;
+- (BOOL)isCancelled;
+
+// called once on the main queue when the request is cancelled, straight
+// away if it already was when this is set
+@property(nonatomic, copy) void (^cancellationHandler)(void);
+
+@end
+
+/*
+ * Runs decodes a few at a time instead of all at once. At most
+ * maxConcurrentDecodes run at the same time (one per core by default) and
+ * only while the bytes they decode to fit in memoryBudget, so a burst of
+ * requests can't oversubscribe the cores or memory. A decode bigger than the
+ * whole budget still runs, on its own.
+ *
+ * Visible requests always start before prefetches, in the order they were
+ * scheduled. Requests that are no longer wanted (scrolled off screen, say)
+ * should be cancelled, cancelRequestsWithPriority: drops a whole lane.
+ *
+ * metrics tells how deep the lanes are and how long requests wait and run.
+ */
+@interface GFSDecodeScheduler : NSObject
+
++ (GFSDecodeScheduler *)sharedScheduler;
+
+// 0 for either means the default: the number of active cores and a quarter
+// of the physical memory
+- (id)initWithMaxConcurrentDecodes:(NSUInteger)maxConcurrentDecodes memoryBudget:(size_t)memoryBudget;
+
+@property(nonatomic, assign, readonly) NSUInteger maxConcurrentDecodes;
+@property(nonatomic, assign, readonly) size_t memoryBudget;
+
+// decode runs on a background queue once admitted and returns the result,
+// completion gets it on the main queue. decodedBytes is how much memory
+// decode will need at its peak.
+- (GFSDecodeRequest *)scheduleDecodeOfBytes:(size_t)decodedBytes
+                                   priority:(GFSDecodePriority)priority
+                                     decode:(id (^)(GFSDecodeRequest *request))decode
+                                 completion:(void (^)(id result))completion;
+
+- (void)cancelRequestsWithPriority:(GFSDecodePriority)priority;
+
+- (GFSDecodeSchedulerMetrics)metrics;
+
+@end
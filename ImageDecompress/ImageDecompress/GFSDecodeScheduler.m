@@ -0,0 +1,286 @@
+//
+//  GFSDecodeScheduler.m
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+
+#import "GFSDecodeScheduler.h"
+#import <libkern/OSAtomic.h>
+
+@class GFSDecodeScheduler;
+
+@interface GFSDecodeRequest()
+
+@property(nonatomic, assign, readwrite) GFSDecodePriority priority;
+@property(nonatomic, assign, readwrite) size_t decodedBytes;
+@property(nonatomic, copy) id (^decode)(GFSDecodeRequest *request);
+@property(nonatomic, copy) void (^completion)(id result);
+@property(nonatomic, assign) CFAbsoluteTime scheduled;
+@property(nonatomic, weak) GFSDecodeScheduler *scheduler;
+
+@end
+
+@interface GFSDecodeScheduler()
+
+@property(nonatomic, assign, readwrite) NSUInteger maxConcurrentDecodes;
+@property(nonatomic, assign, readwrite) size_t memoryBudget;
+
+- (void)requestWasCancelled:(GFSDecodeRequest *)request;
+
+@end
+
+@implementation GFSDecodeRequest {
+  volatile int32_t _cancelled;
+  // guards the two below, cancel takes the handler exactly once
+  OSSpinLock _handlerLock;
+  void (^_cancellationHandler)(void);
+  BOOL _handlerTaken;
+}
+
+@synthesize priority = _priority;
+@synthesize decodedBytes = _decodedBytes;
+@synthesize decode = _decode;
+@synthesize completion = _completion;
+@synthesize scheduled = _scheduled;
+@synthesize scheduler = _scheduler;
+
+- (id)init {
+  self = [super init];
+  if(nil != self) {
+    _handlerLock = OS_SPINLOCK_INIT;
+  }
+  return self;
+}
+
+- (void (^)(void))cancellationHandler {
+  OSSpinLockLock(&_handlerLock);
+  void (^handler)(void) = _cancellationHandler;
+  OSSpinLockUnlock(&_handlerLock);
+  return handler;
+}
+
+- (void)setCancellationHandler:(void (^)(void))cancellationHandler {
+  void (^handler)(void) = [cancellationHandler copy];
+  OSSpinLockLock(&_handlerLock);
+  // cancel already took whatever was here, so this one is run now
+  BOOL taken = _handlerTaken;
+  if(!taken) {
+    _cancellationHandler = handler;
+  }
+  OSSpinLockUnlock(&_handlerLock);
+  if(taken && nil != handler) {
+    dispatch_async(dispatch_get_main_queue(), handler);
+  }
+}
+
+- (void)cancel {
+  if(OSAtomicCompareAndSwap32Barrier(0, 1, &_cancelled)) {
+    OSSpinLockLock(&_handlerLock);
+    void (^handler)(void) = _cancellationHandler;
+    _cancellationHandler = nil;
+    _handlerTaken = YES;
+    OSSpinLockUnlock(&_handlerLock);
+    if(nil != handler) {
+      dispatch_async(dispatch_get_main_queue(), handler);
+    }
+    [self.scheduler requestWasCancelled:self];
+  }
+}
+
+- (BOOL)isCancelled {
+  OSMemoryBarrier();
+  return 0 != _cancelled;
+}
+
+@end
+
+@interface GFSDecodeScheduler(Private)
+
+- (void)startDecodes;
+- (void)runRequest:(GFSDecodeRequest *)request;
+
+@end
+
+@implementation GFSDecodeScheduler {
+  // all of the state below is only touched on _stateQueue
+  dispatch_queue_t _stateQueue;
+  NSMutableArray *_lanes[GFSDecodePriorityCount];
+  NSUInteger _running;
+  size_t _bytesInFlight;
+  size_t _peakBytesInFlight;
+  NSUInteger _completed;
+  NSUInteger _cancelled;
+  NSUInteger _started;
+  NSTimeInterval _totalWait;
+  NSTimeInterval _maximumWait;
+  NSTimeInterval _totalDecode;
+}
+
+@synthesize maxConcurrentDecodes = _maxConcurrentDecodes;
+@synthesize memoryBudget = _memoryBudget;
+
++ (GFSDecodeScheduler *)sharedScheduler {
+  static GFSDecodeScheduler *scheduler = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    scheduler = [[GFSDecodeScheduler alloc] initWithMaxConcurrentDecodes:0 memoryBudget:0];
+  });
+  return scheduler;
+}
+
+- (id)init {
+  return [self initWithMaxConcurrentDecodes:0 memoryBudget:0];
+}
+
+- (id)initWithMaxConcurrentDecodes:(NSUInteger)maxConcurrentDecodes memoryBudget:(size_t)memoryBudget {
+  self = [super init];
+  if(nil != self) {
+    NSProcessInfo *processInfo = [NSProcessInfo processInfo];
+    self.maxConcurrentDecodes = 0 != maxConcurrentDecodes ? maxConcurrentDecodes : MAX(1u, [processInfo activeProcessorCount]);
+    self.memoryBudget = 0 != memoryBudget ? memoryBudget : (size_t)([processInfo physicalMemory] / 4);
+    _stateQueue = dispatch_queue_create("com.galafactory.decodescheduler", DISPATCH_QUEUE_SERIAL);
+    for(NSUInteger i = 0;i < GFSDecodePriorityCount;i++) {
+      _lanes[i] = [NSMutableArray array];
+    }
+  }
+  return self;
+}
+
+- (GFSDecodeRequest *)scheduleDecodeOfBytes:(size_t)decodedBytes
+                                   priority:(GFSDecodePriority)priority
+                                     decode:(id (^)(GFSDecodeRequest *request))decode
+                                 completion:(void (^)(id result))completion {
+  GFSDecodeRequest *request = [[GFSDecodeRequest alloc] init];
+  request.priority = priority < GFSDecodePriorityCount ? priority : GFSDecodePriorityPrefetch;
+  request.decodedBytes = decodedBytes;
+  request.decode = decode;
+  request.completion = completion;
+  request.scheduled = CFAbsoluteTimeGetCurrent();
+  request.scheduler = self;
+  dispatch_async(_stateQueue, ^{
+    if([request isCancelled]) {
+      _cancelled++;
+      return;
+    }
+    [_lanes[request.priority] addObject:request];
+    [self startDecodes];
+  });
+  return request;
+}
+
+- (void)cancelRequestsWithPriority:(GFSDecodePriority)priority {
+  if(priority >= GFSDecodePriorityCount) {
+    return;
+  }
+  dispatch_async(_stateQueue, ^{
+    // cancel takes each out of the lane with requestWasCancelled:
+    NSArray *lane = [_lanes[priority] copy];
+    for(GFSDecodeRequest *request in lane) {
+      [request cancel];
+    }
+  });
+}
+
+- (void)requestWasCancelled:(GFSDecodeRequest *)request {
+  dispatch_async(_stateQueue, ^{
+    // one that has started, or not been queued yet, is counted elsewhere
+    NSMutableArray *lane = _lanes[request.priority];
+    NSUInteger index = [lane indexOfObjectIdenticalTo:request];
+    if(NSNotFound != index) {
+      [lane removeObjectAtIndex:index];
+      _cancelled++;
+    }
+  });
+}
+
+- (GFSDecodeSchedulerMetrics)metrics {
+  __block GFSDecodeSchedulerMetrics metrics;
+  dispatch_sync(_stateQueue, ^{
+    for(NSUInteger i = 0;i < GFSDecodePriorityCount;i++) {
+      metrics.queued[i] = [_lanes[i] count];
+    }
+    metrics.running = _running;
+    metrics.bytesInFlight = _bytesInFlight;
+    metrics.peakBytesInFlight = _peakBytesInFlight;
+    metrics.completed = _completed;
+    metrics.cancelled = _cancelled;
+    metrics.averageWait = 0 != _started ? _totalWait / _started : 0.;
+    metrics.maximumWait = _maximumWait;
+    metrics.averageDecode = 0 != _completed ? _totalDecode / _completed : 0.;
+  });
+  return metrics;
+}
+
+@end
+
+@implementation GFSDecodeScheduler(Private)
+
+// On _stateQueue. Starts the oldest request of the most important lane for
+// as long as there are free workers and its bytes fit in the budget. A
+// request that doesn't fit holds up the ones behind it, so a big visible
+// decode isn't starved by small prefetches.
+- (void)startDecodes {
+  while(_running < self.maxConcurrentDecodes) {
+    GFSDecodeRequest *request = nil;
+    for(NSUInteger i = 0;i < GFSDecodePriorityCount && nil == request;i++) {
+      request = [_lanes[i] count] ? [_lanes[i] objectAtIndex:0] : nil;
+    }
+    if(nil == request) {
+      break;
+    }
+    if(0 != _running && _bytesInFlight + request.decodedBytes > self.memoryBudget) {
+      break;
+    }
+    [_lanes[request.priority] removeObjectAtIndex:0];
+    _running++;
+    _bytesInFlight += request.decodedBytes;
+    _peakBytesInFlight = MAX(_peakBytesInFlight, _bytesInFlight);
+    NSTimeInterval wait = CFAbsoluteTimeGetCurrent() - request.scheduled;
+    _started++;
+    _totalWait += wait;
+    _maximumWait = MAX(_maximumWait, wait);
+    [self runRequest:request];
+  }
+}
+
+- (void)runRequest:(GFSDecodeRequest *)request {
+  long queuePriority = GFSDecodePriorityVisible == request.priority ? DISPATCH_QUEUE_PRIORITY_HIGH : DISPATCH_QUEUE_PRIORITY_LOW;
+  id (^decode)(GFSDecodeRequest *) = request.decode;
+  void (^completion)(id) = request.completion;
+  request.decode = nil;
+  request.completion = nil;
+  dispatch_async(dispatch_get_global_queue(queuePriority, 0), ^{
+    CFAbsoluteTime started = CFAbsoluteTimeGetCurrent();
+    id result = nil;
+    if(![request isCancelled] && nil != decode) {
+      result = decode(request);
+    }
+    NSTimeInterval decodeTime = CFAbsoluteTimeGetCurrent() - started;
+    dispatch_async(_stateQueue, ^{
+      _running--;
+      _bytesInFlight -= request.decodedBytes;
+      if([request isCancelled]) {
+        _cancelled++;
+      } else {
+        _completed++;
+        _totalDecode += decodeTime;
+      }
+      [self startDecodes];
+    });
+    if(![request isCancelled] && nil != completion) {
+      dispatch_async(dispatch_get_main_queue(), ^{
+        if(![request isCancelled]) {
+          completion(result);
+          // done, a late cancel has nothing left to tell anyone
+          request.cancellationHandler = nil;
+        }
+      });
+    } else {
+      request.cancellationHandler = nil;
+    }
+  });
+}
+
+@end
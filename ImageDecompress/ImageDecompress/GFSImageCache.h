@@ -0,0 +1,91 @@
+//
+//  GFSImageCache.h
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import "GFSDecodeScheduler.h"
+
+// Identifies one decoded bitmap: what it was decoded from, the size in
+// pixels it was decoded for and how its pixels are laid out. The same file
+// decoded for two sizes, or into two formats, is two entries.
+@interface GFSImageCacheKey : NSObject <NSCopying>
+
++ (GFSImageCacheKey *)keyWithSource:(id<NSCopying>)source size:(CGSize)size bitmapInfo:(CGBitmapInfo)bitmapInfo;
+
+// a path, NSURL or anything else with a meaningful isEqual: and hash
+@property(nonatomic, copy, readonly) id<NSCopying> source;
+@property(nonatomic, assign, readonly) CGSize size;
+@property(nonatomic, assign, readonly) CGBitmapInfo bitmapInfo;
+
+@end
+
+typedef enum {
+  // pushed out by newer images to stay in the budget
+  GFSImageCacheEvictionReasonCapacity = 0,
+  // replaced by setImage:forKey: with the same key
+  GFSImageCacheEvictionReasonReplaced,
+  // removeImageForKey:, removeAllImages or a memory warning
+  GFSImageCacheEvictionReasonRemoved,
+} GFSImageCacheEvictionReason;
+
+typedef void(^GFSImageCacheEvictionHandler)(GFSImageCacheKey *key, UIImage *image, GFSImageCacheEvictionReason reason);
+
+/*
+ * Keeps decoded images around, least recently used first out, so scrolling
+ * back to an image or showing it again doesn't decode it again. Holds no
+ * more than byteBudget bytes of pixels (counted from each image's
+ * CGImage, its bytes per row times its height).
+ *
+ * The entries are spread over several shards by the key's hash, each with
+ * its own lock and its own share of the budget, so threads looking up
+ * different images don't contend and a hit only holds a spin lock long
+ * enough for a dictionary lookup and a list splice.
+ *
+ * imageForKey:decodedBytes:priority:decode:completion: decodes misses on a
+ * GFSDecodeScheduler and caches the result. Asking for a key that is
+ * already being decoded doesn't decode it again, the completion is added to
+ * the ones waiting on the first decode.
+ *
+ * Everything is safe to call from any thread. The whole cache is emptied
+ * on a memory warning.
+ */
+@interface GFSImageCache : NSObject
+
++ (GFSImageCache *)sharedCache;
+
+// 0 means the default, a sixteenth of the physical memory
+- (id)initWithByteBudget:(size_t)byteBudget;
+
+@property(nonatomic, assign, readonly) size_t byteBudget;
+// bytes of the images in the cache right now
+@property(nonatomic, assign, readonly) size_t cachedBytes;
+// where misses are decoded, the shared scheduler unless set
+@property(nonatomic, strong) GFSDecodeScheduler *scheduler;
+// called for every image that leaves the cache, on whichever thread made
+// it leave and never while a lock is held
+@property(nonatomic, copy) GFSImageCacheEvictionHandler evictionHandler;
+
+// nil on a miss
+- (UIImage *)imageForKey:(GFSImageCacheKey *)key;
+// an image bigger than a shard's share of the budget isn't kept
+- (void)setImage:(UIImage *)image forKey:(GFSImageCacheKey *)key;
+- (void)removeImageForKey:(GFSImageCacheKey *)key;
+- (void)removeAllImages;
+
+// Returns the cached image on a hit and completion isn't called. On a miss
+// returns nil, decode runs on the scheduler (once, however many callers are
+// waiting for this key) and completion gets its image, also cached, on the
+// main queue. If decode fails, or its request is cancelled and nobody asks
+// for the key again before that's noticed, completion gets nil instead.
+// decodedBytes and priority are passed on to the scheduler.
+- (UIImage *)imageForKey:(GFSImageCacheKey *)key
+            decodedBytes:(size_t)decodedBytes
+                priority:(GFSDecodePriority)priority
+                  decode:(UIImage *(^)(void))decode
+              completion:(void (^)(UIImage *image))completion;
+
+@end
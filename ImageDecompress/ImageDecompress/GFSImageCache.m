@@ -0,0 +1,412 @@
+//
+//  GFSImageCache.m
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+
+#import "GFSImageCache.h"
+#import <libkern/OSAtomic.h>
+
+// a power of two, a shard is picked with the low bits of the key's hash
+static const NSUInteger kShardCount = 8;
+
+@interface GFSImageCacheKey()
+
+@property(nonatomic, copy, readwrite) id<NSCopying> source;
+@property(nonatomic, assign, readwrite) CGSize size;
+@property(nonatomic, assign, readwrite) CGBitmapInfo bitmapInfo;
+
+@end
+
+@implementation GFSImageCacheKey {
+  NSUInteger _hash;
+}
+
+@synthesize source = _source;
+@synthesize size = _size;
+@synthesize bitmapInfo = _bitmapInfo;
+
++ (GFSImageCacheKey *)keyWithSource:(id<NSCopying>)source size:(CGSize)size bitmapInfo:(CGBitmapInfo)bitmapInfo {
+  GFSImageCacheKey *key = [[GFSImageCacheKey alloc] init];
+  key.source = source;
+  key.size = size;
+  key.bitmapInfo = bitmapInfo;
+  // worked out once, every lookup and dictionary probe needs it
+  NSUInteger hash = [(id)source hash];
+  hash = hash * 31 + (NSUInteger)size.width;
+  hash = hash * 31 + (NSUInteger)size.height;
+  hash = hash * 31 + bitmapInfo;
+  key->_hash = hash ^ (hash >> 16);
+  return key;
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+  // immutable
+  return self;
+}
+
+- (NSUInteger)hash {
+  return _hash;
+}
+
+- (BOOL)isEqual:(id)object {
+  if(self == object) {
+    return YES;
+  }
+  if(![object isKindOfClass:[GFSImageCacheKey class]]) {
+    return NO;
+  }
+  GFSImageCacheKey *other = object;
+  return _hash == other->_hash && CGSizeEqualToSize(self.size, other.size) &&
+    self.bitmapInfo == other.bitmapInfo && [(id)self.source isEqual:other.source];
+}
+
+- (NSString *)description {
+  return [NSString stringWithFormat:@"<%@ %@ %@ %u>", [self class], self.source,
+          NSStringFromCGSize(self.size), (unsigned)self.bitmapInfo];
+}
+
+@end
+
+#pragma mark -
+
+// A node in a shard's recency list, most recent at the head. The shard's
+// dictionary owns the entries, the links don't.
+@interface GFSImageCacheEntry : NSObject {
+@public
+  GFSImageCacheKey *_key;
+  UIImage *_image;
+  size_t _bytes;
+  __unsafe_unretained GFSImageCacheEntry *_previous;
+  __unsafe_unretained GFSImageCacheEntry *_next;
+}
+@end
+
+@implementation GFSImageCacheEntry
+@end
+
+// A decode that's running, and everyone waiting for it.
+@interface GFSImageCacheInFlight : NSObject {
+@public
+  GFSDecodeRequest *_request;
+  NSMutableArray *_completions;
+}
+@end
+
+@implementation GFSImageCacheInFlight
+@end
+
+// One slice of the cache. Every ivar is guarded by _lock.
+@interface GFSImageCacheShard : NSObject {
+@public
+  OSSpinLock _lock;
+  NSMutableDictionary *_entries;
+  NSMutableDictionary *_inFlight;
+  GFSImageCacheEntry *_head;
+  GFSImageCacheEntry *_tail;
+  size_t _bytes;
+  size_t _budget;
+}
+@end
+
+@implementation GFSImageCacheShard
+
+- (id)init {
+  self = [super init];
+  if(nil != self) {
+    _lock = OS_SPINLOCK_INIT;
+    _entries = [NSMutableDictionary dictionary];
+    _inFlight = [NSMutableDictionary dictionary];
+  }
+  return self;
+}
+
+- (void)unlink:(GFSImageCacheEntry *)entry {
+  if(nil != entry->_previous) {
+    entry->_previous->_next = entry->_next;
+  } else {
+    _head = entry->_next;
+  }
+  if(nil != entry->_next) {
+    entry->_next->_previous = entry->_previous;
+  } else {
+    _tail = entry->_previous;
+  }
+  entry->_previous = nil;
+  entry->_next = nil;
+}
+
+- (void)pushFront:(GFSImageCacheEntry *)entry {
+  entry->_previous = nil;
+  entry->_next = _head;
+  if(nil != _head) {
+    _head->_previous = entry;
+  }
+  _head = entry;
+  if(nil == _tail) {
+    _tail = entry;
+  }
+}
+
+// Takes entry out of the list and the dictionary, handing it to evicted so
+// it outlives the dictionary's reference.
+- (void)remove:(GFSImageCacheEntry *)entry into:(NSMutableArray *)evicted {
+  [evicted addObject:entry];
+  [self unlink:entry];
+  _bytes -= entry->_bytes;
+  [_entries removeObjectForKey:entry->_key];
+}
+
+@end
+
+#pragma mark -
+
+@interface GFSImageCache()
+
+@property(nonatomic, assign, readwrite) size_t byteBudget;
+
+@end
+
+@interface GFSImageCache(Private)
+
+- (GFSImageCacheShard *)shardForKey:(GFSImageCacheKey *)key;
+- (void)notifyEvicted:(NSArray *)entries reason:(GFSImageCacheEvictionReason)reason;
+- (void)didReceiveMemoryWarning:(NSNotification *)notification;
+
+@end
+
+@implementation GFSImageCache {
+  GFSImageCacheShard *_shards[kShardCount];
+}
+
+@synthesize byteBudget = _byteBudget;
+@synthesize scheduler = _scheduler;
+@synthesize evictionHandler = _evictionHandler;
+
++ (GFSImageCache *)sharedCache {
+  static GFSImageCache *cache = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    cache = [[GFSImageCache alloc] initWithByteBudget:0];
+  });
+  return cache;
+}
+
+- (id)init {
+  return [self initWithByteBudget:0];
+}
+
+- (id)initWithByteBudget:(size_t)byteBudget {
+  self = [super init];
+  if(nil != self) {
+    self.byteBudget = 0 != byteBudget ? byteBudget : (size_t)([[NSProcessInfo processInfo] physicalMemory] / 16);
+    self.scheduler = [GFSDecodeScheduler sharedScheduler];
+    for(NSUInteger i = 0;i < kShardCount;i++) {
+      _shards[i] = [[GFSImageCacheShard alloc] init];
+      _shards[i]->_budget = self.byteBudget / kShardCount;
+    }
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(didReceiveMemoryWarning:)
+                                                 name:UIApplicationDidReceiveMemoryWarningNotification
+                                               object:nil];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+- (size_t)cachedBytes {
+  size_t bytes = 0;
+  for(NSUInteger i = 0;i < kShardCount;i++) {
+    GFSImageCacheShard *shard = _shards[i];
+    OSSpinLockLock(&shard->_lock);
+    bytes += shard->_bytes;
+    OSSpinLockUnlock(&shard->_lock);
+  }
+  return bytes;
+}
+
+- (UIImage *)imageForKey:(GFSImageCacheKey *)key {
+  if(nil == key) {
+    return nil;
+  }
+  GFSImageCacheShard *shard = [self shardForKey:key];
+  UIImage *image = nil;
+  OSSpinLockLock(&shard->_lock);
+  GFSImageCacheEntry *entry = [shard->_entries objectForKey:key];
+  if(nil != entry) {
+    if(entry != shard->_head) {
+      [shard unlink:entry];
+      [shard pushFront:entry];
+    }
+    image = entry->_image;
+  }
+  OSSpinLockUnlock(&shard->_lock);
+  return image;
+}
+
+- (void)setImage:(UIImage *)image forKey:(GFSImageCacheKey *)key {
+  if(nil == key) {
+    return;
+  }
+  if(nil == image) {
+    [self removeImageForKey:key];
+    return;
+  }
+  CGImageRef cgImage = image.CGImage;
+  size_t bytes = NULL != cgImage ? CGImageGetBytesPerRow(cgImage) * CGImageGetHeight(cgImage) : 0;
+  GFSImageCacheShard *shard = [self shardForKey:key];
+  NSMutableArray *replaced = [NSMutableArray array];
+  NSMutableArray *evicted = [NSMutableArray array];
+  OSSpinLockLock(&shard->_lock);
+  GFSImageCacheEntry *existing = [shard->_entries objectForKey:key];
+  if(nil != existing) {
+    [shard remove:existing into:replaced];
+  }
+  if(bytes <= shard->_budget) {
+    while(shard->_bytes + bytes > shard->_budget) {
+      [shard remove:shard->_tail into:evicted];
+    }
+    GFSImageCacheEntry *entry = [[GFSImageCacheEntry alloc] init];
+    entry->_key = [key copy];
+    entry->_image = image;
+    entry->_bytes = bytes;
+    [shard->_entries setObject:entry forKey:entry->_key];
+    [shard pushFront:entry];
+    shard->_bytes += bytes;
+  }
+  OSSpinLockUnlock(&shard->_lock);
+  [self notifyEvicted:replaced reason:GFSImageCacheEvictionReasonReplaced];
+  [self notifyEvicted:evicted reason:GFSImageCacheEvictionReasonCapacity];
+}
+
+- (void)removeImageForKey:(GFSImageCacheKey *)key {
+  if(nil == key) {
+    return;
+  }
+  GFSImageCacheShard *shard = [self shardForKey:key];
+  NSMutableArray *removed = [NSMutableArray array];
+  OSSpinLockLock(&shard->_lock);
+  GFSImageCacheEntry *entry = [shard->_entries objectForKey:key];
+  if(nil != entry) {
+    [shard remove:entry into:removed];
+  }
+  OSSpinLockUnlock(&shard->_lock);
+  [self notifyEvicted:removed reason:GFSImageCacheEvictionReasonRemoved];
+}
+
+- (void)removeAllImages {
+  NSMutableArray *removed = [NSMutableArray array];
+  for(NSUInteger i = 0;i < kShardCount;i++) {
+    GFSImageCacheShard *shard = _shards[i];
+    OSSpinLockLock(&shard->_lock);
+    for(GFSImageCacheEntry *entry = shard->_head;nil != entry;entry = entry->_next) {
+      [removed addObject:entry];
+    }
+    [shard->_entries removeAllObjects];
+    shard->_head = nil;
+    shard->_tail = nil;
+    shard->_bytes = 0;
+    OSSpinLockUnlock(&shard->_lock);
+  }
+  [self notifyEvicted:removed reason:GFSImageCacheEvictionReasonRemoved];
+}
+
+- (UIImage *)imageForKey:(GFSImageCacheKey *)key
+            decodedBytes:(size_t)decodedBytes
+                priority:(GFSDecodePriority)priority
+                  decode:(UIImage *(^)(void))decode
+              completion:(void (^)(UIImage *image))completion {
+  UIImage *image = [self imageForKey:key];
+  if(nil != image || nil == key) {
+    return image;
+  }
+  key = [key copy];
+  GFSImageCacheShard *shard = [self shardForKey:key];
+  void (^waiting)(UIImage *) = nil != completion ? [completion copy] : ^(UIImage *result) {};
+  OSSpinLockLock(&shard->_lock);
+  GFSImageCacheInFlight *inFlight = [shard->_inFlight objectForKey:key];
+  // a cancelled decode never finishes, start over rather than wait on it,
+  // taking along whoever was waiting on it
+  BOOL start = nil == inFlight || [inFlight->_request isCancelled];
+  if(start) {
+    GFSImageCacheInFlight *cancelled = inFlight;
+    inFlight = [[GFSImageCacheInFlight alloc] init];
+    inFlight->_completions = nil != cancelled ? [cancelled->_completions mutableCopy] : [NSMutableArray array];
+    [shard->_inFlight setObject:inFlight forKey:key];
+  }
+  [inFlight->_completions addObject:waiting];
+  OSSpinLockUnlock(&shard->_lock);
+  if(!start) {
+    return nil;
+  }
+  // scheduling can't happen under the spin lock, so the request is filled
+  // in afterwards. Until then the entry looks in flight and not cancelled,
+  // which is what it is.
+  GFSDecodeRequest *request =
+  [self.scheduler scheduleDecodeOfBytes:decodedBytes priority:priority decode:^id(GFSDecodeRequest *request) {
+    return decode();
+  } completion:^(id result) {
+    if(nil != result) {
+      [self setImage:result forKey:key];
+    }
+    OSSpinLockLock(&shard->_lock);
+    NSArray *completions = inFlight->_completions;
+    if(inFlight == [shard->_inFlight objectForKey:key]) {
+      [shard->_inFlight removeObjectForKey:key];
+    }
+    OSSpinLockUnlock(&shard->_lock);
+    for(void (^completion)(UIImage *) in completions) {
+      completion(result);
+    }
+  }];
+  OSSpinLockLock(&shard->_lock);
+  inFlight->_request = request;
+  OSSpinLockUnlock(&shard->_lock);
+  // nobody may ask for this key again, so a cancelled decode hands its
+  // waiters nil rather than leave them in _inFlight. Unless a restart has
+  // taken them over already. Weak, the request is held by inFlight.
+  __weak GFSImageCacheInFlight *weakInFlight = inFlight;
+  request.cancellationHandler = ^{
+    GFSImageCacheInFlight *cancelled = weakInFlight;
+    NSArray *completions = nil;
+    OSSpinLockLock(&shard->_lock);
+    if(nil != cancelled && cancelled == [shard->_inFlight objectForKey:key]) {
+      completions = cancelled->_completions;
+      [shard->_inFlight removeObjectForKey:key];
+    }
+    OSSpinLockUnlock(&shard->_lock);
+    for(void (^completion)(UIImage *) in completions) {
+      completion(nil);
+    }
+  };
+  return nil;
+}
+
+@end
+
+@implementation GFSImageCache(Private)
+
+- (GFSImageCacheShard *)shardForKey:(GFSImageCacheKey *)key {
+  return _shards[[key hash] & (kShardCount - 1)];
+}
+
+- (void)notifyEvicted:(NSArray *)entries reason:(GFSImageCacheEvictionReason)reason {
+  GFSImageCacheEvictionHandler handler = self.evictionHandler;
+  if(nil == handler) {
+    return;
+  }
+  for(GFSImageCacheEntry *entry in entries) {
+    handler(entry->_key, entry->_image, reason);
+  }
+}
+
+- (void)didReceiveMemoryWarning:(NSNotification *)notification {
+  [self removeAllImages];
+}
+
+@end
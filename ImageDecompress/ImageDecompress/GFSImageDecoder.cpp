@@ -0,0 +1,1223 @@
+//
+//  GFSImageDecoder.cpp
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+
+#include "GFSImageDecoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <zlib.h>
+
+namespace {
+
+#pragma mark - Bytes
+
+inline uint32_t ReadBig16(const uint8_t *bytes) {
+  return (uint32_t)bytes[0] << 8 | bytes[1];
+}
+
+inline uint32_t ReadBig32(const uint8_t *bytes) {
+  return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+inline uint8_t ClampByte(int32_t value) {
+  return value < 0 ? 0 : value > 255 ? 255 : (uint8_t)value;
+}
+
+inline bool IsValidScale(uint32_t scale) {
+  return 1 == scale || 2 == scale || 4 == scale || 8 == scale;
+}
+
+inline uint32_t GreatestCommonDivisor(uint32_t a, uint32_t b) {
+  while(0 != b) {
+    uint32_t r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+#pragma mark - EXIF
+
+// Reads an APP1 Exif payload: the orientation tag of the first IFD (1 when
+// it's not there), and where the JPEG thumbnail the second IFD points at is,
+// as an offset from the start of the payload (0 length when there isn't
+// one).
+void ReadExif(const uint8_t *payload, size_t length, uint32_t *orientation,
+              size_t *thumbnailOffset, size_t *thumbnailLength) {
+  *orientation = 1;
+  *thumbnailOffset = 0;
+  *thumbnailLength = 0;
+  if(length < 14 || 0 != memcmp(payload, "Exif\0\0", 6)) {
+    return;
+  }
+  const uint8_t *tiff = payload + 6;
+  size_t tiffLength = length - 6;
+  bool little = 'I' == tiff[0] && 'I' == tiff[1];
+  if(!little && !('M' == tiff[0] && 'M' == tiff[1])) {
+    return;
+  }
+  auto read16 = [&](size_t offset) -> uint32_t {
+    return little ? (uint32_t)tiff[offset] | (uint32_t)tiff[offset + 1] << 8 : ReadBig16(tiff + offset);
+  };
+  auto read32 = [&](size_t offset) -> uint32_t {
+    return little ? read16(offset) | read16(offset + 2) << 16 : ReadBig32(tiff + offset);
+  };
+  size_t ifd = read32(4);
+  if(ifd + 2 > tiffLength) {
+    return;
+  }
+  uint32_t count = read16(ifd);
+  for(uint32_t i = 0;i < count;i++) {
+    size_t entry = ifd + 2 + i * 12;
+    if(entry + 12 > tiffLength) {
+      return;
+    }
+    // SHORT, so the value is in the first two bytes of the value field
+    if(0x0112 == read16(entry) && 3 == read16(entry + 2)) {
+      uint32_t value = read16(entry + 8);
+      *orientation = (value >= 1 && value <= 8) ? value : 1;
+    }
+  }
+
+  // the second IFD describes the thumbnail, its offset follows the first
+  // IFD's entries
+  size_t next = ifd + 2 + (size_t)count * 12;
+  if(next + 4 > tiffLength) {
+    return;
+  }
+  ifd = read32(next);
+  if(0 == ifd || ifd + 2 > tiffLength) {
+    return;
+  }
+  count = read16(ifd);
+  size_t offset = 0;
+  size_t bytes = 0;
+  for(uint32_t i = 0;i < count;i++) {
+    size_t entry = ifd + 2 + i * 12;
+    if(entry + 12 > tiffLength) {
+      return;
+    }
+    // JPEGInterchangeFormat and JPEGInterchangeFormatLength, LONGs
+    if(0x0201 == read16(entry)) {
+      offset = read32(entry + 8);
+    } else if(0x0202 == read16(entry)) {
+      bytes = read32(entry + 8);
+    }
+  }
+  if(0 != bytes && offset < tiffLength && bytes <= tiffLength - offset &&
+     bytes >= 4 && 0xFF == tiff[offset] && 0xD8 == tiff[offset + 1]) {
+    *thumbnailOffset = 6 + offset;
+    *thumbnailLength = bytes;
+  }
+}
+
+#pragma mark - JPEG tables
+
+const uint8_t kZigzag[64] = {
+   0,  1,  8, 16,  9,  2,  3, 10,
+  17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34,
+  27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36,
+  29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46,
+  53, 60, 61, 54, 47, 55, 62, 63
+};
+
+const uint32_t kLookaheadBits = 9;
+
+struct HuffmanTable {
+  bool defined;
+  // the length (0 when longer than kLookaheadBits) and symbol of the code
+  // starting with each kLookaheadBits bits
+  uint8_t fastLength[1 << kLookaheadBits];
+  uint8_t fastSymbol[1 << kLookaheadBits];
+  // the largest code of each length, -1 for none
+  int32_t maxCode[17];
+  // symbols[code + symbolOffset[length]] is the symbol of code
+  int32_t symbolOffset[17];
+  uint8_t symbols[256];
+};
+
+bool BuildHuffmanTable(HuffmanTable *table, const uint8_t counts[16], const uint8_t *symbols, uint32_t symbolCount) {
+  memset(table, 0, sizeof(*table));
+  memcpy(table->symbols, symbols, symbolCount);
+  int32_t code = 0;
+  int32_t index = 0;
+  for(uint32_t length = 1;length <= 16;length++) {
+    table->symbolOffset[length] = index - code;
+    for(uint32_t i = 0;i < counts[length - 1];i++) {
+      // more codes than the length has room for, checked before placing
+      // this one as it would land past the end of the lookahead tables
+      if(code >= 1 << length) {
+        return false;
+      }
+      if(length <= kLookaheadBits) {
+        uint32_t first = (uint32_t)code << (kLookaheadBits - length);
+        for(uint32_t j = 0;j < 1u << (kLookaheadBits - length);j++) {
+          table->fastLength[first + j] = (uint8_t)length;
+          table->fastSymbol[first + j] = symbols[index];
+        }
+      }
+      code++;
+      index++;
+    }
+    table->maxCode[length] = counts[length - 1] ? code - 1 : -1;
+    code <<= 1;
+  }
+  table->defined = true;
+  return true;
+}
+
+// Reads entropy coded bits, taking out the stuffed zero after each 0xFF
+// and feeding zeros once it reaches a marker.
+struct BitReader {
+  const uint8_t *next;
+  const uint8_t *end;
+  uint64_t bits;
+  int32_t count;
+  bool atMarker;
+
+  void Fill() {
+    while(count <= 56) {
+      uint32_t byte = 0;
+      if(!atMarker && next < end) {
+        byte = *next;
+        if(0xFF == byte) {
+          if(next + 1 < end && 0 == next[1]) {
+            next += 2;
+          } else {
+            atMarker = true;
+            byte = 0;
+          }
+        } else {
+          next++;
+        }
+      }
+      bits |= (uint64_t)byte << (56 - count);
+      count += 8;
+    }
+  }
+
+  inline uint32_t Peek(uint32_t n) const {
+    return (uint32_t)(bits >> (64 - n));
+  }
+
+  inline void Skip(uint32_t n) {
+    bits <<= n;
+    count -= n;
+  }
+
+  // the n bit value that follows a Huffman symbol, sign extended
+  inline int32_t Receive(uint32_t n) {
+    if(0 == n) {
+      return 0;
+    }
+    int32_t value = (int32_t)Peek(n);
+    Skip(n);
+    if(value < 1 << (n - 1)) {
+      value += (int32_t)(~0u << n) + 1;
+    }
+    return value;
+  }
+
+  // -1 for a code that isn't in the table
+  inline int32_t Decode(const HuffmanTable &table) {
+    Fill();
+    uint32_t look = Peek(kLookaheadBits);
+    uint32_t length = table.fastLength[look];
+    if(0 != length) {
+      Skip(length);
+      return table.fastSymbol[look];
+    }
+    for(length = kLookaheadBits + 1;length <= 16;length++) {
+      int32_t code = (int32_t)Peek(length);
+      if(code <= table.maxCode[length]) {
+        Skip(length);
+        return table.symbols[(code + table.symbolOffset[length]) & 0xFF];
+      }
+    }
+    return -1;
+  }
+
+  // Drops the padding bits and steps over the RSTn marker.
+  void Restart() {
+    bits = 0;
+    count = 0;
+    atMarker = false;
+    while(next + 1 < end && !(0xFF == next[0] && next[1] >= 0xD0 && next[1] <= 0xD7)) {
+      next++;
+    }
+    if(next + 1 < end) {
+      next += 2;
+    }
+  }
+};
+
+// basis[size][m * 8 + u]: how much frequency u adds to sample m of an
+// inverse DCT that gives size samples from the lowest size frequencies of
+// an 8 point block, with the 1/sqrt(2) of u == 0 folded in. The DC of every
+// size is the average of the block.
+struct InverseDCTBasis {
+  float basis[9][64];
+
+  InverseDCTBasis() {
+    memset(basis, 0, sizeof(basis));
+    for(uint32_t size = 1;size <= 8;size++) {
+      for(uint32_t m = 0;m < size;m++) {
+        for(uint32_t u = 0;u < size;u++) {
+          float c = 0 == u ? (float)M_SQRT1_2 : 1.0f;
+          basis[size][m * 8 + u] = 0.5f * c * cosf((float)((2 * m + 1) * u * M_PI / (2.0 * size)));
+        }
+      }
+    }
+  }
+};
+
+const float *InverseDCTBasisForSize(uint32_t size) {
+  static const InverseDCTBasis basis;
+  return basis.basis[size];
+}
+
+// size x size samples of block (dequantized, natural order) into out.
+// Rows of coefficients past rowCount are all zero and are skipped.
+void InverseDCT(const float *block, uint32_t size, uint32_t rowCount, uint8_t *out, size_t outStride) {
+  if(1 == size) {
+    out[0] = ClampByte((int32_t)floorf(block[0] * 0.125f + 128.5f));
+    return;
+  }
+  const float *basis = InverseDCTBasisForSize(size);
+  float rows[64];
+  for(uint32_t v = 0;v < rowCount;v++) {
+    const float *coefficients = block + v * 8;
+    float *row = rows + v * 8;
+    for(uint32_t m = 0;m < size;m++) {
+      const float *weights = basis + m * 8;
+      float sum = 0.0f;
+      for(uint32_t u = 0;u < size;u++) {
+        sum += weights[u] * coefficients[u];
+      }
+      row[m] = sum;
+    }
+  }
+  for(uint32_t n = 0;n < size;n++) {
+    const float *weights = basis + n * 8;
+    uint8_t *outRow = out + n * outStride;
+    for(uint32_t m = 0;m < size;m++) {
+      float sum = 128.5f;
+      for(uint32_t v = 0;v < rowCount;v++) {
+        sum += weights[v] * rows[v * 8 + m];
+      }
+      outRow[m] = ClampByte((int32_t)floorf(sum));
+    }
+  }
+}
+
+// JFIF YCbCr to RGB, 16 bit fixed point
+struct YCbCrTables {
+  int32_t crToRed[256];
+  int32_t crToGreen[256];
+  int32_t cbToGreen[256];
+  int32_t cbToBlue[256];
+
+  YCbCrTables() {
+    for(int32_t i = 0;i < 256;i++) {
+      int32_t c = i - 128;
+      crToRed[i] = (int32_t)lrint(1.402 * 65536.0 * c);
+      crToGreen[i] = -(int32_t)lrint(0.714136 * 65536.0 * c);
+      cbToGreen[i] = -(int32_t)lrint(0.344136 * 65536.0 * c) + (1 << 15);
+      cbToBlue[i] = (int32_t)lrint(1.772 * 65536.0 * c);
+    }
+  }
+};
+
+const YCbCrTables &SharedYCbCrTables() {
+  static const YCbCrTables tables;
+  return tables;
+}
+
+#pragma mark - JPEG
+
+struct JPEGComponent {
+  uint32_t identifier;
+  uint32_t horizontal;
+  uint32_t vertical;
+  uint32_t quantTable;
+  uint32_t dcTable;
+  uint32_t acTable;
+  int32_t dcPrediction;
+  // samples out of each block, and how many times each is repeated across
+  // and down to reach the scaled image's resolution
+  uint32_t blockSize;
+  uint32_t repeatX;
+  uint32_t repeatY;
+  // one row of MCUs at blockSize x blockSize a block
+  std::vector<uint8_t> samples;
+  size_t samplesStride;
+  // the sample under each column of the region
+  std::vector<uint32_t> columns;
+};
+
+struct JPEGDecoder {
+  const uint8_t *data;
+  size_t length;
+  size_t position;
+
+  uint32_t width;
+  uint32_t height;
+  uint32_t componentCount;
+  JPEGComponent components[3];
+  bool progressive;
+  bool frameFound;
+  bool adobe;
+  uint32_t adobeTransform;
+  uint32_t orientation;
+  size_t thumbnailOffset;
+  size_t thumbnailLength;
+  uint32_t restartInterval;
+  uint16_t quantTables[4][64];
+  HuffmanTable dcTables[4];
+  HuffmanTable acTables[4];
+
+  JPEGDecoder(const void *bytes, size_t byteCount)
+  : data((const uint8_t *)bytes), length(byteCount), position(0), width(0), height(0),
+    componentCount(0), progressive(false), frameFound(false), adobe(false), adobeTransform(0),
+    orientation(1), thumbnailOffset(0), thumbnailLength(0), restartInterval(0) {
+    memset(quantTables, 0, sizeof(quantTables));
+    dcTables[0].defined = dcTables[1].defined = dcTables[2].defined = dcTables[3].defined = false;
+    acTables[0].defined = acTables[1].defined = acTables[2].defined = acTables[3].defined = false;
+  }
+
+  GFSImageDecoderError ReadFrame(const uint8_t *segment, size_t segmentLength, uint8_t marker) {
+    if(segmentLength < 6) {
+      return GFSImageDecoderInvalidData;
+    }
+    progressive = 0xC2 == marker;
+    height = ReadBig16(segment + 1);
+    width = ReadBig16(segment + 3);
+    componentCount = segment[5];
+    if(0 == width || 0 == height || segmentLength < 6 + componentCount * 3) {
+      return GFSImageDecoderInvalidData;
+    }
+    frameFound = true;
+    if(8 != segment[0] || (1 != componentCount && 3 != componentCount)) {
+      return GFSImageDecoderUnsupported;
+    }
+    for(uint32_t i = 0;i < componentCount;i++) {
+      const uint8_t *c = segment + 6 + i * 3;
+      JPEGComponent &component = components[i];
+      component.identifier = c[0];
+      component.horizontal = c[1] >> 4;
+      component.vertical = c[1] & 15;
+      component.quantTable = c[2];
+      if(component.horizontal < 1 || component.horizontal > 4 ||
+         component.vertical < 1 || component.vertical > 4 || component.quantTable > 3) {
+        return GFSImageDecoderInvalidData;
+      }
+    }
+    // a single component scan is one block at a time whatever the sampling
+    if(1 == componentCount) {
+      components[0].horizontal = components[0].vertical = 1;
+    }
+    return GFSImageDecoderNoError;
+  }
+
+  GFSImageDecoderError ReadQuantTables(const uint8_t *segment, size_t segmentLength) {
+    while(segmentLength > 0) {
+      uint32_t precision = segment[0] >> 4;
+      uint32_t index = segment[0] & 15;
+      size_t tableLength = 1 + 64 * (precision ? 2 : 1);
+      if(index > 3 || precision > 1 || segmentLength < tableLength) {
+        return GFSImageDecoderInvalidData;
+      }
+      for(uint32_t i = 0;i < 64;i++) {
+        quantTables[index][kZigzag[i]] = precision ? ReadBig16(segment + 1 + i * 2) : segment[1 + i];
+      }
+      segment += tableLength;
+      segmentLength -= tableLength;
+    }
+    return GFSImageDecoderNoError;
+  }
+
+  GFSImageDecoderError ReadHuffmanTables(const uint8_t *segment, size_t segmentLength) {
+    while(segmentLength > 0) {
+      if(segmentLength < 17) {
+        return GFSImageDecoderInvalidData;
+      }
+      uint32_t tableClass = segment[0] >> 4;
+      uint32_t index = segment[0] & 15;
+      uint32_t symbolCount = 0;
+      for(uint32_t i = 0;i < 16;i++) {
+        symbolCount += segment[1 + i];
+      }
+      if(tableClass > 1 || index > 3 || symbolCount > 256 || segmentLength < 17 + symbolCount) {
+        return GFSImageDecoderInvalidData;
+      }
+      HuffmanTable *table = tableClass ? &acTables[index] : &dcTables[index];
+      if(!BuildHuffmanTable(table, segment + 1, segment + 17, symbolCount)) {
+        return GFSImageDecoderInvalidData;
+      }
+      segment += 17 + symbolCount;
+      segmentLength -= 17 + symbolCount;
+    }
+    return GFSImageDecoderNoError;
+  }
+
+  GFSImageDecoderError ReadScan(const uint8_t *segment, size_t segmentLength) {
+    if(segmentLength < 1 || segmentLength < 4 + segment[0] * 2u) {
+      return GFSImageDecoderInvalidData;
+    }
+    if(!frameFound) {
+      return GFSImageDecoderInvalidData;
+    }
+    // every component interleaved in one scan, the only sequential
+    // layout that doesn't need the whole image's coefficients kept
+    if(progressive || segment[0] != componentCount) {
+      return GFSImageDecoderUnsupported;
+    }
+    for(uint32_t i = 0;i < componentCount;i++) {
+      const uint8_t *s = segment + 1 + i * 2;
+      JPEGComponent *component = NULL;
+      for(uint32_t j = 0;j < componentCount;j++) {
+        if(components[j].identifier == s[0]) {
+          component = &components[j];
+        }
+      }
+      if(NULL == component) {
+        return GFSImageDecoderInvalidData;
+      }
+      component->dcTable = s[1] >> 4;
+      component->acTable = s[1] & 15;
+      if(component->dcTable > 3 || component->acTable > 3 ||
+         !dcTables[component->dcTable].defined || !acTables[component->acTable].defined) {
+        return GFSImageDecoderInvalidData;
+      }
+    }
+    return GFSImageDecoderNoError;
+  }
+
+  // Walks the segments up to the first scan (or only up to the frame when
+  // infoOnly), leaving position at the entropy coded data.
+  GFSImageDecoderError ReadHeaders(bool infoOnly) {
+    if(length < 4 || 0xFF != data[0] || 0xD8 != data[1]) {
+      return GFSImageDecoderInvalidData;
+    }
+    position = 2;
+    while(true) {
+      // markers may be padded with any number of 0xFFs
+      while(position < length && 0xFF != data[position]) {
+        position++;
+      }
+      while(position < length && 0xFF == data[position]) {
+        position++;
+      }
+      if(position >= length) {
+        return GFSImageDecoderInvalidData;
+      }
+      uint8_t marker = data[position++];
+      if(0xD9 == marker) {
+        return GFSImageDecoderInvalidData;
+      }
+      if(0x01 == marker || (marker >= 0xD0 && marker <= 0xD7)) {
+        continue;
+      }
+      if(position + 2 > length) {
+        return GFSImageDecoderInvalidData;
+      }
+      size_t segmentLength = ReadBig16(data + position);
+      if(segmentLength < 2 || position + segmentLength > length) {
+        return GFSImageDecoderInvalidData;
+      }
+      const uint8_t *segment = data + position + 2;
+      segmentLength -= 2;
+      position += 2 + segmentLength;
+      GFSImageDecoderError error = GFSImageDecoderNoError;
+      switch(marker) {
+        case 0xC0:
+        case 0xC1:
+        case 0xC2:
+          error = ReadFrame(segment, segmentLength, marker);
+          if(infoOnly && frameFound) {
+            return error == GFSImageDecoderUnsupported ? GFSImageDecoderNoError : error;
+          }
+          break;
+        case 0xC3:
+        case 0xC5:
+        case 0xC6:
+        case 0xC7:
+        case 0xC9:
+        case 0xCA:
+        case 0xCB:
+        case 0xCD:
+        case 0xCE:
+        case 0xCF:
+          // lossless, hierarchical and arithmetic coded
+          return GFSImageDecoderUnsupported;
+        case 0xC4:
+          error = ReadHuffmanTables(segment, segmentLength);
+          break;
+        case 0xDB:
+          error = ReadQuantTables(segment, segmentLength);
+          break;
+        case 0xDD:
+          if(segmentLength < 2) {
+            return GFSImageDecoderInvalidData;
+          }
+          restartInterval = ReadBig16(segment);
+          break;
+        case 0xDA:
+          error = ReadScan(segment, segmentLength);
+          if(GFSImageDecoderNoError == error && infoOnly) {
+            error = GFSImageDecoderInvalidData;
+          }
+          return error;
+        case 0xE1:
+          // the first Exif segment, there might be XMP ones after it
+          if(1 == orientation && 0 == thumbnailLength) {
+            size_t offset;
+            ReadExif(segment, segmentLength, &orientation, &offset, &thumbnailLength);
+            thumbnailOffset = 0 != thumbnailLength ? (size_t)(segment - data) + offset : 0;
+          }
+          break;
+        case 0xEE:
+          if(segmentLength >= 12 && 0 == memcmp(segment, "Adobe", 5)) {
+            adobe = true;
+            adobeTransform = segment[11];
+          }
+          break;
+        default:
+          break;
+      }
+      if(GFSImageDecoderNoError != error) {
+        return error;
+      }
+    }
+  }
+
+  bool IsRGB() const {
+    if(3 != componentCount) {
+      return false;
+    }
+    if(adobe) {
+      return 0 == adobeTransform;
+    }
+    return 'R' == components[0].identifier && 'G' == components[1].identifier && 'B' == components[2].identifier;
+  }
+
+  // Entropy decodes one block into coefficients (natural order, zeroed by
+  // the caller), keeping only the lowest keep x keep frequencies.
+  bool DecodeBlock(BitReader &reader, JPEGComponent &component, int16_t *coefficients, uint32_t keep) {
+    int32_t symbol = reader.Decode(dcTables[component.dcTable]);
+    if(symbol < 0 || symbol > 16) {
+      return false;
+    }
+    component.dcPrediction += reader.Receive((uint32_t)symbol);
+    coefficients[0] = (int16_t)component.dcPrediction;
+    const HuffmanTable &acTable = acTables[component.acTable];
+    for(uint32_t k = 1;k < 64;) {
+      symbol = reader.Decode(acTable);
+      if(symbol < 0) {
+        return false;
+      }
+      uint32_t run = (uint32_t)symbol >> 4;
+      uint32_t size = (uint32_t)symbol & 15;
+      if(0 == size) {
+        if(15 != run) {
+          // end of block
+          break;
+        }
+        k += 16;
+        continue;
+      }
+      k += run;
+      if(k > 63) {
+        return false;
+      }
+      int32_t value = reader.Receive(size);
+      uint32_t index = kZigzag[k];
+      if((index & 7) < keep && (index >> 3) < keep) {
+        coefficients[index] = (int16_t)value;
+      }
+      k++;
+    }
+    return true;
+  }
+
+  GFSImageDecoderError Decode(uint32_t scale, const GFSImageRegion &region, uint8_t *dest, size_t destRowBytes) {
+    uint32_t blockSize = 8 / scale;
+    uint32_t maxHorizontal = 1;
+    uint32_t maxVertical = 1;
+    for(uint32_t i = 0;i < componentCount;i++) {
+      maxHorizontal = std::max(maxHorizontal, components[i].horizontal);
+      maxVertical = std::max(maxVertical, components[i].vertical);
+    }
+    uint32_t mcuWidth = 8 * maxHorizontal;
+    uint32_t mcuHeight = 8 * maxVertical;
+    uint32_t mcusAcross = (width + mcuWidth - 1) / mcuWidth;
+    uint32_t mcusDown = (height + mcuHeight - 1) / mcuHeight;
+    uint32_t scaledMCUWidth = blockSize * maxHorizontal;
+    uint32_t scaledMCUHeight = blockSize * maxVertical;
+    uint32_t firstMCUColumn = region.x / scaledMCUWidth;
+    uint32_t lastMCUColumn = (region.x + region.width - 1) / scaledMCUWidth;
+    uint32_t firstMCURow = region.y / scaledMCUHeight;
+    uint32_t lastMCURow = (region.y + region.height - 1) / scaledMCUHeight;
+
+    for(uint32_t i = 0;i < componentCount;i++) {
+      JPEGComponent &component = components[i];
+      if(0 != maxHorizontal % component.horizontal || 0 != maxVertical % component.vertical) {
+        return GFSImageDecoderUnsupported;
+      }
+      // chroma is decoded at as many samples a block as the scaled image
+      // needs (up to the 8 it has) rather than upsampled
+      uint32_t across = blockSize * (maxHorizontal / component.horizontal);
+      uint32_t down = blockSize * (maxVertical / component.vertical);
+      uint32_t common = GreatestCommonDivisor(across, down);
+      component.blockSize = 1;
+      for(uint32_t size = std::min(8u, common);size > 1;size--) {
+        if(0 == common % size) {
+          component.blockSize = size;
+          break;
+        }
+      }
+      component.repeatX = across / component.blockSize;
+      component.repeatY = down / component.blockSize;
+      component.samplesStride = (size_t)mcusAcross * component.horizontal * component.blockSize;
+      component.samples.assign(component.samplesStride * component.vertical * component.blockSize, 0);
+      component.columns.resize(region.width);
+      for(uint32_t x = 0;x < region.width;x++) {
+        component.columns[x] = (region.x + x) / component.repeatX;
+      }
+      component.dcPrediction = 0;
+    }
+
+    BitReader reader;
+    reader.next = data + position;
+    reader.end = data + length;
+    reader.bits = 0;
+    reader.count = 0;
+    reader.atMarker = false;
+
+    const YCbCrTables &tables = SharedYCbCrTables();
+    bool rgb = IsRGB();
+    int16_t coefficients[64];
+    float block[64];
+    uint32_t restartsToGo = restartInterval;
+    for(uint32_t mcuRow = 0;mcuRow <= lastMCURow && mcuRow < mcusDown;mcuRow++) {
+      bool inRegion = mcuRow >= firstMCURow;
+      for(uint32_t mcuColumn = 0;mcuColumn < mcusAcross;mcuColumn++) {
+        if(0 != restartInterval) {
+          if(0 == restartsToGo) {
+            reader.Restart();
+            for(uint32_t i = 0;i < componentCount;i++) {
+              components[i].dcPrediction = 0;
+            }
+            restartsToGo = restartInterval;
+          }
+          restartsToGo--;
+        }
+        bool reconstruct = inRegion && mcuColumn >= firstMCUColumn && mcuColumn <= lastMCUColumn;
+        for(uint32_t i = 0;i < componentCount;i++) {
+          JPEGComponent &component = components[i];
+          const uint16_t *quant = quantTables[component.quantTable];
+          uint32_t size = component.blockSize;
+          for(uint32_t by = 0;by < component.vertical;by++) {
+            for(uint32_t bx = 0;bx < component.horizontal;bx++) {
+              memset(coefficients, 0, sizeof(coefficients));
+              if(!DecodeBlock(reader, component, coefficients, reconstruct ? size : 0)) {
+                return GFSImageDecoderInvalidData;
+              }
+              if(!reconstruct) {
+                continue;
+              }
+              uint32_t rowCount = 1;
+              for(uint32_t v = 0;v < size;v++) {
+                for(uint32_t u = 0;u < size;u++) {
+                  block[v * 8 + u] = (float)coefficients[v * 8 + u] * quant[v * 8 + u];
+                  if(0 != coefficients[v * 8 + u]) {
+                    rowCount = v + 1;
+                  }
+                }
+              }
+              size_t x = ((size_t)mcuColumn * component.horizontal + bx) * size;
+              uint8_t *out = component.samples.data() + by * size * component.samplesStride + x;
+              InverseDCT(block, size, rowCount, out, component.samplesStride);
+            }
+          }
+        }
+      }
+      if(!inRegion) {
+        continue;
+      }
+      // color convert the rows of this MCU row that are in the region
+      uint32_t top = std::max(region.y, mcuRow * scaledMCUHeight);
+      uint32_t bottom = std::min(region.y + region.height, (mcuRow + 1) * scaledMCUHeight);
+      for(uint32_t y = top;y < bottom;y++) {
+        uint32_t local = y - mcuRow * scaledMCUHeight;
+        uint8_t *out = dest + (size_t)(y - region.y) * destRowBytes;
+        const uint8_t *rows[3];
+        for(uint32_t i = 0;i < componentCount;i++) {
+          rows[i] = components[i].samples.data() + (local / components[i].repeatY) * components[i].samplesStride;
+        }
+        if(1 == componentCount) {
+          const uint32_t *columns = components[0].columns.data();
+          for(uint32_t x = 0;x < region.width;x++) {
+            uint8_t gray = rows[0][columns[x]];
+            out[x * 4] = 255;
+            out[x * 4 + 1] = gray;
+            out[x * 4 + 2] = gray;
+            out[x * 4 + 3] = gray;
+          }
+        } else if(rgb) {
+          const uint32_t *columns[3] = { components[0].columns.data(), components[1].columns.data(), components[2].columns.data() };
+          for(uint32_t x = 0;x < region.width;x++) {
+            out[x * 4] = 255;
+            out[x * 4 + 1] = rows[0][columns[0][x]];
+            out[x * 4 + 2] = rows[1][columns[1][x]];
+            out[x * 4 + 3] = rows[2][columns[2][x]];
+          }
+        } else {
+          const uint32_t *columns[3] = { components[0].columns.data(), components[1].columns.data(), components[2].columns.data() };
+          for(uint32_t x = 0;x < region.width;x++) {
+            int32_t luma = (int32_t)rows[0][columns[0][x]] << 16;
+            uint32_t cb = rows[1][columns[1][x]];
+            uint32_t cr = rows[2][columns[2][x]];
+            out[x * 4] = 255;
+            out[x * 4 + 1] = ClampByte((luma + tables.crToRed[cr] + (1 << 15)) >> 16);
+            out[x * 4 + 2] = ClampByte((luma + tables.cbToGreen[cb] + tables.crToGreen[cr]) >> 16);
+            out[x * 4 + 3] = ClampByte((luma + tables.cbToBlue[cb] + (1 << 15)) >> 16);
+          }
+        }
+      }
+    }
+    return GFSImageDecoderNoError;
+  }
+};
+
+#pragma mark - PNG
+
+const uint8_t kPNGSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+struct PNGDecoder {
+  const uint8_t *data;
+  size_t length;
+
+  uint32_t width;
+  uint32_t height;
+  uint32_t bitDepth;
+  uint32_t colorType;
+  bool interlaced;
+  // samples a pixel
+  uint32_t channels;
+  // palette and transparency, as straight RGBA
+  uint8_t palette[256][4];
+  bool hasColorKey;
+  uint16_t colorKey[3];
+
+  PNGDecoder(const void *bytes, size_t byteCount)
+  : data((const uint8_t *)bytes), length(byteCount), width(0), height(0), bitDepth(0), colorType(0),
+    interlaced(false), channels(0), hasColorKey(false) {
+    for(uint32_t i = 0;i < 256;i++) {
+      palette[i][0] = palette[i][1] = palette[i][2] = 0;
+      palette[i][3] = 255;
+    }
+  }
+
+  GFSImageDecoderError ReadHeader() {
+    if(length < 33 || 0 != memcmp(data, kPNGSignature, 8) || 13 != ReadBig32(data + 8) ||
+       0 != memcmp(data + 12, "IHDR", 4)) {
+      return GFSImageDecoderInvalidData;
+    }
+    const uint8_t *header = data + 16;
+    width = ReadBig32(header);
+    height = ReadBig32(header + 4);
+    bitDepth = header[8];
+    colorType = header[9];
+    interlaced = 1 == header[12];
+    switch(colorType) {
+      case 0: channels = 1; break;
+      case 2: channels = 3; break;
+      case 3: channels = 1; break;
+      case 4: channels = 2; break;
+      case 6: channels = 4; break;
+      default: return GFSImageDecoderInvalidData;
+    }
+    bool validDepth = (0 == colorType && (1 == bitDepth || 2 == bitDepth || 4 == bitDepth || 8 == bitDepth || 16 == bitDepth)) ||
+                      (3 == colorType && (1 == bitDepth || 2 == bitDepth || 4 == bitDepth || 8 == bitDepth)) ||
+                      ((2 == colorType || 4 == colorType || 6 == colorType) && (8 == bitDepth || 16 == bitDepth));
+    if(0 == width || 0 == height || width > 1u << 24 || height > 1u << 24 || !validDepth ||
+       0 != header[10] || 0 != header[11] || header[12] > 1) {
+      return GFSImageDecoderInvalidData;
+    }
+    return GFSImageDecoderNoError;
+  }
+
+  uint32_t Components() const {
+    switch(colorType) {
+      case 0: return hasColorKey ? 2 : 1;
+      case 2: return hasColorKey ? 4 : 3;
+      case 4: return 2;
+      case 3:
+      case 6:
+      default: return 4;
+    }
+  }
+
+  // The straight RGBA of each pixel of a filtered out row.
+  void ExpandRow(const uint8_t *row, uint8_t *rgba) const {
+    if(8 == bitDepth) {
+      for(uint32_t x = 0;x < width;x++) {
+        const uint8_t *p = row + x * channels;
+        uint8_t *out = rgba + x * 4;
+        switch(colorType) {
+          case 0:
+            out[0] = out[1] = out[2] = p[0];
+            out[3] = hasColorKey && p[0] == colorKey[0] ? 0 : 255;
+            break;
+          case 2:
+            out[0] = p[0];
+            out[1] = p[1];
+            out[2] = p[2];
+            out[3] = hasColorKey && p[0] == colorKey[0] && p[1] == colorKey[1] && p[2] == colorKey[2] ? 0 : 255;
+            break;
+          case 3:
+            memcpy(out, palette[p[0]], 4);
+            break;
+          case 4:
+            out[0] = out[1] = out[2] = p[0];
+            out[3] = p[1];
+            break;
+          default:
+            memcpy(out, p, 4);
+            break;
+        }
+      }
+    } else if(16 == bitDepth) {
+      for(uint32_t x = 0;x < width;x++) {
+        const uint8_t *p = row + x * channels * 2;
+        uint8_t *out = rgba + x * 4;
+        switch(colorType) {
+          case 0:
+            out[0] = out[1] = out[2] = p[0];
+            out[3] = hasColorKey && ReadBig16(p) == colorKey[0] ? 0 : 255;
+            break;
+          case 2:
+            out[0] = p[0];
+            out[1] = p[2];
+            out[2] = p[4];
+            out[3] = hasColorKey && ReadBig16(p) == colorKey[0] && ReadBig16(p + 2) == colorKey[1] &&
+                     ReadBig16(p + 4) == colorKey[2] ? 0 : 255;
+            break;
+          case 4:
+            out[0] = out[1] = out[2] = p[0];
+            out[3] = p[2];
+            break;
+          default:
+            out[0] = p[0];
+            out[1] = p[2];
+            out[2] = p[4];
+            out[3] = p[6];
+            break;
+        }
+      }
+    } else {
+      // 1, 2 and 4 bit gray or palette, packed from the high bits
+      uint32_t mask = (1u << bitDepth) - 1;
+      uint32_t perByte = 8 / bitDepth;
+      for(uint32_t x = 0;x < width;x++) {
+        uint32_t shift = 8 - bitDepth * (x % perByte + 1);
+        uint32_t value = (row[x / perByte] >> shift) & mask;
+        uint8_t *out = rgba + x * 4;
+        if(3 == colorType) {
+          memcpy(out, palette[value], 4);
+        } else {
+          out[0] = out[1] = out[2] = (uint8_t)(value * 255 / mask);
+          out[3] = hasColorKey && value == colorKey[0] ? 0 : 255;
+        }
+      }
+    }
+  }
+
+  GFSImageDecoderError Decode(uint32_t scale, const GFSImageRegion &region, uint8_t *dest, size_t destRowBytes) {
+    if(interlaced) {
+      return GFSImageDecoderUnsupported;
+    }
+    // gather the IDAT chunks and the palette before inflating anything
+    std::vector<std::pair<const uint8_t *, uint32_t> > chunks;
+    size_t offset = 8;
+    while(offset + 12 <= length) {
+      uint32_t chunkLength = ReadBig32(data + offset);
+      const uint8_t *type = data + offset + 4;
+      const uint8_t *chunk = data + offset + 8;
+      if(chunkLength > length - offset - 12) {
+        return GFSImageDecoderInvalidData;
+      }
+      if(0 == memcmp(type, "IDAT", 4)) {
+        chunks.push_back(std::make_pair(chunk, chunkLength));
+      } else if(0 == memcmp(type, "PLTE", 4)) {
+        for(uint32_t i = 0;i < chunkLength / 3 && i < 256;i++) {
+          memcpy(palette[i], chunk + i * 3, 3);
+        }
+      } else if(0 == memcmp(type, "tRNS", 4)) {
+        if(3 == colorType) {
+          for(uint32_t i = 0;i < chunkLength && i < 256;i++) {
+            palette[i][3] = chunk[i];
+          }
+        } else if(0 == colorType && chunkLength >= 2) {
+          hasColorKey = true;
+          colorKey[0] = (uint16_t)ReadBig16(chunk);
+        } else if(2 == colorType && chunkLength >= 6) {
+          hasColorKey = true;
+          colorKey[0] = (uint16_t)ReadBig16(chunk);
+          colorKey[1] = (uint16_t)ReadBig16(chunk + 2);
+          colorKey[2] = (uint16_t)ReadBig16(chunk + 4);
+        }
+      } else if(0 == memcmp(type, "IEND", 4)) {
+        break;
+      }
+      offset += 12 + chunkLength;
+    }
+    if(chunks.empty()) {
+      return GFSImageDecoderInvalidData;
+    }
+
+    size_t bitsPerPixel = (size_t)channels * bitDepth;
+    size_t rowBytes = ((size_t)width * bitsPerPixel + 7) / 8;
+    size_t filterStride = std::max<size_t>(1, bitsPerPixel / 8);
+    std::vector<uint8_t> rows(2 * (rowBytes + 1), 0);
+    uint8_t *row = rows.data();
+    uint8_t *previous = rows.data() + rowBytes + 1;
+    std::vector<uint8_t> rgba((size_t)width * 4);
+    // premultiplied sums of each region column's scale x scale box
+    std::vector<uint32_t> sums((size_t)region.width * 3, 0);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if(Z_OK != inflateInit(&stream)) {
+      return GFSImageDecoderMemoryAllocationError;
+    }
+    GFSImageDecoderError error = GFSImageDecoderNoError;
+    size_t chunk = 0;
+    uint32_t lastRow = std::min(height, (region.y + region.height) * scale);
+    for(uint32_t y = 0;y < lastRow && GFSImageDecoderNoError == error;y++) {
+      stream.next_out = row;
+      stream.avail_out = (uInt)(rowBytes + 1);
+      while(0 != stream.avail_out) {
+        if(0 == stream.avail_in) {
+          if(chunk == chunks.size()) {
+            break;
+          }
+          stream.next_in = (Bytef *)chunks[chunk].first;
+          stream.avail_in = chunks[chunk].second;
+          chunk++;
+        }
+        int status = inflate(&stream, Z_NO_FLUSH);
+        if(Z_STREAM_END == status) {
+          break;
+        }
+        if(Z_OK != status && !(Z_BUF_ERROR == status && 0 == stream.avail_in)) {
+          break;
+        }
+      }
+      if(0 != stream.avail_out) {
+        error = GFSImageDecoderInvalidData;
+        break;
+      }
+      uint8_t *pixels = row + 1;
+      const uint8_t *above = previous + 1;
+      switch(row[0]) {
+        case 0:
+          break;
+        case 1:
+          for(size_t i = filterStride;i < rowBytes;i++) {
+            pixels[i] += pixels[i - filterStride];
+          }
+          break;
+        case 2:
+          for(size_t i = 0;i < rowBytes;i++) {
+            pixels[i] += above[i];
+          }
+          break;
+        case 3:
+          for(size_t i = 0;i < rowBytes;i++) {
+            uint32_t left = i >= filterStride ? pixels[i - filterStride] : 0;
+            pixels[i] += (uint8_t)((left + above[i]) / 2);
+          }
+          break;
+        case 4:
+          for(size_t i = 0;i < rowBytes;i++) {
+            int32_t a = i >= filterStride ? pixels[i - filterStride] : 0;
+            int32_t b = above[i];
+            int32_t c = i >= filterStride ? above[i - filterStride] : 0;
+            int32_t p = a + b - c;
+            int32_t pa = abs(p - a);
+            int32_t pb = abs(p - b);
+            int32_t pc = abs(p - c);
+            pixels[i] += (uint8_t)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+          }
+          break;
+        default:
+          error = GFSImageDecoderInvalidData;
+          break;
+      }
+      std::swap(row, previous);
+      uint32_t scaledY = y / scale;
+      if(GFSImageDecoderNoError != error || scaledY < region.y) {
+        continue;
+      }
+      ExpandRow(previous + 1, rgba.data());
+      for(uint32_t x = 0;x < region.width;x++) {
+        uint32_t first = (region.x + x) * scale;
+        uint32_t last = std::min(width, first + scale);
+        uint32_t *sum = sums.data() + x * 3;
+        for(uint32_t sx = first;sx < last;sx++) {
+          const uint8_t *p = rgba.data() + sx * 4;
+          uint32_t alpha = p[3];
+          sum[0] += (p[0] * alpha + 127) / 255;
+          sum[1] += (p[1] * alpha + 127) / 255;
+          sum[2] += (p[2] * alpha + 127) / 255;
+        }
+      }
+      if(y + 1 == lastRow || scale - 1 == y % scale) {
+        uint32_t boxHeight = y % scale + 1;
+        uint8_t *out = dest + (size_t)(scaledY - region.y) * destRowBytes;
+        for(uint32_t x = 0;x < region.width;x++) {
+          uint32_t first = (region.x + x) * scale;
+          uint32_t count = (std::min(width, first + scale) - first) * boxHeight;
+          uint32_t *sum = sums.data() + x * 3;
+          out[x * 4] = 255;
+          out[x * 4 + 1] = (uint8_t)((sum[0] + count / 2) / count);
+          out[x * 4 + 2] = (uint8_t)((sum[1] + count / 2) / count);
+          out[x * 4 + 3] = (uint8_t)((sum[2] + count / 2) / count);
+          sum[0] = sum[1] = sum[2] = 0;
+        }
+      }
+    }
+    inflateEnd(&stream);
+    return error;
+  }
+};
+
+GFSImageFileFormat FileFormat(const void *data, size_t length) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  if(length >= 3 && 0xFF == bytes[0] && 0xD8 == bytes[1] && 0xFF == bytes[2]) {
+    return GFSImageFileFormatJPEG;
+  }
+  if(length >= 8 && 0 == memcmp(bytes, kPNGSignature, 8)) {
+    return GFSImageFileFormatPNG;
+  }
+  return GFSImageFileFormatUnknown;
+}
+
+}
+
+#pragma mark - Public
+
+GFSImageDecoderError GFSImageDecoderReadInfo(const void *data, size_t length, GFSImageInfo *info) {
+  if(NULL == data || NULL == info) {
+    return GFSImageDecoderInvalidArgument;
+  }
+  memset(info, 0, sizeof(*info));
+  info->orientation = 1;
+  info->fileFormat = FileFormat(data, length);
+  if(GFSImageFileFormatJPEG == info->fileFormat) {
+    JPEGDecoder decoder(data, length);
+    GFSImageDecoderError error = decoder.ReadHeaders(true);
+    if(GFSImageDecoderNoError != error) {
+      return error;
+    }
+    info->width = decoder.width;
+    info->height = decoder.height;
+    info->components = 1 == decoder.componentCount ? 1 : 3;
+    info->progressive = decoder.progressive;
+    info->orientation = decoder.orientation;
+    info->thumbnailOffset = decoder.thumbnailOffset;
+    info->thumbnailLength = decoder.thumbnailLength;
+    return GFSImageDecoderNoError;
+  }
+  if(GFSImageFileFormatPNG == info->fileFormat) {
+    PNGDecoder decoder(data, length);
+    GFSImageDecoderError error = decoder.ReadHeader();
+    if(GFSImageDecoderNoError != error) {
+      return error;
+    }
+    info->width = decoder.width;
+    info->height = decoder.height;
+    info->components = decoder.Components();
+    info->progressive = decoder.interlaced;
+    return GFSImageDecoderNoError;
+  }
+  return GFSImageDecoderUnsupported;
+}
+
+void GFSImageDecoderScaledSize(const GFSImageInfo *info, uint32_t scale, uint32_t *width, uint32_t *height) {
+  scale = std::max(1u, scale);
+  *width = (uint32_t)(((uint64_t)info->width + scale - 1) / scale);
+  *height = (uint32_t)(((uint64_t)info->height + scale - 1) / scale);
+}
+
+uint32_t GFSImageDecoderScaleForSize(const GFSImageInfo *info, uint32_t minWidth, uint32_t minHeight) {
+  for(uint32_t scale = 8;scale > 1;scale /= 2) {
+    uint32_t width, height;
+    GFSImageDecoderScaledSize(info, scale, &width, &height);
+    if(width >= minWidth && height >= minHeight) {
+      return scale;
+    }
+  }
+  return 1;
+}
+
+GFSImageDecoderError GFSImageDecodeARGB8888(const void *data,
+                                            size_t length,
+                                            uint32_t scale,
+                                            const GFSImageRegion *region,
+                                            void *dest,
+                                            size_t destRowBytes) {
+  if(NULL == data || NULL == dest || !IsValidScale(scale)) {
+    return GFSImageDecoderInvalidArgument;
+  }
+  GFSImageInfo info;
+  GFSImageDecoderError error = GFSImageDecoderReadInfo(data, length, &info);
+  if(GFSImageDecoderNoError != error) {
+    return error;
+  }
+  uint32_t scaledWidth, scaledHeight;
+  GFSImageDecoderScaledSize(&info, scale, &scaledWidth, &scaledHeight);
+  GFSImageRegion whole = { 0, 0, scaledWidth, scaledHeight };
+  if(NULL == region) {
+    region = &whole;
+  }
+  if(0 == region->width || 0 == region->height ||
+     region->x >= scaledWidth || region->width > scaledWidth - region->x ||
+     region->y >= scaledHeight || region->height > scaledHeight - region->y ||
+     destRowBytes < (size_t)region->width * 4) {
+    return GFSImageDecoderInvalidArgument;
+  }
+  try {
+    if(GFSImageFileFormatJPEG == info.fileFormat) {
+      JPEGDecoder decoder(data, length);
+      error = decoder.ReadHeaders(false);
+      if(GFSImageDecoderNoError == error) {
+        error = decoder.Decode(scale, *region, (uint8_t *)dest, destRowBytes);
+      }
+    } else {
+      PNGDecoder decoder(data, length);
+      error = decoder.ReadHeader();
+      if(GFSImageDecoderNoError == error) {
+        error = decoder.Decode(scale, *region, (uint8_t *)dest, destRowBytes);
+      }
+    }
+  } catch(const std::bad_alloc &) {
+    error = GFSImageDecoderMemoryAllocationError;
+  }
+  return error;
+}
@@ -0,0 +1,119 @@
+//
+//  GFSImageDecoder.h
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+
+#ifndef GFSImageDecoder_h
+#define GFSImageDecoder_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A portable (no ImageIO) JPEG and PNG decoder that can scale while it
+ * decodes, so a thumbnail never needs the full size bitmap in memory. Only
+ * needs zlib, it builds and runs headless on Linux as well as on iOS.
+ *
+ * JPEGs are scaled in the DCT domain: at 1/2, 1/4 and 1/8 each 8x8 block
+ * is turned back into 4x4, 2x2 or 1x1 pixels straight from its lowest
+ * frequencies, 1/8 is just the DC coefficients. Chroma planes are decoded
+ * at the size they're needed so there is usually nothing to upsample. PNGs
+ * are box filtered a row at a time as they are inflated.
+ *
+ * A region of the scaled image can be decoded on its own. Only the rows
+ * down to the bottom of the region are decoded, and of those only the
+ * blocks under the region are turned back into pixels.
+ *
+ * At most one row of JPEG blocks (or two rows of PNG pixels) is held at the
+ * source's resolution, the rest of the memory is the destination.
+ *
+ * Pixels come out the way GFSVImageLoader and vImage want them, ARGB8888
+ * with alpha 255 (kCGImageAlphaNoneSkipFirst, big endian). Transparent
+ * PNGs come out premultiplied, as if drawn over black.
+ *
+ * Supported are baseline and extended sequential 8 bit JPEGs with one
+ * (gray) or three (YCbCr or RGB) components, and non interlaced PNGs of
+ * any color type and bit depth. Anything else returns
+ * GFSImageDecoderUnsupported so the caller can fall back on ImageIO.
+ */
+
+typedef enum {
+  GFSImageDecoderNoError = 0,
+  GFSImageDecoderInvalidArgument,
+  GFSImageDecoderInvalidData,
+  GFSImageDecoderUnsupported,
+  GFSImageDecoderMemoryAllocationError
+} GFSImageDecoderError;
+
+typedef enum {
+  GFSImageFileFormatUnknown = 0,
+  GFSImageFileFormatJPEG,
+  GFSImageFileFormatPNG
+} GFSImageFileFormat;
+
+typedef struct GFSImageInfo {
+  GFSImageFileFormat fileFormat;
+  uint32_t width;
+  uint32_t height;
+  // 1 gray, 2 gray and alpha, 3 color, 4 color and alpha
+  uint32_t components;
+  // progressive JPEG or interlaced PNG, which can't be decoded yet
+  bool progressive;
+  // EXIF orientation 1...8, 1 when there isn't one. Decoding doesn't apply
+  // it.
+  uint32_t orientation;
+  // where in the data the EXIF thumbnail is, a small JPEG of its own (most
+  // cameras store a 160x120 one), 0 length when there isn't one
+  size_t thumbnailOffset;
+  size_t thumbnailLength;
+} GFSImageInfo;
+
+// in pixels of the scaled image, from the top left
+typedef struct GFSImageRegion {
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+} GFSImageRegion;
+
+// Reads only the headers.
+GFSImageDecoderError GFSImageDecoderReadInfo(const void *data,
+                                             size_t length,
+                                             GFSImageInfo *info);
+
+// The size of the image decoded at 1/scale: width / scale and
+// height / scale, rounded up.
+void GFSImageDecoderScaledSize(const GFSImageInfo *info,
+                               uint32_t scale,
+                               uint32_t *width,
+                               uint32_t *height);
+
+// The largest of 1, 2, 4 and 8 the image can be scaled down by and still be
+// at least minWidth x minHeight, so it can be drawn at that size without
+// losing detail.
+uint32_t GFSImageDecoderScaleForSize(const GFSImageInfo *info,
+                                     uint32_t minWidth,
+                                     uint32_t minHeight);
+
+// Decodes region (NULL for all of it) of the image scaled down by scale (1,
+// 2, 4 or 8) into dest, region->width x region->height ARGB8888 pixels.
+GFSImageDecoderError GFSImageDecodeARGB8888(const void *data,
+                                            size_t length,
+                                            uint32_t scale,
+                                            const GFSImageRegion *region,
+                                            void *dest,
+                                            size_t destRowBytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,116 @@
+//
+//  GFSProgressiveDecoder.cpp
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+
+#include "GFSProgressiveDecoder.h"
+#include "GFSMemoryAccounting.h"
+
+#include <algorithm>
+#include <cmath>
+#include <new>
+#include <vector>
+
+namespace {
+
+// a thumbnail whose shape is further than this from the image's is
+// cropped or padded, and would jump when the final image replaces it
+const double kMaxAspectDifference = 0.02;
+
+GFSImageDecoderError ResampleError(GFSResampleError error) {
+  switch(error) {
+    case GFSResampleNoError:
+      return GFSImageDecoderNoError;
+    case GFSResampleMemoryAllocationError:
+      return GFSImageDecoderMemoryAllocationError;
+    default:
+      return GFSImageDecoderInvalidArgument;
+  }
+}
+
+// Decodes data at scale into scratch, then resamples it into dest.
+GFSImageDecoderError DecodeInto(const void *data, size_t length, const GFSImageInfo &info, uint32_t scale,
+                                std::vector<uint8_t> &scratch, GFSMemoryCharge &charge,
+                                const GFSResampleBuffer *dest, GFSResampleFilter filter) {
+  uint32_t width, height;
+  GFSImageDecoderScaledSize(&info, scale, &width, &height);
+  if(width == dest->width && height == dest->height) {
+    return GFSImageDecodeARGB8888(data, length, scale, NULL, dest->data, dest->rowBytes);
+  }
+  // never shrinks, the buffer is reused by every stage
+  scratch.resize(std::max(scratch.size(), (size_t)width * height * 4));
+  charge.Resize(scratch.capacity());
+  GFSImageDecoderError error = GFSImageDecodeARGB8888(data, length, scale, NULL, scratch.data(), (size_t)width * 4);
+  if(GFSImageDecoderNoError != error) {
+    return error;
+  }
+  GFSResampleBuffer src = { scratch.data(), height, width, (size_t)width * 4 };
+  return ResampleError(GFSResampleARGB8888(&src, dest, filter, GFSResampleNoFlags));
+}
+
+// The EXIF thumbnail into dest, false when there isn't a usable one.
+bool DecodeThumbnail(const uint8_t *bytes, const GFSImageInfo &info,
+                     std::vector<uint8_t> &scratch, GFSMemoryCharge &charge, const GFSResampleBuffer *dest) {
+  if(0 == info.thumbnailLength) {
+    return false;
+  }
+  const uint8_t *thumbnail = bytes + info.thumbnailOffset;
+  GFSImageInfo thumbnailInfo;
+  if(GFSImageDecoderNoError != GFSImageDecoderReadInfo(thumbnail, info.thumbnailLength, &thumbnailInfo)) {
+    return false;
+  }
+  double aspect = (double)info.width / info.height;
+  double thumbnailAspect = (double)thumbnailInfo.width / thumbnailInfo.height;
+  if(fabs(aspect / thumbnailAspect - 1.0) > kMaxAspectDifference) {
+    return false;
+  }
+  return GFSImageDecoderNoError == DecodeInto(thumbnail, info.thumbnailLength, thumbnailInfo, 1, scratch, charge,
+                                              dest, GFSResampleFilterBilinear);
+}
+
+}
+
+GFSImageDecoderError GFSProgressiveDecodeARGB8888(const void *data,
+                                                  size_t length,
+                                                  const GFSResampleBuffer *dest,
+                                                  GFSResampleFilter filter,
+                                                  GFSProgressiveCallback callback,
+                                                  void *context) {
+  if(NULL == data || NULL == dest || NULL == dest->data || 0 == dest->width || 0 == dest->height ||
+     dest->width > UINT32_MAX || dest->height > UINT32_MAX || dest->rowBytes < dest->width * 4) {
+    return GFSImageDecoderInvalidArgument;
+  }
+  GFSImageInfo info;
+  GFSImageDecoderError error = GFSImageDecoderReadInfo(data, length, &info);
+  if(GFSImageDecoderNoError != error) {
+    return error;
+  }
+  const uint32_t scale = GFSImageDecoderScaleForSize(&info, (uint32_t)dest->width, (uint32_t)dest->height);
+
+  try {
+    std::vector<uint8_t> scratch;
+    GFSMemoryCharge charge(GFSMemoryStageDecode);
+    if(NULL != callback && GFSImageFileFormatJPEG == info.fileFormat) {
+      GFSProgressiveStage stage = GFSProgressiveStageThumbnail;
+      bool previewed = DecodeThumbnail((const uint8_t *)data, info, scratch, charge, dest);
+      if(!previewed && scale < 8) {
+        stage = GFSProgressiveStagePreview;
+        previewed = GFSImageDecoderNoError == DecodeInto(data, length, info, 8, scratch, charge, dest,
+                                                         GFSResampleFilterBilinear);
+      }
+      if(previewed && !callback(context, stage, dest)) {
+        return GFSImageDecoderNoError;
+      }
+    }
+    error = DecodeInto(data, length, info, scale, scratch, charge, dest, filter);
+  } catch(const std::bad_alloc &) {
+    return GFSImageDecoderMemoryAllocationError;
+  }
+  if(GFSImageDecoderNoError == error && NULL != callback) {
+    callback(context, GFSProgressiveStageFinal, dest);
+  }
+  return error;
+}
@@ -0,0 +1,67 @@
+//
+//  GFSProgressiveDecoder.h
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+
+#ifndef GFSProgressiveDecoder_h
+#define GFSProgressiveDecoder_h
+
+#include <stdbool.h>
+
+#include "GFSImageDecoder.h"
+#include "GFSResampler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Decodes an image to a given size in stages, each one a better version of
+ * the last, so something can be shown long before the whole decode is done.
+ *
+ * First comes a preview: the EXIF thumbnail when the JPEG has one (a few
+ * kilobytes to decode, most cameras write one), otherwise the image decoded
+ * at 1/8, which skips the IDCT but still reads all of the compressed data.
+ * Either is resampled up to the destination size. Then comes the final
+ * image, decoded at the smallest scale that covers the destination and
+ * resampled with the given filter, the same pixels
+ * GFSImageDecodeARGB8888 and GFSResampleARGB8888 give.
+ *
+ * Every stage is written into the same destination buffer, the callback
+ * gets it after each one and has to be done with it (copy it, upload it)
+ * before returning. The pixels from the final stage stay in dest.
+ *
+ * PNGs have no preview, a 1/8 PNG decode costs as much as the full one.
+ */
+
+typedef enum {
+  // the EXIF thumbnail, resampled up
+  GFSProgressiveStageThumbnail = 0,
+  // the image decoded at 1/8, resampled up
+  GFSProgressiveStagePreview,
+  // the image at full quality for dest's size
+  GFSProgressiveStageFinal
+} GFSProgressiveStage;
+
+// Called on the decoding thread with dest after each stage. Return false to
+// stop before the next one.
+typedef bool (*GFSProgressiveCallback)(void *context, GFSProgressiveStage stage, const GFSResampleBuffer *dest);
+
+// Decodes data into all of dest, ARGB8888 like GFSImageDecodeARGB8888,
+// stretched to dest's size as stored (the EXIF orientation isn't applied).
+// Without a callback there are no preview stages, just the final image.
+GFSImageDecoderError GFSProgressiveDecodeARGB8888(const void *data,
+                                                  size_t length,
+                                                  const GFSResampleBuffer *dest,
+                                                  GFSResampleFilter filter,
+                                                  GFSProgressiveCallback callback,
+                                                  void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
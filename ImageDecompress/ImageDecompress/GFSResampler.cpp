@@ -0,0 +1,609 @@
+//
+//  GFSResampler.cpp
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+
+#include "GFSResampler.h"
+#include "GFSMemoryAccounting.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define GFS_RESAMPLE_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+  #define GFS_RESAMPLE_NEON 1
+#endif
+
+namespace {
+
+const int kWeightBits = 14;
+const int32_t kWeightOne = 1 << kWeightBits;
+const int32_t kWeightHalf = 1 << (kWeightBits - 1);
+// don't bother starting a thread for less work than this
+const size_t kMinRowsPerThread = 16;
+
+inline uint8_t Round(int32_t sum) {
+  sum = (sum + kWeightHalf) >> kWeightBits;
+  return sum < 0 ? 0 : (sum > 255 ? 255 : (uint8_t)sum);
+}
+
+#pragma mark - Filters
+
+double BoxWeight(double x) {
+  return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
+}
+
+double BilinearWeight(double x) {
+  x = fabs(x);
+  return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+double Sinc(double x) {
+  if(0.0 == x) {
+    return 1.0;
+  }
+  x *= M_PI;
+  return sin(x) / x;
+}
+
+double Lanczos3Weight(double x) {
+  return x > -3.0 && x < 3.0 ? Sinc(x) * Sinc(x / 3.0) : 0.0;
+}
+
+// Mitchell-Netravali with B = C = 1/3
+double MitchellWeight(double x) {
+  const double B = 1.0 / 3.0;
+  const double C = 1.0 / 3.0;
+  x = fabs(x);
+  if(x < 1.0) {
+    return ((12.0 - 9.0 * B - 6.0 * C) * x * x * x + (-18.0 + 12.0 * B + 6.0 * C) * x * x + (6.0 - 2.0 * B)) / 6.0;
+  }
+  if(x < 2.0) {
+    return ((-B - 6.0 * C) * x * x * x + (6.0 * B + 30.0 * C) * x * x + (-12.0 * B - 48.0 * C) * x + (8.0 * B + 24.0 * C)) / 6.0;
+  }
+  return 0.0;
+}
+
+struct Filter {
+  double (*weight)(double);
+  // how far either side of the center weight is non-zero, at scale 1
+  double support;
+};
+
+bool FilterFor(GFSResampleFilter filter, Filter &f) {
+  switch(filter) {
+    case GFSResampleFilterBox: f.weight = BoxWeight; f.support = 0.5; return true;
+    case GFSResampleFilterBilinear: f.weight = BilinearWeight; f.support = 1.0; return true;
+    case GFSResampleFilterLanczos3: f.weight = Lanczos3Weight; f.support = 3.0; return true;
+    case GFSResampleFilterMitchell: f.weight = MitchellWeight; f.support = 2.0; return true;
+  }
+  return false;
+}
+
+#pragma mark - Weight tables
+
+// Which source pixels, and how much of each, make up every destination
+// pixel along one axis: count pixels from first, weighted by stride
+// weights starting at weights[i * stride] (any past count are zero).
+struct Axis {
+  std::vector<uint32_t> first;
+  std::vector<uint32_t> count;
+  std::vector<int16_t> weights;
+  size_t stride;
+  // the most taps any destination pixel has
+  size_t maxCount;
+};
+
+void BuildAxis(Axis &axis, size_t srcSize, size_t destSize, const Filter &filter) {
+  const double scale = (double)srcSize / destSize;
+  // shrinking stretches the filter over every source pixel under the
+  // destination pixel
+  const double filterScale = std::max(scale, 1.0);
+  const double support = filter.support * filterScale;
+  const size_t maxTaps = (size_t)ceil(support) * 2 + 1;
+  std::vector<double> weights(maxTaps);
+  std::vector<int32_t> fixed(maxTaps);
+
+  axis.first.resize(destSize);
+  axis.count.resize(destSize);
+  axis.stride = maxTaps;
+  axis.weights.assign(destSize * maxTaps, 0);
+  axis.maxCount = 0;
+  for(size_t i = 0;i < destSize;i++) {
+    const double center = (i + 0.5) * scale;
+    ptrdiff_t lo = std::max((ptrdiff_t)0, (ptrdiff_t)floor(center - support + 0.5));
+    ptrdiff_t hi = std::min((ptrdiff_t)srcSize, (ptrdiff_t)floor(center + support + 0.5));
+    hi = std::min(hi, lo + (ptrdiff_t)maxTaps);
+    size_t count = hi > lo ? (size_t)(hi - lo) : 0;
+    double total = 0.0;
+    for(size_t k = 0;k < count;k++) {
+      weights[k] = filter.weight((lo + k - center + 0.5) / filterScale);
+      total += weights[k];
+    }
+    if(0.0 == total) {
+      // nothing under the filter (can't happen with these filters, but
+      // don't divide by zero), take the nearest pixel
+      lo = std::min((ptrdiff_t)srcSize - 1, (ptrdiff_t)center);
+      count = 1;
+      weights[0] = total = 1.0;
+    }
+
+    // to fixed point, with whatever rounding lost given to the biggest
+    // weight so they add up to exactly one
+    int32_t sum = 0;
+    size_t biggest = 0;
+    for(size_t k = 0;k < count;k++) {
+      fixed[k] = (int32_t)lround(weights[k] / total * kWeightOne);
+      sum += fixed[k];
+      if(abs(fixed[k]) > abs(fixed[biggest])) {
+        biggest = k;
+      }
+    }
+    fixed[biggest] += kWeightOne - sum;
+
+    // the box filter (and rounding) leave zeros at the ends, skip them
+    size_t begin = 0;
+    while(begin + 1 < count && 0 == fixed[begin]) {
+      begin++;
+    }
+    while(count > begin + 1 && 0 == fixed[count - 1]) {
+      count--;
+    }
+    axis.first[i] = (uint32_t)(lo + begin);
+    axis.count[i] = (uint32_t)(count - begin);
+    for(size_t k = begin;k < count;k++) {
+      axis.weights[i * maxTaps + k - begin] = (int16_t)fixed[k];
+    }
+    axis.maxCount = std::max(axis.maxCount, count - begin);
+  }
+}
+
+#pragma mark - Jobs
+
+struct Job {
+  const uint8_t *src;
+  size_t srcRowBytes;
+  size_t srcWidth;
+  size_t srcHeight;
+  uint8_t *dest;
+  size_t destRowBytes;
+  size_t destWidth;
+  size_t destHeight;
+  // 4 for ARGB8888, 1 for Planar8
+  size_t channels;
+  Axis across;
+  Axis down;
+  // the source is already the destination's width, its rows are used as
+  // they are
+  bool skipAcross;
+  bool scalar;
+};
+
+// Per thread memory, allocated up front so the workers never allocate.
+struct Scratch {
+  // the band's source rows, resampled across
+  std::vector<uint8_t> intermediate;
+  std::vector<const uint8_t *> rows;
+};
+
+// The source rows destination rows [first, last) need.
+void SourceRows(const Job &job, size_t first, size_t last, size_t &begin, size_t &end) {
+  begin = job.down.first[first];
+  end = begin;
+  for(size_t y = first;y < last;y++) {
+    end = std::max(end, (size_t)job.down.first[y] + job.down.count[y]);
+  }
+}
+
+#pragma mark - Scalar
+
+void AcrossScalar(const Job &job, const uint8_t *src, uint8_t *out, size_t begin, size_t end) {
+  const Axis &axis = job.across;
+  const size_t channels = job.channels;
+  for(size_t x = begin;x < end;x++) {
+    const uint8_t *p = src + axis.first[x] * channels;
+    const int16_t *w = axis.weights.data() + x * axis.stride;
+    const size_t count = axis.count[x];
+    for(size_t c = 0;c < channels;c++) {
+      int32_t sum = 0;
+      for(size_t k = 0;k < count;k++) {
+        sum += p[k * channels + c] * w[k];
+      }
+      out[x * channels + c] = Round(sum);
+    }
+  }
+}
+
+void DownScalar(const uint8_t *const *rows, const int16_t *w, size_t count,
+                uint8_t *out, size_t begin, size_t end) {
+  for(size_t i = begin;i < end;i++) {
+    int32_t sum = 0;
+    for(size_t k = 0;k < count;k++) {
+      sum += rows[k][i] * w[k];
+    }
+    out[i] = Round(sum);
+  }
+}
+
+// Pixels [begin, end) no brighter than their alpha, which overshoot can
+// leave them, so premultiplied pixels stay premultiplied.
+void ClampToAlphaScalar(uint8_t *out, size_t begin, size_t end) {
+  for(size_t x = begin;x < end;x++) {
+    uint8_t *pixel = out + x * 4;
+    for(size_t c = 1;c < 4;c++) {
+      pixel[c] = std::min(pixel[c], pixel[0]);
+    }
+  }
+}
+
+#pragma mark - SSE2
+
+#if GFS_RESAMPLE_SSE2
+
+inline __m128i PairWeights(const int16_t *w) {
+  return _mm_set1_epi32((int32_t)((uint32_t)(uint16_t)w[0] | (uint32_t)(uint16_t)w[1] << 16));
+}
+
+inline __m128i RoundSSE(__m128i sum) {
+  return _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(kWeightHalf)), kWeightBits);
+}
+
+// ClampToAlphaScalar on four pixels, each one's first byte copied across it
+inline __m128i ClampToAlphaSSE(__m128i pixels) {
+  __m128i alpha = _mm_and_si128(pixels, _mm_set1_epi32(0xFF));
+  alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 8));
+  alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 16));
+  return _mm_min_epu8(pixels, alpha);
+}
+
+// Two taps a time: the pixels' channels are interleaved as 16 bit pairs so
+// one multiply-add weighs and sums both.
+void AcrossARGBSSE(const Job &job, const uint8_t *src, uint8_t *out) {
+  const Axis &axis = job.across;
+  const __m128i zero = _mm_setzero_si128();
+  for(size_t x = 0;x < job.destWidth;x++) {
+    const uint8_t *p = src + axis.first[x] * 4;
+    const int16_t *w = axis.weights.data() + x * axis.stride;
+    const size_t count = axis.count[x];
+    __m128i sum = zero;
+    size_t k = 0;
+    for(;k + 2 <= count;k += 2) {
+      __m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + k * 4)), zero);
+      __m128i pairs = _mm_unpacklo_epi16(pixels, _mm_srli_si128(pixels, 8));
+      sum = _mm_add_epi32(sum, _mm_madd_epi16(pairs, PairWeights(w + k)));
+    }
+    if(k < count) {
+      int32_t last;
+      memcpy(&last, p + k * 4, 4);
+      __m128i pixel = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(last), zero), zero);
+      sum = _mm_add_epi32(sum, _mm_madd_epi16(pixel, _mm_set1_epi32((uint16_t)w[k])));
+    }
+    __m128i words = _mm_packs_epi32(RoundSSE(sum), zero);
+    int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+    memcpy(out + x * 4, &packed, 4);
+  }
+}
+
+// Eight taps a time, the weights are contiguous just like the pixels.
+void AcrossPlanarSSE(const Job &job, const uint8_t *src, uint8_t *out) {
+  const Axis &axis = job.across;
+  const __m128i zero = _mm_setzero_si128();
+  for(size_t x = 0;x < job.destWidth;x++) {
+    const uint8_t *p = src + axis.first[x];
+    const int16_t *w = axis.weights.data() + x * axis.stride;
+    const size_t count = axis.count[x];
+    __m128i sums = zero;
+    size_t k = 0;
+    for(;k + 8 <= count;k += 8) {
+      __m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + k)), zero);
+      sums = _mm_add_epi32(sums, _mm_madd_epi16(pixels, _mm_loadu_si128((const __m128i *)(w + k))));
+    }
+    sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+    sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t sum = _mm_cvtsi128_si32(sums);
+    for(;k < count;k++) {
+      sum += p[k] * w[k];
+    }
+    out[x] = Round(sum);
+  }
+}
+
+// 16 bytes a time, rows paired up like AcrossARGBSSE's taps. Returns how
+// far it got.
+size_t DownSSE(const uint8_t *const *rows, const int16_t *w, size_t count, uint8_t *out, size_t length,
+               bool clampToAlpha) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for(;i + 16 <= length;i += 16) {
+    __m128i sum0 = zero, sum1 = zero, sum2 = zero, sum3 = zero;
+    for(size_t k = 0;k < count;k += 2) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(rows[k] + i));
+      __m128i b = zero;
+      __m128i weights;
+      if(k + 1 < count) {
+        b = _mm_loadu_si128((const __m128i *)(rows[k + 1] + i));
+        weights = PairWeights(w + k);
+      } else {
+        weights = _mm_set1_epi32((uint16_t)w[k]);
+      }
+      __m128i aLo = _mm_unpacklo_epi8(a, zero);
+      __m128i aHi = _mm_unpackhi_epi8(a, zero);
+      __m128i bLo = _mm_unpacklo_epi8(b, zero);
+      __m128i bHi = _mm_unpackhi_epi8(b, zero);
+      sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi16(aLo, bLo), weights));
+      sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpackhi_epi16(aLo, bLo), weights));
+      sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpacklo_epi16(aHi, bHi), weights));
+      sum3 = _mm_add_epi32(sum3, _mm_madd_epi16(_mm_unpackhi_epi16(aHi, bHi), weights));
+    }
+    __m128i lo = _mm_packs_epi32(RoundSSE(sum0), RoundSSE(sum1));
+    __m128i hi = _mm_packs_epi32(RoundSSE(sum2), RoundSSE(sum3));
+    __m128i pixels = _mm_packus_epi16(lo, hi);
+    _mm_storeu_si128((__m128i *)(out + i), clampToAlpha ? ClampToAlphaSSE(pixels) : pixels);
+  }
+  return i;
+}
+
+#endif
+
+#pragma mark - NEON
+
+#if GFS_RESAMPLE_NEON
+
+inline uint8x8_t NarrowNEON(int32x4_t lo, int32x4_t hi) {
+  int16x8_t words = vcombine_s16(vqrshrn_n_s32(lo, kWeightBits), vqrshrn_n_s32(hi, kWeightBits));
+  return vqmovun_s16(words);
+}
+
+// ClampToAlphaScalar on four pixels, each one's first byte copied across it
+inline uint8x16_t ClampToAlphaNEON(uint8x16_t pixels) {
+  uint32x4_t alpha = vandq_u32(vreinterpretq_u32_u8(pixels), vdupq_n_u32(0xFF));
+  return vminq_u8(pixels, vreinterpretq_u8_u32(vmulq_n_u32(alpha, 0x01010101)));
+}
+
+void AcrossARGBNEON(const Job &job, const uint8_t *src, uint8_t *out) {
+  const Axis &axis = job.across;
+  for(size_t x = 0;x < job.destWidth;x++) {
+    const uint8_t *p = src + axis.first[x] * 4;
+    const int16_t *w = axis.weights.data() + x * axis.stride;
+    const size_t count = axis.count[x];
+    int32x4_t sum0 = vdupq_n_s32(0);
+    int32x4_t sum1 = vdupq_n_s32(0);
+    size_t k = 0;
+    for(;k + 2 <= count;k += 2) {
+      int16x8_t pixels = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p + k * 4)));
+      sum0 = vmlal_n_s16(sum0, vget_low_s16(pixels), w[k]);
+      sum1 = vmlal_n_s16(sum1, vget_high_s16(pixels), w[k + 1]);
+    }
+    if(k < count) {
+      uint32_t last;
+      memcpy(&last, p + k * 4, 4);
+      int16x8_t pixel = vreinterpretq_s16_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(last))));
+      sum0 = vmlal_n_s16(sum0, vget_low_s16(pixel), w[k]);
+    }
+    int32x4_t sum = vaddq_s32(sum0, sum1);
+    uint8x8_t packed = NarrowNEON(sum, sum);
+    vst1_lane_u32((uint32_t *)(void *)(out + x * 4), vreinterpret_u32_u8(packed), 0);
+  }
+}
+
+void AcrossPlanarNEON(const Job &job, const uint8_t *src, uint8_t *out) {
+  const Axis &axis = job.across;
+  for(size_t x = 0;x < job.destWidth;x++) {
+    const uint8_t *p = src + axis.first[x];
+    const int16_t *w = axis.weights.data() + x * axis.stride;
+    const size_t count = axis.count[x];
+    int32x4_t sums = vdupq_n_s32(0);
+    size_t k = 0;
+    for(;k + 8 <= count;k += 8) {
+      int16x8_t pixels = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p + k)));
+      int16x8_t weights = vld1q_s16(w + k);
+      sums = vmlal_s16(sums, vget_low_s16(pixels), vget_low_s16(weights));
+      sums = vmlal_s16(sums, vget_high_s16(pixels), vget_high_s16(weights));
+    }
+    int32x2_t pair = vadd_s32(vget_low_s32(sums), vget_high_s32(sums));
+    int32_t sum = vget_lane_s32(vpadd_s32(pair, pair), 0);
+    for(;k < count;k++) {
+      sum += p[k] * w[k];
+    }
+    out[x] = Round(sum);
+  }
+}
+
+size_t DownNEON(const uint8_t *const *rows, const int16_t *w, size_t count, uint8_t *out, size_t length,
+                bool clampToAlpha) {
+  size_t i = 0;
+  for(;i + 16 <= length;i += 16) {
+    int32x4_t sum0 = vdupq_n_s32(0), sum1 = vdupq_n_s32(0);
+    int32x4_t sum2 = vdupq_n_s32(0), sum3 = vdupq_n_s32(0);
+    for(size_t k = 0;k < count;k++) {
+      uint8x16_t bytes = vld1q_u8(rows[k] + i);
+      int16x8_t lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(bytes)));
+      int16x8_t hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(bytes)));
+      sum0 = vmlal_n_s16(sum0, vget_low_s16(lo), w[k]);
+      sum1 = vmlal_n_s16(sum1, vget_high_s16(lo), w[k]);
+      sum2 = vmlal_n_s16(sum2, vget_low_s16(hi), w[k]);
+      sum3 = vmlal_n_s16(sum3, vget_high_s16(hi), w[k]);
+    }
+    uint8x16_t pixels = vcombine_u8(NarrowNEON(sum0, sum1), NarrowNEON(sum2, sum3));
+    vst1q_u8(out + i, clampToAlpha ? ClampToAlphaNEON(pixels) : pixels);
+  }
+  return i;
+}
+
+#endif
+
+#pragma mark - Rows
+
+void Across(const Job &job, const uint8_t *src, uint8_t *out) {
+  if(!job.scalar) {
+#if GFS_RESAMPLE_SSE2
+    if(4 == job.channels) {
+      AcrossARGBSSE(job, src, out);
+    } else {
+      AcrossPlanarSSE(job, src, out);
+    }
+    return;
+#elif GFS_RESAMPLE_NEON
+    if(4 == job.channels) {
+      AcrossARGBNEON(job, src, out);
+    } else {
+      AcrossPlanarNEON(job, src, out);
+    }
+    return;
+#endif
+  }
+  AcrossScalar(job, src, out, 0, job.destWidth);
+}
+
+// Writes the destination row, ARGB8888 pixels clamped to their alpha. The
+// SIMD paths stop on a pixel boundary, 16 bytes being four pixels.
+void Down(const Job &job, const uint8_t *const *rows, const int16_t *w, size_t count, uint8_t *out) {
+  const size_t length = job.destWidth * job.channels;
+  const bool clampToAlpha = 4 == job.channels;
+  size_t i = 0;
+  if(!job.scalar) {
+#if GFS_RESAMPLE_SSE2
+    i = DownSSE(rows, w, count, out, length, clampToAlpha);
+#elif GFS_RESAMPLE_NEON
+    i = DownNEON(rows, w, count, out, length, clampToAlpha);
+#endif
+  }
+  DownScalar(rows, w, count, out, i, length);
+  if(clampToAlpha) {
+    ClampToAlphaScalar(out, i / 4, job.destWidth);
+  }
+}
+
+// Destination rows [first, last): the source rows under them are resampled
+// across into the scratch, then down into the destination.
+void ResampleRows(const Job *job, Scratch *scratch, size_t first, size_t last) {
+  size_t begin, end;
+  SourceRows(*job, first, last, begin, end);
+  const size_t rowLength = job->destWidth * job->channels;
+  for(size_t y = begin;y < end && !job->skipAcross;y++) {
+    Across(*job, job->src + y * job->srcRowBytes, scratch->intermediate.data() + (y - begin) * rowLength);
+  }
+  for(size_t y = first;y < last;y++) {
+    const size_t count = job->down.count[y];
+    for(size_t k = 0;k < count;k++) {
+      const size_t row = job->down.first[y] + k;
+      scratch->rows[k] = job->skipAcross ? job->src + row * job->srcRowBytes :
+        scratch->intermediate.data() + (row - begin) * rowLength;
+    }
+    Down(*job, scratch->rows.data(), job->down.weights.data() + y * job->down.stride, count,
+         job->dest + y * job->destRowBytes);
+  }
+}
+
+void RunJob(const Job &job, uint32_t flags) {
+  size_t threadCount = 1;
+  if(0 == (flags & GFSResampleSingleThread)) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, std::max((size_t)1, job.destHeight / kMinRowsPerThread));
+  }
+  const size_t band = (job.destHeight + threadCount - 1) / threadCount;
+
+  std::vector<Scratch> scratch(threadCount);
+  size_t scratchBytes = 0;
+  for(size_t t = 0;t < threadCount;t++) {
+    const size_t first = std::min(job.destHeight, t * band);
+    const size_t last = std::min(job.destHeight, first + band);
+    if(first < last && !job.skipAcross) {
+      size_t begin, end;
+      SourceRows(job, first, last, begin, end);
+      scratch[t].intermediate.resize((end - begin) * job.destWidth * job.channels);
+    }
+    scratch[t].rows.resize(job.down.maxCount);
+    scratchBytes += scratch[t].intermediate.capacity() + scratch[t].rows.capacity() * sizeof(const uint8_t *);
+  }
+  GFSMemoryCharge charge(GFSMemoryStageResample, scratchBytes);
+
+  // the calling thread takes the first band, and any band a thread
+  // couldn't be started for
+  std::vector<std::thread> threads;
+  for(size_t t = 1;t < threadCount;t++) {
+    const size_t first = t * band;
+    const size_t last = std::min(job.destHeight, first + band);
+    if(first < last) {
+      try {
+        threads.push_back(std::thread(ResampleRows, &job, &scratch[t], first, last));
+      } catch(const std::system_error &) {
+        ResampleRows(&job, &scratch[t], first, last);
+      }
+    }
+  }
+  ResampleRows(&job, &scratch[0], 0, std::min(job.destHeight, band));
+  for(size_t t = 0;t < threads.size();t++) {
+    threads[t].join();
+  }
+}
+
+bool IsValidBuffer(const GFSResampleBuffer *buffer, size_t channels) {
+  return NULL != buffer && NULL != buffer->data && 0 != buffer->width && 0 != buffer->height &&
+    buffer->rowBytes >= buffer->width * channels;
+}
+
+GFSResampleError Resample(const GFSResampleBuffer *src,
+                          const GFSResampleBuffer *dest,
+                          GFSResampleFilter filter,
+                          size_t channels,
+                          uint32_t flags) {
+  if(!IsValidBuffer(src, channels) || !IsValidBuffer(dest, channels)) {
+    return GFSResampleInvalidBuffer;
+  }
+  Filter f;
+  if(!FilterFor(filter, f)) {
+    return GFSResampleInvalidFilter;
+  }
+  try {
+    Job job;
+    job.src = (const uint8_t *)src->data;
+    job.srcRowBytes = src->rowBytes;
+    job.srcWidth = src->width;
+    job.srcHeight = src->height;
+    job.dest = (uint8_t *)dest->data;
+    job.destRowBytes = dest->rowBytes;
+    job.destWidth = dest->width;
+    job.destHeight = dest->height;
+    job.channels = channels;
+    job.skipAcross = src->width == dest->width;
+    job.scalar = 0 != (flags & GFSResampleScalar);
+    if(!job.skipAcross) {
+      BuildAxis(job.across, src->width, dest->width, f);
+    }
+    BuildAxis(job.down, src->height, dest->height, f);
+    RunJob(job, flags);
+  } catch(const std::bad_alloc &) {
+    return GFSResampleMemoryAllocationError;
+  }
+  return GFSResampleNoError;
+}
+
+}
+
+#pragma mark - API
+
+GFSResampleError GFSResampleARGB8888(const GFSResampleBuffer *src,
+                                     const GFSResampleBuffer *dest,
+                                     GFSResampleFilter filter,
+                                     uint32_t flags) {
+  return Resample(src, dest, filter, 4, flags);
+}
+
+GFSResampleError GFSResamplePlanar8(const GFSResampleBuffer *src,
+                                    const GFSResampleBuffer *dest,
+                                    GFSResampleFilter filter,
+                                    uint32_t flags) {
+  return Resample(src, dest, filter, 1, flags);
+}
@@ -0,0 +1,95 @@
+//
+//  GFSResampler.h
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+
+#ifndef GFSResampler_h
+#define GFSResampler_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A portable (no Core Graphics) resampler, for drawing an image at display
+ * size without drawing it into a context.
+ *
+ * Separable: each row is resampled across into an intermediate image that
+ * is as wide as the destination, and then the intermediate rows are
+ * resampled down. What source pixels go into each destination pixel, and
+ * with what weights, is worked out once per axis up front. When shrinking,
+ * the filter is stretched to cover every source pixel (a 4x downscale with
+ * Lanczos-3 looks at 24 source pixels each way), so nothing aliases.
+ *
+ * Weights are 14 bit fixed point and sum to exactly one, so flat areas stay
+ * flat. Lanczos-3 and Mitchell overshoot near edges, the results are
+ * clamped to 0...255, and ARGB8888's color channels to the pixel's alpha
+ * (its first byte), so premultiplied alpha comes out right. Images without
+ * alpha need 255 in that byte, as GFSImageDecoder leaves it.
+ *
+ * The color channels are all treated the same, so any order of them works.
+ * Unpremultiplied alpha should be premultiplied first or edges will fringe.
+ *
+ * The inner loops use SSE2 or NEON when the compiler targets them, and the
+ * destination is split into bands of rows across threads.
+ */
+
+// same layout as vImage_Buffer
+typedef struct GFSResampleBuffer {
+  void *data;
+  size_t height;
+  size_t width;
+  size_t rowBytes;
+} GFSResampleBuffer;
+
+typedef enum {
+  // each destination pixel is the average of the source pixels under it,
+  // fastest, soft on upscales
+  GFSResampleFilterBox = 0,
+  // tent, what Core Graphics' low and medium interpolation quality look like
+  GFSResampleFilterBilinear,
+  // sharpest, rings a little at hard edges
+  GFSResampleFilterLanczos3,
+  // Mitchell-Netravali with B = C = 1/3, between bilinear and Lanczos
+  GFSResampleFilterMitchell
+} GFSResampleFilter;
+
+typedef enum {
+  GFSResampleNoError = 0,
+  GFSResampleInvalidBuffer,
+  GFSResampleInvalidFilter,
+  GFSResampleMemoryAllocationError
+} GFSResampleError;
+
+typedef enum {
+  GFSResampleNoFlags = 0,
+  // run on the calling thread only
+  GFSResampleSingleThread = 1 << 0,
+  // skip the SIMD paths, handy for checking them against plain C
+  GFSResampleScalar = 1 << 1
+} GFSResampleFlags;
+
+// Resamples all of src to fill all of dest, whatever the two sizes.
+// src and dest must not overlap.
+GFSResampleError GFSResampleARGB8888(const GFSResampleBuffer *src,
+                                     const GFSResampleBuffer *dest,
+                                     GFSResampleFilter filter,
+                                     uint32_t flags);
+
+// One byte per pixel, for planes split out of an image (or gray images).
+GFSResampleError GFSResamplePlanar8(const GFSResampleBuffer *src,
+                                    const GFSResampleBuffer *dest,
+                                    GFSResampleFilter filter,
+                                    uint32_t flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+//
+//  GFSThumbnailDiskCache.h
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+
+/*
+ * Keeps thumbnails on disk as raw pixels so showing one again, even after a
+ * relaunch, costs a mmap and the page faults of drawing it, not a decode
+ * and resample.
+ *
+ * Each thumbnail is one file: a header page saying how the pixels are laid
+ * out and which source file (path, size and modification time) and max pixel
+ * size they were made from, then the pixels themselves starting on a page
+ * boundary, 32 bit little endian premultiplied ARGB, the screen's own
+ * format. The file is mapped read only and the CGImage reads straight out
+ * of the mapping, so its pixels are clean pages the system can drop and
+ * fault back in rather than dirty memory.
+ *
+ * A thumbnail is stale, and isn't returned, once its source changes size or
+ * modification date. The least recently used files are deleted once the
+ * directory is bigger than byteBudget. Temporary files left by a write that
+ * never finished are deleted after a few minutes.
+ */
+@interface GFSThumbnailDiskCache : NSObject
+
+// Library/Caches/Thumbnails, 64MB
++ (GFSThumbnailDiskCache *)sharedCache;
+
+- (id)initWithDirectory:(NSURL *)directory byteBudget:(unsigned long long)byteBudget;
+
+@property(nonatomic, strong, readonly) NSURL *directory;
+@property(nonatomic, assign, readonly) unsigned long long byteBudget;
+
+// nil when there's no thumbnail for this source at this size, or the one
+// there is stale. Cheap enough for the main thread.
+- (UIImage *)thumbnailForFileURL:(NSURL *)fileURL maxPixelSize:(NSUInteger)maxPixelSize;
+
+// Draws image into a new file for the source and returns the mapped copy,
+// which should be used from then on in place of image so only one copy of
+// the pixels is in memory. nil if the file couldn't be written. Safe to call
+// from any thread.
+- (UIImage *)storeThumbnail:(UIImage *)image forFileURL:(NSURL *)fileURL maxPixelSize:(NSUInteger)maxPixelSize;
+
+- (void)removeAllThumbnails;
+
+@end
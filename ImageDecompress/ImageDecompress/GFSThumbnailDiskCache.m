@@ -0,0 +1,334 @@
+//
+//  GFSThumbnailDiskCache.m
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+
+#import "GFSThumbnailDiskCache.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static const uint32_t kThumbnailMagic = 'GFST';
+static const uint32_t kThumbnailVersion = 1;
+static const CGBitmapInfo kThumbnailBitmapInfo = kCGBitmapByteOrder32Little | kCGImageAlphaPremultipliedFirst;
+static NSString * const kThumbnailExtension = @"thumbnail";
+// a temporary file this old was left behind by a write that never finished
+static const NSTimeInterval kAbandonedTemporaryAge = 5. * 60.;
+
+// The first page of every file, the pixels start right after it.
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  // offset of the pixels, a multiple of the page size
+  uint32_t pixelOffset;
+  uint32_t width;
+  uint32_t height;
+  uint32_t bytesPerRow;
+  uint32_t bitmapInfo;
+  uint32_t maxPixelSize;
+  // what the thumbnail was made from, it's stale once these change
+  uint64_t sourceBytes;
+  int64_t sourceModifiedSeconds;
+  int64_t sourceModifiedNanoseconds;
+  // followed by this many bytes of the source's path, no terminating 0
+  uint32_t pathLength;
+} GFSThumbnailHeader;
+
+// The mapping lives as long as the CGImage reading out of it.
+static void GFSUnmapThumbnail(void *info, const void *data, size_t size) {
+  munmap(info, (size_t)data - (size_t)info + size);
+}
+
+@interface GFSThumbnailDiskCache()
+
+@property(nonatomic, strong, readwrite) NSURL *directory;
+@property(nonatomic, assign, readwrite) unsigned long long byteBudget;
+
+@end
+
+@interface GFSThumbnailDiskCache(Private)
+
+- (NSString *)pathForFileURL:(NSURL *)fileURL maxPixelSize:(NSUInteger)maxPixelSize;
+- (BOOL)fillHeader:(GFSThumbnailHeader *)header forFileURL:(NSURL *)fileURL maxPixelSize:(NSUInteger)maxPixelSize;
+- (void)trimToBudget;
+
+@end
+
+@implementation GFSThumbnailDiskCache {
+  // trimming runs here, one at a time
+  dispatch_queue_t _trimQueue;
+  size_t _pageSize;
+}
+
+@synthesize directory = _directory;
+@synthesize byteBudget = _byteBudget;
+
++ (GFSThumbnailDiskCache *)sharedCache {
+  static GFSThumbnailDiskCache *cache = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    NSURL *caches = [[[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory
+                                                            inDomains:NSUserDomainMask] lastObject];
+    cache = [[GFSThumbnailDiskCache alloc] initWithDirectory:[caches URLByAppendingPathComponent:@"Thumbnails"]
+                                                  byteBudget:64 * 1024 * 1024];
+  });
+  return cache;
+}
+
+- (id)initWithDirectory:(NSURL *)directory byteBudget:(unsigned long long)byteBudget {
+  self = [super init];
+  if(nil != self) {
+    self.directory = directory;
+    self.byteBudget = byteBudget;
+    _trimQueue = dispatch_queue_create("com.galafactory.thumbnaildiskcache", DISPATCH_QUEUE_SERIAL);
+    _pageSize = (size_t)getpagesize();
+    [[NSFileManager defaultManager] createDirectoryAtURL:directory
+                             withIntermediateDirectories:YES
+                                              attributes:nil
+                                                   error:NULL];
+    // sweeps up after a crash mid-write last time
+    dispatch_async(_trimQueue, ^{
+      [self trimToBudget];
+    });
+  }
+  return self;
+}
+
+- (UIImage *)thumbnailForFileURL:(NSURL *)fileURL maxPixelSize:(NSUInteger)maxPixelSize {
+  GFSThumbnailHeader expected;
+  if(![self fillHeader:&expected forFileURL:fileURL maxPixelSize:maxPixelSize]) {
+    return nil;
+  }
+  NSString *path = [self pathForFileURL:fileURL maxPixelSize:maxPixelSize];
+  int fd = open([path fileSystemRepresentation], O_RDONLY);
+  if(-1 == fd) {
+    return nil;
+  }
+  struct stat info;
+  void *mapping = MAP_FAILED;
+  size_t length = 0;
+  if(0 == fstat(fd, &info) && info.st_size >= (off_t)_pageSize) {
+    length = (size_t)info.st_size;
+    mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  if(MAP_FAILED != mapping) {
+    // the modification date orders the files for trimming, a hit makes this
+    // one the most recently used
+    futimes(fd, NULL);
+  }
+  close(fd);
+  if(MAP_FAILED == mapping) {
+    return nil;
+  }
+
+  // everything about the file has to match, and the pixels have to fit
+  const GFSThumbnailHeader *header = mapping;
+  NSData *sourcePath = [[fileURL path] dataUsingEncoding:NSUTF8StringEncoding];
+  BOOL valid = header->magic == kThumbnailMagic && header->version == kThumbnailVersion &&
+    header->maxPixelSize == expected.maxPixelSize && header->sourceBytes == expected.sourceBytes &&
+    header->sourceModifiedSeconds == expected.sourceModifiedSeconds &&
+    header->sourceModifiedNanoseconds == expected.sourceModifiedNanoseconds &&
+    header->bitmapInfo == kThumbnailBitmapInfo && 0 == header->pixelOffset % _pageSize &&
+    header->pathLength == [sourcePath length] && sizeof(GFSThumbnailHeader) + header->pathLength <= header->pixelOffset &&
+    0 == memcmp(header + 1, [sourcePath bytes], header->pathLength) &&
+    0 != header->width && 0 != header->height && header->bytesPerRow >= (uint64_t)header->width * 4 &&
+    header->pixelOffset + (uint64_t)header->bytesPerRow * header->height == length;
+  if(!valid) {
+    munmap(mapping, length);
+    return nil;
+  }
+
+  uint8_t *pixels = (uint8_t *)mapping + header->pixelOffset;
+  size_t pixelBytes = (size_t)header->bytesPerRow * header->height;
+  CGDataProviderRef provider = CGDataProviderCreateWithData(mapping, pixels, pixelBytes, GFSUnmapThumbnail);
+  CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+  CGImageRef cgImage = CGImageCreate(header->width, header->height, 8, 32, header->bytesPerRow,
+                                     colorSpace, header->bitmapInfo, provider, NULL, YES,
+                                     kCGRenderingIntentDefault);
+  CGColorSpaceRelease(colorSpace);
+  CGDataProviderRelease(provider);
+  if(NULL == cgImage) {
+    return nil;
+  }
+  UIImage *image = [UIImage imageWithCGImage:cgImage];
+  CGImageRelease(cgImage);
+  return image;
+}
+
+- (UIImage *)storeThumbnail:(UIImage *)image forFileURL:(NSURL *)fileURL maxPixelSize:(NSUInteger)maxPixelSize {
+  GFSThumbnailHeader header;
+  NSData *sourcePath = [[fileURL path] dataUsingEncoding:NSUTF8StringEncoding];
+  if(nil == image || ![self fillHeader:&header forFileURL:fileURL maxPixelSize:maxPixelSize]) {
+    return nil;
+  }
+  size_t width = (size_t)(image.size.width * image.scale);
+  size_t height = (size_t)(image.size.height * image.scale);
+  if(0 == width || 0 == height) {
+    return nil;
+  }
+  // rows on 64 byte boundaries, what Core Animation likes to copy from
+  size_t bytesPerRow = (width * 4 + 63) & ~(size_t)63;
+  size_t pixelOffset = (sizeof(header) + [sourcePath length] + _pageSize - 1) / _pageSize * _pageSize;
+  size_t length = pixelOffset + bytesPerRow * height;
+  header.pixelOffset = (uint32_t)pixelOffset;
+  header.width = (uint32_t)width;
+  header.height = (uint32_t)height;
+  header.bytesPerRow = (uint32_t)bytesPerRow;
+  header.pathLength = (uint32_t)[sourcePath length];
+
+  // written to a temporary file and renamed into place, so a reader never
+  // sees half a thumbnail
+  NSString *path = [self pathForFileURL:fileURL maxPixelSize:maxPixelSize];
+  NSString *temporaryTemplate = [path stringByAppendingString:@".XXXXXX"];
+  char temporaryPath[PATH_MAX];
+  if(![temporaryTemplate getFileSystemRepresentation:temporaryPath maxLength:sizeof(temporaryPath)]) {
+    return nil;
+  }
+  int fd = mkstemp(temporaryPath);
+  if(-1 == fd) {
+    return nil;
+  }
+  void *mapping = MAP_FAILED;
+  if(0 == ftruncate(fd, (off_t)length)) {
+    mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if(MAP_FAILED == mapping) {
+    unlink(temporaryPath);
+    return nil;
+  }
+  memcpy(mapping, &header, sizeof(header));
+  memcpy((uint8_t *)mapping + sizeof(header), [sourcePath bytes], [sourcePath length]);
+
+  // draw straight into the file, UIKit takes care of the orientation
+  CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+  CGContextRef context = CGBitmapContextCreate((uint8_t *)mapping + pixelOffset, width, height, 8,
+                                               bytesPerRow, colorSpace, kThumbnailBitmapInfo);
+  CGColorSpaceRelease(colorSpace);
+  if(NULL != context) {
+    CGContextTranslateCTM(context, 0.0, height);
+    CGContextScaleCTM(context, 1.0, -1.0);
+    UIGraphicsPushContext(context);
+    [image drawInRect:CGRectMake(0.0, 0.0, width, height)];
+    UIGraphicsPopContext();
+    CGContextRelease(context);
+  }
+  munmap(mapping, length);
+  if(NULL == context || 0 != rename(temporaryPath, [path fileSystemRepresentation])) {
+    unlink(temporaryPath);
+    return nil;
+  }
+  dispatch_async(_trimQueue, ^{
+    [self trimToBudget];
+  });
+  return [self thumbnailForFileURL:fileURL maxPixelSize:maxPixelSize];
+}
+
+- (void)removeAllThumbnails {
+  dispatch_sync(_trimQueue, ^{
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSArray *files = [fileManager contentsOfDirectoryAtURL:self.directory
+                                includingPropertiesForKeys:nil
+                                                   options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                     error:NULL];
+    for(NSURL *file in files) {
+      [fileManager removeItemAtURL:file error:NULL];
+    }
+  });
+}
+
+@end
+
+@implementation GFSThumbnailDiskCache(Private)
+
+// One file per source path and size, a new thumbnail of a changed source
+// replaces the stale one. The path is hashed (64 bit FNV-1a) to keep the
+// name short, the header holds the whole path to catch collisions.
+- (NSString *)pathForFileURL:(NSURL *)fileURL maxPixelSize:(NSUInteger)maxPixelSize {
+  const char *sourcePath = [[fileURL path] UTF8String];
+  uint64_t hash = 14695981039346656037ULL;
+  for(const char *c = sourcePath;'\0' != *c;c++) {
+    hash = (hash ^ (uint8_t)*c) * 1099511628211ULL;
+  }
+  NSString *name = [NSString stringWithFormat:@"%016llx-%lu.%@", hash, (unsigned long)maxPixelSize,
+                    kThumbnailExtension];
+  return [[self.directory path] stringByAppendingPathComponent:name];
+}
+
+- (BOOL)fillHeader:(GFSThumbnailHeader *)header forFileURL:(NSURL *)fileURL maxPixelSize:(NSUInteger)maxPixelSize {
+  struct stat info;
+  if(![fileURL isFileURL] || 0 != stat([[fileURL path] fileSystemRepresentation], &info)) {
+    return NO;
+  }
+  memset(header, 0, sizeof(*header));
+  header->magic = kThumbnailMagic;
+  header->version = kThumbnailVersion;
+  header->bitmapInfo = kThumbnailBitmapInfo;
+  header->maxPixelSize = (uint32_t)maxPixelSize;
+  header->sourceBytes = (uint64_t)info.st_size;
+  header->sourceModifiedSeconds = info.st_mtimespec.tv_sec;
+  header->sourceModifiedNanoseconds = info.st_mtimespec.tv_nsec;
+  return YES;
+}
+
+// On _trimQueue. Deletes temporary files abandoned by a write that never
+// got as far as the rename, then the least recently used thumbnails, by
+// modification date, until what's left fits the budget. Temporary files
+// still being written count towards it.
+- (void)trimToBudget {
+  NSFileManager *fileManager = [NSFileManager defaultManager];
+  NSArray *keys = [NSArray arrayWithObjects:NSURLContentModificationDateKey, NSURLTotalFileAllocatedSizeKey, nil];
+  NSArray *files = [fileManager contentsOfDirectoryAtURL:self.directory
+                              includingPropertiesForKeys:keys
+                                                 options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                   error:NULL];
+  unsigned long long total = 0;
+  NSMutableArray *thumbnails = [NSMutableArray arrayWithCapacity:[files count]];
+  for(NSURL *file in files) {
+    NSNumber *bytes = nil;
+    [file getResourceValue:&bytes forKey:NSURLTotalFileAllocatedSizeKey error:NULL];
+    if(![[file pathExtension] isEqualToString:kThumbnailExtension]) {
+      // mkstemp's <name>.thumbnail.XXXXXX
+      if(![[[file URLByDeletingPathExtension] pathExtension] isEqualToString:kThumbnailExtension]) {
+        continue;
+      }
+      NSDate *modified = nil;
+      [file getResourceValue:&modified forKey:NSURLContentModificationDateKey error:NULL];
+      BOOL abandoned = nil != modified && -[modified timeIntervalSinceNow] > kAbandonedTemporaryAge;
+      if(!abandoned || ![fileManager removeItemAtURL:file error:NULL]) {
+        total += [bytes unsignedLongLongValue];
+      }
+      continue;
+    }
+    total += [bytes unsignedLongLongValue];
+    [thumbnails addObject:file];
+  }
+  if(total <= self.byteBudget) {
+    return;
+  }
+  [thumbnails sortUsingComparator:^NSComparisonResult(NSURL *a, NSURL *b) {
+    NSDate *aDate = nil;
+    NSDate *bDate = nil;
+    [a getResourceValue:&aDate forKey:NSURLContentModificationDateKey error:NULL];
+    [b getResourceValue:&bDate forKey:NSURLContentModificationDateKey error:NULL];
+    return [aDate compare:bDate];
+  }];
+  for(NSURL *file in thumbnails) {
+    if(total <= self.byteBudget) {
+      break;
+    }
+    NSNumber *bytes = nil;
+    [file getResourceValue:&bytes forKey:NSURLTotalFileAllocatedSizeKey error:NULL];
+    // an image already made from it keeps its mapping
+    if([fileManager removeItemAtURL:file error:NULL]) {
+      total -= MIN(total, [bytes unsignedLongLongValue]);
+    }
+  }
+}
+
+@end
@@ -7,6 +7,10 @@
 //
 
 #import "GFSViewController.h"
+#import "UIImage+ScaledDecoding.h"
+#import "GFSImageCache.h"
+#import "GFSImageDecoder.h"
+#import "GFSMemoryAccounting.h"
 
 typedef void(^ImageDecompressCompletion)(UIImage *decompressedImage);
 
@@ -18,15 +22,6 @@ typedef void(^ImageDecompressCompletion)(UIImage *decompressedImage);
 
 @implementation GFSViewController
 
-+ (NSOperationQueue *)decompressionQueue {
-  static NSOperationQueue *queue = nil;
-  static dispatch_once_t onceToken;
-  dispatch_once(&onceToken, ^{
-    queue = [[NSOperationQueue alloc] init];
-  });
-  return queue;
-}
-
 - (void)viewDidLoad {
   [super viewDidLoad];
   [self decompressImage:@"IMG_4087" extension:@"jpg"
@@ -35,40 +30,87 @@ typedef void(^ImageDecompressCompletion)(UIImage *decompressedImage);
              }];
 }
 
+// completionBlock is called on the main queue with each better version of
+// the image as it's decoded, the last call has the finished one.
 - (void)decompressImage:(NSString *)name
               extension:(NSString *)extension
              completion:(ImageDecompressCompletion)completionBlock {
-  [[[self class] decompressionQueue] addOperationWithBlock:^{
-    // create a graphics context that is optimized for the screen
-    // the source image is 1x so it's forced here. If you have a 2x image
-    // set the final arg to zero.
-    UIGraphicsBeginImageContextWithOptions(CGSizeMake(512.0, 512.0),
-                                           YES, 1.0);
-    // find and load the image, we are on a background thread so dataWihtContentsOfURL:
-    // is fine
-    NSURL *url = [[NSBundle mainBundle] URLForResource:name withExtension:extension];
-    UIImage *image = [UIImage imageWithData:[NSData dataWithContentsOfURL:url]];
-    // draw the image, since the screen context created with UIGraphicsBeginImageContextWithOptions
-    // is current this draws as expected into that context
-    //
-    // before this call we have allocated 512x512x4 (1.05MB) of
-    // memory for the context and loaded the compressed image into memory
-    // after this call the image is decompressed (also 1.05MB) and then
-    // drawn into the context, which is still 1.05MB so we have 2.1MB
-    // used for this little dance. After we return and ARC cleans up
-    // there is 1.05 for the screen image.
-    [image drawInRect:CGRectMake(0.0, 0.0, 512.0, 512.0)];
-    // at this point image has a decompressed version of it's self
-    // we could return that and we'd have a decompressed jpg or png or whatever
-    // however, it would not necessarly be optimized for display on the screen
-    // if we get the image from the graphics context we'll have something optimized
-    // for the screen
-    UIImage *screenOptimizedImage = UIGraphicsGetImageFromCurrentImageContext();
-    UIGraphicsEndImageContext();
-    dispatch_async(dispatch_get_main_queue(), ^{
-      completionBlock(screenOptimizedImage);
-    });
+  NSURL *url = [[NSBundle mainBundle] URLForResource:name withExtension:extension];
+  // GFSImageDecoder and GFSResampler's pixels, big endian ARGB with no alpha
+  GFSImageCacheKey *key = [GFSImageCacheKey keyWithSource:url size:CGSizeMake(512.0, 512.0)
+                                               bitmapInfo:kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipFirst];
+  UIImage *cachedImage = [[GFSImageCache sharedCache] imageForKey:key];
+  if(nil != cachedImage) {
+    completionBlock(cachedImage);
+    return;
+  }
+  // the file is mapped rather than read so looking at its header to size the
+  // decode costs next to nothing here on the main thread
+  NSData *data = [NSData dataWithContentsOfURL:url options:NSDataReadingMappedIfSafe error:NULL];
+  // the scheduler keeps a burst of these from oversubscribing the cores or
+  // memory, it needs to know how much this one will use at its peak: the
+  // scaled decode plus the 512x512 image it's resampled to
+  size_t decodedBytes = 512 * 512 * 4;
+  GFSImageInfo info;
+  if(GFSImageDecoderNoError == GFSImageDecoderReadInfo([data bytes], [data length], &info)) {
+    uint32_t width, height;
+    GFSImageDecoderScaledSize(&info, GFSImageDecoderScaleForSize(&info, 512, 512), &width, &height);
+    decodedBytes += (size_t)width * height * 4;
+  }
+  // asking again before this finishes waits on the same decode
+  cachedImage = [[GFSImageCache sharedCache] imageForKey:key decodedBytes:decodedBytes priority:GFSDecodePriorityVisible decode:^UIImage *{
+    // decode only as big as it needs to be, a JPEG several times bigger than
+    // 512x512 is scaled down while it's decoded so its full size bitmap never
+    // exists, and GFSResampler takes it the rest of the way to 512x512.
+    // There's no context to draw into, the resampled pixels are the image.
+    // A rough version comes first, off the EXIF thumbnail, in a millisecond
+    // or two rather than the tens the whole decode takes; it's shown until
+    // the real one replaces it. The main queue runs blocks in order, so the
+    // preview always lands before the final image.
+    // What the decode really allocates is counted as a "decode" request,
+    // GFSMemoryWriteReport has it next to the others.
+    GFSMemoryRequest *request = GFSMemoryRequestBegin("decode");
+    UIImage *decodedImage = [UIImage imageWithData:data decodedToSize:CGSizeMake(512.0, 512.0)
+                                            filter:GFSResampleFilterLanczos3
+                                          previews:^(UIImage *preview) {
+                                            dispatch_async(dispatch_get_main_queue(), ^{
+                                              completionBlock(preview);
+                                            });
+                                          }];
+    if(nil == decodedImage) {
+      // GFSImageDecoder can't read it, fall back on UIImage and Core Graphics.
+      // create a graphics context that is optimized for the screen
+      // the source image is 1x so it's forced here. If you have a 2x image
+      // set the final arg to zero.
+      UIGraphicsBeginImageContextWithOptions(CGSizeMake(512.0, 512.0),
+                                             YES, 1.0);
+      UIImage *image = [UIImage imageWithData:data];
+      // draw the image, since the screen context created with UIGraphicsBeginImageContextWithOptions
+      // is current this draws as expected into that context
+      //
+      // before this call we have allocated 512x512x4 (1.05MB) of
+      // memory for the context and loaded the compressed image into memory
+      // the image is decompressed and drawn into the context, which is still
+      // 1.05MB. After we return and ARC cleans up there is 1.05 for the
+      // screen image.
+      [image drawInRect:CGRectMake(0.0, 0.0, 512.0, 512.0)];
+      // at this point image has a decompressed version of it's self
+      // we could return that and we'd have a decompressed jpg or png or whatever
+      // however, it would not necessarly be optimized for display on the screen
+      // if we get the image from the graphics context we'll have something optimized
+      // for the screen
+      decodedImage = UIGraphicsGetImageFromCurrentImageContext();
+      UIGraphicsEndImageContext();
+    }
+    GFSMemoryRequestEnd(request);
+    return decodedImage;
+  } completion:^(UIImage *result) {
+    completionBlock(result);
   }];
+  // cached by another decode since the first look
+  if(nil != cachedImage) {
+    completionBlock(cachedImage);
+  }
 }
 
 @end
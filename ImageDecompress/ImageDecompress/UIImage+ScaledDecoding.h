@@ -0,0 +1,31 @@
+//
+//  UIImage+ScaledDecoding.h
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+#import <UIKit/UIKit.h>
+#import "GFSResampler.h"
+
+@interface UIImage (ScaledDecoding)
+
+// Decodes data (a JPEG or PNG) with GFSImageDecoder, scaled down as far as
+// it can go while still covering size pixels, so the full size bitmap is
+// never made. The EXIF orientation is kept, like imageWithData:. nil when
+// GFSImageDecoder can't read it, ImageIO probably can.
++ (UIImage *)imageWithData:(NSData *)data decodedToCoverSize:(CGSize)size;
+
+// Like imageWithData:decodedToCoverSize:, then resampled with filter to
+// exactly size pixels (as it's shown, the EXIF orientation is kept), so it
+// doesn't have to be drawn into a context of that size to get there.
++ (UIImage *)imageWithData:(NSData *)data decodedToSize:(CGSize)size filter:(GFSResampleFilter)filter;
+
+// Like imageWithData:decodedToSize:filter:, handing previews rougher
+// versions of the same size first (from the EXIF thumbnail or a 1/8
+// decode, see GFSProgressiveDecoder.h) while the rest of the decode goes on.
+// previews is called on the calling thread, before this returns.
++ (UIImage *)imageWithData:(NSData *)data decodedToSize:(CGSize)size filter:(GFSResampleFilter)filter
+                  previews:(void (^)(UIImage *preview))previews;
+
+@end
@@ -0,0 +1,141 @@
+//
+//  UIImage+ScaledDecoding.m
+//  ImageDecompress
+//
+//  Created by Bill Dudney on 4/12/13.
+//  Copyright (c) 2013 Bill Dudney. All rights reserved.
+//
+
+#import "UIImage+ScaledDecoding.h"
+#import "GFSImageDecoder.h"
+#import "GFSProgressiveDecoder.h"
+#import "GFSMemoryAccounting.h"
+
+@implementation UIImage (ScaledDecoding)
+
+// The orientation to show a decoded image with, from its EXIF orientation.
+static UIImageOrientation GFSImageOrientation(uint32_t exifOrientation) {
+  static const UIImageOrientation orientations[9] = {
+    UIImageOrientationUp,
+    UIImageOrientationUp, UIImageOrientationUpMirrored,
+    UIImageOrientationDown, UIImageOrientationDownMirrored,
+    UIImageOrientationLeftMirrored, UIImageOrientationRight,
+    UIImageOrientationRightMirrored, UIImageOrientationLeft
+  };
+  return orientations[exifOrientation <= 8 ? exifOrientation : 1];
+}
+
+// called by Quartz when the last image using the pixels goes away
+static void GFSReleasePixels(void *info, const void *data, size_t size) {
+  GFSMemoryRecordFree(GFSMemoryStageDecode, size);
+  CFRelease(info);
+}
+
+// Wraps width x height ARGB8888 pixels as they are, no copy. The pixels are
+// counted under GFSMemoryStageDecode from when they're allocated until
+// Quartz lets go of them, or until here when there's no image.
+static UIImage *GFSImageWithPixels(NSData *pixels, uint32_t width, uint32_t height, uint32_t exifOrientation) {
+  CGDataProviderRef provider = CGDataProviderCreateWithData((__bridge_retained void *)pixels,
+                                                            [pixels bytes], [pixels length],
+                                                            GFSReleasePixels);
+  if(NULL == provider) {
+    GFSReleasePixels((__bridge void *)pixels, [pixels bytes], [pixels length]);
+    return nil;
+  }
+  CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+  CGImageRef imageRef = CGImageCreate(width, height, 8, 32, width * 4, colorSpace,
+                                      kCGBitmapByteOrder32Big | kCGImageAlphaNoneSkipFirst,
+                                      provider, NULL, false, kCGRenderingIntentDefault);
+  CGColorSpaceRelease(colorSpace);
+  CGDataProviderRelease(provider);
+  if(NULL == imageRef) {
+    return nil;
+  }
+  UIImage *image = [UIImage imageWithCGImage:imageRef scale:1.0 orientation:GFSImageOrientation(exifOrientation)];
+  CGImageRelease(imageRef);
+  return image;
+}
+
++ (UIImage *)imageWithData:(NSData *)data decodedToCoverSize:(CGSize)size {
+  GFSImageInfo info;
+  if(GFSImageDecoderNoError != GFSImageDecoderReadInfo([data bytes], [data length], &info)) {
+    return nil;
+  }
+  // 5 through 8 are turned a quarter, the stored image is on its side
+  if(info.orientation >= 5) {
+    size = CGSizeMake(size.height, size.width);
+  }
+  uint32_t scale = GFSImageDecoderScaleForSize(&info, ceil(size.width), ceil(size.height));
+  uint32_t width, height;
+  GFSImageDecoderScaledSize(&info, scale, &width, &height);
+  NSMutableData *pixels = [NSMutableData dataWithLength:(NSUInteger)width * height * 4];
+  if(nil == pixels) {
+    return nil;
+  }
+  GFSMemoryRecordAllocation(GFSMemoryStageDecode, [pixels length]);
+  if(GFSImageDecoderNoError != GFSImageDecodeARGB8888([data bytes], [data length], scale, NULL,
+                                                      [pixels mutableBytes], width * 4)) {
+    GFSMemoryRecordFree(GFSMemoryStageDecode, [pixels length]);
+    return nil;
+  }
+  return GFSImageWithPixels(pixels, width, height, info.orientation);
+}
+
++ (UIImage *)imageWithData:(NSData *)data decodedToSize:(CGSize)size filter:(GFSResampleFilter)filter {
+  return [self imageWithData:data decodedToSize:size filter:filter previews:nil];
+}
+
+typedef struct GFSPreviewContext {
+  __unsafe_unretained void (^previews)(UIImage *preview);
+  uint32_t orientation;
+} GFSPreviewContext;
+
+static bool GFSHandlePreview(void *context, GFSProgressiveStage stage, const GFSResampleBuffer *dest) {
+  if(GFSProgressiveStageFinal != stage) {
+    GFSPreviewContext *previewContext = (GFSPreviewContext *)context;
+    // the next stage is decoded over these pixels, so the preview gets a copy
+    NSData *pixels = [NSData dataWithBytes:dest->data length:dest->rowBytes * dest->height];
+    GFSMemoryRecordAllocation(GFSMemoryStageDecode, [pixels length]);
+    UIImage *preview = GFSImageWithPixels(pixels, (uint32_t)dest->width, (uint32_t)dest->height,
+                                          previewContext->orientation);
+    if(nil != preview) {
+      previewContext->previews(preview);
+    }
+  }
+  return true;
+}
+
++ (UIImage *)imageWithData:(NSData *)data decodedToSize:(CGSize)size filter:(GFSResampleFilter)filter
+                  previews:(void (^)(UIImage *preview))previews {
+  GFSImageInfo info;
+  if(GFSImageDecoderNoError != GFSImageDecoderReadInfo([data bytes], [data length], &info)) {
+    return nil;
+  }
+  // 5 through 8 are turned a quarter, the stored image is on its side
+  if(info.orientation >= 5) {
+    size = CGSizeMake(size.height, size.width);
+  }
+  uint32_t destWidth = (uint32_t)ceil(size.width);
+  uint32_t destHeight = (uint32_t)ceil(size.height);
+  if(0 == destWidth || 0 == destHeight) {
+    return nil;
+  }
+  NSMutableData *pixels = [NSMutableData dataWithLength:(NSUInteger)destWidth * destHeight * 4];
+  if(nil == pixels) {
+    return nil;
+  }
+  GFSMemoryRecordAllocation(GFSMemoryStageDecode, [pixels length]);
+  // the scaled decode gets within 2x of the size, the resampler does the
+  // rest, straight into pixels
+  GFSResampleBuffer dest = { [pixels mutableBytes], destHeight, destWidth, destWidth * 4 };
+  GFSPreviewContext context = { previews, info.orientation };
+  if(GFSImageDecoderNoError != GFSProgressiveDecodeARGB8888([data bytes], [data length], &dest, filter,
+                                                            nil == previews ? NULL : GFSHandlePreview,
+                                                            &context)) {
+    GFSMemoryRecordFree(GFSMemoryStageDecode, [pixels length]);
+    return nil;
+  }
+  return GFSImageWithPixels(pixels, destWidth, destHeight, info.orientation);
+}
+
+@end
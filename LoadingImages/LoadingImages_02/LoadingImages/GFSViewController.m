@@ -7,6 +7,7 @@
 //
 
 #import "GFSViewController.h"
+#import "UIImage+ScaledDecoding.h"
 
 @interface GFSViewController ()
 
@@ -26,8 +27,19 @@
 -(UIImage *)redrawnImage {
   NSString *path = [[NSBundle mainBundle] pathForResource:@"phillip"
                                                    ofType:@"jpg"];
-  UIImage *image = [UIImage imageWithContentsOfFile:path];
   CGSize size = CGSizeMake(1024.0, 768.0);
+  CGFloat screenScale = [[UIScreen mainScreen] scale];
+  // the 3264x2448 photo is decoded at half size when that still covers
+  // the screen's pixels, a quarter of the memory and time, then resampled
+  // to exactly the screen's pixels. No context to redraw it into.
+  NSData *data = [NSData dataWithContentsOfFile:path];
+  UIImage *image = [UIImage imageWithData:data
+                            decodedToSize:CGSizeMake(size.width * screenScale, size.height * screenScale)
+                                   filter:GFSResampleFilterLanczos3];
+  if(nil != image) {
+    return [UIImage imageWithCGImage:image.CGImage scale:screenScale orientation:image.imageOrientation];
+  }
+  image = [UIImage imageWithData:data];
   UIGraphicsBeginImageContextWithOptions(size, YES, 0.0);
   [image drawInRect:CGRectMake(0.0, 0.0, size.width, size.height)];
   UIImage *redrawnImage = UIGraphicsGetImageFromCurrentImageContext();
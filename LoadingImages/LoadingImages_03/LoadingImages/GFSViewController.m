@@ -8,6 +8,8 @@
 
 #import "GFSViewController.h"
 #import <ImageIO/ImageIO.h>
+#import "GFSImageCache.h"
+#import "GFSThumbnailDiskCache.h"
 
 @interface GFSViewController ()
 
@@ -21,13 +23,44 @@
 
 - (void)viewDidLoad {
   [super viewDidLoad];
-  self.imageView.image = [self thumbnailImage];
+  NSString *path = [[NSBundle mainBundle] pathForResource:@"phillip"
+                                                   ofType:@"jpg"];
+  NSURL *url = [NSURL fileURLWithPath:path];
+  // thumbnails are kept in the disk cache's format, whichever way they were
+  // made
+  GFSImageCacheKey *key = [GFSImageCacheKey keyWithSource:path size:CGSizeMake(1024.0, 1024.0)
+                                               bitmapInfo:kCGBitmapByteOrder32Little | kCGImageAlphaPremultipliedFirst];
+  UIImage *image = [[GFSImageCache sharedCache] imageForKey:key];
+  if(nil == image) {
+    // made on an earlier launch, mapping the file is all this costs
+    image = [[GFSThumbnailDiskCache sharedCache] thumbnailForFileURL:url maxPixelSize:1024];
+    if(nil != image) {
+      [[GFSImageCache sharedCache] setImage:image forKey:key];
+    }
+  }
+  if(nil == image) {
+    // never seen, made off the main thread, at most 1024x1024 pixels, and
+    // written to disk for next time
+    __weak GFSViewController *weakSelf = self;
+    image = [[GFSImageCache sharedCache] imageForKey:key decodedBytes:1024 * 1024 * 4
+                                            priority:GFSDecodePriorityVisible
+                                              decode:^UIImage *{
+                                                UIImage *thumbnail = [GFSViewController thumbnailImageAtPath:path];
+                                                UIImage *mapped = [[GFSThumbnailDiskCache sharedCache] storeThumbnail:thumbnail
+                                                                                                           forFileURL:url
+                                                                                                         maxPixelSize:1024];
+                                                return nil != mapped ? mapped : thumbnail;
+                                              } completion:^(UIImage *image) {
+                                                weakSelf.imageView.image = image;
+                                              }];
+  }
+  if(nil != image) {
+    self.imageView.image = image;
+  }
 }
 
--(UIImage *)thumbnailImage {
++ (UIImage *)thumbnailImageAtPath:(NSString *)path {
   UIImage *image = nil;
-  NSString *path = [[NSBundle mainBundle] pathForResource:@"phillip"
-                                                   ofType:@"jpg"];
   NSURL *url = [NSURL fileURLWithPath:path];
   CGImageSourceRef imageSource = 
   CGImageSourceCreateWithURL((__bridge CFURLRef)url, NULL);
@@ -46,6 +46,7 @@
  */
 
 #import "RippleModel.h"
+#import "RippleStencil.h"
 
 @interface RippleModel () {
     unsigned int screenWidth;
@@ -61,6 +62,15 @@
     float texCoordFactorT;
     float texCoordOffsetT;
     
+    // undisturbed texture coords, s for each row and t for each column,
+    // the ripple only adds to them
+    float *texCoordBaseS;
+    float *texCoordBaseT;
+    
+    // runSimulation's bands, and where they've met this frame
+    unsigned int rowsPerBand;
+    int32_t *bandArrivals;
+    
     // ripple coefficients
     float *rippleCoeff;
     
@@ -99,6 +109,15 @@
     }    
 }
 
+- (void)initTexCoordBases {
+    for (int y=0; y<poolHeight; y++) {
+        texCoordBaseS[y] = (float)y/(poolHeight-1) * texCoordFactorS + texCoordOffsetS;
+    }
+    for (int x=0; x<poolWidth; x++) {
+        texCoordBaseT[x] = (1.f - (float)x/(poolWidth-1)) * texCoordFactorT + texCoordOffsetT;
+    }
+}
+
 - (void)initMesh {
     for (int i=0; i<poolHeight; i++) {
         for (int j=0; j<poolWidth; j++) {
@@ -182,6 +201,11 @@
     free(rippleSource);
     free(rippleDest);
     
+    free(texCoordBaseS);
+    free(texCoordBaseT);
+    
+    free(bandArrivals);
+    
     free(rippleVertices);
     free(rippleTexCoords);
     free(rippleIndicies);    
@@ -223,11 +247,20 @@
         rippleSource = (float *)malloc((poolWidth+2)*(poolHeight+2)*sizeof(float));
         rippleDest = (float *)malloc((poolWidth+2)*(poolHeight+2)*sizeof(float));
         
+        texCoordBaseS = (float *)malloc(poolHeight*sizeof(float));
+        texCoordBaseT = (float *)malloc(poolWidth*sizeof(float));
+        
+        // a few bands a core so one slow thread doesn't hold up the frame,
+        // not so thin that the rows they share are much of the work
+        rowsPerBand = (unsigned int)MAX(8, poolHeight/(4*[[NSProcessInfo processInfo] activeProcessorCount]));
+        bandArrivals = (int32_t *)malloc(RippleFrameBandCount(poolHeight, rowsPerBand)*sizeof(int32_t));
+        
         rippleVertices = (GLfloat *)malloc(poolWidth*poolHeight*2*sizeof(GLfloat));
         rippleTexCoords = (GLfloat *)malloc(poolWidth*poolHeight*2*sizeof(GLfloat));
         rippleIndicies = (GLushort *)malloc((poolHeight-1)*(poolWidth*2+2)*sizeof(GLushort));
         
         if (!rippleCoeff || !rippleSource || !rippleDest || 
+            !texCoordBaseS || !texCoordBaseT || !bandArrivals ||
             !rippleVertices || !rippleTexCoords || !rippleIndicies) {
             [self freeBuffers];
             return nil;
@@ -237,6 +270,8 @@
         
         [self initRippleCoeff];
         
+        [self initTexCoordBases];
+        
         [self initMesh];
     }
     
@@ -245,65 +280,18 @@
 
 - (void)runSimulation {
     dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    unsigned int bandCount = RippleFrameBandCount(poolHeight, rowsPerBand);
+    memset(bandArrivals, 0, bandCount*sizeof(int32_t));
+    RippleFrame frame = {
+        rippleSource, rippleDest, poolWidth, poolHeight,
+        texCoordBaseS, texCoordBaseT, rippleTexCoords,
+        rowsPerBand, bandArrivals
+    };
     
-    // first pass for simulation buffers...
-    dispatch_apply(poolHeight, queue, ^(size_t y) {
-        for (int x=0; x<poolWidth; x++) {
-            // * - denotes current pixel
-            //
-            //       a 
-            //     c * d
-            //       b 
-            
-            // +1 to both x/y values because the border is padded
-            float a = rippleSource[(y)*(poolWidth+2) + x+1];
-            float b = rippleSource[(y+2)*(poolWidth+2) + x+1];
-            float c = rippleSource[(y+1)*(poolWidth+2) + x];
-            float d = rippleSource[(y+1)*(poolWidth+2) + x+2];
-          
-          // convolution filter
-          // CGFloat c = 1.0 - (1.0 / 32.0) = 31.0 / 32.0
-          // 0.0   0.5   0.0
-          // 0.5    c    0.5
-          // 0.0   0.5   0.0
-          float result = (a + b + c + d)/2.f - rippleDest[(y+1)*(poolWidth+2) + x+1];
-            
-            result -= result/32.f;
-            
-            rippleDest[(y+1)*(poolWidth+2) + x+1] = result;
-        }            
-    });
-    
-    // second pass for modifying texture coord
-    dispatch_apply(poolHeight, queue, ^(size_t y) {
-        for (int x=0; x<poolWidth; x++) {
-            // * - denotes current pixel
-            //
-            //       a
-            //     c * d
-            //       b
-            
-            // +1 to both x/y values because the border is padded
-            float a = rippleDest[(y)*(poolWidth+2) + x+1];
-            float b = rippleDest[(y+2)*(poolWidth+2) + x+1];
-            float c = rippleDest[(y+1)*(poolWidth+2) + x];
-            float d = rippleDest[(y+1)*(poolWidth+2) + x+2];
-            
-            float s_offset = ((b - a) / 2048.f);
-            float t_offset = ((c - d) / 2048.f);
-            
-            // clamp
-            s_offset = (s_offset < -0.5f) ? -0.5f : s_offset;
-            t_offset = (t_offset < -0.5f) ? -0.5f : t_offset;
-            s_offset = (s_offset > 0.5f) ? 0.5f : s_offset;
-            t_offset = (t_offset > 0.5f) ? 0.5f : t_offset;
-            
-            float s_tc = (float)y/(poolHeight-1) * texCoordFactorS + texCoordOffsetS;
-            float t_tc = (1.f - (float)x/(poolWidth-1)) * texCoordFactorT + texCoordOffsetT;
-            
-            rippleTexCoords[(y*poolWidth+x)*2+0] = s_tc + s_offset;
-            rippleTexCoords[(y*poolWidth+x)*2+1] = t_tc + t_offset;
-        }
+    // one pass for the simulation buffers and the texture coords they
+    // modify, the bands pass rows between themselves without a barrier
+    dispatch_apply(bandCount, queue, ^(size_t band) {
+        RippleFrameRunBand(&frame, (unsigned int)band);
     });
     
     float *pTmp = rippleDest;
@@ -0,0 +1,257 @@
+/*
+     File: RippleStencil.c
+ Abstract: Vectorized rows of the ripple simulation and of the texture
+           coordinates it displaces.
+
+ Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+
+ */
+
+#include "RippleStencil.h"
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+// a fused multiply-add rounds once where the scalar code rounded twice
+#pragma STDC FP_CONTRACT OFF
+
+#pragma mark - Vectors
+
+#if defined(__AVX__)
+
+#define RIPPLE_VECTOR_LANES 8
+
+typedef __m256 RippleVector;
+
+static inline RippleVector RippleLoad(const float *p) { return _mm256_loadu_ps(p); }
+static inline void RippleStore(float *p, RippleVector v) { _mm256_storeu_ps(p, v); }
+static inline RippleVector RippleSplat(float f) { return _mm256_set1_ps(f); }
+static inline RippleVector RippleAdd(RippleVector a, RippleVector b) { return _mm256_add_ps(a, b); }
+static inline RippleVector RippleSub(RippleVector a, RippleVector b) { return _mm256_sub_ps(a, b); }
+static inline RippleVector RippleMul(RippleVector a, RippleVector b) { return _mm256_mul_ps(a, b); }
+// (lo > v) ? lo : v, v when it's NaN like the scalar clamp
+static inline RippleVector RippleMax(RippleVector lo, RippleVector v) { return _mm256_max_ps(lo, v); }
+// (hi < v) ? hi : v
+static inline RippleVector RippleMin(RippleVector hi, RippleVector v) { return _mm256_min_ps(hi, v); }
+
+static inline void RippleStorePairs(float *p, RippleVector s, RippleVector t) {
+    // unpack works within each 128 bit half, the halves are put back in order
+    __m256 lo = _mm256_unpacklo_ps(s, t);
+    __m256 hi = _mm256_unpackhi_ps(s, t);
+    _mm256_storeu_ps(p, _mm256_permute2f128_ps(lo, hi, 0x20));
+    _mm256_storeu_ps(p + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+}
+
+#elif defined(__SSE2__)
+
+#define RIPPLE_VECTOR_LANES 4
+
+typedef __m128 RippleVector;
+
+static inline RippleVector RippleLoad(const float *p) { return _mm_loadu_ps(p); }
+static inline void RippleStore(float *p, RippleVector v) { _mm_storeu_ps(p, v); }
+static inline RippleVector RippleSplat(float f) { return _mm_set1_ps(f); }
+static inline RippleVector RippleAdd(RippleVector a, RippleVector b) { return _mm_add_ps(a, b); }
+static inline RippleVector RippleSub(RippleVector a, RippleVector b) { return _mm_sub_ps(a, b); }
+static inline RippleVector RippleMul(RippleVector a, RippleVector b) { return _mm_mul_ps(a, b); }
+// (lo > v) ? lo : v, v when it's NaN like the scalar clamp
+static inline RippleVector RippleMax(RippleVector lo, RippleVector v) { return _mm_max_ps(lo, v); }
+// (hi < v) ? hi : v
+static inline RippleVector RippleMin(RippleVector hi, RippleVector v) { return _mm_min_ps(hi, v); }
+
+static inline void RippleStorePairs(float *p, RippleVector s, RippleVector t) {
+    _mm_storeu_ps(p, _mm_unpacklo_ps(s, t));
+    _mm_storeu_ps(p + 4, _mm_unpackhi_ps(s, t));
+}
+
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+
+#define RIPPLE_VECTOR_LANES 4
+
+typedef float32x4_t RippleVector;
+
+static inline RippleVector RippleLoad(const float *p) { return vld1q_f32(p); }
+static inline void RippleStore(float *p, RippleVector v) { vst1q_f32(p, v); }
+static inline RippleVector RippleSplat(float f) { return vdupq_n_f32(f); }
+static inline RippleVector RippleAdd(RippleVector a, RippleVector b) { return vaddq_f32(a, b); }
+static inline RippleVector RippleSub(RippleVector a, RippleVector b) { return vsubq_f32(a, b); }
+// vmul then vsub rather than vmls, which isn't rounded the same on every core
+static inline RippleVector RippleMul(RippleVector a, RippleVector b) { return vmulq_f32(a, b); }
+static inline RippleVector RippleMax(RippleVector lo, RippleVector v) { return vmaxq_f32(lo, v); }
+static inline RippleVector RippleMin(RippleVector hi, RippleVector v) { return vminq_f32(hi, v); }
+
+static inline void RippleStorePairs(float *p, RippleVector s, RippleVector t) {
+    float32x4x2_t pairs = { { s, t } };
+    vst2q_f32(p, pairs);
+}
+
+#endif
+
+#pragma mark - Cells
+
+// The scalar stencil, for the cells left over at the end of a row and when
+// there's no vector unit. The divisions are exact, they're written as
+// multiplies to match the vectors.
+static inline float RippleSimulateCell(float a, float b, float c, float d, float previous) {
+    float result = (a + b + c + d) * 0.5f - previous;
+    return result - result * (1.f / 32.f);
+}
+
+static inline void RippleTexCoordCell(float a, float b, float c, float d, float s, float t, float *texCoord) {
+    float sOffset = (b - a) * (1.f / 2048.f);
+    float tOffset = (c - d) * (1.f / 2048.f);
+    sOffset = (sOffset < -0.5f) ? -0.5f : sOffset;
+    tOffset = (tOffset < -0.5f) ? -0.5f : tOffset;
+    sOffset = (sOffset > 0.5f) ? 0.5f : sOffset;
+    tOffset = (tOffset > 0.5f) ? 0.5f : tOffset;
+    texCoord[0] = s + sOffset;
+    texCoord[1] = t + tOffset;
+}
+
+#pragma mark - Rows
+
+#ifdef RIPPLE_VECTOR_LANES
+
+typedef struct {
+    RippleVector a;
+    RippleVector b;
+    RippleVector c;
+    RippleVector d;
+} RippleCross;
+
+// the neighbours of cells x through x + RIPPLE_VECTOR_LANES - 1
+static inline RippleCross RippleLoadCross(const float *above, const float *row, const float *below, unsigned int x) {
+    RippleCross cross = {
+        RippleLoad(above + x + 1),
+        RippleLoad(below + x + 1),
+        RippleLoad(row + x),
+        RippleLoad(row + x + 2)
+    };
+    return cross;
+}
+
+static inline RippleVector RippleSimulateVector(RippleCross cross, RippleVector previous) {
+    RippleVector sum = RippleAdd(RippleAdd(RippleAdd(cross.a, cross.b), cross.c), cross.d);
+    RippleVector result = RippleSub(RippleMul(sum, RippleSplat(0.5f)), previous);
+    return RippleSub(result, RippleMul(result, RippleSplat(1.f / 32.f)));
+}
+
+static inline void RippleTexCoordVector(RippleCross cross, RippleVector s, RippleVector t, float *texCoords) {
+    RippleVector lo = RippleSplat(-0.5f);
+    RippleVector hi = RippleSplat(0.5f);
+    RippleVector scale = RippleSplat(1.f / 2048.f);
+    RippleVector sOffset = RippleMin(hi, RippleMax(lo, RippleMul(RippleSub(cross.b, cross.a), scale)));
+    RippleVector tOffset = RippleMin(hi, RippleMax(lo, RippleMul(RippleSub(cross.c, cross.d), scale)));
+    RippleStorePairs(texCoords, RippleAdd(s, sOffset), RippleAdd(t, tOffset));
+}
+
+#endif
+
+void RippleSimulateRow(const float *above, const float *row, const float *below,
+                       float *dest, unsigned int width) {
+    unsigned int x = 0;
+#ifdef RIPPLE_VECTOR_LANES
+    // two vectors a loop, their loads and math overlap
+    for (; x + 2 * RIPPLE_VECTOR_LANES <= width; x += 2 * RIPPLE_VECTOR_LANES) {
+        RippleCross first = RippleLoadCross(above, row, below, x);
+        RippleCross second = RippleLoadCross(above, row, below, x + RIPPLE_VECTOR_LANES);
+        RippleVector firstResult = RippleSimulateVector(first, RippleLoad(dest + x + 1));
+        RippleVector secondResult = RippleSimulateVector(second, RippleLoad(dest + x + 1 + RIPPLE_VECTOR_LANES));
+        RippleStore(dest + x + 1, firstResult);
+        RippleStore(dest + x + 1 + RIPPLE_VECTOR_LANES, secondResult);
+    }
+#endif
+    for (; x < width; x++) {
+        dest[x + 1] = RippleSimulateCell(above[x + 1], below[x + 1], row[x], row[x + 2], dest[x + 1]);
+    }
+}
+
+void RippleTexCoordRow(const float *above, const float *row, const float *below,
+                       float s, const float *t, float *texCoords, unsigned int width) {
+    unsigned int x = 0;
+#ifdef RIPPLE_VECTOR_LANES
+    RippleVector sVector = RippleSplat(s);
+    for (; x + 2 * RIPPLE_VECTOR_LANES <= width; x += 2 * RIPPLE_VECTOR_LANES) {
+        RippleCross first = RippleLoadCross(above, row, below, x);
+        RippleCross second = RippleLoadCross(above, row, below, x + RIPPLE_VECTOR_LANES);
+        RippleTexCoordVector(first, sVector, RippleLoad(t + x), texCoords + x * 2);
+        RippleTexCoordVector(second, sVector, RippleLoad(t + x + RIPPLE_VECTOR_LANES),
+                             texCoords + (x + RIPPLE_VECTOR_LANES) * 2);
+    }
+#endif
+    for (; x < width; x++) {
+        RippleTexCoordCell(above[x + 1], below[x + 1], row[x], row[x + 2], s, t[x], texCoords + x * 2);
+    }
+}
+
+#pragma mark - Frames
+
+static void RippleFrameSimulateRow(const RippleFrame *frame, unsigned int y) {
+    const size_t stride = frame->width + 2;
+    // +1 to y because the border is padded
+    RippleSimulateRow(frame->source + y * stride, frame->source + (y + 1) * stride,
+                      frame->source + (y + 2) * stride, frame->dest + (y + 1) * stride, frame->width);
+}
+
+static void RippleFrameTexCoordRow(const RippleFrame *frame, unsigned int y) {
+    const size_t stride = frame->width + 2;
+    RippleTexCoordRow(frame->dest + y * stride, frame->dest + (y + 1) * stride, frame->dest + (y + 2) * stride,
+                      frame->s[y], frame->t, frame->texCoords + (size_t)y * frame->width * 2, frame->width);
+}
+
+// The bands either side of boundary (the first row of the lower one) both
+// come here once they've done their two rows next to it. The full barrier
+// makes the first one's rows visible to the second, which does the texture
+// coord rows that need them.
+static void RippleFrameArrive(const RippleFrame *frame, unsigned int band) {
+    if (2 == __sync_add_and_fetch(&frame->arrivals[band - 1], 1)) {
+        unsigned int boundary = band * frame->rowsPerBand;
+        RippleFrameTexCoordRow(frame, boundary - 1);
+        RippleFrameTexCoordRow(frame, boundary);
+    }
+}
+
+unsigned int RippleFrameBandCount(unsigned int height, unsigned int rowsPerBand) {
+    unsigned int count = height / rowsPerBand;
+    return count > 0 ? count : 1;
+}
+
+void RippleFrameRunBand(const RippleFrame *frame, unsigned int band) {
+    const unsigned int first = band * frame->rowsPerBand;
+    const unsigned int last = band + 1 == RippleFrameBandCount(frame->height, frame->rowsPerBand)
+        ? frame->height : first + frame->rowsPerBand;
+    for (unsigned int y = first; y < last; y++) {
+        RippleFrameSimulateRow(frame, y);
+        if (first > 0 && y == first + 1) {
+            RippleFrameArrive(frame, band);
+        }
+        // rows y - 2 through y are done, the padding above the first row
+        // counts as done, the rows of the band above don't
+        if (y > first && (y - 1 > first || 0 == first)) {
+            RippleFrameTexCoordRow(frame, y - 1);
+        }
+    }
+    // the padding below the last row counts as done too
+    if (last == frame->height) {
+        RippleFrameTexCoordRow(frame, last - 1);
+    } else {
+        RippleFrameArrive(frame, band + 1);
+    }
+}
@@ -0,0 +1,105 @@
+/*
+     File: RippleStencil.h
+ Abstract: Vectorized rows of the ripple simulation and of the texture
+           coordinates it displaces.
+
+ Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+
+ */
+
+#ifndef RippleStencil_h
+#define RippleStencil_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Both passes of -[RippleModel runSimulation] look at the same four
+ * neighbours of every cell,
+ *
+ *       a
+ *     c * d
+ *       b
+ *
+ * so they share one stencil: the neighbours of several cells are loaded at
+ * once (4 with NEON and SSE, 8 with AVX, two vectors a loop) and the rest
+ * is adds, multiplies and min/max, no branches. Whatever is left at the
+ * end of a row goes through the same arithmetic a cell at a time.
+ *
+ * The results are bit for bit the ones the scalar loops gave: the adds are
+ * done in the same order, dividing by 2, 32 and 2048 is the same as
+ * multiplying by their reciprocals, and min/max clamp the way the
+ * conditionals did. RippleBenchmark checks it.
+ *
+ * Rows are given as pointers to their first element in the padded height
+ * fields, the border column, so cell x is row[x + 1].
+ */
+
+// One row of the wave equation: dest's cells become the average of their
+// neighbours in source less their previous value, damped by 1/32.
+// above, row and below are rows y - 1, y and y + 1 of source, dest is row y
+// of the other field, updated in place.
+void RippleSimulateRow(const float *above, const float *row, const float *below,
+                       float *dest, unsigned int width);
+
+// One row of texture coordinates: the undisturbed coordinate, s for the
+// row and t[x] for the column, pushed along the slope of the height field
+// at the cell, at most half the texture either way. Written as s, t pairs.
+void RippleTexCoordRow(const float *above, const float *row, const float *below,
+                       float s, const float *t, float *texCoords, unsigned int width);
+
+/*
+ * A whole frame, both passes fused: the rows are split into bands, and a
+ * band does a texture coord row as soon as the three rows of the new
+ * height field it needs are done, while they're still in the cache, rather
+ * than coming back for all of them after every band is through. The bands
+ * run in parallel and never wait on each other. The two texture coord rows
+ * either side of where two bands meet need rows from both, whichever band
+ * gets there second does them (arrivals counts who's been).
+ *
+ * Gives the same results as RippleSimulateRow over every row then
+ * RippleTexCoordRow over every row.
+ */
+typedef struct RippleFrame {
+    // the padded height fields, (width + 2) * (height + 2)
+    const float *source;
+    float *dest;
+    unsigned int width;
+    unsigned int height;
+    // undisturbed texture coords, height of s and width of t
+    const float *s;
+    const float *t;
+    float *texCoords;
+    // at least 2
+    unsigned int rowsPerBand;
+    // RippleFrameBandCount - 1 of them, zero at the start of every frame
+    volatile int32_t *arrivals;
+} RippleFrame;
+
+// How many bands height rows make, each rowsPerBand long but the last,
+// which takes what's left over.
+unsigned int RippleFrameBandCount(unsigned int height, unsigned int rowsPerBand);
+
+// Does band of frame, on any thread, as long as every band is done once.
+void RippleFrameRunBand(const RippleFrame *frame, unsigned int band);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
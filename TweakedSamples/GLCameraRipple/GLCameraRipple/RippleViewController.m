@@ -78,6 +78,7 @@ enum
   size_t _textureWidth;
   size_t _textureHeight;
   unsigned int _meshFactor;
+  unsigned int _touchRadius;
   
   EAGLContext *_context;
   RippleModel *_ripple;
@@ -127,15 +128,28 @@ enum
     // meshFactor controls the ending ripple mesh size.
     // For example mesh width = screenWidth / meshFactor.
     // It's chosen based on both screen resolution and device size.
-    _meshFactor = 8;
+    // With the vectorized stencil (RippleStencil.h) the mesh is twice as
+    // fine as it used to be.
+    _meshFactor = 4;
     
     // Choosing bigger preset for bigger screen.
     _sessionPreset = AVCaptureSessionPreset1280x720;
   } else {
-    _meshFactor = 4;
+    _meshFactor = 2;
     _sessionPreset = AVCaptureSessionPreset640x480;
   }
   
+  // A touch covers 40 points either way on iPad and 20 on iPhone, as it
+  // did on the coarser mesh.
+  unsigned int touchPoints = 10*_meshFactor;
+  
+  // The mesh is indexed with GLushorts, so it can't have more than 65536
+  // vertices, coarser than asked for on the bigger screens.
+  while (((unsigned int)_screenWidth/_meshFactor)*((unsigned int)_screenHeight/_meshFactor) > 65536) {
+    _meshFactor++;
+  }
+  _touchRadius = MAX(1, touchPoints/_meshFactor);
+  
   [self setupGL];
   
   [self setupAVCapture];
@@ -205,7 +219,7 @@ enum
     _ripple = [[RippleModel alloc] initWithScreenWidth:_screenWidth
                                           screenHeight:_screenHeight
                                             meshFactor:_meshFactor
-                                           touchRadius:5
+                                           touchRadius:_touchRadius
                                           textureWidth:_textureWidth
                                          textureHeight:_textureHeight];
     
@@ -0,0 +1,342 @@
+/*
+     File: RippleBenchmark.cpp
+ Abstract: Checks RippleStencil against the scalar loops -[RippleModel
+           runSimulation] used to run, bit for bit, and times them.
+
+ Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+
+ All of them run the same ripples (touches at pseudo random places every
+ few frames) for a few hundred frames, the height fields and texture
+ coords are compared after every frame. The scalar loops, the two passes
+ of rows and the fused bands run on one thread, then the two passes and
+ the fused bands again on every core, threads taking rows or bands as
+ they're free the way dispatch_apply does. Meshes of every size
+ RippleViewController can ask for are run, on the iPhone and iPad screens,
+ plus widths that leave every possible number of cells at the end of a
+ row. Prints CSV, the time is per frame.
+
+ Runs on Linux as well as OS X, the flags keep the compiler from fusing
+ multiplies and adds in one version and not the other:
+
+   cc -O2 -ffp-contract=off -c ../GLCameraRipple/RippleStencil.c
+   c++ -O2 -std=c++11 -ffp-contract=off -I../GLCameraRipple -o RippleBenchmark
+       RippleStencil.o RippleBenchmark.cpp -lpthread
+   ./RippleBenchmark [threads]
+
+ Compile RippleStencil.c with -mavx for the AVX version.
+
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "RippleStencil.h"
+
+#pragma STDC FP_CONTRACT OFF
+
+namespace {
+
+const unsigned kFrames = 300;
+const unsigned kFramesPerTouch = 20;
+const unsigned kTouchRadius = 10;
+const unsigned kTextureWidth = 1280;
+const unsigned kTextureHeight = 720;
+
+// what RippleModel keeps, for one way of running it
+struct Pool {
+    unsigned width;
+    unsigned height;
+    float texCoordFactorS;
+    float texCoordOffsetS;
+    float texCoordFactorT;
+    float texCoordOffsetT;
+    std::vector<float> source;
+    std::vector<float> dest;
+    std::vector<float> texCoords;
+    std::vector<float> baseS;
+    std::vector<float> baseT;
+    unsigned rowsPerBand;
+    std::vector<int32_t> arrivals;
+};
+
+Pool MakePool(unsigned screenWidth, unsigned screenHeight, unsigned meshFactor) {
+    Pool pool;
+    pool.width = screenWidth/meshFactor;
+    pool.height = screenHeight/meshFactor;
+    if ((float)screenHeight/screenWidth < (float)kTextureWidth/kTextureHeight) {
+        pool.texCoordFactorS = (float)(kTextureHeight*screenHeight)/(screenWidth*kTextureWidth);
+        pool.texCoordOffsetS = (1.f - pool.texCoordFactorS)/2.f;
+        pool.texCoordFactorT = 1.f;
+        pool.texCoordOffsetT = 0.f;
+    } else {
+        pool.texCoordFactorS = 1.f;
+        pool.texCoordOffsetS = 0.f;
+        pool.texCoordFactorT = (float)(screenWidth*kTextureWidth)/(kTextureHeight*screenHeight);
+        pool.texCoordOffsetT = (1.f - pool.texCoordFactorT)/2.f;
+    }
+    pool.source.assign((pool.width+2)*(pool.height+2), 0.f);
+    pool.dest.assign((pool.width+2)*(pool.height+2), 0.f);
+    pool.texCoords.assign(pool.width*pool.height*2, 0.f);
+    for (unsigned y=0; y<pool.height; y++) {
+        pool.baseS.push_back((float)y/(pool.height-1) * pool.texCoordFactorS + pool.texCoordOffsetS);
+    }
+    for (unsigned x=0; x<pool.width; x++) {
+        pool.baseT.push_back((1.f - (float)x/(pool.width-1)) * pool.texCoordFactorT + pool.texCoordOffsetT);
+    }
+    // as -[RippleModel initWithScreenWidth:...] picks them
+    pool.rowsPerBand = std::max(8u, pool.height/(4*std::max(1u, std::thread::hardware_concurrency())));
+    pool.arrivals.assign(RippleFrameBandCount(pool.height, pool.rowsPerBand), 0);
+    return pool;
+}
+
+#pragma mark - Ripples
+
+// -[RippleModel initRippleCoeff]
+std::vector<float> MakeCoefficients() {
+    std::vector<float> coefficients((kTouchRadius*2+1)*(kTouchRadius*2+1));
+    for (int y=0; y<=2*(int)kTouchRadius; y++) {
+        for (int x=0; x<=2*(int)kTouchRadius; x++) {
+            float distance = sqrt((x-kTouchRadius)*(x-kTouchRadius)+(y-kTouchRadius)*(y-kTouchRadius));
+            coefficients[y*(kTouchRadius*2+1)+x] = distance <= kTouchRadius
+                ? -(cos(distance/kTouchRadius*M_PI)+1.f) * 256.f : 0.f;
+        }
+    }
+    return coefficients;
+}
+
+// -[RippleModel initiateRippleAtLocation:], at a cell rather than a point
+void Touch(Pool &pool, const std::vector<float> &coefficients, int xIndex, int yIndex) {
+    const int radius = kTouchRadius;
+    for (int y=yIndex-radius; y<=yIndex+radius; y++) {
+        for (int x=xIndex-radius; x<=xIndex+radius; x++) {
+            if (x>=0 && x<(int)pool.width && y>=0 && y<(int)pool.height) {
+                pool.source[(pool.width+2)*(y+1)+x+1] +=
+                    coefficients[(y-(yIndex-radius))*(radius*2+1)+x-(xIndex-radius)];
+            }
+        }
+    }
+}
+
+#pragma mark - Frames
+
+// -[RippleModel runSimulation] as it was, one thread
+void ScalarFrame(Pool &pool) {
+    const unsigned poolWidth = pool.width;
+    const unsigned poolHeight = pool.height;
+    float *rippleSource = pool.source.data();
+    float *rippleDest = pool.dest.data();
+    for (size_t y=0; y<poolHeight; y++) {
+        for (unsigned x=0; x<poolWidth; x++) {
+            float a = rippleSource[(y)*(poolWidth+2) + x+1];
+            float b = rippleSource[(y+2)*(poolWidth+2) + x+1];
+            float c = rippleSource[(y+1)*(poolWidth+2) + x];
+            float d = rippleSource[(y+1)*(poolWidth+2) + x+2];
+            float result = (a + b + c + d)/2.f - rippleDest[(y+1)*(poolWidth+2) + x+1];
+            result -= result/32.f;
+            rippleDest[(y+1)*(poolWidth+2) + x+1] = result;
+        }
+    }
+    for (size_t y=0; y<poolHeight; y++) {
+        for (unsigned x=0; x<poolWidth; x++) {
+            float a = rippleDest[(y)*(poolWidth+2) + x+1];
+            float b = rippleDest[(y+2)*(poolWidth+2) + x+1];
+            float c = rippleDest[(y+1)*(poolWidth+2) + x];
+            float d = rippleDest[(y+1)*(poolWidth+2) + x+2];
+            float s_offset = ((b - a) / 2048.f);
+            float t_offset = ((c - d) / 2048.f);
+            s_offset = (s_offset < -0.5f) ? -0.5f : s_offset;
+            t_offset = (t_offset < -0.5f) ? -0.5f : t_offset;
+            s_offset = (s_offset > 0.5f) ? 0.5f : s_offset;
+            t_offset = (t_offset > 0.5f) ? 0.5f : t_offset;
+            float s_tc = (float)y/(poolHeight-1) * pool.texCoordFactorS + pool.texCoordOffsetS;
+            float t_tc = (1.f - (float)x/(poolWidth-1)) * pool.texCoordFactorT + pool.texCoordOffsetT;
+            pool.texCoords[(y*poolWidth+x)*2+0] = s_tc + s_offset;
+            pool.texCoords[(y*poolWidth+x)*2+1] = t_tc + t_offset;
+        }
+    }
+    pool.source.swap(pool.dest);
+}
+
+// -[RippleModel runSimulation] now, one thread
+void StencilFrame(Pool &pool) {
+    const size_t stride = pool.width+2;
+    const float *source = pool.source.data();
+    float *dest = pool.dest.data();
+    for (size_t y=0; y<pool.height; y++) {
+        RippleSimulateRow(source + y*stride, source + (y+1)*stride, source + (y+2)*stride,
+                          dest + (y+1)*stride, pool.width);
+    }
+    for (size_t y=0; y<pool.height; y++) {
+        RippleTexCoordRow(dest + y*stride, dest + (y+1)*stride, dest + (y+2)*stride,
+                          pool.baseS[y], pool.baseT.data(), pool.texCoords.data() + y*pool.width*2, pool.width);
+    }
+    pool.source.swap(pool.dest);
+}
+
+// dispatch_apply, more or less: every thread takes the next index until
+// they're gone, and it returns when they're all done
+void Apply(size_t count, unsigned threads, const std::function<void(size_t)> &work) {
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i=next++; i<count; i=next++) {
+            work(i);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i=1; i<threads; i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : pool) {
+        thread.join();
+    }
+}
+
+// StencilFrame with a barrier between the passes, as runSimulation was
+void ThreadedStencilFrame(Pool &pool, unsigned threads) {
+    const size_t stride = pool.width+2;
+    const float *source = pool.source.data();
+    float *dest = pool.dest.data();
+    Apply(pool.height, threads, [&](size_t y) {
+        RippleSimulateRow(source + y*stride, source + (y+1)*stride, source + (y+2)*stride,
+                          dest + (y+1)*stride, pool.width);
+    });
+    Apply(pool.height, threads, [&](size_t y) {
+        RippleTexCoordRow(dest + y*stride, dest + (y+1)*stride, dest + (y+2)*stride,
+                          pool.baseS[y], pool.baseT.data(), pool.texCoords.data() + y*pool.width*2, pool.width);
+    });
+    pool.source.swap(pool.dest);
+}
+
+// -[RippleModel runSimulation] now
+void FusedFrame(Pool &pool, unsigned threads) {
+    const unsigned bandCount = RippleFrameBandCount(pool.height, pool.rowsPerBand);
+    std::fill(pool.arrivals.begin(), pool.arrivals.end(), 0);
+    RippleFrame frame = {
+        pool.source.data(), pool.dest.data(), pool.width, pool.height,
+        pool.baseS.data(), pool.baseT.data(), pool.texCoords.data(),
+        pool.rowsPerBand, pool.arrivals.data()
+    };
+    if (threads > 1) {
+        Apply(bandCount, threads, [&](size_t band) { RippleFrameRunBand(&frame, (unsigned)band); });
+    } else {
+        // bottom up, so the lower band of every pair gets there first
+        for (unsigned band=bandCount; band>0; band--) {
+            RippleFrameRunBand(&frame, band-1);
+        }
+    }
+    pool.source.swap(pool.dest);
+}
+
+bool Same(const std::vector<float> &a, const std::vector<float> &b) {
+    return 0 == memcmp(a.data(), b.data(), a.size()*sizeof(float));
+}
+
+// milliseconds a frame, each way of running it
+struct Times {
+    double scalar = 0.;
+    double stencil = 0.;
+    double fused = 0.;
+    double threadedStencil = 0.;
+    double threadedFused = 0.;
+};
+
+// Runs every way for kFrames, false as soon as one differs from the scalar
+// loops. Adds the time each took to times.
+bool Compare(unsigned screenWidth, unsigned screenHeight, unsigned meshFactor,
+             const std::vector<float> &coefficients, unsigned threads, Times &times) {
+    Pool scalar = MakePool(screenWidth, screenHeight, meshFactor);
+    Pool others[4] = {
+        MakePool(screenWidth, screenHeight, meshFactor), MakePool(screenWidth, screenHeight, meshFactor),
+        MakePool(screenWidth, screenHeight, meshFactor), MakePool(screenWidth, screenHeight, meshFactor)
+    };
+    static const char *names[4] = { "stencil", "fused", "threaded stencil", "threaded fused" };
+    double *totals[4] = { &times.stencil, &times.fused, &times.threadedStencil, &times.threadedFused };
+    srand(screenWidth*screenHeight + meshFactor);
+    for (unsigned frame=0; frame<kFrames; frame++) {
+        if (0 == frame % kFramesPerTouch) {
+            int x = rand() % scalar.width;
+            int y = rand() % scalar.height;
+            Touch(scalar, coefficients, x, y);
+            for (Pool &other : others) {
+                Touch(other, coefficients, x, y);
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        ScalarFrame(scalar);
+        auto end = std::chrono::steady_clock::now();
+        times.scalar += std::chrono::duration<double, std::milli>(end - start).count();
+        for (int i=0; i<4; i++) {
+            start = std::chrono::steady_clock::now();
+            switch (i) {
+                case 0: StencilFrame(others[i]); break;
+                case 1: FusedFrame(others[i], 1); break;
+                case 2: ThreadedStencilFrame(others[i], threads); break;
+                case 3: FusedFrame(others[i], threads); break;
+            }
+            end = std::chrono::steady_clock::now();
+            *totals[i] += std::chrono::duration<double, std::milli>(end - start).count();
+            if (!Same(scalar.source, others[i].source) || !Same(scalar.dest, others[i].dest) ||
+                !Same(scalar.texCoords, others[i].texCoords)) {
+                fprintf(stderr, "%ux%u mesh %u: %s frame %u differs\n", screenWidth, screenHeight, meshFactor,
+                        names[i], frame);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    const std::vector<float> coefficients = MakeCoefficients();
+    // a core each unless told otherwise
+    const unsigned threads = argc > 1 ? std::max(1, atoi(argv[1])) : std::max(1u, std::thread::hardware_concurrency());
+    bool passed = true;
+
+    // every count of cells left over after the vectors, up to 16 (AVX, two
+    // vectors a loop), and bands of every height the last one can be
+    for (unsigned width=40; width<57; width++) {
+        Times times;
+        passed = Compare(width, 60 + width - 40, 1, coefficients, threads, times) && passed;
+    }
+
+    // RippleViewController's screens and mesh factors, past and present
+    static const unsigned screens[][2] = { { 320, 480 }, { 320, 568 }, { 768, 1024 } };
+    static const unsigned meshFactors[] = { 8, 4, 2, 1 };
+    printf("screen_width,screen_height,mesh_factor,pool_width,pool_height,frames,scalar_ms,stencil_ms,speedup,"
+           "fused_ms,threads,two_pass_threads_ms,fused_threads_ms,identical\n");
+    for (size_t i=0; i<sizeof(screens)/sizeof(screens[0]); i++) {
+        for (size_t j=0; j<sizeof(meshFactors)/sizeof(meshFactors[0]); j++) {
+            Times times;
+            bool identical = Compare(screens[i][0], screens[i][1], meshFactors[j], coefficients, threads, times);
+            passed = passed && identical;
+            printf("%u,%u,%u,%u,%u,%u,%.4f,%.4f,%.2f,%.4f,%u,%.4f,%.4f,%s\n", screens[i][0], screens[i][1],
+                   meshFactors[j], screens[i][0]/meshFactors[j], screens[i][1]/meshFactors[j], kFrames,
+                   times.scalar/kFrames, times.stencil/kFrames, times.scalar/times.stencil, times.fused/kFrames,
+                   threads, times.threadedStencil/kFrames, times.threadedFused/kFrames, identical ? "yes" : "no");
+        }
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
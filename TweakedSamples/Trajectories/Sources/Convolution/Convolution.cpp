@@ -0,0 +1,1058 @@
+//---------------------------------------------------------------------------
+//
+//	File: Convolution.cpp
+//
+//  Abstract: A class to convolve ARGB8888 images using tiled OpenCL kernels
+//
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#import <iostream>
+#import <sstream>
+#import <vector>
+
+//---------------------------------------------------------------------------
+
+#import "OpenCLKit.h"
+#import "Convolution.h"
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#pragma mark -
+#pragma mark Private - Constants
+
+//---------------------------------------------------------------------------
+
+static const cl_int  kMaxKernelSize   = 64;
+static const cl_int  kMaxKernelTaps   = kMaxKernelSize * kMaxKernelSize;
+static const cl_int  kMaxGaussRadius  = 5;
+static const size_t  kPixelSize       = 4 * sizeof(cl_uchar);
+static const size_t  kSumSize         = sizeof(cl_int4);
+static const size_t  kWeightSize      = sizeof(cl_short);
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#pragma mark -
+#pragma mark Private - Data Structures
+
+//---------------------------------------------------------------------------
+
+enum ConvolutionType
+{
+	kConvolutionType2D = 0,
+	kConvolutionTypeSeparable,
+	kConvolutionTypeBox
+};
+
+typedef enum ConvolutionType ConvolutionType;
+
+//---------------------------------------------------------------------------
+
+class ConvolutionStruct
+{
+	public:
+		bool                   mbAcquired;
+		size_t                 mnWidth;
+		size_t                 mnHeight;
+		size_t                 mnTileWidth;
+		size_t                 mnTileHeight;
+		cl_ulong               mnLocalMemSize;
+		ConvolutionType        mnType;
+		cl_int                 mnKernelWidth;
+		cl_int                 mnKernelHeight;
+		cl_int                 mnDivisor;
+		cl_int4                maBackground;
+		std::vector<cl_short>  maWeights;
+		std::vector<cl_short>  maRowWeights;
+		std::vector<cl_short>  maColumnWeights;
+		std::vector<cl_int>    maReference;
+		OpenCL::Buffer        *mpSrc;
+		OpenCL::Buffer        *mpDst;
+		OpenCL::Buffer        *mpSums;
+		OpenCL::Buffer        *mpWeights;
+		OpenCL::Buffer        *mpRowWeights;
+		OpenCL::Buffer        *mpColumnWeights;
+		OpenCL::Kernel        *mpKernel;
+};
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#pragma mark -
+#pragma mark Private - Utilities - Numerics
+
+//---------------------------------------------------------------------------
+//
+// Round a global work size up to a multiple of the tile size.
+//
+//---------------------------------------------------------------------------
+
+static inline size_t ConvolutionRoundUp(const size_t n, const size_t d)
+{
+	return( ( ( n + d - 1 ) / d ) * d );
+} // ConvolutionRoundUp
+
+//---------------------------------------------------------------------------
+
+static inline cl_uchar ConvolutionSaturate(const cl_int nValue)
+{
+	return( ( nValue < 0 ) ? 0 : ( ( nValue > 255 ) ? 255 : (cl_uchar)nValue ) );
+} // ConvolutionSaturate
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#pragma mark -
+#pragma mark Private - Utilities - Buffers
+
+//---------------------------------------------------------------------------
+
+static void ConvolutionReleaseBuffer(OpenCL::Buffer **ppBuffer)
+{
+	if( *ppBuffer != NULL )
+	{
+		delete *ppBuffer;
+
+		*ppBuffer = NULL;
+	} // if
+} // ConvolutionReleaseBuffer
+
+//---------------------------------------------------------------------------
+//
+// Buffers are bound by cl_mem (not by buffer index) because the same
+// buffer is a different kernel argument in the row and column passes.
+//
+//---------------------------------------------------------------------------
+
+static OpenCL::Buffer *ConvolutionCreateBuffer(OpenCL::Program *pProgram,
+											   const size_t nBufferSize,
+											   const bool bReadOnly)
+{
+	OpenCL::Buffer *pBuffer = new OpenCL::Buffer(pProgram);
+
+	if( pBuffer != NULL )
+	{
+		pBuffer->SetIsNPOT();
+
+		if( bReadOnly )
+		{
+			pBuffer->SetReadOnly();
+		} // if
+
+		if( !pBuffer->Acquire(0, nBufferSize) )
+		{
+			ConvolutionReleaseBuffer(&pBuffer);
+		} // if
+	} // if
+
+	return( pBuffer );
+} // ConvolutionCreateBuffer
+
+//---------------------------------------------------------------------------
+
+static void ConvolutionReleaseImageBuffers(ConvolutionStruct *pSConvolution)
+{
+	ConvolutionReleaseBuffer(&pSConvolution->mpSrc);
+	ConvolutionReleaseBuffer(&pSConvolution->mpDst);
+	ConvolutionReleaseBuffer(&pSConvolution->mpSums);
+
+	pSConvolution->mbAcquired = false;
+} // ConvolutionReleaseImageBuffers
+
+//---------------------------------------------------------------------------
+
+static bool ConvolutionCreateImageBuffers(OpenCL::Program *pProgram,
+										  const size_t nWidth,
+										  const size_t nHeight,
+										  ConvolutionStruct *pSConvolution)
+{
+	ConvolutionReleaseImageBuffers(pSConvolution);
+
+	const size_t nCount = nWidth * nHeight;
+
+	pSConvolution->mpSrc  = ConvolutionCreateBuffer(pProgram, nCount * kPixelSize, true);
+	pSConvolution->mpDst  = ConvolutionCreateBuffer(pProgram, nCount * kPixelSize, false);
+	pSConvolution->mpSums = ConvolutionCreateBuffer(pProgram, nCount * kSumSize,   false);
+
+	pSConvolution->mbAcquired =		( pSConvolution->mpSrc  != NULL )
+								&&	( pSConvolution->mpDst  != NULL )
+								&&	( pSConvolution->mpSums != NULL );
+
+	if( pSConvolution->mbAcquired )
+	{
+		pSConvolution->mnWidth  = nWidth;
+		pSConvolution->mnHeight = nHeight;
+	} // if
+	else
+	{
+		std::cerr << ">> ERROR: Convolution - Failed to acquire image buffers!" << std::endl;
+
+		ConvolutionReleaseImageBuffers(pSConvolution);
+	} // else
+
+	return( pSConvolution->mbAcquired );
+} // ConvolutionCreateImageBuffers
+
+//---------------------------------------------------------------------------
+//
+// The weights live in constant memory and are sized once for the largest
+// supported kernel; changing the kernel only rewrites the used prefix.
+//
+//---------------------------------------------------------------------------
+
+static bool ConvolutionCreateWeightBuffers(OpenCL::Program *pProgram,
+										   ConvolutionStruct *pSConvolution)
+{
+	const size_t nWeightsSize = kMaxKernelTaps * kWeightSize;
+	const size_t nAxisSize    = kMaxKernelSize * kWeightSize;
+
+	pSConvolution->mpWeights       = ConvolutionCreateBuffer(pProgram, nWeightsSize, true);
+	pSConvolution->mpRowWeights    = ConvolutionCreateBuffer(pProgram, nAxisSize, true);
+	pSConvolution->mpColumnWeights = ConvolutionCreateBuffer(pProgram, nAxisSize, true);
+
+	return(		( pSConvolution->mpWeights       != NULL )
+			&&	( pSConvolution->mpRowWeights    != NULL )
+			&&	( pSConvolution->mpColumnWeights != NULL ) );
+} // ConvolutionCreateWeightBuffers
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#pragma mark -
+#pragma mark Private - Constructor
+
+//---------------------------------------------------------------------------
+//
+// Create an opaque convolution data object by,
+//
+// (1) specializing the program for the tile size,
+// (2) acquiring a program from OpenCL,
+// (3) querying the device's local memory size,
+// (4) creating a kernel object,
+// (5) creating the constant weight buffers.
+//
+// Image buffers are created later, by Acquire, once the size is known.
+//
+//---------------------------------------------------------------------------
+
+static ConvolutionStruct *ConvolutionCreate(OpenCL::Program *pProgram,
+											const size_t nTileWidth,
+											const size_t nTileHeight)
+{
+	ConvolutionStruct *pSConvolution = new ConvolutionStruct;
+
+	if( pSConvolution != NULL )
+	{
+		pSConvolution->mbAcquired      = false;
+		pSConvolution->mnWidth         = 0;
+		pSConvolution->mnHeight        = 0;
+		pSConvolution->mnTileWidth     = nTileWidth;
+		pSConvolution->mnTileHeight    = nTileHeight;
+		pSConvolution->mnLocalMemSize  = 0;
+		pSConvolution->mnType          = kConvolutionType2D;
+		pSConvolution->mnKernelWidth   = 0;
+		pSConvolution->mnKernelHeight  = 0;
+		pSConvolution->mnDivisor       = 1;
+		pSConvolution->mpSrc           = NULL;
+		pSConvolution->mpDst           = NULL;
+		pSConvolution->mpSums          = NULL;
+		pSConvolution->mpWeights       = NULL;
+		pSConvolution->mpRowWeights    = NULL;
+		pSConvolution->mpColumnWeights = NULL;
+		pSConvolution->mpKernel        = NULL;
+
+		pSConvolution->maBackground.s[0] = 0;
+		pSConvolution->maBackground.s[1] = 0;
+		pSConvolution->maBackground.s[2] = 0;
+		pSConvolution->maBackground.s[3] = 0;
+
+		std::ostringstream aBuildOptions;
+
+		aBuildOptions << "-DTILE_WIDTH=" << nTileWidth << " -DTILE_HEIGHT=" << nTileHeight;
+
+		pProgram->SetBuildOptions(aBuildOptions.str());
+
+		if( pProgram->Acquire() )
+		{
+			clGetDeviceInfo(pProgram->GetDeviceId(),
+							CL_DEVICE_LOCAL_MEM_SIZE,
+							sizeof(cl_ulong),
+							&pSConvolution->mnLocalMemSize,
+							NULL);
+
+			pSConvolution->mpKernel = new OpenCL::Kernel(pProgram);
+
+			ConvolutionCreateWeightBuffers(pProgram, pSConvolution);
+		} // if
+	} // if
+
+	return( pSConvolution );
+} // ConvolutionCreate
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#pragma mark -
+#pragma mark Private - Destructor
+
+//---------------------------------------------------------------------------
+
+static void ConvolutionRelease(ConvolutionStruct *pSConvolution)
+{
+	if( pSConvolution != NULL )
+	{
+		ConvolutionReleaseImageBuffers(pSConvolution);
+
+		ConvolutionReleaseBuffer(&pSConvolution->mpWeights);
+		ConvolutionReleaseBuffer(&pSConvolution->mpRowWeights);
+		ConvolutionReleaseBuffer(&pSConvolution->mpColumnWeights);
+
+		if( pSConvolution->mpKernel != NULL )
+		{
+			delete pSConvolution->mpKernel;
+		} // if
+
+		delete pSConvolution;
+	} // if
+} // ConvolutionRelease
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#pragma mark -
+#pragma mark Private - Kernel Weights
+
+//---------------------------------------------------------------------------
+//
+// vImage requires odd kernel dimensions, so that the kernel has a center.
+//
+//---------------------------------------------------------------------------
+
+static bool ConvolutionValidateKernelSize(const cl_int nKernelWidth,
+										  const cl_int nKernelHeight,
+										  const cl_int nDivisor)
+{
+	bool bIsValid =		( nKernelWidth  > 0 ) && ( nKernelWidth  <= kMaxKernelSize ) && ( nKernelWidth  & 1 )
+					&&	( nKernelHeight > 0 ) && ( nKernelHeight <= kMaxKernelSize ) && ( nKernelHeight & 1 )
+					&&	( nDivisor != 0 );
+
+	if( !bIsValid )
+	{
+		std::cerr	<< ">> ERROR: Convolution - Invalid kernel [ "
+					<< nKernelWidth
+					<< " x "
+					<< nKernelHeight
+					<< " ] / "
+					<< nDivisor
+					<< "!"
+					<< std::endl;
+	} // if
+
+	return( bIsValid );
+} // ConvolutionValidateKernelSize
+
+//---------------------------------------------------------------------------
+//
+// Local memory needed by the current kernel for one tile plus its halo.
+//
+//---------------------------------------------------------------------------
+
+static bool ConvolutionValidateLocalMemory(const ConvolutionStruct *pSConvolution)
+{
+	size_t nTileWidth  = pSConvolution->mnTileWidth;
+	size_t nTileHeight = pSConvolution->mnTileHeight;
+
+	if( pSConvolution->mnType == kConvolutionType2D )
+	{
+		nTileWidth  += pSConvolution->mnKernelWidth  - 1;
+		nTileHeight += pSConvolution->mnKernelHeight - 1;
+	} // if
+	else
+	{
+		nTileHeight += pSConvolution->mnKernelHeight - 1;
+	} // else
+
+	size_t nRowTileSize = ( pSConvolution->mnTileWidth + pSConvolution->mnKernelWidth - 1 ) * pSConvolution->mnTileHeight;
+	size_t nTileSize    = nTileWidth * nTileHeight;
+
+	if( nRowTileSize > nTileSize )
+	{
+		nTileSize = nRowTileSize;
+	} // if
+
+	bool bIsValid = ( nTileSize * kSumSize ) <= pSConvolution->mnLocalMemSize;
+
+	if( !bIsValid )
+	{
+		std::cerr << ">> ERROR: Convolution - Kernel halo does not fit in local memory!" << std::endl;
+	} // if
+
+	return( bIsValid );
+} // ConvolutionValidateLocalMemory
+
+//---------------------------------------------------------------------------
+//
+// Keep the full 2D weights (as 32-bit integers, the outer product of a
+// separable kernel may not fit in a short) for host verification.
+//
+//---------------------------------------------------------------------------
+
+static void ConvolutionSetReferenceWeights(ConvolutionStruct *pSConvolution)
+{
+	const cl_int nKernelWidth  = pSConvolution->mnKernelWidth;
+	const cl_int nKernelHeight = pSConvolution->mnKernelHeight;
+
+	pSConvolution->maReference.resize(nKernelWidth * nKernelHeight);
+
+	cl_int kx;
+	cl_int ky;
+
+	for( ky = 0; ky < nKernelHeight; ++ky )
+	{
+		for( kx = 0; kx < nKernelWidth; ++kx )
+		{
+			cl_int nWeight = 1;
+
+			switch( pSConvolution->mnType )
+			{
+				case kConvolutionType2D:
+					nWeight = pSConvolution->maWeights[ky * nKernelWidth + kx];
+					break;
+
+				case kConvolutionTypeSeparable:
+					nWeight = (cl_int)pSConvolution->maColumnWeights[ky] * (cl_int)pSConvolution->maRowWeights[kx];
+					break;
+
+				default:
+					break;
+			} // switch
+
+			pSConvolution->maReference[ky * nKernelWidth + kx] = nWeight;
+		} // for
+	} // for
+} // ConvolutionSetReferenceWeights
+
+//---------------------------------------------------------------------------
+
+static bool ConvolutionSetKernel(const cl_short *pWeights,
+								 const cl_int nKernelWidth,
+								 const cl_int nKernelHeight,
+								 const cl_int nDivisor,
+								 ConvolutionStruct *pSConvolution)
+{
+	bool bKernelSet = false;
+
+	if( ( pWeights != NULL ) && ConvolutionValidateKernelSize(nKernelWidth, nKernelHeight, nDivisor) )
+	{
+		pSConvolution->mnType         = kConvolutionType2D;
+		pSConvolution->mnKernelWidth  = nKernelWidth;
+		pSConvolution->mnKernelHeight = nKernelHeight;
+		pSConvolution->mnDivisor      = nDivisor;
+
+		pSConvolution->maWeights.assign(pWeights, pWeights + nKernelWidth * nKernelHeight);
+
+		ConvolutionSetReferenceWeights(pSConvolution);
+
+		bKernelSet =		ConvolutionValidateLocalMemory(pSConvolution)
+						&&	pSConvolution->mpWeights->Write(pSConvolution->maWeights.size() * kWeightSize,
+															&pSConvolution->maWeights[0]);
+	} // if
+
+	return( bKernelSet );
+} // ConvolutionSetKernel
+
+//---------------------------------------------------------------------------
+
+static bool ConvolutionSetSeparableKernel(const cl_short *pRowWeights,
+										  const cl_int nKernelWidth,
+										  const cl_short *pColumnWeights,
+										  const cl_int nKernelHeight,
+										  const cl_int nDivisor,
+										  ConvolutionStruct *pSConvolution)
+{
+	bool bKernelSet = false;
+
+	if(		( pRowWeights != NULL )
+		&&	( pColumnWeights != NULL )
+		&&	ConvolutionValidateKernelSize(nKernelWidth, nKernelHeight, nDivisor) )
+	{
+		pSConvolution->mnType         = kConvolutionTypeSeparable;
+		pSConvolution->mnKernelWidth  = nKernelWidth;
+		pSConvolution->mnKernelHeight = nKernelHeight;
+		pSConvolution->mnDivisor      = nDivisor;
+
+		pSConvolution->maRowWeights.assign(pRowWeights, pRowWeights + nKernelWidth);
+		pSConvolution->maColumnWeights.assign(pColumnWeights, pColumnWeights + nKernelHeight);
+
+		ConvolutionSetReferenceWeights(pSConvolution);
+
+		bKernelSet =		ConvolutionValidateLocalMemory(pSConvolution)
+						&&	pSConvolution->mpRowWeights->Write(nKernelWidth * kWeightSize,
+															   &pSConvolution->maRowWeights[0])
+						&&	pSConvolution->mpColumnWeights->Write(nKernelHeight * kWeightSize,
+																  &pSConvolution->maColumnWeights[0]);
+	} // if
+
+	return( bKernelSet );
+} // ConvolutionSetSeparableKernel
+
+//---------------------------------------------------------------------------
+
+static bool ConvolutionSetBoxKernel(const cl_int nKernelWidth,
+									const cl_int nKernelHeight,
+									ConvolutionStruct *pSConvolution)
+{
+	bool bKernelSet = false;
+
+	const cl_int nDivisor = nKernelWidth * nKernelHeight;
+
+	if( ConvolutionValidateKernelSize(nKernelWidth, nKernelHeight, nDivisor) )
+	{
+		pSConvolution->mnType         = kConvolutionTypeBox;
+		pSConvolution->mnKernelWidth  = nKernelWidth;
+		pSConvolution->mnKernelHeight = nKernelHeight;
+		pSConvolution->mnDivisor      = nDivisor;
+
+		ConvolutionSetReferenceWeights(pSConvolution);
+
+		bKernelSet = ConvolutionValidateLocalMemory(pSConvolution);
+	} // if
+
+	return( bKernelSet );
+} // ConvolutionSetBoxKernel
+
+//---------------------------------------------------------------------------
+//
+// An integer Gaussian is the binomial row of order 2r along each axis, so
+// the 2D divisor is 2^(4r).  With r <= 5 the largest sum, 255 * 2^20,
+// still fits in the 32-bit accumulators.
+//
+//---------------------------------------------------------------------------
+
+static bool ConvolutionSetGaussianKernel(const cl_int nRadius,
+										 ConvolutionStruct *pSConvolution)
+{
+	bool bKernelSet = false;
+
+	if( ( nRadius > 0 ) && ( nRadius <= kMaxGaussRadius ) )
+	{
+		const cl_int nTaps = 2 * nRadius + 1;
+
+		std::vector<cl_short> aWeights(nTaps, 0);
+
+		aWeights[0] = 1;
+
+		cl_int i;
+		cl_int j;
+
+		for( i = 1; i < nTaps; ++i )
+		{
+			for( j = i; j > 0; --j )
+			{
+				aWeights[j] += aWeights[j - 1];
+			} // for
+		} // for
+
+		bKernelSet = ConvolutionSetSeparableKernel(&aWeights[0],
+												   nTaps,
+												   &aWeights[0],
+												   nTaps,
+												   1 << ( 4 * nRadius ),
+												   pSConvolution);
+	} // if
+	else
+	{
+		std::cerr << ">> ERROR: Convolution - Gaussian radius must be in [1, " << kMaxGaussRadius << "]!" << std::endl;
+	} // else
+
+	return( bKernelSet );
+} // ConvolutionSetGaussianKernel
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#pragma mark -
+#pragma mark Private - Compute
+
+//---------------------------------------------------------------------------
+//
+// Bind a cl_mem object as a kernel argument.
+//
+//---------------------------------------------------------------------------
+
+static inline bool ConvolutionBindMemory(const cl_uint nParamIndex,
+										 const OpenCL::Buffer *pBuffer,
+										 ConvolutionStruct *pSConvolution)
+{
+	cl_mem pMem = pBuffer->GetBuffer();
+
+	return( pSConvolution->mpKernel->BindParameter(nParamIndex, sizeof(cl_mem), &pMem) );
+} // ConvolutionBindMemory
+
+//---------------------------------------------------------------------------
+
+static inline bool ConvolutionBindInteger(const cl_uint nParamIndex,
+										  const cl_int nValue,
+										  ConvolutionStruct *pSConvolution)
+{
+	return( pSConvolution->mpKernel->BindParameter(nParamIndex, sizeof(cl_int), &nValue) );
+} // ConvolutionBindInteger
+
+//---------------------------------------------------------------------------
+//
+// The row sum of a row lying entirely outside the image.
+//
+//---------------------------------------------------------------------------
+
+static cl_int4 ConvolutionBackgroundSum(const ConvolutionStruct *pSConvolution)
+{
+	cl_int nWeightSum = 0;
+
+	if( pSConvolution->mnType == kConvolutionTypeBox )
+	{
+		nWeightSum = pSConvolution->mnKernelWidth;
+	} // if
+	else
+	{
+		cl_int kx;
+
+		for( kx = 0; kx < pSConvolution->mnKernelWidth; ++kx )
+		{
+			nWeightSum += pSConvolution->maRowWeights[kx];
+		} // for
+	} // else
+
+	cl_int4 nBackgroundSum;
+
+	cl_int i;
+
+	for( i = 0; i < 4; ++i )
+	{
+		nBackgroundSum.s[i] = pSConvolution->maBackground.s[i] * nWeightSum;
+	} // for
+
+	return( nBackgroundSum );
+} // ConvolutionBackgroundSum
+
+//---------------------------------------------------------------------------
+
+static bool ConvolutionExecute(const std::string &rKernelName,
+							   const size_t nLocalMemSize,
+							   ConvolutionStruct *pSConvolution)
+{
+	const size_t aLocalWorkSize[2]  = { pSConvolution->mnTileWidth, pSConvolution->mnTileHeight };
+	const size_t aGlobalWorkSize[2] =
+	{
+		ConvolutionRoundUp(pSConvolution->mnWidth,  pSConvolution->mnTileWidth),
+		ConvolutionRoundUp(pSConvolution->mnHeight, pSConvolution->mnTileHeight)
+	};
+
+	OpenCL::Kernel *pKernel = pSConvolution->mpKernel;
+
+	bool bExecuted = pKernel->Acquire(rKernelName) && pKernel->SetWorkDimension(2);
+
+	if( bExecuted )
+	{
+		const cl_int nWidth  = (cl_int)pSConvolution->mnWidth;
+		const cl_int nHeight = (cl_int)pSConvolution->mnHeight;
+
+		if( rKernelName == "Convolve2D" )
+		{
+			bExecuted =		ConvolutionBindMemory(0, pSConvolution->mpSrc, pSConvolution)
+						&&	ConvolutionBindMemory(1, pSConvolution->mpDst, pSConvolution)
+						&&	ConvolutionBindMemory(2, pSConvolution->mpWeights, pSConvolution)
+						&&	pKernel->BindParameter(3, nLocalMemSize)
+						&&	ConvolutionBindInteger(4, nWidth, pSConvolution)
+						&&	ConvolutionBindInteger(5, nHeight, pSConvolution)
+						&&	ConvolutionBindInteger(6, pSConvolution->mnKernelWidth, pSConvolution)
+						&&	ConvolutionBindInteger(7, pSConvolution->mnKernelHeight, pSConvolution)
+						&&	ConvolutionBindInteger(8, pSConvolution->mnDivisor, pSConvolution)
+						&&	pKernel->BindParameter(9, sizeof(cl_int4), &pSConvolution->maBackground);
+		} // if
+		else if( rKernelName == "ConvolveRows" )
+		{
+			bExecuted =		ConvolutionBindMemory(0, pSConvolution->mpSrc, pSConvolution)
+						&&	ConvolutionBindMemory(1, pSConvolution->mpSums, pSConvolution)
+						&&	ConvolutionBindMemory(2, pSConvolution->mpRowWeights, pSConvolution)
+						&&	pKernel->BindParameter(3, nLocalMemSize)
+						&&	ConvolutionBindInteger(4, nWidth, pSConvolution)
+						&&	ConvolutionBindInteger(5, nHeight, pSConvolution)
+						&&	ConvolutionBindInteger(6, pSConvolution->mnKernelWidth, pSConvolution)
+						&&	pKernel->BindParameter(7, sizeof(cl_int4), &pSConvolution->maBackground);
+		} // else if
+		else if( rKernelName == "ConvolveColumns" )
+		{
+			cl_int4 nBackgroundSum = ConvolutionBackgroundSum(pSConvolution);
+
+			bExecuted =		ConvolutionBindMemory(0, pSConvolution->mpSums, pSConvolution)
+						&&	ConvolutionBindMemory(1, pSConvolution->mpDst, pSConvolution)
+						&&	ConvolutionBindMemory(2, pSConvolution->mpColumnWeights, pSConvolution)
+						&&	pKernel->BindParameter(3, nLocalMemSize)
+						&&	ConvolutionBindInteger(4, nWidth, pSConvolution)
+						&&	ConvolutionBindInteger(5, nHeight, pSConvolution)
+						&&	ConvolutionBindInteger(6, pSConvolution->mnKernelHeight, pSConvolution)
+						&&	ConvolutionBindInteger(7, pSConvolution->mnDivisor, pSConvolution)
+						&&	pKernel->BindParameter(8, sizeof(cl_int4), &nBackgroundSum);
+		} // else if
+		else if( rKernelName == "BoxRows" )
+		{
+			bExecuted =		ConvolutionBindMemory(0, pSConvolution->mpSrc, pSConvolution)
+						&&	ConvolutionBindMemory(1, pSConvolution->mpSums, pSConvolution)
+						&&	pKernel->BindParameter(2, nLocalMemSize)
+						&&	ConvolutionBindInteger(3, nWidth, pSConvolution)
+						&&	ConvolutionBindInteger(4, nHeight, pSConvolution)
+						&&	ConvolutionBindInteger(5, pSConvolution->mnKernelWidth, pSConvolution)
+						&&	pKernel->BindParameter(6, sizeof(cl_int4), &pSConvolution->maBackground);
+		} // else if
+		else
+		{
+			cl_int4 nBackgroundSum = ConvolutionBackgroundSum(pSConvolution);
+
+			bExecuted =		ConvolutionBindMemory(0, pSConvolution->mpSums, pSConvolution)
+						&&	ConvolutionBindMemory(1, pSConvolution->mpDst, pSConvolution)
+						&&	pKernel->BindParameter(2, nLocalMemSize)
+						&&	ConvolutionBindInteger(3, nWidth, pSConvolution)
+						&&	ConvolutionBindInteger(4, nHeight, pSConvolution)
+						&&	ConvolutionBindInteger(5, pSConvolution->mnKernelHeight, pSConvolution)
+						&&	ConvolutionBindInteger(6, pSConvolution->mnDivisor, pSConvolution)
+						&&	pKernel->BindParameter(7, sizeof(cl_int4), &nBackgroundSum);
+		} // else
+
+		if( bExecuted )
+		{
+			bExecuted = pKernel->Execute(NULL, aGlobalWorkSize, aLocalWorkSize);
+		} // if
+	} // if
+
+	return( bExecuted );
+} // ConvolutionExecute
+
+//---------------------------------------------------------------------------
+
+static bool ConvolutionCompute(OpenCL::Program *pProgram,
+							   const void *pSrc,
+							   void *pDst,
+							   ConvolutionStruct *pSConvolution)
+{
+	bool bComputed = false;
+
+	if( pSConvolution->mbAcquired && ( pSConvolution->mnKernelWidth > 0 ) )
+	{
+		const size_t nTileWidth  = pSConvolution->mnTileWidth;
+		const size_t nTileHeight = pSConvolution->mnTileHeight;
+		const size_t nHaloWidth  = pSConvolution->mnKernelWidth  - 1;
+		const size_t nHaloHeight = pSConvolution->mnKernelHeight - 1;
+
+		const size_t nImageSize = pSConvolution->mnWidth * pSConvolution->mnHeight * kPixelSize;
+
+		bComputed = pSConvolution->mpSrc->Write(nImageSize, pSrc);
+
+		if( bComputed )
+		{
+			switch( pSConvolution->mnType )
+			{
+				case kConvolutionType2D:
+					bComputed = ConvolutionExecute("Convolve2D",
+												   ( nTileWidth + nHaloWidth ) * ( nTileHeight + nHaloHeight ) * kSumSize,
+												   pSConvolution);
+					break;
+
+				case kConvolutionTypeSeparable:
+					bComputed =		ConvolutionExecute("ConvolveRows",
+													   ( nTileWidth + nHaloWidth ) * nTileHeight * kSumSize,
+													   pSConvolution)
+								&&	ConvolutionExecute("ConvolveColumns",
+													   nTileWidth * ( nTileHeight + nHaloHeight ) * kSumSize,
+													   pSConvolution);
+					break;
+
+				case kConvolutionTypeBox:
+					bComputed =		ConvolutionExecute("BoxRows",
+													   ( nTileWidth + nHaloWidth ) * nTileHeight * kSumSize,
+													   pSConvolution)
+								&&	ConvolutionExecute("BoxColumns",
+													   nTileWidth * ( nTileHeight + nHaloHeight ) * kSumSize,
+													   pSConvolution);
+					break;
+			} // switch
+		} // if
+
+		if( bComputed )
+		{
+			pProgram->Finish();
+
+			if( pDst != NULL )
+			{
+				bComputed = pSConvolution->mpDst->Read(nImageSize, pDst);
+			} // if
+		} // if
+	} // if
+	else
+	{
+		std::cerr << ">> ERROR: Convolution - Acquire an image size and set a kernel before computing!" << std::endl;
+	} // else
+
+	return( bComputed );
+} // ConvolutionCompute
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#pragma mark -
+#pragma mark Private - Verify
+
+//---------------------------------------------------------------------------
+//
+// Scalar reference of vImageConvolve_ARGB8888 with background color fill,
+// used to check the device results bit for bit.
+//
+//---------------------------------------------------------------------------
+
+static bool ConvolutionVerify(const cl_uchar *pSrc,
+							  const cl_uchar *pDst,
+							  const ConvolutionStruct *pSConvolution)
+{
+	const cl_int nWidth        = (cl_int)pSConvolution->mnWidth;
+	const cl_int nHeight       = (cl_int)pSConvolution->mnHeight;
+	const cl_int nKernelWidth  = pSConvolution->mnKernelWidth;
+	const cl_int nKernelHeight = pSConvolution->mnKernelHeight;
+
+	cl_int x;
+	cl_int y;
+
+	for( y = 0; y < nHeight; ++y )
+	{
+		for( x = 0; x < nWidth; ++x )
+		{
+			cl_int aSum[4] = { 0, 0, 0, 0 };
+
+			cl_int kx;
+			cl_int ky;
+			cl_int c;
+
+			for( ky = 0; ky < nKernelHeight; ++ky )
+			{
+				const cl_int sy = y + ky - nKernelHeight / 2;
+
+				for( kx = 0; kx < nKernelWidth; ++kx )
+				{
+					const cl_int sx      = x + kx - nKernelWidth / 2;
+					const cl_int nWeight = pSConvolution->maReference[ky * nKernelWidth + kx];
+
+					bool bInside = ( sx >= 0 ) && ( sx < nWidth ) && ( sy >= 0 ) && ( sy < nHeight );
+
+					for( c = 0; c < 4; ++c )
+					{
+						cl_int nPixel = bInside ? pSrc[( sy * nWidth + sx ) * 4 + c] : pSConvolution->maBackground.s[c];
+
+						aSum[c] += nPixel * nWeight;
+					} // for
+				} // for
+			} // for
+
+			for( c = 0; c < 4; ++c )
+			{
+				cl_uchar nExpected = ConvolutionSaturate(aSum[c] / pSConvolution->mnDivisor);
+				cl_uchar nActual   = pDst[( y * nWidth + x ) * 4 + c];
+
+				if( nExpected != nActual )
+				{
+					std::cerr	<< ">> ERROR: Convolution - Mismatch at ( "
+								<< x << ", " << y << " ) channel " << c
+								<< ": expected " << (cl_int)nExpected
+								<< ", got " << (cl_int)nActual
+								<< std::endl;
+
+					return( false );
+				} // if
+			} // for
+		} // for
+	} // for
+
+	return( true );
+} // ConvolutionVerify
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#pragma mark -
+#pragma mark Public - Constructors
+
+//---------------------------------------------------------------------------
+
+Convolution::Convolution(const std::string &rProgramSource,
+						 const size_t nTileWidth,
+						 const size_t nTileHeight)
+	: OpenCL::Program(rProgramSource)
+{
+	mpSConvolution = ConvolutionCreate(this, nTileWidth, nTileHeight);
+} // Constructor
+
+//---------------------------------------------------------------------------
+
+#pragma mark -
+#pragma mark Public - Destructor
+
+//---------------------------------------------------------------------------
+
+Convolution::~Convolution()
+{
+	ConvolutionRelease(mpSConvolution);
+} // Destructor
+
+//---------------------------------------------------------------------------
+
+#pragma mark -
+#pragma mark Public - Utilities
+
+//---------------------------------------------------------------------------
+//
+// Acquire device buffers for images of the given size.  May be called
+// again to change the image size.
+//
+//---------------------------------------------------------------------------
+
+bool Convolution::Acquire(const size_t nWidth, const size_t nHeight)
+{
+	return( ConvolutionCreateImageBuffers(this, nWidth, nHeight, mpSConvolution) );
+} // Acquire
+
+//---------------------------------------------------------------------------
+
+bool Convolution::SetKernel(const cl_short *pWeights,
+							const cl_int nKernelWidth,
+							const cl_int nKernelHeight,
+							const cl_int nDivisor)
+{
+	return( ConvolutionSetKernel(pWeights, nKernelWidth, nKernelHeight, nDivisor, mpSConvolution) );
+} // SetKernel
+
+//---------------------------------------------------------------------------
+
+bool Convolution::SetSeparableKernel(const cl_short *pRowWeights,
+									 const cl_int nKernelWidth,
+									 const cl_short *pColumnWeights,
+									 const cl_int nKernelHeight,
+									 const cl_int nDivisor)
+{
+	return( ConvolutionSetSeparableKernel(pRowWeights,
+										  nKernelWidth,
+										  pColumnWeights,
+										  nKernelHeight,
+										  nDivisor,
+										  mpSConvolution) );
+} // SetSeparableKernel
+
+//---------------------------------------------------------------------------
+
+bool Convolution::SetBoxKernel(const cl_int nKernelWidth,
+							   const cl_int nKernelHeight)
+{
+	return( ConvolutionSetBoxKernel(nKernelWidth, nKernelHeight, mpSConvolution) );
+} // SetBoxKernel
+
+//---------------------------------------------------------------------------
+
+bool Convolution::SetGaussianKernel(const cl_int nRadius)
+{
+	return( ConvolutionSetGaussianKernel(nRadius, mpSConvolution) );
+} // SetGaussianKernel
+
+//---------------------------------------------------------------------------
+//
+// Four bytes in the same channel order as the image, as with the vImage
+// backgroundColor parameter.
+//
+//---------------------------------------------------------------------------
+
+void Convolution::SetBackgroundColor(const cl_uchar *pColor)
+{
+	cl_int i;
+
+	for( i = 0; i < 4; ++i )
+	{
+		mpSConvolution->maBackground.s[i] = pColor[i];
+	} // for
+} // SetBackgroundColor
+
+//---------------------------------------------------------------------------
+//
+// Convolve a tightly packed width x height ARGB8888 image.  The result
+// stays on the device as well, so it may be copied into a texture.  Pass
+// NULL for the destination to skip the readback.
+//
+//---------------------------------------------------------------------------
+
+bool Convolution::Compute(const void *pSrc, void *pDst)
+{
+	return( ConvolutionCompute(this, pSrc, pDst, mpSConvolution) );
+} // Compute
+
+//---------------------------------------------------------------------------
+//
+// Copy the last result into a shared texture.  The texture's region must
+// match the acquired image size.
+//
+//---------------------------------------------------------------------------
+
+bool Convolution::Copy(OpenCL::Texture2D &rTexture2D)
+{
+	return( mpSConvolution->mbAcquired && rTexture2D.Copy(mpSConvolution->mpDst) );
+} // Copy
+
+//---------------------------------------------------------------------------
+
+bool Convolution::Verify(const void *pSrc, const void *pDst) const
+{
+	return( ConvolutionVerify((const cl_uchar *)pSrc, (const cl_uchar *)pDst, mpSConvolution) );
+} // Verify
+
+//---------------------------------------------------------------------------
+
+#pragma mark -
+#pragma mark Public - Accessors
+
+//---------------------------------------------------------------------------
+
+const size_t Convolution::GetWidth() const
+{
+	return( mpSConvolution->mnWidth );
+} // GetWidth
+
+//---------------------------------------------------------------------------
+
+const size_t Convolution::GetHeight() const
+{
+	return( mpSConvolution->mnHeight );
+} // GetHeight
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
@@ -0,0 +1,112 @@
+//---------------------------------------------------------------------------
+//
+//	File: Convolution.h
+//
+//  Abstract: A class to convolve ARGB8888 images using tiled OpenCL kernels
+//
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//---------------------------------------------------------------------------
+
+#ifndef _CONVOLUTION_H_
+#define _CONVOLUTION_H_
+
+#ifdef __cplusplus
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#import <string>
+
+#import "OpenCLKit.h"
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+class ConvolutionStruct;
+
+//---------------------------------------------------------------------------
+//
+// Convolves interleaved 8-bit ARGB images with the same semantics as
+// vImageConvolve_ARGB8888 using kvImageBackgroundColorFill (see the notes
+// at the top of ConvolutionKernels.cl).
+//
+// Usage:
+//
+//	Convolution convolution("ConvolutionKernels.cl", 16, 16);
+//
+//	if( convolution.Acquire(width, height) )
+//	{
+//		convolution.SetGaussianKernel(2);
+//		convolution.Compute(pSrc, pDst);
+//	} // if
+//
+// Generic kernels run as a single tiled 2D pass.  Separable, box, and
+// Gaussian kernels run as a row pass followed by a column pass through a
+// 32-bit intermediate buffer.
+//
+//---------------------------------------------------------------------------
+
+class Convolution : public OpenCL::Program
+{
+	public:
+		Convolution(const std::string &rProgramSource,
+					const size_t nTileWidth,
+					const size_t nTileHeight);
+
+		~Convolution();
+
+		bool Acquire(const size_t nWidth, const size_t nHeight);
+
+		bool SetKernel(const cl_short *pWeights,
+					   const cl_int nKernelWidth,
+					   const cl_int nKernelHeight,
+					   const cl_int nDivisor);
+
+		bool SetSeparableKernel(const cl_short *pRowWeights,
+								const cl_int nKernelWidth,
+								const cl_short *pColumnWeights,
+								const cl_int nKernelHeight,
+								const cl_int nDivisor);
+
+		bool SetBoxKernel(const cl_int nKernelWidth,
+						  const cl_int nKernelHeight);
+
+		bool SetGaussianKernel(const cl_int nRadius);
+
+		void SetBackgroundColor(const cl_uchar *pColor);
+
+		bool Compute(const void *pSrc, void *pDst);
+
+		bool Copy(OpenCL::Texture2D &rTexture2D);
+
+		bool Verify(const void *pSrc, const void *pDst) const;
+
+		const size_t GetWidth()  const;
+		const size_t GetHeight() const;
+
+	private:
+		ConvolutionStruct  *mpSConvolution;
+};
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#endif
+
+#endif
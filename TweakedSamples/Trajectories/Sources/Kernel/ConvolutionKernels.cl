@@ -0,0 +1,377 @@
+//---------------------------------------------------------------------------
+//
+//	File: ConvolutionKernels.cl
+//
+//  Abstract: Tiled 2D convolution kernels for interleaved 8-bit, 4 channel
+//            (ARGB8888) images with vImage compatible integer semantics
+//
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// The tile size is the local work size, and is supplied by the host as
+// build options (e.g. "-DTILE_WIDTH=16 -DTILE_HEIGHT=16").  Every work
+// group first copies its tile, plus a halo of half the kernel size on
+// each side, into local memory and then convolves out of local memory.
+//
+// The arithmetic matches vImageConvolve_ARGB8888 with the flag
+// kvImageBackgroundColorFill:
+//
+// (1) the kernel is centered at ( width / 2, height / 2 ) and is applied
+//     without rotation, kernel[0] weighs the top left neighbor,
+// (2) source pixels outside of the image take the background color,
+// (3) products are accumulated as 32-bit integers per channel,
+// (4) the sum is divided by the divisor (truncating toward zero), and
+// (5) the quotient is saturated to [0, 255].
+//
+// The separable and box kernels keep the intermediate sums of the row
+// pass as 32-bit integers, and only divide once in the column pass, so
+// their output is bit-exact with the equivalent 2D kernel.
+//
+//---------------------------------------------------------------------------
+
+#ifndef TILE_WIDTH
+	#define TILE_WIDTH 16
+#endif
+
+#ifndef TILE_HEIGHT
+	#define TILE_HEIGHT 16
+#endif
+
+//---------------------------------------------------------------------------
+//
+// Fetch a source pixel, or the background color when outside the image.
+//
+//---------------------------------------------------------------------------
+
+inline int4 ConvolutionFetch(__global const uchar4 *pSrc,
+							 const int x,
+							 const int y,
+							 const int nWidth,
+							 const int nHeight,
+							 const int4 nBackground)
+{
+	int4 nPixel = nBackground;
+
+	if( ( x >= 0 ) && ( x < nWidth ) && ( y >= 0 ) && ( y < nHeight ) )
+	{
+		nPixel = convert_int4( pSrc[y * nWidth + x] );
+	} // if
+
+	return( nPixel );
+} // ConvolutionFetch
+
+//---------------------------------------------------------------------------
+//
+// Fetch a row pass sum, or the row sum of the background color when the
+// row is outside the image.
+//
+//---------------------------------------------------------------------------
+
+inline int4 ConvolutionFetchSum(__global const int4 *pSrc,
+								const int x,
+								const int y,
+								const int nWidth,
+								const int nHeight,
+								const int4 nBackgroundSum)
+{
+	int4 nSum = nBackgroundSum;
+
+	if( ( x < nWidth ) && ( y >= 0 ) && ( y < nHeight ) )
+	{
+		nSum = pSrc[y * nWidth + x];
+	} // if
+
+	return( nSum );
+} // ConvolutionFetchSum
+
+//---------------------------------------------------------------------------
+
+inline uchar4 ConvolutionPack(const int4 nSum, const int nDivisor)
+{
+	return( convert_uchar4_sat( nSum / nDivisor ) );
+} // ConvolutionPack
+
+//---------------------------------------------------------------------------
+//
+// Generic N x M convolution.  The local tile holds
+// ( TILE_WIDTH + N - 1 ) x ( TILE_HEIGHT + M - 1 ) pixels.
+//
+//---------------------------------------------------------------------------
+
+__kernel void Convolve2D(__global const uchar4 *pSrc,
+						 __global uchar4 *pDst,
+						 __constant short *pWeights,
+						 __local int4 *pTile,
+						 const int nWidth,
+						 const int nHeight,
+						 const int nKernelWidth,
+						 const int nKernelHeight,
+						 const int nDivisor,
+						 const int4 nBackground)
+{
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int gx = get_global_id(0);
+	const int gy = get_global_id(1);
+
+	const int nTileWidth  = TILE_WIDTH  + nKernelWidth  - 1;
+	const int nTileHeight = TILE_HEIGHT + nKernelHeight - 1;
+
+	const int nOriginX = get_group_id(0) * TILE_WIDTH  - nKernelWidth  / 2;
+	const int nOriginY = get_group_id(1) * TILE_HEIGHT - nKernelHeight / 2;
+
+	int tx;
+	int ty;
+
+	for( ty = ly; ty < nTileHeight; ty += TILE_HEIGHT )
+	{
+		for( tx = lx; tx < nTileWidth; tx += TILE_WIDTH )
+		{
+			pTile[ty * nTileWidth + tx] = ConvolutionFetch(pSrc,
+														   nOriginX + tx,
+														   nOriginY + ty,
+														   nWidth,
+														   nHeight,
+														   nBackground);
+		} // for
+	} // for
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if( ( gx < nWidth ) && ( gy < nHeight ) )
+	{
+		int4 nSum = (int4)(0);
+
+		int kx;
+		int ky;
+
+		for( ky = 0; ky < nKernelHeight; ++ky )
+		{
+			__local const int4 *pRow = pTile + ( ly + ky ) * nTileWidth + lx;
+
+			__constant const short *pKRow = pWeights + ky * nKernelWidth;
+
+			for( kx = 0; kx < nKernelWidth; ++kx )
+			{
+				nSum += pRow[kx] * (int)pKRow[kx];
+			} // for
+		} // for
+
+		pDst[gy * nWidth + gx] = ConvolutionPack(nSum, nDivisor);
+	} // if
+} // Convolve2D
+
+//---------------------------------------------------------------------------
+//
+// Row pass of a separable convolution.  Writes the undivided 32-bit sums
+// so that the column pass can apply the divisor exactly once.
+//
+//---------------------------------------------------------------------------
+
+__kernel void ConvolveRows(__global const uchar4 *pSrc,
+						   __global int4 *pDst,
+						   __constant short *pWeights,
+						   __local int4 *pTile,
+						   const int nWidth,
+						   const int nHeight,
+						   const int nKernelWidth,
+						   const int4 nBackground)
+{
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int gx = get_global_id(0);
+	const int gy = get_global_id(1);
+
+	const int nTileWidth = TILE_WIDTH + nKernelWidth - 1;
+	const int nOriginX   = get_group_id(0) * TILE_WIDTH - nKernelWidth / 2;
+
+	__local int4 *pRow = pTile + ly * nTileWidth;
+
+	int tx;
+
+	for( tx = lx; tx < nTileWidth; tx += TILE_WIDTH )
+	{
+		pRow[tx] = ConvolutionFetch(pSrc, nOriginX + tx, gy, nWidth, nHeight, nBackground);
+	} // for
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if( ( gx < nWidth ) && ( gy < nHeight ) )
+	{
+		int4 nSum = (int4)(0);
+
+		int kx;
+
+		for( kx = 0; kx < nKernelWidth; ++kx )
+		{
+			nSum += pRow[lx + kx] * (int)pWeights[kx];
+		} // for
+
+		pDst[gy * nWidth + gx] = nSum;
+	} // if
+} // ConvolveRows
+
+//---------------------------------------------------------------------------
+//
+// Column pass of a separable convolution.  Rows above and below the image
+// were never produced by the row pass; they consist entirely of background
+// pixels, so their row sum is the background times the sum of the row
+// weights, which the host supplies as nBackgroundSum.
+//
+//---------------------------------------------------------------------------
+
+__kernel void ConvolveColumns(__global const int4 *pSrc,
+							  __global uchar4 *pDst,
+							  __constant short *pWeights,
+							  __local int4 *pTile,
+							  const int nWidth,
+							  const int nHeight,
+							  const int nKernelHeight,
+							  const int nDivisor,
+							  const int4 nBackgroundSum)
+{
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int gx = get_global_id(0);
+	const int gy = get_global_id(1);
+
+	const int nTileHeight = TILE_HEIGHT + nKernelHeight - 1;
+	const int nOriginY    = get_group_id(1) * TILE_HEIGHT - nKernelHeight / 2;
+
+	int ty;
+
+	for( ty = ly; ty < nTileHeight; ty += TILE_HEIGHT )
+	{
+		pTile[ty * TILE_WIDTH + lx] = ConvolutionFetchSum(pSrc, gx, nOriginY + ty, nWidth, nHeight, nBackgroundSum);
+	} // for
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if( ( gx < nWidth ) && ( gy < nHeight ) )
+	{
+		int4 nSum = (int4)(0);
+
+		int ky;
+
+		for( ky = 0; ky < nKernelHeight; ++ky )
+		{
+			nSum += pTile[( ly + ky ) * TILE_WIDTH + lx] * (int)pWeights[ky];
+		} // for
+
+		pDst[gy * nWidth + gx] = ConvolutionPack(nSum, nDivisor);
+	} // if
+} // ConvolveColumns
+
+//---------------------------------------------------------------------------
+//
+// Row pass of a box filter, a separable convolution with unit weights.
+//
+//---------------------------------------------------------------------------
+
+__kernel void BoxRows(__global const uchar4 *pSrc,
+					  __global int4 *pDst,
+					  __local int4 *pTile,
+					  const int nWidth,
+					  const int nHeight,
+					  const int nKernelWidth,
+					  const int4 nBackground)
+{
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int gx = get_global_id(0);
+	const int gy = get_global_id(1);
+
+	const int nTileWidth = TILE_WIDTH + nKernelWidth - 1;
+	const int nOriginX   = get_group_id(0) * TILE_WIDTH - nKernelWidth / 2;
+
+	__local int4 *pRow = pTile + ly * nTileWidth;
+
+	int tx;
+
+	for( tx = lx; tx < nTileWidth; tx += TILE_WIDTH )
+	{
+		pRow[tx] = ConvolutionFetch(pSrc, nOriginX + tx, gy, nWidth, nHeight, nBackground);
+	} // for
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if( ( gx < nWidth ) && ( gy < nHeight ) )
+	{
+		int4 nSum = (int4)(0);
+
+		int kx;
+
+		for( kx = 0; kx < nKernelWidth; ++kx )
+		{
+			nSum += pRow[lx + kx];
+		} // for
+
+		pDst[gy * nWidth + gx] = nSum;
+	} // if
+} // BoxRows
+
+//---------------------------------------------------------------------------
+//
+// Column pass of a box filter.
+//
+//---------------------------------------------------------------------------
+
+__kernel void BoxColumns(__global const int4 *pSrc,
+						 __global uchar4 *pDst,
+						 __local int4 *pTile,
+						 const int nWidth,
+						 const int nHeight,
+						 const int nKernelHeight,
+						 const int nDivisor,
+						 const int4 nBackgroundSum)
+{
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int gx = get_global_id(0);
+	const int gy = get_global_id(1);
+
+	const int nTileHeight = TILE_HEIGHT + nKernelHeight - 1;
+	const int nOriginY    = get_group_id(1) * TILE_HEIGHT - nKernelHeight / 2;
+
+	int ty;
+
+	for( ty = ly; ty < nTileHeight; ty += TILE_HEIGHT )
+	{
+		pTile[ty * TILE_WIDTH + lx] = ConvolutionFetchSum(pSrc, gx, nOriginY + ty, nWidth, nHeight, nBackgroundSum);
+	} // for
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if( ( gx < nWidth ) && ( gy < nHeight ) )
+	{
+		int4 nSum = (int4)(0);
+
+		int ky;
+
+		for( ky = 0; ky < nKernelHeight; ++ky )
+		{
+			nSum += pTile[( ly + ky ) * TILE_WIDTH + lx];
+		} // for
+
+		pDst[gy * nWidth + gx] = ConvolutionPack(nSum, nDivisor);
+	} // if
+} // BoxColumns
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
@@ -0,0 +1,550 @@
+//---------------------------------------------------------------------------
+//
+//	File: ConvolutionBenchmark.cpp
+//
+//  Abstract: A command line tool to verify and time the Convolver's CPU
+//            engine (plain C and SIMD) against the tiled OpenCL kernels
+//            across image and kernel sizes, reported as CSV
+//
+//  Copyright (c) 2013 Gala Factory Software, LLC. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+#import <atomic>
+#import <cstdlib>
+#import <cstring>
+#import <iostream>
+#import <new>
+#import <vector>
+
+#import <mach/mach_time.h>
+#import <sys/resource.h>
+
+//---------------------------------------------------------------------------
+
+#import "Convolution.h"
+#import "GFSConvolutionEngine.h"
+#import "GFSMemoryAccounting.h"
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+static const size_t kTileWidth     = 16;
+static const size_t kTileHeight    = 16;
+static const size_t kMinImageSize  = 256;
+static const size_t kMaxImageSize  = 16384;
+static const size_t kMaxVerifySize = 512;
+static const size_t kMaxIterations = 10;
+static const double kMinSeconds    = 0.5;
+
+//---------------------------------------------------------------------------
+//
+// Every C++ allocation goes through here so the bytes allocated by each
+// call can be reported.  This sees the CPU engine's buffers and the host
+// side of the OpenCL kit, but not what the OpenCL driver allocates.
+//
+//---------------------------------------------------------------------------
+
+static std::atomic<size_t> gnAllocatedBytes(0);
+
+void *operator new(size_t nSize)
+{
+	gnAllocatedBytes += nSize;
+
+	void *pMemory = std::malloc(nSize ? nSize : 1);
+
+	if( pMemory == NULL )
+	{
+		throw std::bad_alloc();
+	} // if
+
+	return( pMemory );
+} // operator new
+
+void operator delete(void *pMemory) noexcept
+{
+	std::free(pMemory);
+} // operator delete
+
+//---------------------------------------------------------------------------
+//
+// The kernels used by the Convolver sample.
+//
+//---------------------------------------------------------------------------
+
+static const cl_short kEdgeDetect[9] =
+{
+	-1, -1, -1,
+	-1,  8, -1,
+	-1, -1, -1
+};
+
+//---------------------------------------------------------------------------
+
+enum BenchmarkKernel
+{
+	kBenchmarkEdgeDetect = 0,
+	kBenchmarkBlur,
+	kBenchmarkMotionBlur,
+	kBenchmarkGaussian,
+	kBenchmarkKernelCount
+};
+
+typedef enum BenchmarkKernel BenchmarkKernel;
+
+static const char *kBenchmarkKernelNames[kBenchmarkKernelCount] =
+{
+	"edge 3x3",
+	"blur 3x3",
+	"motion 25x1",
+	"gaussian 9x9"
+};
+
+//---------------------------------------------------------------------------
+
+enum BenchmarkBackend
+{
+	kBackendScalar = 0,
+	kBackendSIMD,
+	kBackendOpenCL,
+	kBackendCount
+};
+
+typedef enum BenchmarkBackend BenchmarkBackend;
+
+static const char *kBackendNames[kBackendCount] =
+{
+	"scalar",
+	"simd",
+	"opencl"
+};
+
+//---------------------------------------------------------------------------
+
+struct BenchmarkWeights
+{
+	std::vector<int16_t>  maWeights;
+	uint32_t              mnWidth;
+	uint32_t              mnHeight;
+	int32_t               mnDivisor;
+};
+
+typedef struct BenchmarkWeights BenchmarkWeights;
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// The whole 2D kernel, for the CPU engine.  Must match what
+// BenchmarkSetKernel gives the OpenCL kit.
+//
+//---------------------------------------------------------------------------
+
+static void BenchmarkGetWeights(const BenchmarkKernel nKernel,
+								BenchmarkWeights &rWeights)
+{
+	switch( nKernel )
+	{
+		case kBenchmarkEdgeDetect:
+			rWeights.maWeights.assign(kEdgeDetect, kEdgeDetect + 9);
+			rWeights.mnWidth   = 3;
+			rWeights.mnHeight  = 3;
+			rWeights.mnDivisor = 1;
+			break;
+
+		case kBenchmarkBlur:
+			rWeights.maWeights.assign(9, 1);
+			rWeights.mnWidth   = 3;
+			rWeights.mnHeight  = 3;
+			rWeights.mnDivisor = 9;
+			break;
+
+		case kBenchmarkMotionBlur:
+			rWeights.maWeights.assign(25, 1);
+			rWeights.mnWidth   = 25;
+			rWeights.mnHeight  = 1;
+			rWeights.mnDivisor = 25;
+			break;
+
+		case kBenchmarkGaussian:
+		default:
+		{
+			// binomial row of order 8, the same as SetGaussianKernel(4)
+			std::vector<int16_t> aRow(9, 0);
+
+			aRow[0] = 1;
+
+			size_t i;
+			size_t j;
+
+			for( i = 1; i < aRow.size(); ++i )
+			{
+				for( j = i; j > 0; --j )
+				{
+					aRow[j] += aRow[j - 1];
+				} // for
+			} // for
+
+			rWeights.maWeights.resize(81);
+			rWeights.mnWidth   = 9;
+			rWeights.mnHeight  = 9;
+			rWeights.mnDivisor = 1 << 16;
+
+			for( i = 0; i < 9; ++i )
+			{
+				for( j = 0; j < 9; ++j )
+				{
+					rWeights.maWeights[i * 9 + j] = aRow[i] * aRow[j];
+				} // for
+			} // for
+
+			break;
+		}
+	} // switch
+} // BenchmarkGetWeights
+
+//---------------------------------------------------------------------------
+
+static bool BenchmarkSetKernel(const BenchmarkKernel nKernel,
+							   Convolution &rConvolution)
+{
+	bool bKernelSet = false;
+
+	switch( nKernel )
+	{
+		case kBenchmarkEdgeDetect:
+			bKernelSet = rConvolution.SetKernel(kEdgeDetect, 3, 3, 1);
+			break;
+
+		case kBenchmarkBlur:
+			bKernelSet = rConvolution.SetBoxKernel(3, 3);
+			break;
+
+		case kBenchmarkMotionBlur:
+			bKernelSet = rConvolution.SetBoxKernel(25, 1);
+			break;
+
+		case kBenchmarkGaussian:
+			bKernelSet = rConvolution.SetGaussianKernel(4);
+			break;
+
+		default:
+			break;
+	} // switch
+
+	return( bKernelSet );
+} // BenchmarkSetKernel
+
+//---------------------------------------------------------------------------
+//
+// Runs the kernel through the CPU engine the same way GFSImageConvolver
+// does, splitting it into two 1D passes when that pays.
+//
+//---------------------------------------------------------------------------
+
+static bool BenchmarkConvolveCPU(const BenchmarkWeights &rWeights,
+								 const cl_uchar *pBackground,
+								 const size_t nSize,
+								 const cl_uchar *pSrc,
+								 cl_uchar *pDst,
+								 const uint32_t nFlags)
+{
+	GFSConvolutionBuffer src  = { (void *)pSrc, nSize, nSize, nSize * 4 };
+	GFSConvolutionBuffer dest = { pDst, nSize, nSize, nSize * 4 };
+
+	std::vector<int16_t> aRow(rWeights.mnWidth);
+	std::vector<int16_t> aColumn(rWeights.mnHeight);
+
+	GFSConvolutionError nErr;
+
+	if(    GFSConvolutionShouldSeparateKernel(&rWeights.maWeights[0], rWeights.mnWidth, rWeights.mnHeight)
+		&& GFSConvolutionSeparateKernel(&rWeights.maWeights[0], rWeights.mnWidth, rWeights.mnHeight, &aRow[0], &aColumn[0]) )
+	{
+		nErr = GFSConvolveSeparableARGB8888(&src, &dest, 0, 0,
+											&aRow[0], rWeights.mnWidth,
+											&aColumn[0], rWeights.mnHeight,
+											rWeights.mnDivisor, pBackground, nFlags);
+	} // if
+	else
+	{
+		nErr = GFSConvolveARGB8888(&src, &dest, 0, 0,
+								   &rWeights.maWeights[0], rWeights.mnWidth, rWeights.mnHeight,
+								   rWeights.mnDivisor, pBackground, nFlags);
+	} // else
+
+	return( nErr == GFSConvolutionNoError );
+} // BenchmarkConvolveCPU
+
+//---------------------------------------------------------------------------
+
+static bool BenchmarkConvolve(const BenchmarkBackend nBackend,
+							  const BenchmarkWeights &rWeights,
+							  const cl_uchar *pBackground,
+							  const size_t nSize,
+							  const cl_uchar *pSrc,
+							  cl_uchar *pDst,
+							  Convolution &rConvolution)
+{
+	bool bConvolved = false;
+
+	switch( nBackend )
+	{
+		case kBackendScalar:
+			bConvolved = BenchmarkConvolveCPU(rWeights, pBackground, nSize, pSrc, pDst,
+											  GFSConvolutionScalar | GFSConvolutionSingleThread);
+			break;
+
+		case kBackendSIMD:
+			bConvolved = BenchmarkConvolveCPU(rWeights, pBackground, nSize, pSrc, pDst,
+											  GFSConvolutionNoFlags);
+			break;
+
+		case kBackendOpenCL:
+			bConvolved = rConvolution.Compute(pSrc, pDst);
+			break;
+
+		default:
+			break;
+	} // switch
+
+	return( bConvolved );
+} // BenchmarkConvolve
+
+//---------------------------------------------------------------------------
+
+static double BenchmarkSeconds(const uint64_t nElapsed)
+{
+	static mach_timebase_info_data_t sTimebase = { 0, 0 };
+
+	if( sTimebase.denom == 0 )
+	{
+		mach_timebase_info(&sTimebase);
+	} // if
+
+	return( 1.0e-9 * (double)nElapsed * (double)sTimebase.numer / (double)sTimebase.denom );
+} // BenchmarkSeconds
+
+//---------------------------------------------------------------------------
+
+static size_t BenchmarkPeakResidentBytes()
+{
+	struct rusage sUsage;
+
+	std::memset(&sUsage, 0, sizeof(sUsage));
+
+	getrusage(RUSAGE_SELF, &sUsage);
+
+	// bytes on Mac OS X (kilobytes elsewhere)
+	return( (size_t)sUsage.ru_maxrss );
+} // BenchmarkPeakResidentBytes
+
+//---------------------------------------------------------------------------
+//
+// FNV-1a, to check every backend against the scalar result without
+// keeping another image around.
+//
+//---------------------------------------------------------------------------
+
+static uint64_t BenchmarkHash(const cl_uchar *pData, const size_t nSize)
+{
+	uint64_t nHash = 14695981039346656037ULL;
+
+	size_t i;
+
+	for( i = 0; i < nSize; ++i )
+	{
+		nHash ^= pData[i];
+		nHash *= 1099511628211ULL;
+	} // for
+
+	return( nHash );
+} // BenchmarkHash
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Usage: convolution-benchmark [largest image size]
+//
+// Writes one CSV row per backend, kernel, and image size to stdout.  The
+// scalar backend is the CPU engine's plain C path on one thread, simd is
+// the same engine with its SSE/AVX/NEON paths on every core.  Every result
+// is checked against the scalar one, which for small images is itself
+// checked against the OpenCL kit's host reference.
+//
+//---------------------------------------------------------------------------
+
+int main( int argc, char **argv )
+{
+	size_t nMaxImageSize = kMaxImageSize;
+
+	if( argc > 1 )
+	{
+		nMaxImageSize = (size_t)std::strtoul(argv[1], NULL, 10);
+	} // if
+
+	Convolution convolution("ConvolutionKernels.cl", kTileWidth, kTileHeight);
+
+	const cl_uchar aBackground[4] = { 255, 0, 0, 0 };
+
+	convolution.SetBackgroundColor(aBackground);
+
+	bool bPassed = true;
+
+	std::cout << "backend,kernel,width,height,iterations,ms,mpix_per_s,peak_rss_bytes,bytes_allocated_per_call,scratch_peak_bytes" << std::endl;
+
+	size_t nSize;
+
+	for( nSize = kMinImageSize; nSize <= nMaxImageSize; nSize *= 2 )
+	{
+		// the OpenCL device may not have room for the largest images, the
+		// CPU numbers are still worth having
+		bool bOpenCL = convolution.Acquire(nSize, nSize);
+
+		if( !bOpenCL )
+		{
+			std::cerr << ">> WARNING: no OpenCL buffers for " << nSize << " x " << nSize << ", skipping OpenCL!" << std::endl;
+		} // if
+
+		const size_t nImageSize = nSize * nSize * 4;
+
+		std::vector<cl_uchar> aSrc(nImageSize);
+		std::vector<cl_uchar> aDst(nImageSize);
+
+		size_t i;
+
+		for( i = 0; i < nImageSize; ++i )
+		{
+			aSrc[i] = (cl_uchar)random();
+		} // for
+
+		int nKernel;
+
+		for( nKernel = 0; nKernel < kBenchmarkKernelCount; ++nKernel )
+		{
+			BenchmarkWeights weights;
+
+			BenchmarkGetWeights((BenchmarkKernel)nKernel, weights);
+
+			uint64_t nExpected = 0;
+
+			int nBackend;
+
+			for( nBackend = 0; nBackend < kBackendCount; ++nBackend )
+			{
+				if( nBackend == kBackendOpenCL )
+				{
+					if( !bOpenCL )
+					{
+						continue;
+					} // if
+
+					if( !BenchmarkSetKernel((BenchmarkKernel)nKernel, convolution) )
+					{
+						bPassed = false;
+
+						continue;
+					} // if
+				} // if
+
+				// Warm up, and check the results
+
+				if( !BenchmarkConvolve((BenchmarkBackend)nBackend, weights, aBackground, nSize, &aSrc[0], &aDst[0], convolution) )
+				{
+					std::cerr << ">> ERROR: " << kBackendNames[nBackend] << " " << kBenchmarkKernelNames[nKernel] << " failed!" << std::endl;
+
+					bPassed = false;
+
+					continue;
+				} // if
+
+				uint64_t nHash = BenchmarkHash(&aDst[0], nImageSize);
+
+				if( nBackend == kBackendScalar )
+				{
+					nExpected = nHash;
+
+					// the kit's reference only knows the kernel it was last given
+					if(    ( nSize <= kMaxVerifySize )
+						&& bOpenCL
+						&& BenchmarkSetKernel((BenchmarkKernel)nKernel, convolution)
+						&& !convolution.Verify(&aSrc[0], &aDst[0]) )
+					{
+						std::cerr << ">> ERROR: scalar " << kBenchmarkKernelNames[nKernel] << " failed verification!" << std::endl;
+
+						bPassed = false;
+					} // if
+				} // if
+				else if( nHash != nExpected )
+				{
+					std::cerr << ">> ERROR: " << kBackendNames[nBackend] << " " << kBenchmarkKernelNames[nKernel] << " doesn't match scalar!" << std::endl;
+
+					bPassed = false;
+				} // else if
+
+				// Time as many runs as fit in kMinSeconds, at least one
+
+				// the CPU engine's band scratch, as GFSMemoryAccounting counts it
+
+				GFSMemoryStats sScratchStats;
+
+				GFSMemoryResetPeaks();
+
+				const size_t nAllocatedBytes = gnAllocatedBytes;
+				const uint64_t nStart = mach_absolute_time();
+
+				size_t n       = 0;
+				double nTotal  = 0.0;
+
+				while( ( n < kMaxIterations ) && ( ( n == 0 ) || ( nTotal < kMinSeconds ) ) )
+				{
+					BenchmarkConvolve((BenchmarkBackend)nBackend, weights, aBackground, nSize, &aSrc[0], &aDst[0], convolution);
+
+					nTotal = BenchmarkSeconds(mach_absolute_time() - nStart);
+
+					++n;
+				} // while
+
+				const double nSeconds = nTotal / n;
+				const double nMPixels = 1.0e-6 * nSize * nSize / nSeconds;
+
+				GFSMemoryGetStats(GFSMemoryStageConvolve, &sScratchStats);
+
+				std::cout	<< kBackendNames[nBackend]
+							<< "," << kBenchmarkKernelNames[nKernel]
+							<< "," << nSize
+							<< "," << nSize
+							<< "," << n
+							<< "," << 1000.0 * nSeconds
+							<< "," << nMPixels
+							<< "," << BenchmarkPeakResidentBytes()
+							<< "," << ( gnAllocatedBytes - nAllocatedBytes ) / n
+							<< "," << sScratchStats.peakBytes
+							<< std::endl;
+			} // for
+		} // for
+	} // for
+
+	return( bPassed ? EXIT_SUCCESS : EXIT_FAILURE );
+} // main
+
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
@@ -85,6 +85,7 @@ namespace OpenCL
 			void SetDeviceType(const cl_device_type nDeviceType);
 			void SetDeviceEntries(const cl_uint nEntries);
 			void SetCommandQueueProperties(const cl_command_queue_properties nCmdQueueProperties);
+			void SetBuildOptions(const std::string &rBuildOptions);
 			
 			void SetContextPropertyWithCGLShareGroup();
 			void SetContextProperties(cl_context_properties *pContextProperties);
@@ -49,6 +49,7 @@
 //---------------------------------------------------------------------------
 
 #import <iostream>
+#import <string>
 
 //---------------------------------------------------------------------------
 
@@ -87,6 +88,7 @@ class OpenCL::ProgramStruct
 		cl_context                    mpContext;
 		cl_command_queue              mpCommandQueue;
 		cl_program                    mpProgram;
+		std::string                   maBuildOptions;
 };
 
 //---------------------------------------------------------------------------
@@ -566,10 +568,17 @@ static inline bool OpenCLProgramBuildSuccess(OpenCL::ProgramStruct *pSProgram)
 
 static bool OpenCLProgramBuild( OpenCL::ProgramStruct *pSProgram )
 {
+	const char *pBuildOptions = NULL;
+	
+	if( !pSProgram->maBuildOptions.empty() )
+	{
+		pBuildOptions = pSProgram->maBuildOptions.c_str();
+	} // if
+	
     pSProgram->mnError = clBuildProgram(pSProgram->mpProgram, 
 										0, 
 										NULL, 
-										NULL, 
+										pBuildOptions, 
 										NULL, 
 										NULL);
 	
@@ -748,6 +757,7 @@ static OpenCL::ProgramStruct *OpenCLProgramCopy(const OpenCL::ProgramStruct * co
 			pSProgramDst->mnPlatformCount      = pSProgramSrc->mnPlatformCount;
 			pSProgramDst->mnProgramCount       = pSProgramSrc->mnProgramCount;
 			pSProgramDst->mnCmdQueueProperties = pSProgramSrc->mnCmdQueueProperties;
+			pSProgramDst->maBuildOptions       = pSProgramSrc->maBuildOptions;
 			pSProgramDst->mpContextProperties  = NULL;
 			pSProgramDst->mpContext            = NULL;
 			pSProgramDst->mpCommandQueue       = NULL;
@@ -914,6 +924,19 @@ void OpenCL::Program::SetCommandQueueProperties( const cl_command_queue_properti
 	mpSProgram->mnCmdQueueProperties = nCmdQueueProperties;
 } // SetCommandQueueProperties
 
+//---------------------------------------------------------------------------
+//
+// Options passed to the compiler when the program is built (e.g. "-D"
+// macro definitions used to specialize kernels).  Must be set before
+// calling Acquire().
+//
+//---------------------------------------------------------------------------
+
+void OpenCL::Program::SetBuildOptions( const std::string &rBuildOptions )
+{
+	mpSProgram->maBuildOptions = rBuildOptions;
+} // SetBuildOptions
+
 //---------------------------------------------------------------------------
 
 //---------------------------------------------------------------------------